@@ -129,6 +129,9 @@ typedef struct flash_loader {
     stm32_addr_t buf_addr; // buffer sram address
     uint32_t rcc_dma_bkp; // backup RCC DMA enable state
     uint32_t iwdg_kr; // IWDG key register address
+    int32_t voltage; // target voltage in mV on F2/F4/F7/L4, it selects the write parallelism
+    bool clock_boosted; // the clock registers below are saved and must be restored
+    uint32_t rcc_cr_bkp, rcc_pllcfgr_bkp, rcc_cfgr_bkp, flash_acr_bkp;
 } flash_loader_t;
 
 typedef struct _cortex_m3_cpuid_ {
@@ -156,6 +159,14 @@ typedef struct stlink_version_ {
     uint32_t flags;
 } stlink_version_t;
 
+// where the time of the last connect went, in us
+typedef struct stlink_connect_times_ {
+    uint32_t usb;                   // opening the probe: version, mode and SWD clock
+    uint32_t swd;                   // entering the SWD mode, holding the target in reset if asked
+    uint32_t reset;                 // resetting the target
+    uint32_t identify;              // reading the core, chip and flash identification
+} stlink_connect_times_t;
+
 enum transport_type {
     TRANSPORT_TYPE_ZERO = 0,
     TRANSPORT_TYPE_LIBSG,
@@ -184,6 +195,20 @@ enum run_type {
 
 typedef struct _stlink stlink_t;
 
+enum stlink_progress_phase {
+    STLINK_PROGRESS_ERASE = 0,
+    STLINK_PROGRESS_WRITE = 1,
+    STLINK_PROGRESS_VERIFY = 2,
+    STLINK_PROGRESS_READ = 3,
+};
+
+/*
+ * Progress hook of the long running flash and memory operations, called after
+ * each block with the bytes done out of total (total is 0 when unknown).
+ * Returning non-zero cancels the operation at the next block boundary.
+ */
+typedef int32_t (*stlink_progress_fn)(void *arg, enum stlink_progress_phase phase, uint32_t done, uint32_t total);
+
 #include <stm32.h>
 #include <backend.h>
 
@@ -236,6 +261,14 @@ struct _stlink {
 
     uint32_t otp_base;
     uint32_t otp_size;
+
+    stlink_progress_fn progress;    // optional, set by the application
+    void *progress_arg;
+    bool cancelled;                 // the progress hook cancelled the last operation
+
+    stlink_connect_times_t connect_times; // set by stlink_open_usb() and stlink_target_connect()
+
+    bool boost_clock;               // run the flash loaders with the core clock raised, see flash_loader.c
 };
 
 /* Functions defined in common.c */
@@ -259,6 +292,7 @@ int32_t stlink_parse_ihex(const char* path, uint8_t erased_pattern, uint8_t* *me
 uint8_t stlink_get_erased_pattern(stlink_t *sl);
 int32_t stlink_mwrite_sram(stlink_t *sl, uint8_t* data, uint32_t length, stm32_addr_t addr);
 int32_t stlink_fwrite_sram(stlink_t *sl, const char* path, stm32_addr_t addr);
+int32_t stlink_boot_sram(stlink_t *sl, stm32_addr_t vectors);
 int32_t stlink_cpu_id(stlink_t *sl, cortex_m3_cpuid_t *cpuid);
 uint32_t stlink_calculate_pagesize(stlink_t *sl, uint32_t flashaddr);
 //void stlink_core_stat(stlink_t *sl);
@@ -270,6 +304,7 @@ int32_t write_buffer_to_sram(stlink_t *sl, flash_loader_t* fl, const uint8_t* bu
 int32_t stlink_fread(stlink_t* sl, const char* path, bool is_ihex, stm32_addr_t addr, uint32_t size);
 int32_t stlink_load_device_params(stlink_t *sl);
 int32_t stlink_target_connect(stlink_t *sl, enum connect_type connect);
+int32_t stlink_progress(stlink_t *sl, enum stlink_progress_phase phase, uint32_t done, uint32_t total);
 
 #include <chipid.h>
 #include <commands.h>
@@ -206,6 +206,19 @@ enum stm32_chipids {
 #define STM32F4_RCC_AHB1ENR 0x40023830
 #define STM32F4_RCC_DMAEN 0x00600000 // DMA2EN | DMA1EN
 
+// RCC clock control of F2/F4/F7, RM0090 section 7.3
+#define STM32F4_RCC_CR 0x40023800
+#define STM32F4_RCC_CR_PLLON 0x01000000
+#define STM32F4_RCC_CR_PLLRDY 0x02000000
+#define STM32F4_RCC_PLLCFGR 0x40023804
+#define STM32F4_RCC_PLLCFGR_MASK 0x0f437fff  // PLLQ | PLLSRC | PLLP | PLLN | PLLM
+#define STM32F4_RCC_CFGR 0x40023808
+#define STM32F4_RCC_CFGR_SW_MASK 0x00000003
+#define STM32F4_RCC_CFGR_SW_PLL 0x00000002
+#define STM32F4_RCC_CFGR_SWS_MASK 0x0000000c
+#define STM32F4_RCC_CFGR_SWS_PLL 0x00000008
+#define STM32F4_RCC_CFGR_PRE_MASK 0x0000fcf0 // PPRE2 | PPRE1 | HPRE
+
 #define STM32G0_RCC_AHBENR 0x40021038
 #define STM32G0_RCC_DMAEN 0x00000003 // DMA2EN | DMA1EN
 
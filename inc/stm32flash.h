@@ -108,6 +108,8 @@
 // == STM32F4 ==
 // F4 Flash registers
 #define FLASH_F4_REGS_ADDR ((uint32_t) 0x40023c00)
+#define FLASH_F4_ACR (FLASH_F4_REGS_ADDR + 0x00)
+#define FLASH_F4_ACR_LATENCY_MASK 0x0000000f
 #define FLASH_F4_KEYR (FLASH_F4_REGS_ADDR + 0x04)
 #define FLASH_F4_OPT_KEYR (FLASH_F4_REGS_ADDR + 0x08)
 #define FLASH_F4_SR (FLASH_F4_REGS_ADDR + 0x0c)
@@ -25,6 +25,7 @@
 
 #include <chipid.h>
 #include <common_flash.h>
+#include <ext_loader.h>
 #include <map_file.h>
 #include <option_bytes.h>
 #include <usb.h>
@@ -49,6 +50,10 @@ static void usage(void) {
     puts("       st-flash [options] write <value>");
     puts("       st-flash [options] erase <addr> <size>");
     puts("       st-flash [options] reset");
+    puts("       st-flash [options] coredump <file> [<addr> <size>]...");
+    puts("");
+    puts("coredump connects without a reset and writes all the SRAM banks of the");
+    puts("chip, e.g. the H7 AXI SRAM and SRAM1-4, and the given ranges.");
     puts("");
     puts("options:");
     puts("  --freq <kHz>           Frequency of JTAG/SWD, default 1800kHz.");
@@ -56,6 +61,13 @@ static void usage(void) {
     puts("  --connect-under-reset  Pull reset low while connecting.");
     puts("  --hot-plug             Connect without reset.");
     puts("  --reset                Reset after writing.");
+    puts("  --ram                  Write the image to SRAM, at its start by default,");
+    puts("                         and boot it from there, leaving the flash alone.");
+    puts("  --boost-clock          Raise the core clock of F2/F4/F7 while writing");
+    puts("                         the flash, restoring it afterwards.");
+    puts("  --ext-loader <file>    External loader for the memory at the address");
+    puts("                         it declares, e.g. QSPI flash: write and erase");
+    puts("                         in that range go through it.");
     puts("  --format {binary|ihex} Format of file to read or write. When writing");
     puts("                         with ihex specifying addr is not needed.");
     puts("  --flash <size>         Specify size of flash, e.g. 128k, 1M.");
@@ -77,17 +89,22 @@ static void usage(void) {
     puts("  st-flash --area=optcr1 write 0xXXXXXXXX");
     puts("  st-flash --area=otp read <file>");
     puts("  st-flash --area=otp write <file> 0xXXXXXXXX");
+    puts("  st-flash coredump core.elf 0x40021000 0x400");
+    puts("  st-flash --ram write firmware-sram.bin");
+    puts("  st-flash --ext-loader qspi-loader.bin write assets.bin 0x90000000");
 }
 
 int32_t main(int32_t ac, char** av) {
     stlink_t* sl = NULL;
     struct flash_opts o;
+    struct stlink_ext_loader xl;
     int32_t err = -1;
     uint8_t * mem = NULL;
     int32_t getopt_ret;
 
     o.size = 0;
     o.connect = CONNECT_NORMAL;
+    memset(&xl, 0, sizeof(xl));
 
     getopt_ret = flash_get_opts(&o, ac - 1, av + 1);
     if (getopt_ret  == -1) {
@@ -119,6 +136,7 @@ int32_t main(int32_t ac, char** av) {
 
     sl->verbose = o.log_level;
     sl->opt = o.opt;
+    sl->boost_clock = o.boost_clock;
     const enum erase_type_t erase_type = o.mass_erase ? MASS_ERASE : SECTION_ERASE;
 
     connected_stlink = sl;
@@ -137,7 +155,53 @@ int32_t main(int32_t ac, char** av) {
         goto on_error;
     }
 
-    if (o.cmd == FLASH_CMD_WRITE) {
+    if (o.ext_loader && stlink_ext_loader_open(sl, &xl, o.ext_loader)) {
+        printf("Cannot use the external loader %s\n", o.ext_loader);
+        goto on_error;
+    }
+
+    if (o.cmd == FLASH_CMD_WRITE && o.ram) {
+        // the image runs with the peripherals as after a reset, but from SRAM
+        uint32_t size = 0;
+        mapped_file_t mf = MAPPED_FILE_INITIALIZER;
+
+        if (stlink_reset(sl, RESET_SOFT_AND_HALT)) {
+            printf("Failed to reset device\n");
+            goto on_error;
+        }
+
+        if (o.format == FLASH_FORMAT_IHEX) {
+            err = stlink_parse_ihex(o.filename, 0, &mem, &size, &o.addr);
+
+            if (err == -1) {
+                printf("Cannot parse %s as Intel-HEX file\n", o.filename);
+                goto on_error;
+            }
+
+            err = stlink_mwrite_sram(sl, mem, size, o.addr);
+        } else if (map_file(&mf, o.filename) == -1) {
+            err = -1;
+        } else {
+            if (o.addr == 0) { o.addr = sl->sram_base; }
+
+            err = stlink_mwrite_sram(sl, mf.base, mf.len, o.addr);
+            unmap_file(&mf);
+        }
+
+        if (err == -1) {
+            printf("stlink_mwrite_sram() == -1\n");
+            goto on_error;
+        }
+
+        err = stlink_boot_sram(sl, o.addr);
+
+        if (err == -1) {
+            printf("stlink_boot_sram() == -1\n");
+            goto on_error;
+        }
+
+        printf("Booting from SRAM at %#010x\n", o.addr);
+    } else if (o.cmd == FLASH_CMD_WRITE) {
         uint32_t size = 0;
 
         if (erase_type == MASS_ERASE) {
@@ -157,7 +221,29 @@ int32_t main(int32_t ac, char** av) {
                 goto on_error;
             }
         }
-        if ((o.addr >= sl->flash_base) && (o.addr < sl->flash_base + sl->flash_size)) {
+        if (stlink_ext_loader_contains(&xl, o.addr)) {
+            mapped_file_t mf = MAPPED_FILE_INITIALIZER;
+
+            if (o.format == FLASH_FORMAT_IHEX) {
+                err = stlink_ext_write(sl, &xl, o.addr, mem, size, true);
+            } else if (map_file(&mf, o.filename) == -1) {
+                err = -1;
+            } else {
+                err = stlink_ext_write(sl, &xl, o.addr, mf.base, mf.len, true);
+                unmap_file(&mf);
+            }
+
+            if (err == -1) {
+                printf("stlink_ext_write() == -1\n");
+                goto on_error;
+            }
+
+            // the loader left the core in its trap and the memory set up its way
+            if (stlink_reset(sl, RESET_AUTO)) {
+                printf("Failed to reset device\n");
+                goto on_error;
+            }
+        } else if ((o.addr >= sl->flash_base) && (o.addr < sl->flash_base + sl->flash_size)) {
             if (o.format == FLASH_FORMAT_IHEX) {
                 err = stlink_mwrite_flash(sl, mem, size, o.addr, erase_type);
             } else {
@@ -231,7 +317,14 @@ int32_t main(int32_t ac, char** av) {
     } else if (o.cmd == FLASH_CMD_ERASE) {
 
         // erase
-        if ((erase_type == MASS_ERASE) || (o.size == 0 || o.addr == 0)) {
+        if (o.size != 0 && stlink_ext_loader_contains(&xl, o.addr)) {
+            err = stlink_ext_erase(sl, &xl, o.addr, o.size);
+            if (err == -1) {
+                printf("stlink_ext_erase() == -1\n");
+                goto on_error;
+            }
+            printf("External erase completed successfully.\n");
+        } else if ((erase_type == MASS_ERASE) || (o.size == 0 || o.addr == 0)) {
             err = stlink_erase_flash_mass(sl);
             if (err == -1) {
                 printf("stlink_erase_flash_mass() == -1\n");
@@ -253,6 +346,19 @@ int32_t main(int32_t ac, char** av) {
             goto on_error;
         }
     
+    } else if (o.cmd == CMD_COREDUMP) {
+
+        // all the SRAM banks of the chip, followed by the regions from the command line
+        struct stlink_coredump_region regions[COREDUMP_REGION_NUM_MAX];
+        uint32_t count = stlink_coredump_sram_regions(sl, regions);
+        memcpy(&regions[count], o.dump, o.dump_count * sizeof(regions[0]));
+
+        err = stlink_coredump(sl, o.filename, regions, count + o.dump_count);
+        if (err == -1) {
+            printf("stlink_coredump() == -1\n");
+            goto on_error;
+        }
+
     } else if (o.cmd == CMD_RESET) {
 
         // reset
@@ -347,7 +453,8 @@ int32_t main(int32_t ac, char** av) {
         }
     }
 
-    if (o.reset) stlink_reset(sl, RESET_AUTO);
+    // a reset would boot from flash again
+    if (o.reset && !o.ram) stlink_reset(sl, RESET_AUTO);
 
     stlink_run(sl, RUN_NORMAL);
 
@@ -356,6 +463,7 @@ int32_t main(int32_t ac, char** av) {
 on_error:
     stlink_exit_debug_mode(sl);
     stlink_close(sl);
+    stlink_ext_loader_close(&xl);
     free(mem);
 
     return (err);
@@ -108,6 +108,21 @@ int32_t flash_get_opts(struct flash_opts* o, int32_t ac, char** av) {
             o->mass_erase = ENABLE_OPT;
         } else if (strcmp(av[0], "--reset") == 0) {
             o->reset = 1;
+        } else if (strcmp(av[0], "--ram") == 0) {
+            o->ram = 1;
+        } else if (strcmp(av[0], "--boost-clock") == 0) {
+            o->boost_clock = 1;
+        } else if (strcmp(av[0], "--ext-loader") == 0 || starts_with(av[0], "--ext-loader=")) {
+            if (strcmp(av[0], "--ext-loader") == 0) {
+                ac--;
+                av++;
+
+                if (ac < 1) { return (-1); }
+
+                o->ext_loader = av[0];
+            } else {
+                o->ext_loader = av[0] + strlen("--ext-loader=");
+            }
         } else if (strcmp(av[0], "--serial") == 0 || starts_with(av[0], "--serial=")) {
             const char * serial;
 
@@ -235,6 +250,10 @@ int32_t flash_get_opts(struct flash_opts* o, int32_t ac, char** av) {
             if (o->cmd != FLASH_CMD_NONE) { return (-1); }
 
             o->cmd = CMD_RESET;
+        } else if (strcmp(av[0], "coredump") == 0) {
+            if (o->cmd != FLASH_CMD_NONE) { return (-1); }
+
+            o->cmd = CMD_COREDUMP;
         } else {
             break;
         }
@@ -243,6 +262,14 @@ int32_t flash_get_opts(struct flash_opts* o, int32_t ac, char** av) {
         av++;
     }
 
+    if (o->ram && (o->cmd != FLASH_CMD_WRITE || o->area != FLASH_MAIN_MEMORY || o->mass_erase)) {
+        return invalid_args("--ram write <path> [addr]");
+    }
+
+    if (o->ext_loader && (o->ram || o->area != FLASH_MAIN_MEMORY || o->mass_erase)) {
+        return invalid_args("--ext-loader <loader> {write <path> <addr>|erase <addr> <size>}");
+    }
+
     switch (o->cmd) {
     case FLASH_CMD_NONE:     // no command found
         return (-1);
@@ -364,6 +391,8 @@ int32_t flash_get_opts(struct flash_opts* o, int32_t ac, char** av) {
             } else {
                 o->val = val;
             }
+        } else if (o->format == FLASH_FORMAT_BINARY && o->ram && ac == 1) { // addr defaults to SRAM start
+            o->filename = av[0];
         } else if (o->format == FLASH_FORMAT_BINARY) {    // expect filename and addr
             if (ac != 2) { return invalid_args("write <path> <addr>"); }
             
@@ -386,6 +415,41 @@ int32_t flash_get_opts(struct flash_opts* o, int32_t ac, char** av) {
 
         break;
 
+    case CMD_COREDUMP:       // expect filename and optional addr/size pairs
+        if (ac < 1 || (ac % 2) != 1) { return invalid_args("coredump <path> [<addr> <size>]..."); }
+
+        // a reset while connecting would wipe out the state to dump
+        if (o->connect == CONNECT_UNDER_RESET) { return bad_arg ("coredump: --connect-under-reset"); }
+
+        o->connect = CONNECT_HOT_PLUG;
+
+        o->filename = av[0];
+        ac--;
+        av++;
+
+        while (ac >= 2) {
+            uint32_t address, size;
+
+            // room is left for the SRAM regions of the chip
+            if (o->dump_count >= COREDUMP_REGION_NUM_MAX - COREDUMP_SRAM_REGION_NUM_MAX) {
+                return bad_arg ("coredump: too many regions");
+            }
+
+            result = get_integer_from_char_array(av[0], &address);
+            if (result != 0) { return bad_arg ("addr"); }
+
+            result = get_integer_from_char_array(av[1], &size);
+            if (result != 0) { return bad_arg ("size"); }
+
+            o->dump[o->dump_count].addr = (stm32_addr_t) address;
+            o->dump[o->dump_count].size = size;
+            o->dump_count++;
+            ac -= 2;
+            av += 2;
+        }
+
+        break;
+
     default: break;
     }
 
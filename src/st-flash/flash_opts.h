@@ -7,9 +7,11 @@
 #ifndef FLASH_OPTS_H
 #define FLASH_OPTS_H
 
-#define FLASH_OPTS_INITIALIZER {0, { 0 }, NULL, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+#include <coredump.h>
 
-enum flash_cmd {FLASH_CMD_NONE = 0, FLASH_CMD_WRITE = 1, FLASH_CMD_READ = 2, FLASH_CMD_ERASE = 3, CMD_RESET = 4};
+#define FLASH_OPTS_INITIALIZER {0, { 0 }, NULL, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, { { 0, 0 } }, 0, 0, 0, NULL}
+
+enum flash_cmd {FLASH_CMD_NONE = 0, FLASH_CMD_WRITE = 1, FLASH_CMD_READ = 2, FLASH_CMD_ERASE = 3, CMD_RESET = 4, CMD_COREDUMP = 5};
 enum flash_format {FLASH_FORMAT_BINARY = 0, FLASH_FORMAT_IHEX = 1};
 enum flash_area {FLASH_MAIN_MEMORY = 0, FLASH_SYSTEM_MEMORY = 1, FLASH_OTP = 2, FLASH_OPTION_BYTES = 3, FLASH_OPTION_BYTES_BOOT_ADD = 4, FLASH_OPTCR = 5, FLASH_OPTCR1 = 6};
 
@@ -29,6 +31,11 @@ struct flash_opts {
     int32_t mass_erase;   // Use mass-erase when programming flash instead of sector-erase
     int32_t freq;         // --freq=n[k, M] frequency of JTAG/SWD
     enum connect_type connect;
+    struct stlink_coredump_region dump[COREDUMP_REGION_NUM_MAX]; // coredump <path> [<addr> <size>]...
+    uint32_t dump_count;
+    int32_t ram;          // --ram: boot the written image from SRAM, the flash is left alone
+    int32_t boost_clock;  // --boost-clock: raise the core clock while the flash loaders run
+    const char* ext_loader; // --ext-loader <path>: program the external memory it drives
 };
 
 // static bool starts_with(const char * str, const char * prefix);
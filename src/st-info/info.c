@@ -49,6 +49,11 @@ static void stlink_print_info(stlink_t *sl) {
 
     params = stlink_chipid_get_params(sl->chip_id);
     if (params) { printf("  dev-type:   %s\n", params->dev_type); }
+
+    const stlink_connect_times_t *t = &sl->connect_times;
+    printf("  connect:    %.1f ms (usb %.1f, swd %.1f, reset %.1f, identify %.1f)\n",
+           (t->usb + t->swd + t->reset + t->identify) / 1000.0, t->usb / 1000.0, t->swd / 1000.0,
+           t->reset / 1000.0, t->identify / 1000.0);
 }
 
 static void stlink_probe(enum connect_type connect, int32_t freq) {
@@ -0,0 +1,801 @@
+/*
+ * File: run.c
+ *
+ * Loads an ELF file, runs it and collects its semihosting and ITM output in a
+ * single session, for firmware tests on target
+ */
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <stlink.h>
+
+#include <common_flash.h>
+#include <helper.h>
+#include <logging.h>
+#include <read_write.h>
+#include <register.h>
+#include <usb.h>
+
+#include "itm.h"
+#include "semihosting.h"
+
+#define DEFAULT_LOGGING_LEVEL 50
+#define DEBUG_LOGGING_LEVEL 100
+
+// the target exit code is passed through, st-run uses the values of timeout(1)
+#define APP_RESULT_TIMEOUT 124
+#define APP_RESULT_ERROR 125
+#define APP_RESULT_TARGET_FAULT 126
+#define APP_RESULT_INTERRUPTED 130
+
+#define DEFAULT_TIMEOUT_S 60
+
+#define ELF_EM_ARM 40
+#define ELF_PT_LOAD 1
+
+#define RUN_SEGMENTS_MAX 32
+// largest read of the target memory in one transfer
+#define RUN_READ_MAX 1024
+// output kept for the JUnit report, the console gets all of it
+#define RUN_OUTPUT_MAX (1024 * 1024)
+// idle polling period, a USB round trip costs about as much
+#define RUN_POLL_US 1000
+// reads of the trace after the exit, the SWO output lags the core
+#define RUN_TRACE_DRAIN 4
+
+#define THUMB_BKPT_SEMIHOSTING 0xBEAB
+
+typedef struct {
+  bool show_help;
+  bool show_version;
+  int32_t logging_level;
+  char *serial_number;
+  int32_t freq;
+  uint32_t timeout_s;
+  bool trace;
+  uint32_t trace_frequency;
+  uint32_t core_frequency;
+  const char *junit;
+  const char *name;
+  const char *elf;
+} st_settings_t;
+
+typedef struct {
+  stm32_addr_t addr;
+  uint32_t offset;
+  uint32_t size;
+} run_segment_t;
+
+typedef struct {
+  uint8_t *data;
+  uint32_t size;
+  uint32_t entry;
+  run_segment_t flash[RUN_SEGMENTS_MAX];
+  uint32_t flash_count;
+  run_segment_t sram[RUN_SEGMENTS_MAX];
+  uint32_t sram_count;
+} run_image_t;
+
+typedef struct {
+  char *data;
+  uint32_t len;
+  uint32_t size;
+  bool truncated;
+} run_output_t;
+
+static bool g_abort_run = false;
+
+static void abort_run() { g_abort_run = true; }
+
+#if defined(_WIN32)
+BOOL WINAPI CtrlHandler(DWORD fdwCtrlType) {
+  (void)fdwCtrlType;
+  abort_run();
+  return TRUE;
+}
+#endif
+
+static void usage(void) {
+  puts("st-run - usage:");
+  puts("  st-run [options] <file.elf>");
+  puts("  Loads the PT_LOAD segments of the file into flash and SRAM, starts it at");
+  puts("  its entry point and prints its semihosting and ITM output until it calls");
+  puts("  SYS_EXIT. Exits with the exit code of the target, or:");
+  puts("    124 on a timeout, 125 on an error of st-run or of the probe,");
+  puts("    126 on a fault of the target (hard fault or breakpoint)");
+  puts("");
+  puts("  -h, --help            Print this help");
+  puts("  -V, --version         Print this version");
+  puts("  -vXX, --verbose=XX    Specify a specific verbosity level (0..99)");
+  puts("  -v, --verbose         Specify a generally verbose logging");
+  puts("  -tXX, --timeout=XX    Stop the target after XX seconds (default 60, 0 = never)");
+  puts("  -T, --trace[=XX]      Also print the ITM output of stimulus port 0, read at");
+  puts("                        the trace frequency XX (eg. --trace=2M)");
+  puts("  -cXX, --clock=XX      Core frequency of the target when it runs (eg. 72M),");
+  puts("                        the target sets the trace prescaler otherwise");
+  puts("  -jXX, --junit=XX      Write a JUnit XML report to XX");
+  puts("  -nXX, --name=XX       Test case name in the report, the file name by default");
+  puts("  -sXX, --serial=XX     Use a specific serial number");
+  puts("  -FXX, --freq=XX       Set the SWD frequency, eg. --freq=4M");
+}
+
+static bool parse_options(int32_t argc, char **argv, st_settings_t *settings) {
+
+  static struct option long_options[] = {
+      {"help", no_argument, NULL, 'h'},
+      {"version", no_argument, NULL, 'V'},
+      {"verbose", optional_argument, NULL, 'v'},
+      {"timeout", required_argument, NULL, 't'},
+      {"trace", optional_argument, NULL, 'T'},
+      {"clock", required_argument, NULL, 'c'},
+      {"junit", required_argument, NULL, 'j'},
+      {"name", required_argument, NULL, 'n'},
+      {"serial", required_argument, NULL, 's'},
+      {"freq", required_argument, NULL, 'F'},
+      {0, 0, 0, 0},
+  };
+  int32_t option_index = 0;
+  int32_t c;
+  int32_t khz;
+  bool error = false;
+
+  memset(settings, 0, sizeof(*settings));
+  settings->logging_level = DEFAULT_LOGGING_LEVEL;
+  settings->timeout_s = DEFAULT_TIMEOUT_S;
+  ugly_init(settings->logging_level);
+
+  while ((c = getopt_long(argc, argv, "hVv::t:T::c:j:n:s:F:", long_options, &option_index)) != -1) {
+    switch (c) {
+    case 'h':
+      settings->show_help = true;
+      break;
+    case 'V':
+      settings->show_version = true;
+      break;
+    case 'v':
+      if (optarg) {
+        settings->logging_level = atoi(optarg);
+      } else {
+        settings->logging_level = DEBUG_LOGGING_LEVEL;
+      }
+      ugly_init(settings->logging_level);
+      break;
+    case 't':
+      settings->timeout_s = (uint32_t)strtoul(optarg, NULL, 0);
+      break;
+    case 'T':
+      settings->trace = true;
+      if (optarg) {
+        if ((khz = arg_parse_freq(optarg)) <= 0) {
+          ELOG("Invalid trace frequency '%s'\n", optarg);
+          error = true;
+        }
+        settings->trace_frequency = (uint32_t)khz * 1000;
+      }
+      break;
+    case 'c':
+      if ((khz = arg_parse_freq(optarg)) <= 0) {
+        ELOG("Invalid clock frequency '%s'\n", optarg);
+        error = true;
+      }
+      settings->core_frequency = (uint32_t)khz * 1000;
+      break;
+    case 'j':
+      settings->junit = optarg;
+      break;
+    case 'n':
+      settings->name = optarg;
+      break;
+    case 's':
+      settings->serial_number = optarg;
+      break;
+    case 'F':
+      settings->freq = arg_parse_freq(optarg);
+      if (settings->freq < 0) {
+        ELOG("Invalid frequency '%s'\n", optarg);
+        error = true;
+      }
+      break;
+    case '?':
+      error = true;
+      break;
+    default:
+      ELOG("Unknown command line option: '%c' (0x%02x)\n", c, c);
+      error = true;
+      break;
+    }
+  }
+
+  if (optind < argc) { settings->elf = argv[optind++]; }
+
+  if (optind < argc) {
+    ELOG("Unexpected argument '%s'\n", argv[optind]);
+    error = true;
+  }
+
+  if (settings->elf == NULL && !settings->show_help && !settings->show_version) {
+    ELOG("No ELF file given\n");
+    error = true;
+  }
+
+  if (settings->name == NULL && settings->elf != NULL) {
+    const char *slash = strrchr(settings->elf, '/');
+    settings->name = slash ? slash + 1 : settings->elf;
+  }
+
+  return (!error);
+}
+
+static bool in_range(stm32_addr_t addr, uint32_t size, stm32_addr_t base, uint32_t base_size) {
+  return (addr >= base && size <= base_size && addr - base <= base_size - size);
+}
+
+/*
+ * Reads the file and sorts its PT_LOAD segments into flash and SRAM by their
+ * load address, so that initialised data goes wherever the linker put its copy.
+ */
+static bool elf_load(const char *path, const stlink_t *sl, run_image_t *image) {
+  FILE *fp = fopen(path, "rb");
+  long len = 0;
+
+  memset(image, 0, sizeof(*image));
+
+  if (fp == NULL) {
+    ELOG("Cannot open %s\n", path);
+    return (false);
+  }
+
+  if (fseek(fp, 0, SEEK_END) == 0 && (len = ftell(fp)) > 0 && fseek(fp, 0, SEEK_SET) == 0) {
+    image->data = malloc(len);
+
+    if (image->data != NULL && fread(image->data, 1, len, fp) != (size_t)len) {
+      free(image->data);
+      image->data = NULL;
+    }
+
+    image->size = (uint32_t)len;
+  }
+
+  fclose(fp);
+
+  if (image->data == NULL || image->size < 52 || memcmp(image->data, "\177ELF\1\1", 6) ||
+      read_uint16(image->data, 18) != ELF_EM_ARM) {
+    ELOG("%s is not a 32 bit little endian ARM ELF file\n", path);
+    return (false);
+  }
+
+  uint32_t phoff = read_uint32(image->data, 28);
+  uint32_t phentsize = read_uint16(image->data, 42);
+  uint32_t phnum = read_uint16(image->data, 44);
+
+  image->entry = read_uint32(image->data, 24);
+
+  if (phentsize < 32 || phoff > image->size || phnum > (image->size - phoff) / phentsize) {
+    ELOG("%s has no valid program headers\n", path);
+    return (false);
+  }
+
+  for (uint32_t i = 0; i < phnum; i++) {
+    const uint8_t *ph = &image->data[phoff + i * phentsize];
+    run_segment_t seg;
+
+    seg.offset = read_uint32(ph, 4);
+    seg.addr = read_uint32(ph, 12);
+    seg.size = read_uint32(ph, 16);
+
+    if (read_uint32(ph, 0) != ELF_PT_LOAD || seg.size == 0) { continue; }
+
+    if (seg.offset > image->size || seg.size > image->size - seg.offset) {
+      ELOG("Segment %u of %s is truncated\n", i, path);
+      return (false);
+    }
+
+    if (in_range(seg.addr, seg.size, sl->flash_base, sl->flash_size) &&
+        image->flash_count < RUN_SEGMENTS_MAX) {
+      image->flash[image->flash_count++] = seg;
+    } else if (in_range(seg.addr, seg.size, sl->sram_base, sl->sram_size) &&
+               image->sram_count < RUN_SEGMENTS_MAX) {
+      image->sram[image->sram_count++] = seg;
+    } else {
+      ELOG("Segment %u of %s at %#010x+%u is neither in flash nor in SRAM\n", i, path, seg.addr,
+           seg.size);
+      return (false);
+    }
+  }
+
+  if (image->flash_count == 0 && image->sram_count == 0) {
+    ELOG("%s has nothing to load\n", path);
+    return (false);
+  }
+
+  return (true);
+}
+
+// The flash segments as one image, gaps filled with the erased value
+static int32_t load_flash(stlink_t *sl, const run_image_t *image) {
+  stm32_addr_t start = UINT32_MAX;
+  stm32_addr_t end = 0;
+
+  for (uint32_t i = 0; i < image->flash_count; i++) {
+    const run_segment_t *seg = &image->flash[i];
+
+    if (seg->addr < start) { start = seg->addr; }
+
+    if (seg->addr + seg->size > end) { end = seg->addr + seg->size; }
+  }
+
+  uint8_t *data = malloc(end - start);
+
+  if (data == NULL) { return (-1); }
+
+  memset(data, 0xff, end - start);
+
+  for (uint32_t i = 0; i < image->flash_count; i++) {
+    const run_segment_t *seg = &image->flash[i];
+    memcpy(data + (seg->addr - start), image->data + seg->offset, seg->size);
+  }
+
+  int32_t ret = stlink_mwrite_flash(sl, data, end - start, start, SECTION_ERASE);
+
+  free(data);
+  return (ret);
+}
+
+static int32_t load_sram(stlink_t *sl, const run_image_t *image) {
+  for (uint32_t i = 0; i < image->sram_count; i++) {
+    const run_segment_t *seg = &image->sram[i];
+
+    if (stlink_mwrite_sram(sl, image->data + seg->offset, seg->size, seg->addr)) {
+      ELOG("Cannot write %u bytes at %#010x\n", seg->size, seg->addr);
+      return (-1);
+    }
+  }
+
+  return (0);
+}
+
+// The vector table of an image linked for SRAM is at its lowest address
+static int32_t start_sram(stlink_t *sl, const run_image_t *image) {
+  stm32_addr_t vectors = UINT32_MAX;
+
+  for (uint32_t i = 0; i < image->sram_count; i++) {
+    if (image->sram[i].addr < vectors) { vectors = image->sram[i].addr; }
+  }
+
+  return (stlink_boot_sram(sl, vectors));
+}
+
+static void output(void *arg, const uint8_t *data, uint32_t len) {
+  run_output_t *out = arg;
+
+  fwrite(data, 1, len, stdout);
+  fflush(stdout);
+
+  if (out->len + len > RUN_OUTPUT_MAX) {
+    out->truncated = true;
+    return;
+  }
+
+  if (out->len + len > out->size) {
+    uint32_t size = out->size ? out->size : 4096;
+
+    while (size < out->len + len) { size *= 2; }
+
+    char *data_new = realloc(out->data, size);
+
+    if (data_new == NULL) {
+      out->truncated = true;
+      return;
+    }
+
+    out->data = data_new;
+    out->size = size;
+  }
+
+  memcpy(out->data + out->len, data, len);
+  out->len += len;
+}
+
+// Reads any range of the target memory, the probe only reads aligned words
+static int32_t read_target(stlink_t *sl, stm32_addr_t addr, uint8_t *buf, uint32_t len) {
+  while (len) {
+    uint32_t skew = addr & 3;
+    uint32_t n = len < RUN_READ_MAX - skew ? len : RUN_READ_MAX - skew;
+
+    if (stlink_read_mem32(sl, addr - skew, (uint16_t)((skew + n + 3) & ~3u))) { return (-1); }
+
+    memcpy(buf, sl->q_buf + skew, n);
+    addr += n;
+    buf += n;
+    len -= n;
+  }
+
+  return (0);
+}
+
+/*
+ * The semihosting calls of the console and of the exit, handled here so that
+ * their output is captured, the others go to the implementation of st-util.
+ * Returns true when the target has exited, with its exit code.
+ */
+static bool semihosting(stlink_t *sl, uint32_t r0, uint32_t r1, uint32_t *ret, run_output_t *out,
+                        int32_t *exit_code) {
+  uint32_t args[3];
+  uint8_t buf[RUN_READ_MAX];
+
+  *ret = 0;
+
+  switch (r0) {
+  case SEMIHOST_SYS_EXIT:
+    *exit_code = r1 == SEMIHOST_ADP_STOPPED_APPLICATION_EXIT ? 0 : 1;
+    return (true);
+  case SEMIHOST_SYS_EXIT_EXTENDED:
+    if (read_target(sl, r1, (uint8_t *)args, 8)) {
+      *exit_code = 1;
+    } else {
+      *exit_code = args[0] == SEMIHOST_ADP_STOPPED_APPLICATION_EXIT ? (int32_t)args[1] : 1;
+    }
+    return (true);
+  case SEMIHOST_SYS_OPEN:
+    // ":tt" is the console, stdin, stdout or stderr depending on the mode
+    if (read_target(sl, r1, (uint8_t *)args, 12) == 0 && args[2] == 3 &&
+        read_target(sl, args[0], buf, 4) == 0 && memcmp(buf, ":tt", 4) == 0) {
+      *ret = args[1] < 4 ? 0 : args[1] < 8 ? 1 : 2;
+      return (false);
+    }
+    break;
+  case SEMIHOST_SYS_CLOSE:
+    if (read_target(sl, r1, (uint8_t *)args, 4) == 0 && args[0] <= 2) { return (false); }
+    break;
+  case SEMIHOST_SYS_WRITE:
+    if (read_target(sl, r1, (uint8_t *)args, 12) == 0 && (args[0] == 1 || args[0] == 2)) {
+      for (uint32_t off = 0; off < args[2]; off += sizeof(buf)) {
+        uint32_t n = args[2] - off < sizeof(buf) ? args[2] - off : (uint32_t)sizeof(buf);
+
+        if (read_target(sl, args[1] + off, buf, n)) {
+          *ret = args[2] - off; // bytes not written
+          break;
+        }
+
+        output(out, buf, n);
+      }
+      return (false);
+    }
+    break;
+  case SEMIHOST_SYS_WRITEC:
+    if (read_target(sl, r1, buf, 1) == 0) { output(out, buf, 1); }
+    return (false);
+  case SEMIHOST_SYS_WRITE0:
+    for (bool end = false; !end; r1 += 64) {
+      uint32_t n = 0;
+
+      if (read_target(sl, r1, buf, 64)) { break; }
+
+      while (n < 64 && buf[n]) { n++; }
+
+      end = n < 64;
+      output(out, buf, n);
+    }
+    return (false);
+  default:
+    break;
+  }
+
+  if (do_semihosting(sl, r0, r1, ret)) { DLOG("Semihosting call %#x failed\n", r0); }
+
+  return (false);
+}
+
+static bool read_trace(stlink_t *sl, st_trace_t *trace) {
+  uint8_t buffer[STLINK_V3_TRACE_BUF_LEN];
+  int32_t length = stlink_trace_read(sl, buffer, sizeof(buffer));
+
+  if (length < 0) {
+    ELOG("Error reading trace (%d)\n", length);
+    return (false);
+  }
+
+  if (length == sizeof(buffer)) {
+    WLOG("Trace buffer overflow, try a slower trace frequency\n");
+    trace->state = TRACE_STATE_UNKNOWN;
+  }
+
+  if (length) { update_trace_block(trace, buffer, (uint32_t)length); }
+
+  return (length > 0);
+}
+
+static void xml_escape(FILE *fp, const char *text) {
+  for (; *text; text++) {
+    switch (*text) {
+    case '&': fputs("&amp;", fp); break;
+    case '<': fputs("&lt;", fp); break;
+    case '>': fputs("&gt;", fp); break;
+    case '"': fputs("&quot;", fp); break;
+    default: fputc(*text, fp); break;
+    }
+  }
+}
+
+/*
+ * exited tells a target that ran to its exit call, whatever its exit code, from a
+ * timeout, fault or error of st-run; only the latter are reported as <error>.
+ */
+static bool write_junit(const st_settings_t *settings, bool exited, int32_t result,
+                        const char *message, double seconds, const run_output_t *out) {
+  FILE *fp = fopen(settings->junit, "w");
+
+  if (fp == NULL) {
+    ELOG("Cannot open %s for writing\n", settings->junit);
+    return (false);
+  }
+
+  bool error = !exited;
+
+  fprintf(fp, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+  fprintf(fp, "<testsuites>\n");
+  fprintf(fp, "  <testsuite name=\"st-run\" tests=\"1\" failures=\"%d\" errors=\"%d\" time=\"%.3f\">\n",
+          exited && result, error, seconds);
+  fprintf(fp, "    <testcase classname=\"st-run\" name=\"");
+  xml_escape(fp, settings->name);
+  fprintf(fp, "\" time=\"%.3f\">\n", seconds);
+
+  if (error || result) {
+    fprintf(fp, "      <%s message=\"", error ? "error" : "failure");
+    xml_escape(fp, message);
+    fprintf(fp, "\"/>\n");
+  }
+
+  // CDATA cannot hold "]]>" nor most control characters
+  fprintf(fp, "      <system-out><![CDATA[");
+
+  for (uint32_t i = 0; i < out->len; i++) {
+    uint8_t c = (uint8_t)out->data[i];
+
+    if (c == '>' && i >= 2 && out->data[i - 1] == ']' && out->data[i - 2] == ']') {
+      fputs("]]><![CDATA[>", fp);
+    } else if (c < 0x20 && c != '\t' && c != '\n' && c != '\r') {
+      fputc('?', fp);
+    } else {
+      fputc(c, fp);
+    }
+  }
+
+  if (out->truncated) { fprintf(fp, "\n[output truncated]\n"); }
+
+  fprintf(fp, "]]></system-out>\n");
+  fprintf(fp, "    </testcase>\n");
+  fprintf(fp, "  </testsuite>\n");
+  fprintf(fp, "</testsuites>\n");
+
+  return (fclose(fp) == 0);
+}
+
+static stlink_t *run_connect(const st_settings_t *settings) {
+  stlink_t *sl = stlink_open_usb(settings->logging_level, CONNECT_NORMAL, settings->serial_number,
+                                 settings->freq);
+
+  if (!sl) {
+    ELOG("Unable to locate an stlink\n");
+    return (NULL);
+  }
+
+  if (sl->chip_id == STM32_CHIPID_UNKNOWN) {
+    ELOG("Your stlink is not connected to a device\n");
+    stlink_close(sl);
+    return (NULL);
+  }
+
+  if (settings->trace && (!(sl->version.flags & STLINK_F_HAS_TRACE) ||
+                          !(sl->chip_flags & CHIP_F_HAS_SWO_TRACING))) {
+    ELOG("Tracing is not supported by this stlink or device\n");
+    stlink_close(sl);
+    return (NULL);
+  }
+
+  return (sl);
+}
+
+/*
+ * Runs the target until it exits, faults or times out, serving its semihosting
+ * calls and reading its trace in between. Returns the exit code of st-run and
+ * sets exited when that is the exit code of the target.
+ */
+static int32_t run(stlink_t *sl, const st_settings_t *settings, st_trace_t *trace,
+                   run_output_t *out, char *message, size_t message_size, bool *exited) {
+  uint64_t deadline = settings->timeout_s ? time_ms() + settings->timeout_s * 1000ull : 0;
+  int32_t result = APP_RESULT_ERROR;
+  bool halted = false;
+
+  if (stlink_run(sl, RUN_NORMAL)) {
+    snprintf(message, message_size, "cannot start the target");
+    return (result);
+  }
+
+  while (!halted) {
+    bool busy = settings->trace && read_trace(sl, trace);
+
+    if (g_abort_run) {
+      snprintf(message, message_size, "interrupted");
+      result = APP_RESULT_INTERRUPTED;
+      break;
+    }
+
+    if (deadline && time_ms() > deadline) {
+      snprintf(message, message_size, "timeout after %u s", settings->timeout_s);
+      result = APP_RESULT_TIMEOUT;
+      break;
+    }
+
+    if (stlink_status(sl)) {
+      snprintf(message, message_size, "lost the target");
+      break;
+    }
+
+    if (sl->core_stat != TARGET_HALTED) {
+      if (!busy) { usleep(RUN_POLL_US); }
+      continue;
+    }
+
+    struct stlink_reg regp;
+    uint8_t insn[2];
+    uint32_t ret;
+    int32_t exit_code;
+
+    if (stlink_read_all_regs(sl, &regp) || read_target(sl, regp.r[15], insn, 2)) {
+      snprintf(message, message_size, "cannot read the state of the halted target");
+      break;
+    }
+
+    if (read_uint16(insn, 0) != THUMB_BKPT_SEMIHOSTING) {
+      uint32_t dfsr = 0;
+      uint32_t cfsr = 0;
+      stlink_read_debug32(sl, STLINK_REG_DFSR, &dfsr);
+      stlink_read_debug32(sl, STLINK_REG_CFSR, &cfsr);
+      snprintf(message, message_size, "target halted at pc %#010x, lr %#010x (DFSR %#x, CFSR %#x)",
+               regp.r[15], regp.r[14], dfsr, cfsr);
+      result = APP_RESULT_TARGET_FAULT;
+      break;
+    }
+
+    if (semihosting(sl, regp.r[0], regp.r[1], &ret, out, &exit_code)) {
+      snprintf(message, message_size, "exit code %d", exit_code);
+      result = exit_code & 0xff;
+      halted = true;
+      *exited = true;
+      break;
+    }
+
+    if (stlink_write_reg(sl, ret, 0) || stlink_write_reg(sl, regp.r[15] + 2, 15) ||
+        stlink_run(sl, RUN_NORMAL)) {
+      snprintf(message, message_size, "cannot resume the target");
+      break;
+    }
+  }
+
+  if (!halted) { stlink_force_debug(sl); }
+
+  // what the core wrote to the ITM before it stopped is still on its way
+  for (uint32_t i = 0; settings->trace && i < RUN_TRACE_DRAIN; i++) {
+    if (!read_trace(sl, trace)) { usleep(RUN_POLL_US); }
+  }
+
+  return (result);
+}
+
+int32_t main(int32_t argc, char **argv) {
+#if defined(_WIN32)
+  SetConsoleCtrlHandler((PHANDLER_ROUTINE)CtrlHandler, TRUE);
+#else
+  signal(SIGINT, &abort_run);
+  signal(SIGTERM, &abort_run);
+#endif
+
+  st_settings_t settings;
+  if (!parse_options(argc, argv, &settings)) {
+    usage();
+    return APP_RESULT_ERROR;
+  }
+
+  if (settings.show_help) {
+    usage();
+    return 0;
+  }
+
+  if (settings.show_version) {
+    printf("v%s\n", STLINK_VERSION);
+    return 0;
+  }
+
+  uint64_t load_start = time_ms();
+  stlink_t *sl = run_connect(&settings);
+  run_image_t image;
+  run_output_t out;
+  st_trace_t trace;
+  char message[128] = "";
+  int32_t result = APP_RESULT_ERROR;
+  bool from_sram = false;
+  bool exited = false;
+  uint32_t demcr = 0;
+  uint64_t run_start;
+
+  memset(&out, 0, sizeof(out));
+  memset(&trace, 0, sizeof(trace));
+  trace.output = output;
+  trace.output_arg = &out;
+  memset(&image, 0, sizeof(image));
+
+  if (!sl) {
+    snprintf(message, sizeof(message), "no target");
+    goto on_exit;
+  }
+
+  if (!elf_load(settings.elf, sl, &image)) {
+    snprintf(message, sizeof(message), "cannot load %s", settings.elf);
+    goto on_exit;
+  }
+
+  from_sram = in_range(image.entry & ~1u, 2, sl->sram_base, sl->sram_size);
+
+  if (from_sram && image.sram_count == 0) {
+    snprintf(message, sizeof(message), "entry point %#010x has nothing loaded", image.entry);
+    goto on_exit;
+  }
+
+  // the flash loader runs from SRAM, load the SRAM segments after it
+  if ((image.flash_count && load_flash(sl, &image)) ||
+      stlink_reset(sl, RESET_SOFT_AND_HALT) || load_sram(sl, &image) ||
+      (from_sram && start_sram(sl, &image))) {
+    snprintf(message, sizeof(message), "cannot load %s", settings.elf);
+    goto on_exit;
+  }
+
+  if (settings.trace &&
+      !itm_enable(sl, settings.core_frequency,
+                  settings.trace_frequency ? settings.trace_frequency : STLINK_DEFAULT_TRACE_FREQUENCY,
+                  false, false)) {
+    snprintf(message, sizeof(message), "cannot enable the trace");
+    goto on_exit;
+  }
+
+  // a fault stops the core instead of spinning in the default handler
+  if (stlink_read_debug32(sl, STLINK_REG_CM3_DEMCR, &demcr) ||
+      stlink_write_debug32(sl, STLINK_REG_CM3_DEMCR, demcr | STLINK_REG_CM3_DEMCR_VC_HARDERR)) {
+    snprintf(message, sizeof(message), "cannot set up the fault catch");
+    goto on_exit;
+  }
+
+  run_start = time_ms();
+  ILOG("Loaded %s in %u ms, running from %s\n", settings.elf, (uint32_t)(run_start - load_start),
+       from_sram ? "SRAM" : "flash");
+
+  result = run(sl, &settings, &trace, &out, message, sizeof(message), &exited);
+  ILOG("Stopped after %u ms\n", (uint32_t)(time_ms() - run_start));
+
+on_exit:
+  if (!exited) {
+    ELOG("%s\n", message);
+  } else {
+    ILOG("%s\n", message);
+  }
+
+  if (sl && settings.trace) { stlink_trace_disable(sl); }
+
+  stlink_close(sl);
+
+  if (settings.junit != NULL &&
+      !write_junit(&settings, exited, result, message, (time_ms() - load_start) / 1000.0, &out)) {
+    result = APP_RESULT_ERROR;
+  }
+
+  free(image.data);
+  free(out.data);
+  return result;
+}
@@ -0,0 +1,696 @@
+/*
+ * File: scope.c
+ *
+ * Periodic sampling of target variables while the core is running
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <stlink.h>
+
+#include <helper.h>
+#include <logging.h>
+#include <read_write.h>
+#include <usb.h>
+
+#define DEFAULT_LOGGING_LEVEL 50
+#define DEBUG_LOGGING_LEVEL 100
+
+#define APP_RESULT_SUCCESS 0
+#define APP_RESULT_INVALID_PARAMS 1
+#define APP_RESULT_STLINK_NOT_FOUND 2
+#define APP_RESULT_STLINK_MISSING_DEVICE 3
+#define APP_RESULT_OUTPUT_ERROR 4
+#define APP_RESULT_READ_ERROR 5
+
+#define SCOPE_VAR_NUM_MAX 64
+// largest single read the probes handle reliably
+#define SCOPE_READ_MAX 0x1800
+// reading over a short gap is cheaper than another USB transaction
+#define SCOPE_GAP_MAX 64
+// sleeping is too coarse for kHz rates, spin for the last part of a period
+#define SCOPE_SPIN_US 200
+
+#define ELF_SHT_SYMTAB 2
+
+typedef enum {
+  VAR_U8,
+  VAR_I8,
+  VAR_U16,
+  VAR_I16,
+  VAR_U32,
+  VAR_I32,
+  VAR_F32,
+} var_type;
+
+static const struct {
+  const char *name;
+  var_type type;
+  uint32_t size;
+} var_types[] = {
+  {"u8", VAR_U8, 1},
+  {"i8", VAR_I8, 1},
+  {"u16", VAR_U16, 2},
+  {"i16", VAR_I16, 2},
+  {"u32", VAR_U32, 4},
+  {"i32", VAR_I32, 4},
+  {"f32", VAR_F32, 4},
+};
+
+typedef struct {
+  const char *name;
+  char *name_copy; // owned copy of the name, NULL if it points into argv
+  stm32_addr_t addr;
+  var_type type;
+  uint32_t size;
+  uint32_t window; // coalesced read holding the variable
+  uint32_t offset; // offset of the variable within that read
+} scope_var_t;
+
+typedef struct {
+  stm32_addr_t addr;
+  uint32_t len;
+  uint8_t *data;
+} scope_window_t;
+
+typedef struct {
+  bool show_help;
+  bool show_version;
+  int32_t logging_level;
+  uint32_t rate;
+  uint32_t count;
+  bool binary;
+  const char *output;
+  const char *elf;
+  char *serial_number;
+  int32_t freq;
+  char *specs[SCOPE_VAR_NUM_MAX];
+  uint32_t spec_count;
+} st_settings_t;
+
+typedef struct {
+  uint64_t first;
+  uint64_t prev;
+  uint32_t samples;
+  uint32_t overruns;
+  uint64_t min;
+  uint64_t max;
+  double sum;    // sum of the sampling intervals in us
+  double sum_sq; // sum of their squares, for the jitter
+} scope_stats_t;
+
+// We use a global flag to allow communicating to the main thread from the
+// signal handler.
+static bool g_abort_scope = false;
+
+static void abort_scope() { g_abort_scope = true; }
+
+#if defined(_WIN32)
+BOOL WINAPI CtrlHandler(DWORD fdwCtrlType) {
+  (void)fdwCtrlType;
+  abort_scope();
+  return TRUE;
+}
+#endif
+
+static void usage(void) {
+  puts("st-scope - usage:");
+  puts("  st-scope [options] <var> [<var>...]");
+  puts("  <var> is <addr|symbol[+offset]>[:type[:name]], type one of");
+  puts("        u8, i8, u16, i16, u32, i32 or f32 (eg. 0x20000010:i16:speed)");
+  puts("");
+  puts("  -h, --help            Print this help");
+  puts("  -V, --version         Print this version");
+  puts("  -vXX, --verbose=XX    Specify a specific verbosity level (0..99)");
+  puts("  -v, --verbose         Specify a generally verbose logging");
+  puts("  -rXX, --rate=XX       Sample rate, optionally followed by k=kHz");
+  puts("                        (eg. --rate=2k), as fast as possible if not given");
+  puts("  -nXX, --count=XX      Stop after XX samples, Ctrl-C stops otherwise");
+  puts("  -eXX, --elf=XX        Resolve symbols from the ELF file XX");
+  puts("  -oXX, --output=XX     Write the samples to XX instead of stdout");
+  puts("  -b, --binary          Write binary records instead of CSV: a 64 bit");
+  puts("                        little endian timestamp in us, then the raw");
+  puts("                        bytes of each variable in command line order");
+  puts("  -sXX, --serial=XX     Use a specific serial number");
+  puts("  -FXX, --freq=XX       Set the SWD frequency, eg. --freq=4M");
+}
+
+static bool parse_rate(char *text, uint32_t *result) {
+  char *suffix = text;
+  double value = strtod(text, &suffix);
+  double scale = 1.0;
+
+  if (*suffix == 'k') {
+    scale = 1000;
+  } else if (*suffix != '\0') {
+    ELOG("Unknown rate suffix '%s'.\n", suffix);
+    return false;
+  }
+
+  value *= scale;
+
+  if (value < 1 || value > 1000000) {
+    ELOG("Sample rate is out of valid range.\n");
+    return false;
+  }
+
+  *result = (uint32_t)value;
+  return true;
+}
+
+static bool parse_options(int32_t argc, char **argv, st_settings_t *settings) {
+
+  static struct option long_options[] = {
+      {"help", no_argument, NULL, 'h'},
+      {"version", no_argument, NULL, 'V'},
+      {"verbose", optional_argument, NULL, 'v'},
+      {"rate", required_argument, NULL, 'r'},
+      {"count", required_argument, NULL, 'n'},
+      {"elf", required_argument, NULL, 'e'},
+      {"output", required_argument, NULL, 'o'},
+      {"binary", no_argument, NULL, 'b'},
+      {"serial", required_argument, NULL, 's'},
+      {"freq", required_argument, NULL, 'F'},
+      {0, 0, 0, 0},
+  };
+  int32_t option_index = 0;
+  int32_t c;
+  bool error = false;
+
+  memset(settings, 0, sizeof(*settings));
+  settings->logging_level = DEFAULT_LOGGING_LEVEL;
+  ugly_init(settings->logging_level);
+
+  while ((c = getopt_long(argc, argv, "hVv::r:n:e:o:bs:F:", long_options, &option_index)) != -1) {
+    switch (c) {
+    case 'h':
+      settings->show_help = true;
+      break;
+    case 'V':
+      settings->show_version = true;
+      break;
+    case 'v':
+      if (optarg) {
+        settings->logging_level = atoi(optarg);
+      } else {
+        settings->logging_level = DEBUG_LOGGING_LEVEL;
+      }
+      ugly_init(settings->logging_level);
+      break;
+    case 'r':
+      if (!parse_rate(optarg, &settings->rate)) error = true;
+      break;
+    case 'n':
+      settings->count = (uint32_t)strtoul(optarg, NULL, 0);
+      break;
+    case 'e':
+      settings->elf = optarg;
+      break;
+    case 'o':
+      settings->output = optarg;
+      break;
+    case 'b':
+      settings->binary = true;
+      break;
+    case 's':
+      settings->serial_number = optarg;
+      break;
+    case 'F':
+      settings->freq = arg_parse_freq(optarg);
+      if (settings->freq < 0) {
+        ELOG("Invalid frequency '%s'\n", optarg);
+        error = true;
+      }
+      break;
+    case '?':
+      error = true;
+      break;
+    default:
+      ELOG("Unknown command line option: '%c' (0x%02x)\n", c, c);
+      error = true;
+      break;
+    }
+  }
+
+  while (optind < argc) {
+    if (settings->spec_count == SCOPE_VAR_NUM_MAX) {
+      ELOG("Too many variables, at most %d are supported\n", SCOPE_VAR_NUM_MAX);
+      error = true;
+      break;
+    }
+
+    settings->specs[settings->spec_count++] = argv[optind++];
+  }
+
+  if (settings->spec_count == 0 && !settings->show_help && !settings->show_version) {
+    ELOG("No variables given\n");
+    error = true;
+  }
+
+  return (!error);
+}
+
+static uint8_t *elf_load(const char *path, uint32_t *size) {
+  FILE *fp = fopen(path, "rb");
+  uint8_t *buf = NULL;
+  long len;
+
+  if (fp == NULL) {
+    ELOG("Cannot open %s\n", path);
+    return (NULL);
+  }
+
+  if (fseek(fp, 0, SEEK_END) == 0 && (len = ftell(fp)) > 0 && fseek(fp, 0, SEEK_SET) == 0) {
+    buf = malloc(len);
+
+    if (buf != NULL && fread(buf, 1, len, fp) != (size_t)len) {
+      free(buf);
+      buf = NULL;
+    }
+
+    *size = (uint32_t)len;
+  }
+
+  fclose(fp);
+
+  if (buf == NULL || *size < 52 || memcmp(buf, "\177ELF\1\1", 6)) {
+    ELOG("%s is not a 32 bit little endian ELF file\n", path);
+    free(buf);
+    return (NULL);
+  }
+
+  return (buf);
+}
+
+static bool elf_lookup(const uint8_t *elf, uint32_t size, const char *name, uint32_t *value,
+                       uint32_t *sym_size) {
+  uint32_t shoff = read_uint32(elf, 32);
+  uint32_t shentsize = read_uint16(elf, 46);
+  uint32_t shnum = read_uint16(elf, 48);
+
+  if (shentsize < 40 || shoff > size || shnum > (size - shoff) / shentsize) {
+    return (false);
+  }
+
+  for (uint32_t i = 0; i < shnum; i++) {
+    const uint8_t *sh = &elf[shoff + i * shentsize];
+
+    if (read_uint32(sh, 4) != ELF_SHT_SYMTAB) { continue; }
+
+    uint32_t symoff = read_uint32(sh, 16);
+    uint32_t symsize = read_uint32(sh, 20);
+    uint32_t link = read_uint32(sh, 24);
+
+    if (link >= shnum || symoff > size || symsize > size - symoff) { continue; }
+
+    const uint8_t *strsh = &elf[shoff + link * shentsize];
+    uint32_t stroff = read_uint32(strsh, 16);
+    uint32_t strsize = read_uint32(strsh, 20);
+
+    if (stroff > size || strsize > size - stroff) { continue; }
+
+    for (uint32_t off = 0; off + 16 <= symsize; off += 16) {
+      const uint8_t *sym = &elf[symoff + off];
+      uint32_t str = read_uint32(sym, 0);
+
+      if (str < strsize && strncmp((const char *)&elf[stroff + str], name, strsize - str) == 0) {
+        *value = read_uint32(sym, 4);
+        *sym_size = read_uint32(sym, 8);
+        return (true);
+      }
+    }
+  }
+
+  return (false);
+}
+
+static void free_vars(scope_var_t *vars, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) { free(vars[i].name_copy); }
+}
+
+static bool parse_var(char *spec, const uint8_t *elf, uint32_t elf_size, scope_var_t *var) {
+  char *location = spec;
+  char *type = strchr(spec, ':');
+  char *name = NULL;
+  uint32_t sym_size = 0;
+
+  if (type != NULL) {
+    *type++ = '\0';
+    name = strchr(type, ':');
+
+    if (name != NULL) { *name++ = '\0'; }
+  }
+
+  var->name = (name != NULL && *name) ? name : location;
+  var->name_copy = NULL;
+
+  if (location[0] >= '0' && location[0] <= '9') {
+    char *tail;
+    var->addr = (uint32_t)strtoul(location, &tail, 0);
+
+    if (*tail != '\0') {
+      ELOG("Invalid address '%s'\n", location);
+      return (false);
+    }
+  } else {
+    char *plus = strchr(location, '+');
+    uint32_t offset = 0;
+
+    if (plus != NULL) {
+      offset = (uint32_t)strtoul(plus + 1, NULL, 0);
+      // the name keeps the offset, the symbol lookup must not
+      if (var->name == location) {
+        if ((var->name_copy = strdup(location)) == NULL) { return (false); }
+
+        var->name = var->name_copy;
+      }
+      *plus = '\0';
+    }
+
+    if (elf == NULL) {
+      ELOG("Symbol '%s' needs an ELF file, see --elf\n", location);
+      return (false);
+    }
+
+    if (!elf_lookup(elf, elf_size, location, &var->addr, &sym_size)) {
+      ELOG("Symbol '%s' not found\n", location);
+      return (false);
+    }
+
+    var->addr += offset;
+
+    if (offset) { sym_size = 0; }
+  }
+
+  if (type == NULL || *type == '\0') {
+    // default to the symbol size when it matches an integer type
+    var->type = (sym_size == 1) ? VAR_U8 : (sym_size == 2) ? VAR_U16 : VAR_U32;
+  } else {
+    uint32_t i;
+
+    for (i = 0; i < sizeof(var_types) / sizeof(var_types[0]); i++) {
+      if (strcmp(type, var_types[i].name) == 0) { break; }
+    }
+
+    if (i == sizeof(var_types) / sizeof(var_types[0])) {
+      ELOG("Unknown type '%s'\n", type);
+      return (false);
+    }
+
+    var->type = var_types[i].type;
+  }
+
+  var->size = var_types[var->type].size;
+  return (true);
+}
+
+/*
+ * Pack the variables into the minimum number of word aligned reads. Every
+ * read is a full USB round trip, so neighbours are merged even across small
+ * gaps as long as the read stays within SCOPE_READ_MAX.
+ */
+static uint32_t coalesce(scope_var_t *vars, uint32_t count, scope_window_t *windows) {
+  uint32_t order[SCOPE_VAR_NUM_MAX];
+  uint32_t num = 0;
+
+  // keep the command line order for the output, sort an index instead
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t j = i;
+
+    while (j > 0 && vars[order[j - 1]].addr > vars[i].addr) {
+      order[j] = order[j - 1];
+      j--;
+    }
+
+    order[j] = i;
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    scope_var_t *var = &vars[order[i]];
+    stm32_addr_t start = var->addr & ~3u;
+    stm32_addr_t end = (var->addr + var->size + 3) & ~3u;
+    scope_window_t *w = num ? &windows[num - 1] : NULL;
+
+    if (w == NULL || start > w->addr + w->len + SCOPE_GAP_MAX || end - w->addr > SCOPE_READ_MAX) {
+      w = &windows[num++];
+      w->addr = start;
+      w->len = 0;
+    }
+
+    if (end - w->addr > w->len) { w->len = end - w->addr; }
+
+    var->window = num - 1;
+    var->offset = var->addr - w->addr;
+  }
+
+  for (uint32_t i = 0; i < num; i++) {
+    windows[i].data = calloc(1, windows[i].len);
+  }
+
+  return (num);
+}
+
+static int32_t sample(stlink_t *sl, scope_window_t *windows, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    if (stlink_read_mem32(sl, windows[i].addr, (uint16_t)windows[i].len)) {
+      ELOG("Cannot read %#010x\n", windows[i].addr);
+      return (-1);
+    }
+
+    memcpy(windows[i].data, sl->q_buf, windows[i].len);
+  }
+
+  return (0);
+}
+
+static void print_var(FILE *fp, const scope_var_t *var, const uint8_t *p) {
+  uint32_t u32;
+  float f32;
+
+  switch (var->type) {
+  case VAR_U8: fprintf(fp, "%u", p[0]); break;
+  case VAR_I8: fprintf(fp, "%d", (int8_t)p[0]); break;
+  case VAR_U16: fprintf(fp, "%u", read_uint16(p, 0)); break;
+  case VAR_I16: fprintf(fp, "%d", (int16_t)read_uint16(p, 0)); break;
+  case VAR_U32: fprintf(fp, "%" PRIu32, read_uint32(p, 0)); break;
+  case VAR_I32: fprintf(fp, "%" PRId32, (int32_t)read_uint32(p, 0)); break;
+  case VAR_F32:
+    u32 = read_uint32(p, 0);
+    memcpy(&f32, &u32, sizeof(f32));
+    fprintf(fp, "%g", f32);
+    break;
+  }
+}
+
+static int32_t write_sample(FILE *fp, const st_settings_t *settings, const scope_var_t *vars,
+                            uint32_t count, const scope_window_t *windows, uint64_t timestamp) {
+  if (settings->binary) {
+    uint8_t ts[8];
+    write_uint32(&ts[0], (uint32_t)timestamp);
+    write_uint32(&ts[4], (uint32_t)(timestamp >> 32));
+    fwrite(ts, 1, sizeof(ts), fp);
+
+    for (uint32_t i = 0; i < count; i++) {
+      fwrite(&windows[vars[i].window].data[vars[i].offset], 1, vars[i].size, fp);
+    }
+  } else {
+    fprintf(fp, "%" PRIu64, timestamp);
+
+    for (uint32_t i = 0; i < count; i++) {
+      fputc(',', fp);
+      print_var(fp, &vars[i], &windows[vars[i].window].data[vars[i].offset]);
+    }
+
+    fputc('\n', fp);
+  }
+
+  return (ferror(fp) ? -1 : 0);
+}
+
+static void update_stats(scope_stats_t *stats, uint64_t now) {
+  if (stats->samples++ == 0) {
+    stats->first = now;
+  } else {
+    uint64_t interval = now - stats->prev;
+
+    if (stats->samples == 2 || interval < stats->min) { stats->min = interval; }
+
+    if (interval > stats->max) { stats->max = interval; }
+
+    stats->sum += (double)interval;
+    stats->sum_sq += (double)interval * (double)interval;
+  }
+
+  stats->prev = now;
+}
+
+static void report_stats(const scope_stats_t *stats, uint32_t reads, uint32_t bytes) {
+  if (stats->samples < 2) {
+    ILOG("%u samples taken\n", stats->samples);
+    return;
+  }
+
+  double intervals = stats->samples - 1;
+  double mean = stats->sum / intervals;
+  double variance = stats->sum_sq / intervals - mean * mean;
+  double jitter = variance > 0 ? sqrt(variance) : 0;
+
+  ILOG("%u samples in %.3f s, %.1f Hz, %u reads of %u bytes per sample\n", stats->samples,
+       (stats->prev - stats->first) / 1e6, 1e6 / mean, reads, bytes);
+  ILOG("Interval %.1f us mean, %.1f us jitter (std dev), %" PRIu64 "..%" PRIu64 " us, %u overruns\n",
+       mean, jitter, stats->min, stats->max, stats->overruns);
+}
+
+static void wait_until(uint64_t deadline) {
+  uint64_t now = time_us();
+
+  if (now + SCOPE_SPIN_US < deadline) { usleep((uint32_t)(deadline - now - SCOPE_SPIN_US)); }
+
+  while (time_us() < deadline) {}
+}
+
+int32_t main(int32_t argc, char **argv) {
+#if defined(_WIN32)
+  SetConsoleCtrlHandler((PHANDLER_ROUTINE)CtrlHandler, TRUE);
+#else
+  signal(SIGINT, &abort_scope);
+  signal(SIGTERM, &abort_scope);
+  signal(SIGPIPE, &abort_scope);
+#endif
+
+  st_settings_t settings;
+  if (!parse_options(argc, argv, &settings)) {
+    usage();
+    return APP_RESULT_INVALID_PARAMS;
+  }
+
+  if (settings.show_help) {
+    usage();
+    return APP_RESULT_SUCCESS;
+  }
+
+  if (settings.show_version) {
+    printf("v%s\n", STLINK_VERSION);
+    return APP_RESULT_SUCCESS;
+  }
+
+  uint8_t *elf = NULL;
+  uint32_t elf_size = 0;
+
+  if (settings.elf != NULL && (elf = elf_load(settings.elf, &elf_size)) == NULL) {
+    return APP_RESULT_INVALID_PARAMS;
+  }
+
+  scope_var_t vars[SCOPE_VAR_NUM_MAX];
+  scope_window_t windows[SCOPE_VAR_NUM_MAX];
+  uint32_t bytes = 0;
+
+  for (uint32_t i = 0; i < settings.spec_count; i++) {
+    if (!parse_var(settings.specs[i], elf, elf_size, &vars[i])) {
+      free_vars(vars, i + 1);
+      free(elf);
+      return APP_RESULT_INVALID_PARAMS;
+    }
+
+    DLOG("%s at %#010x, %s\n", vars[i].name, vars[i].addr, var_types[vars[i].type].name);
+  }
+
+  free(elf);
+
+  uint32_t reads = coalesce(vars, settings.spec_count, windows);
+
+  for (uint32_t i = 0; i < reads; i++) {
+    DLOG("read %#010x+%u\n", windows[i].addr, windows[i].len);
+    bytes += windows[i].len;
+  }
+
+  // attach to the running core, neither reset nor halt it
+  stlink_t *stlink = stlink_open_usb(settings.logging_level, CONNECT_HOT_PLUG, settings.serial_number,
+                                     settings.freq);
+  int32_t result = APP_RESULT_SUCCESS;
+  FILE *fp = stdout;
+
+  if (!stlink) {
+    ELOG("Unable to locate an stlink\n");
+    result = APP_RESULT_STLINK_NOT_FOUND;
+    goto on_exit;
+  }
+
+  if (stlink->chip_id == STM32_CHIPID_UNKNOWN) {
+    ELOG("Your stlink is not connected to a device\n");
+    result = APP_RESULT_STLINK_MISSING_DEVICE;
+    goto on_exit;
+  }
+
+  if (settings.output != NULL && (fp = fopen(settings.output, settings.binary ? "wb" : "w")) == NULL) {
+    ELOG("Cannot open %s for writing\n", settings.output);
+    fp = stdout;
+    result = APP_RESULT_OUTPUT_ERROR;
+    goto on_exit;
+  }
+
+  if (!settings.binary) {
+    fprintf(fp, "time_us");
+
+    for (uint32_t i = 0; i < settings.spec_count; i++) { fprintf(fp, ",%s", vars[i].name); }
+
+    fputc('\n', fp);
+  }
+
+  ILOG("Sampling %u variables with %u reads of %u bytes\n", settings.spec_count, reads, bytes);
+
+  uint64_t period = settings.rate ? 1000000 / settings.rate : 0;
+  uint64_t next = time_us();
+  scope_stats_t stats;
+  memset(&stats, 0, sizeof(stats));
+
+  while (!g_abort_scope && (settings.count == 0 || stats.samples < settings.count)) {
+    if (period) { wait_until(next); }
+
+    uint64_t now = time_us();
+
+    if (sample(stlink, windows, reads)) {
+      result = APP_RESULT_READ_ERROR;
+      break;
+    }
+
+    update_stats(&stats, now);
+
+    if (write_sample(fp, &settings, vars, settings.spec_count, windows, now - stats.first)) {
+      ELOG("Cannot write the samples\n");
+      result = APP_RESULT_OUTPUT_ERROR;
+      break;
+    }
+
+    if (period) {
+      next += period;
+
+      // fell behind by more than a period, skip ahead instead of bursting
+      if (next + period < time_us()) {
+        stats.overruns++;
+        next = time_us() + period;
+      }
+    }
+  }
+
+  report_stats(&stats, reads, bytes);
+
+on_exit:
+  if (fp != stdout) { fclose(fp); } else { fflush(fp); }
+
+  for (uint32_t i = 0; i < reads; i++) { free(windows[i].data); }
+
+  free_vars(vars, settings.spec_count);
+  stlink_close(stlink);
+
+  return result;
+}
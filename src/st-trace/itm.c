@@ -0,0 +1,411 @@
+/*
+ * File: itm.c
+ *
+ * SWO trace setup and ITM/DWT trace stream decoder of st-trace
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <stlink.h>
+#include <logging.h>
+#include <read_write.h>
+#include <register.h>
+
+#include "itm.h"
+
+int32_t stlink_trace_enable(stlink_t *sl, uint32_t frequency) {
+  DLOG("*** stlink_trace_enable ***\n");
+  return (sl->backend->trace_enable(sl, frequency));
+}
+
+int32_t stlink_trace_disable(stlink_t *sl) {
+  DLOG("*** stlink_trace_disable ***\n");
+  return (sl->backend->trace_disable(sl));
+}
+
+int32_t stlink_trace_read(stlink_t *sl, uint8_t *buf, uint32_t size) {
+  return (sl->backend->trace_read(sl, buf, size));
+}
+
+/*
+ * Enables the SWO output of the probe and configures the TPIU, ITM and DWT of
+ * the target for it, which is left halted. The TPIU prescaler is only set if
+ * the core frequency is known, the target firmware is expected to set it
+ * otherwise. event_counters adds the DWT event counter packets to the stream.
+ * force carries on after errors.
+ */
+bool itm_enable(stlink_t *stlink, uint32_t core_frequency, uint32_t trace_frequency, bool event_counters,
+                bool force) {
+  stlink_write_debug32(stlink, STLINK_REG_DHCSR,
+                       STLINK_REG_DHCSR_DBGKEY | STLINK_REG_DHCSR_C_DEBUGEN |
+                           STLINK_REG_DHCSR_C_HALT);
+  stlink_write_debug32(stlink, STLINK_REG_DEMCR, STLINK_REG_DEMCR_TRCENA);
+  stlink_write_debug32(stlink, STLINK_REG_CM3_FP_CTRL,
+                       STLINK_REG_CM3_FP_CTRL_KEY);
+  stlink_write_debug32(stlink, STLINK_REG_DWT_FUNCTION0, 0);
+  stlink_write_debug32(stlink, STLINK_REG_DWT_FUNCTION1, 0);
+  stlink_write_debug32(stlink, STLINK_REG_DWT_FUNCTION2, 0);
+  stlink_write_debug32(stlink, STLINK_REG_DWT_FUNCTION3, 0);
+  stlink_write_debug32(stlink, STLINK_REG_DWT_CTRL, 0);
+  stlink_write_debug32(stlink, STLINK_REG_DBGMCU_CR,
+      STLINK_REG_DBGMCU_CR_DBG_SLEEP | STLINK_REG_DBGMCU_CR_DBG_STOP |
+          STLINK_REG_DBGMCU_CR_DBG_STANDBY | STLINK_REG_DBGMCU_CR_TRACE_IOEN |
+          STLINK_REG_DBGMCU_CR_TRACE_MODE_ASYNC);
+
+  if (stlink_trace_enable(stlink, trace_frequency)) {
+    ELOG("Unable to turn on tracing in stlink\n");
+    if (!force) return false;
+  }
+
+  stlink_write_debug32(stlink, STLINK_REG_TPI_CSPSR, STLINK_REG_TPI_CSPSR_PORT_SIZE_1);
+
+  if (core_frequency) {
+    uint32_t prescaler = core_frequency / trace_frequency - 1;
+    if (prescaler > STLINK_REG_TPI_ACPR_MAX) {
+      ELOG("Trace frequency prescaler %d out of range. Try setting a faster "
+           "trace frequency.\n", prescaler);
+      if (!force) return false;
+    }
+    stlink_write_debug32(stlink, STLINK_REG_TPI_ACPR,
+                         prescaler); // Set TPIU_ACPR clock divisor
+  }
+  stlink_write_debug32(stlink, STLINK_REG_TPI_FFCR,
+                       STLINK_REG_TPI_FFCR_TRIG_IN);
+  stlink_write_debug32(stlink, STLINK_REG_TPI_SPPR,
+                       STLINK_REG_TPI_SPPR_SWO_NRZ);
+  stlink_write_debug32(stlink, STLINK_REG_ITM_LAR, STLINK_REG_ITM_LAR_KEY);
+  stlink_write_debug32(stlink, STLINK_REG_ITM_TCC, 0x00000400); // Set sync counter
+
+  uint32_t dwt_events = 0;
+  if (event_counters) {
+    uint32_t dwt_ctrl = 0;
+    stlink_read_debug32(stlink, STLINK_REG_DWT_CTRL, &dwt_ctrl);
+    if (dwt_ctrl & STLINK_REG_DWT_CTRL_NOPRFCNT) {
+      ELOG("The core has no DWT event counters\n");
+      if (!force) return false;
+    } else {
+      dwt_events = STLINK_REG_DWT_CTRL_CPIEVTENA | STLINK_REG_DWT_CTRL_EXCEVTENA |
+                   STLINK_REG_DWT_CTRL_SLEEPEVTENA | STLINK_REG_DWT_CTRL_LSUEVTENA |
+                   STLINK_REG_DWT_CTRL_FOLDEVTENA | STLINK_REG_DWT_CTRL_CYCEVTENA;
+    }
+  }
+
+  stlink_write_debug32(stlink, STLINK_REG_ITM_TCR,
+                       STLINK_REG_ITM_TCR_TRACE_BUS_ID_1 |
+                          (dwt_events ? STLINK_REG_ITM_TCR_DWT_ENA : 0) |
+                          STLINK_REG_ITM_TCR_TS_ENA |
+                          STLINK_REG_ITM_TCR_ITM_ENA);
+  stlink_write_debug32(stlink, STLINK_REG_ITM_TER,
+                       STLINK_REG_ITM_TER_PORTS_ALL);
+  stlink_write_debug32(stlink, STLINK_REG_ITM_TPR,
+                       STLINK_REG_ITM_TPR_PORTS_ALL);
+  // POSTCNT wraps, for DWT_EVENT_CYC, every 16 times 1024 cycles with CYC_TAP
+  stlink_write_debug32(stlink, STLINK_REG_DWT_CTRL,
+                       4 * STLINK_REG_DWT_CTRL_NUM_COMP | dwt_events |
+                           STLINK_REG_DWT_CTRL_CYC_TAP |
+                           0xF * STLINK_REG_DWT_CTRL_POST_INIT |
+                           0xF * STLINK_REG_DWT_CTRL_POST_PRESET |
+                           STLINK_REG_DWT_CTRL_CYCCNT_ENA);
+  stlink_write_debug32(stlink, STLINK_REG_DEMCR, STLINK_REG_DEMCR_TRCENA);
+
+  uint32_t prescaler = 0;
+  stlink_read_debug32(stlink, STLINK_REG_TPI_ACPR, &prescaler);
+  if (prescaler) {
+    uint32_t system_clock_speed = (prescaler + 1) * trace_frequency;
+    ILOG("Trace Port Interface configured to expect a %d Hz system clock.\n",
+         system_clock_speed);
+  } else {
+    WLOG("Trace Port Interface not configured.  Specify the system clock with "
+         "a --clock=XX command\n");
+    WLOG("line option or set it in your device's clock initialization routine, "
+         "such as with:\n");
+    WLOG("  TPI->ACPR = HAL_RCC_GetHCLKFreq() / %d - 1;\n", trace_frequency);
+  }
+  ILOG("Trace frequency set to %d Hz.\n", trace_frequency);
+
+  return true;
+}
+
+static void count_dwt_events(st_trace_t *trace, uint8_t c) {
+  for (uint32_t i = 0; i < DWT_EVENT_NUM; i++)
+    if (c & (1 << i)) trace->count_dwt_event[i]++;
+}
+
+static trace_state update_trace_idle(st_trace_t *trace, uint8_t c) {
+  // Handle a trace byte when we are in the idle state.
+
+  if (TRACE_OP_IS_TARGET_SOURCE(c)) return TRACE_STATE_TARGET_SOURCE;
+
+  if (c == TRACE_OP_DWT_EVENT) return TRACE_STATE_DWT_EVENT;
+
+  if (TRACE_OP_IS_SOURCE(c)) {
+    uint8_t size = TRACE_OP_GET_SOURCE_SIZE(c);
+    if (TRACE_OP_IS_SW_SOURCE(c)) {
+      uint8_t addr = TRACE_OP_GET_SW_SOURCE_ADDR(c);
+      if (!(trace->unknown_sources & (1 << addr)))
+        WLOG("Unsupported source 0x%x size %d\n", addr, size);
+      trace->unknown_sources |= (1 << addr);
+    }
+    if (size == 1) return TRACE_STATE_SKIP_1;
+    if (size == 2) return TRACE_STATE_SKIP_2;
+    if (size == 3) return TRACE_STATE_SKIP_4;
+  }
+
+  if (TRACE_OP_IS_LOCAL_TIME(c) || TRACE_OP_IS_GLOBAL_TIME(c)) {
+    trace->count_time_packets++;
+    return TRACE_OP_GET_CONTINUATION(c) ? TRACE_STATE_SKIP_FRAME : TRACE_STATE_IDLE;
+  }
+
+  if (TRACE_OP_IS_EXTENSION(c)) {
+    return TRACE_OP_GET_CONTINUATION(c) ? TRACE_STATE_SKIP_FRAME : TRACE_STATE_IDLE;
+  }
+
+  if (TRACE_OP_IS_OVERFLOW(c)) trace->count_hw_overflow++;
+
+  if (!(trace->unknown_opcodes[c / 8] & (1 << c % 8)))
+    WLOG("Unknown opcode 0x%02x\n", c);
+  trace->unknown_opcodes[c / 8] |= (1 << c % 8);
+
+  trace->count_error++;
+  return TRACE_OP_GET_CONTINUATION(c) ? TRACE_STATE_SKIP_FRAME : TRACE_STATE_IDLE;
+}
+
+trace_state update_trace(st_trace_t *trace, uint8_t c) {
+  trace->count_raw_bytes++;
+
+  // Parse the input using a state machine.
+
+  if (trace->state == TRACE_STATE_UNKNOWN) {
+    if (TRACE_OP_IS_TARGET_SOURCE(c) || TRACE_OP_IS_LOCAL_TIME(c) || TRACE_OP_IS_GLOBAL_TIME(c))
+      trace->state = TRACE_STATE_IDLE;
+  }
+
+  switch (trace->state) {
+  case TRACE_STATE_IDLE:
+    return update_trace_idle(trace, c);
+
+  case TRACE_STATE_TARGET_SOURCE:
+    putchar(c);
+    if (c == '\n') fflush(stdout);
+    trace->count_target_data++;
+    return TRACE_STATE_IDLE;
+
+  case TRACE_STATE_SKIP_FRAME:
+    return TRACE_OP_GET_CONTINUATION(c) ? TRACE_STATE_SKIP_FRAME : TRACE_STATE_IDLE;
+
+  case TRACE_STATE_DWT_EVENT:
+    count_dwt_events(trace, c);
+    return TRACE_STATE_IDLE;
+
+  case TRACE_STATE_SKIP_4:
+    return TRACE_STATE_SKIP_3;
+
+  case TRACE_STATE_SKIP_3:
+    return TRACE_STATE_SKIP_2;
+
+  case TRACE_STATE_SKIP_2:
+    return TRACE_STATE_SKIP_1;
+
+  case TRACE_STATE_SKIP_1:
+    return TRACE_STATE_IDLE;
+
+  case TRACE_STATE_UNKNOWN:
+    return TRACE_STATE_UNKNOWN;
+
+  default:
+    ELOG("Invalid state %d.  This should never happen\n", trace->state);
+    return TRACE_STATE_IDLE;
+  }
+}
+
+/*
+ * Block decoder, equivalent to update_trace() on each byte of the block.
+ *
+ * Header bytes are classified through a table built once from the TRACE_OP_*
+ * macros, payloads and frame continuations are skipped in bulk, and runs of
+ * stimulus port 0 packets, two bytes each, are checked a word at a time and
+ * their data written out with a single fwrite(), or trace->output() call.
+ */
+
+#define ITM_NEXT_STATE 0x0f // trace_state after the header
+#define ITM_SYNC       0x10 // leaves TRACE_STATE_UNKNOWN
+#define ITM_TIME       0x20 // counted in count_time_packets
+#define ITM_SW_SOURCE  0x40 // unsupported software source
+#define ITM_ERROR      0x80 // unknown opcode, or overflow
+
+#define ITM_OUT_SIZE 4096
+
+static uint8_t itm_table[256];
+static bool itm_table_ready = false;
+
+static void itm_table_init(void) {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint8_t c = (uint8_t)i;
+    uint8_t e;
+
+    if (TRACE_OP_IS_TARGET_SOURCE(c)) {
+      e = TRACE_STATE_TARGET_SOURCE;
+    } else if (c == TRACE_OP_DWT_EVENT) {
+      e = TRACE_STATE_DWT_EVENT;
+    } else if (TRACE_OP_IS_SOURCE(c)) {
+      uint8_t size = TRACE_OP_GET_SOURCE_SIZE(c);
+      e = (size == 1) ? TRACE_STATE_SKIP_1 : (size == 2) ? TRACE_STATE_SKIP_2 : TRACE_STATE_SKIP_4;
+      if (TRACE_OP_IS_SW_SOURCE(c)) e |= ITM_SW_SOURCE;
+    } else if (TRACE_OP_IS_LOCAL_TIME(c) || TRACE_OP_IS_GLOBAL_TIME(c)) {
+      e = ITM_TIME | (TRACE_OP_GET_CONTINUATION(c) ? TRACE_STATE_SKIP_FRAME : TRACE_STATE_IDLE);
+    } else if (TRACE_OP_IS_EXTENSION(c)) {
+      e = TRACE_OP_GET_CONTINUATION(c) ? TRACE_STATE_SKIP_FRAME : TRACE_STATE_IDLE;
+    } else {
+      e = ITM_ERROR | (TRACE_OP_GET_CONTINUATION(c) ? TRACE_STATE_SKIP_FRAME : TRACE_STATE_IDLE);
+    }
+
+    if (TRACE_OP_IS_TARGET_SOURCE(c) || TRACE_OP_IS_LOCAL_TIME(c) || TRACE_OP_IS_GLOBAL_TIME(c))
+      e |= ITM_SYNC;
+
+    itm_table[i] = e;
+  }
+
+  itm_table_ready = true;
+}
+
+static void itm_header(st_trace_t *trace, uint8_t c, uint8_t e) {
+  // the rare cases of update_trace_idle(), with its warnings
+  if (e & ITM_TIME) trace->count_time_packets++;
+
+  if (e & ITM_SW_SOURCE) {
+    uint8_t addr = TRACE_OP_GET_SW_SOURCE_ADDR(c);
+    if (!(trace->unknown_sources & (1u << addr)))
+      WLOG("Unsupported source 0x%x size %d\n", addr, TRACE_OP_GET_SOURCE_SIZE(c));
+    trace->unknown_sources |= (1u << addr);
+  }
+
+  if (e & ITM_ERROR) {
+    if (TRACE_OP_IS_OVERFLOW(c)) trace->count_hw_overflow++;
+    if (!(trace->unknown_opcodes[c / 8] & (1 << c % 8)))
+      WLOG("Unknown opcode 0x%02x\n", c);
+    trace->unknown_opcodes[c / 8] |= (1 << c % 8);
+    trace->count_error++;
+  }
+}
+
+static void itm_flush(st_trace_t *trace, uint8_t *out, uint32_t *n, bool *newline) {
+  if (trace->output) {
+    if (*n) trace->output(trace->output_arg, out, *n);
+  } else {
+    if (*n) fwrite(out, 1, *n, stdout);
+    if (*newline) fflush(stdout);
+  }
+  *n = 0;
+  *newline = false;
+}
+
+// number of stimulus port 0 packets at buf, 0x01 followed by a data byte
+static uint32_t itm_stimulus_run(const uint8_t *buf, uint32_t len) {
+  static const uint8_t pattern[8] = { 0x01, 0, 0x01, 0, 0x01, 0, 0x01, 0 };
+  static const uint8_t mask[8] = { 0xff, 0, 0xff, 0, 0xff, 0, 0xff, 0 };
+  uint64_t p, m, w;
+  uint32_t i = 0;
+
+  memcpy(&p, pattern, 8);
+  memcpy(&m, mask, 8);
+
+  while (i + 8 <= len) {
+    memcpy(&w, buf + i, 8);
+    if ((w & m) != p) break;
+    i += 8;
+  }
+
+  while (i + 2 <= len && buf[i] == 0x01) i += 2;
+
+  return i / 2;
+}
+
+void update_trace_block(st_trace_t *trace, const uint8_t *buf, uint32_t len) {
+  uint8_t out[ITM_OUT_SIZE];
+  uint32_t n = 0;
+  bool newline = false;
+  trace_state state = trace->state;
+  uint32_t i = 0;
+
+  if (!itm_table_ready) itm_table_init();
+
+  trace->count_raw_bytes += len;
+
+  while (i < len) {
+    switch (state) {
+    case TRACE_STATE_UNKNOWN:
+      while (i < len && !(itm_table[buf[i]] & ITM_SYNC)) i++;
+      if (i < len) state = TRACE_STATE_IDLE;
+      break;
+
+    case TRACE_STATE_IDLE: {
+      uint32_t run = itm_stimulus_run(buf + i, len - i);
+
+      for (uint32_t k = 0; k < run; k++) {
+        uint8_t c = buf[i + 2 * k + 1];
+        if (n == ITM_OUT_SIZE) itm_flush(trace, out, &n, &newline);
+        out[n++] = c;
+        if (c == '\n') newline = true;
+      }
+
+      trace->count_target_data += run;
+      i += 2 * run;
+
+      if (i < len) {
+        uint8_t c = buf[i++];
+        uint8_t e = itm_table[c];
+        if (e & (ITM_TIME | ITM_SW_SOURCE | ITM_ERROR)) itm_header(trace, c, e);
+        state = (trace_state)(e & ITM_NEXT_STATE);
+      }
+      break;
+    }
+
+    case TRACE_STATE_TARGET_SOURCE:
+      if (n == ITM_OUT_SIZE) itm_flush(trace, out, &n, &newline);
+      out[n++] = buf[i];
+      if (buf[i++] == '\n') newline = true;
+      trace->count_target_data++;
+      state = TRACE_STATE_IDLE;
+      break;
+
+    case TRACE_STATE_DWT_EVENT:
+      count_dwt_events(trace, buf[i++]);
+      state = TRACE_STATE_IDLE;
+      break;
+
+    case TRACE_STATE_SKIP_FRAME:
+      while (i < len && TRACE_OP_GET_CONTINUATION(buf[i])) i++;
+      if (i < len) {
+        i++;
+        state = TRACE_STATE_IDLE;
+      }
+      break;
+
+    case TRACE_STATE_SKIP_4:
+    case TRACE_STATE_SKIP_3:
+    case TRACE_STATE_SKIP_2:
+    case TRACE_STATE_SKIP_1: {
+      uint32_t left = TRACE_STATE_SKIP_1 + 1 - state; // payload bytes still to come
+      if (len - i >= left) {
+        i += left;
+        state = TRACE_STATE_IDLE;
+      } else {
+        state = (trace_state)(state + (len - i));
+        i = len;
+      }
+      break;
+    }
+
+    default:
+      ELOG("Invalid state %d.  This should never happen\n", state);
+      state = TRACE_STATE_IDLE;
+      break;
+    }
+  }
+
+  itm_flush(trace, out, &n, &newline);
+  trace->state = state;
+}
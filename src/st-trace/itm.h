@@ -0,0 +1,95 @@
+/*
+ * File: itm.h
+ *
+ * SWO trace setup and ITM/DWT trace stream decoder of st-trace
+ */
+
+#ifndef ITM_H
+#define ITM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <stlink.h>
+
+// See D4.2 of https://developer.arm.com/documentation/ddi0403/ed/
+#define TRACE_OP_IS_OVERFLOW(c) ((c) == 0x70)
+#define TRACE_OP_IS_LOCAL_TIME(c) (((c)&0x0f) == 0x00 && ((c)&0x70) != 0x00)
+#define TRACE_OP_IS_EXTENSION(c) (((c)&0x0b) == 0x08)
+#define TRACE_OP_IS_GLOBAL_TIME(c) (((c)&0xdf) == 0x94)
+#define TRACE_OP_IS_SOURCE(c) (((c)&0x03) != 0x00)
+#define TRACE_OP_IS_SW_SOURCE(c) (((c)&0x03) != 0x00 && ((c)&0x04) == 0x00)
+#define TRACE_OP_IS_HW_SOURCE(c) (((c)&0x03) != 0x00 && ((c)&0x04) == 0x04)
+#define TRACE_OP_IS_TARGET_SOURCE(c) ((c) == 0x01)
+#define TRACE_OP_GET_CONTINUATION(c) ((c)&0x80)
+#define TRACE_OP_GET_SOURCE_SIZE(c) ((c)&0x03)
+#define TRACE_OP_GET_SW_SOURCE_ADDR(c) ((c) >> 3)
+// Event counter packet, hardware source 0 with one byte of payload. See D4.3.1
+#define TRACE_OP_DWT_EVENT 0x05
+
+/*
+ * The bits of the event counter packet, in order: each is set when the 8 bit
+ * counter it stands for wraps, or for CYC when POSTCNT does, which itm_enable()
+ * sets to every DWT_CYC_EVENT_CYCLES cycles.
+ */
+typedef enum {
+  DWT_EVENT_CPI,    // extra cycles of multi-cycle instructions, and stalls
+  DWT_EVENT_EXC,    // cycles of exception entry and return
+  DWT_EVENT_SLEEP,  // cycles asleep
+  DWT_EVENT_LSU,    // extra cycles of loads and stores
+  DWT_EVENT_FOLD,   // folded instructions, run in no cycle
+  DWT_EVENT_CYC,
+  DWT_EVENT_NUM,
+} dwt_event;
+
+#define DWT_EVENT_COUNT 256 // events per wrap of the 8 bit counters
+#define DWT_CYC_EVENT_CYCLES (16 * 1024)
+
+// We use a simple state machine to parse the trace data.
+typedef enum {
+  TRACE_STATE_UNKNOWN,
+  TRACE_STATE_IDLE,
+  TRACE_STATE_TARGET_SOURCE,
+  TRACE_STATE_SKIP_FRAME,
+  TRACE_STATE_SKIP_4,
+  TRACE_STATE_SKIP_3,
+  TRACE_STATE_SKIP_2,
+  TRACE_STATE_SKIP_1,
+  TRACE_STATE_DWT_EVENT,
+} trace_state;
+
+typedef struct {
+  time_t start_time;
+  bool configuration_checked;
+
+  trace_state state;
+
+  uint32_t count_raw_bytes;
+  uint32_t count_target_data;
+  uint32_t count_time_packets;
+  uint32_t count_hw_overflow;
+  uint32_t count_sw_overflow;
+  uint32_t count_error;
+  uint32_t count_dwt_event[DWT_EVENT_NUM]; // counter wraps, see dwt_event
+
+  uint8_t unknown_opcodes[256 / 8];
+  uint32_t unknown_sources;
+
+  // receives the target data of update_trace_block(), written on stdout if NULL
+  void (*output)(void *arg, const uint8_t *data, uint32_t len);
+  void *output_arg;
+} st_trace_t;
+
+int32_t stlink_trace_enable(stlink_t* sl, uint32_t frequency);
+int32_t stlink_trace_disable(stlink_t* sl);
+int32_t stlink_trace_read(stlink_t* sl, uint8_t* buf, uint32_t size);
+bool itm_enable(stlink_t *stlink, uint32_t core_frequency, uint32_t trace_frequency, bool event_counters,
+                bool force);
+
+// Decodes the next byte of the trace stream, returns the state that follows it
+trace_state update_trace(st_trace_t *trace, uint8_t c);
+// Decodes len bytes of the trace stream, as update_trace() on each of them would
+void update_trace_block(st_trace_t *trace, const uint8_t *buf, uint32_t len);
+
+#endif // ITM_H
@@ -10,6 +10,10 @@
 #include <time.h>
 #include <unistd.h>
 
+#if !defined(_MSC_VER)
+#include <pthread.h>
+#endif
+
 #include <stlink.h>
 
 #include <chipid.h>
@@ -18,6 +22,8 @@
 #include <register.h>
 #include <usb.h>
 
+#include "itm.h"
+
 #define DEFAULT_LOGGING_LEVEL 50
 #define DEBUG_LOGGING_LEVEL 100
 
@@ -30,18 +36,8 @@
 #define APP_RESULT_UNSUPPORTED_TRACE_FREQUENCY 6
 #define APP_RESULT_STLINK_STATE_ERROR 7
 
-// See D4.2 of https://developer.arm.com/documentation/ddi0403/ed/
-#define TRACE_OP_IS_OVERFLOW(c) ((c) == 0x70)
-#define TRACE_OP_IS_LOCAL_TIME(c) (((c)&0x0f) == 0x00 && ((c)&0x70) != 0x00)
-#define TRACE_OP_IS_EXTENSION(c) (((c)&0x0b) == 0x08)
-#define TRACE_OP_IS_GLOBAL_TIME(c) (((c)&0xdf) == 0x94)
-#define TRACE_OP_IS_SOURCE(c) (((c)&0x03) != 0x00)
-#define TRACE_OP_IS_SW_SOURCE(c) (((c)&0x03) != 0x00 && ((c)&0x04) == 0x00)
-#define TRACE_OP_IS_HW_SOURCE(c) (((c)&0x03) != 0x00 && ((c)&0x04) == 0x04)
-#define TRACE_OP_IS_TARGET_SOURCE(c) ((c) == 0x01)
-#define TRACE_OP_GET_CONTINUATION(c) ((c)&0x80)
-#define TRACE_OP_GET_SOURCE_SIZE(c) ((c)&0x03)
-#define TRACE_OP_GET_SW_SOURCE_ADDR(c) ((c) >> 3)
+#define TRACE_PROBES_MAX 8
+#define TRACE_LINE_MAX 256
 
 typedef struct {
   bool show_help;
@@ -51,43 +47,60 @@ typedef struct {
   uint32_t trace_frequency;
   bool reset_board;
   bool force;
-  char *serial_number;
+  char *serial_numbers[TRACE_PROBES_MAX];
+  char *names[TRACE_PROBES_MAX];
+  uint32_t probe_count;
+  char *output;
+  bool metrics;
+  char *metrics_file;
 } st_settings_t;
 
-// We use a simple state machine to parse the trace data.
-typedef enum {
-  TRACE_STATE_UNKNOWN,
-  TRACE_STATE_IDLE,
-  TRACE_STATE_TARGET_SOURCE,
-  TRACE_STATE_SKIP_FRAME,
-  TRACE_STATE_SKIP_4,
-  TRACE_STATE_SKIP_3,
-  TRACE_STATE_SKIP_2,
-  TRACE_STATE_SKIP_1,
-} trace_state;
-
+// The CPU load reported by report_metrics(), as of its last report
 typedef struct {
-  time_t start_time;
-  bool configuration_checked;
-
-  trace_state state;
+  uint64_t start_time;
+  uint64_t time;
+  uint32_t events[DWT_EVENT_NUM];
+  uint32_t lost;              // hardware and software overflows
+} trace_metrics_t;
+
+// A line of target output, stamped with the host time of the USB read that completed it
+typedef struct trace_event {
+  struct trace_event *next;
+  uint64_t time;
+  char text[];
+} trace_event_t;
+
+// One of the probes of a multi-probe capture, read by its own thread
+typedef struct {
+  const char *name;
+  stlink_t *stlink;
+  uint32_t trace_frequency;
+  st_trace_t trace;
+#if !defined(_MSC_VER)
+  pthread_t thread;
+  bool started;
+#endif
 
-  uint32_t count_raw_bytes;
-  uint32_t count_target_data;
-  uint32_t count_time_packets;
-  uint32_t count_hw_overflow;
-  uint32_t count_sw_overflow;
-  uint32_t count_error;
+  uint64_t read_time;     // of the read being decoded
+  trace_metrics_t metrics;
+  char line[TRACE_LINE_MAX];
+  uint32_t line_len;
 
-  uint8_t unknown_opcodes[256 / 8];
-  uint32_t unknown_sources;
-} st_trace_t;
+  // under trace_lock
+  bool running;
+  uint64_t watermark;     // host time of the last read, later events have later times
+  trace_event_t *head;
+  trace_event_t *tail;
+} trace_probe_t;
 
 // We use a global flag to allow communicating to the main thread from the
-// signal handler.
-static bool g_abort_trace = false;
+// signal handler; the capture threads of the probes poll it too.
+static volatile sig_atomic_t g_abort_trace = 0;
 
-static void abort_trace() { g_abort_trace = true; }
+// where the CPU load goes, NULL without --metrics
+static FILE *g_metrics = NULL;
+
+static void abort_trace() { g_abort_trace = 1; }
 
 #if defined(_WIN32)
 BOOL WINAPI CtrlHandler(DWORD fdwCtrlType) {
@@ -97,20 +110,6 @@ BOOL WINAPI CtrlHandler(DWORD fdwCtrlType) {
 }
 #endif
 
-int32_t stlink_trace_enable(stlink_t *sl, uint32_t frequency) {
-  DLOG("*** stlink_trace_enable ***\n");
-  return (sl->backend->trace_enable(sl, frequency));
-}
-
-int32_t stlink_trace_disable(stlink_t *sl) {
-  DLOG("*** stlink_trace_disable ***\n");
-  return (sl->backend->trace_disable(sl));
-}
-
-int32_t stlink_trace_read(stlink_t *sl, uint8_t *buf, uint32_t size) {
-  return (sl->backend->trace_read(sl, buf, size));
-}
-
 static void usage(void) {
   puts("st-trace - usage:");
   puts("  -h, --help            Print this help");
@@ -122,7 +121,15 @@ static void usage(void) {
   puts("  -tXX, --trace=XX      Specify the trace frequency, optionally followed by");
   puts("                        k=kHz, m=MHz, or g=GHz (eg. --trace=2m)");
   puts("  -n, --no-reset        Do not reset board on connection");
-  puts("  -sXX, --serial=XX     Use a specific serial number");
+  puts("  -sXX, --serial=XX     Use a specific serial number, optionally followed by");
+  puts("                        :NAME. Repeat to capture from several probes at once,");
+  puts("                        their lines merged in host time order and labelled");
+  puts("                        with NAME (eg. -s 066DFF...:app -s 0670FF...:radio)");
+  puts("  -oXX, --output=XX     Write the trace to a file instead of stdout");
+  puts("  -m, --metrics[=FILE]  Enable the DWT event counters and report the CPU load");
+  puts("                        once a second, on stderr or appended to FILE: the");
+  puts("                        clock, the time asleep, in exception entry and return,");
+  puts("                        stalled on loads and stores or multi-cycle instructions");
   puts("  -f, --force           Ignore most initialization errors");
 }
 
@@ -172,7 +179,9 @@ bool parse_options(int32_t argc, char **argv, st_settings_t *settings) {
       {"trace", required_argument, NULL, 't'},
       {"no-reset", no_argument, NULL, 'n'},
       {"serial", required_argument, NULL, 's'},
+      {"output", required_argument, NULL, 'o'},
       {"force", no_argument, NULL, 'f'},
+      {"metrics", optional_argument, NULL, 'm'},
       {0, 0, 0, 0},
   };
   int32_t option_index = 0;
@@ -186,10 +195,13 @@ bool parse_options(int32_t argc, char **argv, st_settings_t *settings) {
   settings->trace_frequency = 0;
   settings->reset_board = true;
   settings->force = false;
-  settings->serial_number = NULL;
+  settings->probe_count = 0;
+  settings->output = NULL;
+  settings->metrics = false;
+  settings->metrics_file = NULL;
   ugly_init(settings->logging_level);
 
-  while ((c = getopt_long(argc, argv, "hVv::c:ns:f", long_options, &option_index)) != -1) {
+  while ((c = getopt_long(argc, argv, "hVv::c:ns:o:fm::", long_options, &option_index)) != -1) {
     switch (c) {
     case 'h':
       settings->show_help = true;
@@ -217,8 +229,25 @@ bool parse_options(int32_t argc, char **argv, st_settings_t *settings) {
     case 'f':
       settings->force = true;
       break;
-    case 's':
-      settings->serial_number = optarg;
+    case 's': {
+      if (settings->probe_count == TRACE_PROBES_MAX) {
+        ELOG("At most %d probes\n", TRACE_PROBES_MAX);
+        error = true;
+        break;
+      }
+      char *name = strchr(optarg, ':');
+      if (name) *name++ = '\0';
+      settings->serial_numbers[settings->probe_count] = optarg;
+      settings->names[settings->probe_count] = name;
+      settings->probe_count++;
+      break;
+    }
+    case 'o':
+      settings->output = optarg;
+      break;
+    case 'm':
+      settings->metrics = true;
+      settings->metrics_file = optarg;
       break;
     case '?':
       error = true;
@@ -242,8 +271,8 @@ bool parse_options(int32_t argc, char **argv, st_settings_t *settings) {
   return true;
 }
 
-static stlink_t *stlink_connect(const st_settings_t *settings) {
-  return stlink_open_usb(settings->logging_level, false, settings->serial_number, 0);
+static stlink_t *stlink_connect(const st_settings_t *settings, char *serial_number) {
+  return stlink_open_usb(settings->logging_level, false, serial_number, 0);
 }
 
 static bool enable_trace(stlink_t *stlink, const st_settings_t *settings, uint32_t trace_frequency) {
@@ -257,164 +286,74 @@ static bool enable_trace(stlink_t *stlink, const st_settings_t *settings, uint32
     if (!settings->force) return false;
   }
 
-  stlink_write_debug32(stlink, STLINK_REG_DHCSR,
-                       STLINK_REG_DHCSR_DBGKEY | STLINK_REG_DHCSR_C_DEBUGEN |
-                           STLINK_REG_DHCSR_C_HALT);
-  stlink_write_debug32(stlink, STLINK_REG_DEMCR, STLINK_REG_DEMCR_TRCENA);
-  stlink_write_debug32(stlink, STLINK_REG_CM3_FP_CTRL,
-                       STLINK_REG_CM3_FP_CTRL_KEY);
-  stlink_write_debug32(stlink, STLINK_REG_DWT_FUNCTION0, 0);
-  stlink_write_debug32(stlink, STLINK_REG_DWT_FUNCTION1, 0);
-  stlink_write_debug32(stlink, STLINK_REG_DWT_FUNCTION2, 0);
-  stlink_write_debug32(stlink, STLINK_REG_DWT_FUNCTION3, 0);
-  stlink_write_debug32(stlink, STLINK_REG_DWT_CTRL, 0);
-  stlink_write_debug32(stlink, STLINK_REG_DBGMCU_CR,
-      STLINK_REG_DBGMCU_CR_DBG_SLEEP | STLINK_REG_DBGMCU_CR_DBG_STOP |
-          STLINK_REG_DBGMCU_CR_DBG_STANDBY | STLINK_REG_DBGMCU_CR_TRACE_IOEN |
-          STLINK_REG_DBGMCU_CR_TRACE_MODE_ASYNC);
-
-  if (stlink_trace_enable(stlink, trace_frequency)) {
-    ELOG("Unable to turn on tracing in stlink\n");
-    if (!settings->force) return false;
-  }
-
-  stlink_write_debug32(stlink, STLINK_REG_TPI_CSPSR, STLINK_REG_TPI_CSPSR_PORT_SIZE_1);
-
-  if (settings->core_frequency) {
-    uint32_t prescaler = settings->core_frequency / trace_frequency - 1;
-    if (prescaler > STLINK_REG_TPI_ACPR_MAX) {
-      ELOG("Trace frequency prescaler %d out of range. Try setting a faster "
-           "trace frequency.\n", prescaler);
-      if (!settings->force) return false;
-    }
-    stlink_write_debug32(stlink, STLINK_REG_TPI_ACPR,
-                         prescaler); // Set TPIU_ACPR clock divisor
-  }
-  stlink_write_debug32(stlink, STLINK_REG_TPI_FFCR,
-                       STLINK_REG_TPI_FFCR_TRIG_IN);
-  stlink_write_debug32(stlink, STLINK_REG_TPI_SPPR,
-                       STLINK_REG_TPI_SPPR_SWO_NRZ);
-  stlink_write_debug32(stlink, STLINK_REG_ITM_LAR, STLINK_REG_ITM_LAR_KEY);
-  stlink_write_debug32(stlink, STLINK_REG_ITM_TCC, 0x00000400); // Set sync counter
-  stlink_write_debug32(stlink, STLINK_REG_ITM_TCR,
-                       STLINK_REG_ITM_TCR_TRACE_BUS_ID_1 |
-                          STLINK_REG_ITM_TCR_TS_ENA |
-                          STLINK_REG_ITM_TCR_ITM_ENA);
-  stlink_write_debug32(stlink, STLINK_REG_ITM_TER,
-                       STLINK_REG_ITM_TER_PORTS_ALL);
-  stlink_write_debug32(stlink, STLINK_REG_ITM_TPR,
-                       STLINK_REG_ITM_TPR_PORTS_ALL);
-  stlink_write_debug32(stlink, STLINK_REG_DWT_CTRL,
-                       4 * STLINK_REG_DWT_CTRL_NUM_COMP |
-                           STLINK_REG_DWT_CTRL_CYC_TAP |
-                           0xF * STLINK_REG_DWT_CTRL_POST_INIT |
-                           0xF * STLINK_REG_DWT_CTRL_POST_PRESET |
-                           STLINK_REG_DWT_CTRL_CYCCNT_ENA);
-  stlink_write_debug32(stlink, STLINK_REG_DEMCR, STLINK_REG_DEMCR_TRCENA);
-
-  uint32_t prescaler = 0;
-  stlink_read_debug32(stlink, STLINK_REG_TPI_ACPR, &prescaler);
-  if (prescaler) {
-    uint32_t system_clock_speed = (prescaler + 1) * trace_frequency;
-    ILOG("Trace Port Interface configured to expect a %d Hz system clock.\n",
-         system_clock_speed);
-  } else {
-    WLOG("Trace Port Interface not configured.  Specify the system clock with "
-         "a --clock=XX command\n");
-    WLOG("line option or set it in your device's clock initialization routine, "
-         "such as with:\n");
-    WLOG("  TPI->ACPR = HAL_RCC_GetHCLKFreq() / %d - 1;\n", trace_frequency);
-  }
-  ILOG("Trace frequency set to %d Hz.\n", trace_frequency);
-
-  return true;
+  return itm_enable(stlink, settings->core_frequency, trace_frequency, settings->metrics, settings->force);
 }
 
-static trace_state update_trace_idle(st_trace_t *trace, uint8_t c) {
-  // Handle a trace byte when we are in the idle state.
-
-  if (TRACE_OP_IS_TARGET_SOURCE(c)) return TRACE_STATE_TARGET_SOURCE;
-
-  if (TRACE_OP_IS_SOURCE(c)) {
-    uint8_t size = TRACE_OP_GET_SOURCE_SIZE(c);
-    if (TRACE_OP_IS_SW_SOURCE(c)) {
-      uint8_t addr = TRACE_OP_GET_SW_SOURCE_ADDR(c);
-      if (!(trace->unknown_sources & (1 << addr)))
-        WLOG("Unsupported source 0x%x size %d\n", addr, size);
-      trace->unknown_sources |= (1 << addr);
-    }
-    if (size == 1) return TRACE_STATE_SKIP_1;
-    if (size == 2) return TRACE_STATE_SKIP_2;
-    if (size == 3) return TRACE_STATE_SKIP_4;
-  }
-
-  if (TRACE_OP_IS_LOCAL_TIME(c) || TRACE_OP_IS_GLOBAL_TIME(c)) {
-    trace->count_time_packets++;
-    return TRACE_OP_GET_CONTINUATION(c) ? TRACE_STATE_SKIP_FRAME : TRACE_STATE_IDLE;
-  }
-
-  if (TRACE_OP_IS_EXTENSION(c)) {
-    return TRACE_OP_GET_CONTINUATION(c) ? TRACE_STATE_SKIP_FRAME : TRACE_STATE_IDLE;
-  }
-
-  if (TRACE_OP_IS_OVERFLOW(c)) trace->count_hw_overflow++;
-
-  if (!(trace->unknown_opcodes[c / 8] & (1 << c % 8)))
-    WLOG("Unknown opcode 0x%02x\n", c);
-  trace->unknown_opcodes[c / 8] |= (1 << c % 8);
+#if !defined(_MSC_VER)
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
-  trace->count_error++;
-  return TRACE_OP_GET_CONTINUATION(c) ? TRACE_STATE_SKIP_FRAME : TRACE_STATE_IDLE;
+// shared by the capture threads, so that the times of all probes compare
+static uint64_t host_time_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec);
 }
 
-static trace_state update_trace(st_trace_t *trace, uint8_t c) {
-  trace->count_raw_bytes++;
-
-  // Parse the input using a state machine.
+static void metrics_start(trace_metrics_t *metrics, uint64_t now) {
+  memset(metrics, 0, sizeof(*metrics));
+  metrics->start_time = now;
+  metrics->time = now;
+}
 
-  if (trace->state == TRACE_STATE_UNKNOWN) {
-    if (TRACE_OP_IS_TARGET_SOURCE(c) || TRACE_OP_IS_LOCAL_TIME(c) || TRACE_OP_IS_GLOBAL_TIME(c))
-      trace->state = TRACE_STATE_IDLE;
+/*
+ * Once a second, writes the CPU load since the last report from the wraps of
+ * the DWT event counters. The cycles come from the DWT as well, through
+ * DWT_EVENT_CYC, so the figures hold whatever the core clock; they are in
+ * units of 256 events and low if trace data was lost, which is flagged.
+ */
+static void report_metrics(const char *name, const st_trace_t *trace, trace_metrics_t *metrics, uint64_t now) {
+  if (!g_metrics || now - metrics->time < 1000000000ull) return;
+
+  uint64_t delta[DWT_EVENT_NUM];
+  for (uint32_t i = 0; i < DWT_EVENT_NUM; i++) {
+    delta[i] = (uint64_t)(trace->count_dwt_event[i] - metrics->events[i]) * DWT_EVENT_COUNT;
+    metrics->events[i] = trace->count_dwt_event[i];
+  }
+
+  uint64_t cycles = delta[DWT_EVENT_CYC] / DWT_EVENT_COUNT * DWT_CYC_EVENT_CYCLES;
+  uint32_t lost = trace->count_hw_overflow + trace->count_sw_overflow;
+  uint64_t t = now - metrics->start_time;
+
+  fprintf(g_metrics, "%6u.%06u %s%s", (uint32_t)(t / 1000000000), (uint32_t)(t / 1000 % 1000000),
+          name ? name : "", name ? ": " : "");
+
+  if (cycles) {
+    double percent = 100.0 / (double)cycles;
+    // cycles = instructions + the extra cycles counted - the folded instructions
+    int64_t instructions = (int64_t)(cycles - delta[DWT_EVENT_CPI] - delta[DWT_EVENT_EXC] -
+                                     delta[DWT_EVENT_SLEEP] - delta[DWT_EVENT_LSU] + delta[DWT_EVENT_FOLD]);
+
+    fprintf(g_metrics, "%7.2f MHz  sleep %5.1f%%  exception %5.1f%%  lsu %5.1f%%  cpi %5.1f%%  ipc %4.2f%s\n",
+            (double)cycles * 1000.0 / (double)(now - metrics->time), delta[DWT_EVENT_SLEEP] * percent,
+            delta[DWT_EVENT_EXC] * percent, delta[DWT_EVENT_LSU] * percent, delta[DWT_EVENT_CPI] * percent,
+            instructions > 0 ? (double)instructions / (double)cycles : 0.0,
+            lost != metrics->lost ? "  (trace lost)" : "");
+  } else {
+    fprintf(g_metrics, "no cycle count, is the core running?\n");
   }
 
-  switch (trace->state) {
-  case TRACE_STATE_IDLE:
-    return update_trace_idle(trace, c);
-
-  case TRACE_STATE_TARGET_SOURCE:
-    putchar(c);
-    if (c == '\n') fflush(stdout);
-    trace->count_target_data++;
-    return TRACE_STATE_IDLE;
-
-  case TRACE_STATE_SKIP_FRAME:
-    return TRACE_OP_GET_CONTINUATION(c) ? TRACE_STATE_SKIP_FRAME : TRACE_STATE_IDLE;
-
-  case TRACE_STATE_SKIP_4:
-    return TRACE_STATE_SKIP_3;
-
-  case TRACE_STATE_SKIP_3:
-    return TRACE_STATE_SKIP_2;
-
-  case TRACE_STATE_SKIP_2:
-    return TRACE_STATE_SKIP_1;
-
-  case TRACE_STATE_SKIP_1:
-    return TRACE_STATE_IDLE;
-
-  case TRACE_STATE_UNKNOWN:
-    return TRACE_STATE_UNKNOWN;
-
-  default:
-    ELOG("Invalid state %d.  This should never happen\n", trace->state);
-    return TRACE_STATE_IDLE;
-  }
+  fflush(g_metrics);
+  metrics->time = now;
+  metrics->lost = lost;
 }
 
-static bool read_trace(stlink_t *stlink, st_trace_t *trace) {
+static bool read_trace(stlink_t *stlink, st_trace_t *trace, trace_probe_t *probe) {
   uint8_t buffer[STLINK_V3_TRACE_BUF_LEN];
   int32_t length = stlink_trace_read(stlink, buffer, sizeof(buffer));
 
+  if (probe) probe->read_time = host_time_ns();
+
   if (length < 0) {
     ELOG("Error reading trace (%d)\n", length);
     return false;
@@ -433,13 +372,107 @@ static bool read_trace(stlink_t *stlink, st_trace_t *trace) {
     trace->state = TRACE_STATE_UNKNOWN;
   }
 
-  for (int32_t i = 0; i < length; i++) {
-    trace->state = update_trace(trace, buffer[i]);
-  }
+  update_trace_block(trace, buffer, (uint32_t)length);
 
   return true;
 }
 
+#if !defined(_MSC_VER)
+static void probe_line(trace_probe_t *probe) {
+  trace_event_t *event = malloc(sizeof(trace_event_t) + probe->line_len + 1);
+
+  if (event) {
+    event->next = NULL;
+    event->time = probe->read_time;
+    memcpy(event->text, probe->line, probe->line_len);
+    event->text[probe->line_len] = '\0';
+
+    pthread_mutex_lock(&trace_lock);
+    if (probe->tail) probe->tail->next = event; else probe->head = event;
+    probe->tail = event;
+    pthread_mutex_unlock(&trace_lock);
+  }
+
+  probe->line_len = 0;
+}
+
+// st_trace_t.output of the probes, cuts their target data into lines
+static void probe_output(void *arg, const uint8_t *data, uint32_t len) {
+  trace_probe_t *probe = arg;
+
+  for (uint32_t i = 0; i < len; i++) {
+    if (data[i] == '\n') {
+      probe_line(probe);
+    } else if (data[i] != '\r') {
+      probe->line[probe->line_len++] = (char)data[i];
+      if (probe->line_len == TRACE_LINE_MAX - 1) probe_line(probe);
+    }
+  }
+}
+
+static void check_for_configuration_error(stlink_t *stlink, st_trace_t *trace, uint32_t trace_frequency);
+
+static void *probe_capture(void *arg) {
+  trace_probe_t *probe = arg;
+
+  while (!g_abort_trace && read_trace(probe->stlink, &probe->trace, probe)) {
+    pthread_mutex_lock(&trace_lock);
+    probe->watermark = probe->read_time;
+    pthread_mutex_unlock(&trace_lock);
+    check_for_configuration_error(probe->stlink, &probe->trace, probe->trace_frequency);
+    report_metrics(probe->name, &probe->trace, &probe->metrics, probe->read_time);
+  }
+
+  if (probe->line_len) probe_line(probe);
+
+  pthread_mutex_lock(&trace_lock);
+  probe->running = false;
+  pthread_mutex_unlock(&trace_lock);
+  return NULL;
+}
+
+/*
+ * Prints the lines of all probes in time order. A line is only printed once
+ * every probe still capturing has read past its time, as none of them can
+ * produce an earlier one then; all remaining lines are printed when draining.
+ * Returns whether any probe is still capturing.
+ */
+static bool merge_lines(trace_probe_t *probes, uint32_t count, uint64_t start_time, bool drain) {
+  pthread_mutex_lock(&trace_lock);
+
+  uint64_t watermark = UINT64_MAX;
+  bool running = false;
+  for (uint32_t i = 0; i < count; i++) {
+    if (!probes[i].running) continue;
+    running = true;
+    if (!drain && probes[i].watermark < watermark) watermark = probes[i].watermark;
+  }
+
+  while (true) {
+    trace_probe_t *next = NULL;
+    for (uint32_t i = 0; i < count; i++)
+      if (probes[i].head && probes[i].head->time <= watermark &&
+          (!next || probes[i].head->time < next->head->time))
+        next = &probes[i];
+
+    if (!next) break;
+
+    trace_event_t *event = next->head;
+    next->head = event->next;
+    if (!next->head) next->tail = NULL;
+
+    uint64_t t = event->time - start_time;
+    printf("%6u.%06u %s: %s\n", (uint32_t)(t / 1000000000), (uint32_t)(t / 1000 % 1000000), next->name,
+           event->text);
+    free(event);
+  }
+
+  pthread_mutex_unlock(&trace_lock);
+  fflush(stdout);
+  return running;
+}
+#endif // !_MSC_VER
+
 static void check_for_configuration_error(stlink_t *stlink, st_trace_t *trace, uint32_t trace_frequency) {
   // Only check configuration one time after the first 10 seconds of running.
   time_t elapsed_time_s = time(NULL) - trace->start_time;
@@ -514,6 +547,132 @@ static void check_for_configuration_error(stlink_t *stlink, st_trace_t *trace, u
   WLOG("****\n");
 }
 
+// Connects to a probe and configures the trace of its target, which is left halted
+static int32_t open_probe(const st_settings_t *settings, char *serial_number, trace_probe_t *probe) {
+  stlink_t *stlink = stlink_connect(settings, serial_number);
+  if (!stlink) {
+    ELOG("Unable to locate an stlink\n");
+    return APP_RESULT_STLINK_NOT_FOUND;
+  }
+
+  // the caller closes it, also when a check below fails
+  probe->stlink = stlink;
+
+  stlink->verbose = settings->logging_level;
+
+  if (stlink->chip_id == STM32_CHIPID_UNKNOWN) {
+    ELOG("Your stlink is not connected to a device\n");
+    if (!settings->force) return APP_RESULT_STLINK_MISSING_DEVICE;
+  }
+
+  if (!(stlink->version.flags & STLINK_F_HAS_TRACE)) {
+    ELOG("Your stlink does not support tracing\n");
+    if (!settings->force) return APP_RESULT_STLINK_UNSUPPORTED_LINK;
+  }
+
+  if (!(stlink->chip_flags & CHIP_F_HAS_SWO_TRACING)) {
+    const struct stlink_chipid_params *params = stlink_chipid_get_params(stlink->chip_id);
+    ELOG("We do not support SWO output for device '%s'\n", params ? params->dev_type : "");
+    if (!settings->force) return APP_RESULT_STLINK_UNSUPPORTED_DEVICE;
+  }
+
+  uint32_t trace_frequency = settings->trace_frequency;
+  if (!trace_frequency) trace_frequency = STLINK_DEFAULT_TRACE_FREQUENCY;
+  uint32_t max_trace_freq = stlink->max_trace_freq;
+  uint32_t min_trace_freq = 0;
+
+  if (settings->core_frequency != 0) {
+    if (max_trace_freq > settings->core_frequency / 5) max_trace_freq = settings->core_frequency / 5;
+    min_trace_freq = settings->core_frequency / (STLINK_REG_TPI_ACPR_MAX + 1);
+  }
+  if (trace_frequency > max_trace_freq || trace_frequency < min_trace_freq) {
+    ELOG("Invalid trace frequency %d (min %d max %d)\n", trace_frequency, min_trace_freq,
+        max_trace_freq);
+    if (!settings->force) return APP_RESULT_UNSUPPORTED_TRACE_FREQUENCY;
+  }
+
+  if (!enable_trace(stlink, settings, trace_frequency)) {
+    ELOG("Unable to enable trace mode\n");
+    if (!settings->force) return APP_RESULT_STLINK_STATE_ERROR;
+  }
+
+  probe->trace_frequency = trace_frequency;
+  return APP_RESULT_SUCCESS;
+}
+
+#if !defined(_MSC_VER)
+static int32_t trace_probes(const st_settings_t *settings) {
+  trace_probe_t probes[TRACE_PROBES_MAX];
+  uint32_t count = settings->probe_count;
+  int32_t result = APP_RESULT_SUCCESS;
+
+  memset(probes, 0, sizeof(probes));
+
+  for (uint32_t i = 0; i < count && result == APP_RESULT_SUCCESS; i++) {
+    probes[i].name = settings->names[i] ? settings->names[i] : settings->serial_numbers[i];
+    result = open_probe(settings, settings->serial_numbers[i], &probes[i]);
+  }
+
+  if (result != APP_RESULT_SUCCESS) {
+    for (uint32_t i = 0; i < count; i++)
+      if (probes[i].stlink) stlink_close(probes[i].stlink);
+    return result;
+  }
+
+  ILOG("Reading Trace from %d probes\n", count);
+  uint64_t start_time = host_time_ns();
+
+  for (uint32_t i = 0; i < count; i++) {
+    trace_probe_t *probe = &probes[i];
+
+    probe->trace.start_time = time(NULL);
+    probe->trace.output = probe_output;
+    probe->trace.output_arg = probe;
+    probe->watermark = start_time;
+    probe->running = true;
+    metrics_start(&probe->metrics, start_time);
+
+    if (stlink_run(probe->stlink, RUN_NORMAL)) {
+      ELOG("Unable to run device of %s\n", probe->name);
+      if (!settings->force) g_abort_trace = 1;
+    }
+
+    if (pthread_create(&probe->thread, NULL, probe_capture, probe)) {
+      ELOG("Unable to start the capture of %s\n", probe->name);
+      probe->running = false;
+      g_abort_trace = 1;
+    } else {
+      probe->started = true;
+    }
+  }
+
+  while (!g_abort_trace && merge_lines(probes, count, start_time, false)) {
+    usleep(1000);
+  }
+
+  g_abort_trace = 1;
+
+  for (uint32_t i = 0; i < count; i++) {
+    if (probes[i].started) pthread_join(probes[i].thread, NULL);
+  }
+
+  merge_lines(probes, count, start_time, true);
+
+  for (uint32_t i = 0; i < count; i++) {
+    stlink_trace_disable(probes[i].stlink);
+    stlink_close(probes[i].stlink);
+  }
+
+  return APP_RESULT_SUCCESS;
+}
+#else
+static int32_t trace_probes(const st_settings_t *settings) {
+  (void)settings;
+  ELOG("Capturing from several probes is not supported by this build\n");
+  return APP_RESULT_INVALID_PARAMS;
+}
+#endif // !_MSC_VER
+
 int32_t main(int32_t argc, char **argv) {
 #if defined(_WIN32)
   SetConsoleCtrlHandler((PHANDLER_ROUTINE)CtrlHandler, TRUE);
@@ -538,8 +697,12 @@ int32_t main(int32_t argc, char **argv) {
   DLOG("trace_frequency = %d Hz\n", settings.trace_frequency);
   DLOG("reset_board = %s\n", settings.reset_board ? "true" : "false");
   DLOG("force = %s\n", settings.force ? "true" : "false");
-  DLOG("serial_number = %s\n",
-       settings.serial_number ? settings.serial_number : "any");
+  for (uint32_t i = 0; i < settings.probe_count; i++)
+    DLOG("serial_number = %s (%s)\n", settings.serial_numbers[i],
+         settings.names[i] ? settings.names[i] : "unnamed");
+  if (!settings.probe_count) DLOG("serial_number = any\n");
+  DLOG("output = %s\n", settings.output ? settings.output : "stdout");
+  DLOG("metrics = %s\n", settings.metrics ? (settings.metrics_file ? settings.metrics_file : "stderr") : "off");
 
   if (settings.show_help) {
     usage();
@@ -551,49 +714,32 @@ int32_t main(int32_t argc, char **argv) {
     return APP_RESULT_SUCCESS;
   }
 
-  stlink_t *stlink = stlink_connect(&settings);
-  if (!stlink) {
-    ELOG("Unable to locate an stlink\n");
-    return APP_RESULT_STLINK_NOT_FOUND;
-  }
-
-  stlink->verbose = settings.logging_level;
-
-  if (stlink->chip_id == STM32_CHIPID_UNKNOWN) {
-    ELOG("Your stlink is not connected to a device\n");
-    if (!settings.force) return APP_RESULT_STLINK_MISSING_DEVICE;
+  if (settings.output && !freopen(settings.output, "w", stdout)) {
+    ELOG("Unable to open %s\n", settings.output);
+    return APP_RESULT_INVALID_PARAMS;
   }
 
-  if (!(stlink->version.flags & STLINK_F_HAS_TRACE)) {
-    ELOG("Your stlink does not support tracing\n");
-    if (!settings.force) return APP_RESULT_STLINK_UNSUPPORTED_LINK;
+  if (settings.metrics) {
+    g_metrics = settings.metrics_file ? fopen(settings.metrics_file, "a") : stderr;
+    if (!g_metrics) {
+      ELOG("Unable to open %s\n", settings.metrics_file);
+      return APP_RESULT_INVALID_PARAMS;
+    }
   }
 
-  if (!(stlink->chip_flags & CHIP_F_HAS_SWO_TRACING)) {
-    const struct stlink_chipid_params *params = stlink_chipid_get_params(stlink->chip_id);
-    ELOG("We do not support SWO output for device '%s'\n", params ? params->dev_type : "");
-    if (!settings.force) return APP_RESULT_STLINK_UNSUPPORTED_DEVICE;
-  }
+  if (settings.probe_count > 1) return trace_probes(&settings);
 
-  uint32_t trace_frequency = settings.trace_frequency;
-  if (!trace_frequency) trace_frequency = STLINK_DEFAULT_TRACE_FREQUENCY;
-  uint32_t max_trace_freq = stlink->max_trace_freq;
-  uint32_t min_trace_freq = 0;
+  trace_probe_t probe;
+  memset(&probe, 0, sizeof(probe));
 
-  if (settings.core_frequency != 0) {
-    if (max_trace_freq > settings.core_frequency / 5) max_trace_freq = settings.core_frequency / 5;
-    min_trace_freq = settings.core_frequency / (STLINK_REG_TPI_ACPR_MAX + 1);
-  }
-  if (trace_frequency > max_trace_freq || trace_frequency < min_trace_freq) {
-    ELOG("Invalid trace frequency %d (min %d max %d)\n", trace_frequency, min_trace_freq,
-        max_trace_freq);
-    if (!settings.force) return APP_RESULT_UNSUPPORTED_TRACE_FREQUENCY;
+  int32_t result = open_probe(&settings, settings.probe_count ? settings.serial_numbers[0] : NULL, &probe);
+  if (result != APP_RESULT_SUCCESS) {
+    stlink_close(probe.stlink);
+    return result;
   }
 
-  if (!enable_trace(stlink, &settings, trace_frequency)) {
-    ELOG("Unable to enable trace mode\n");
-    if (!settings.force) return APP_RESULT_STLINK_STATE_ERROR;
-  }
+  stlink_t *stlink = probe.stlink;
+  uint32_t trace_frequency = probe.trace_frequency;
 
   ILOG("Reading Trace\n");
   st_trace_t trace;
@@ -605,8 +751,11 @@ int32_t main(int32_t argc, char **argv) {
     if (!settings.force) return APP_RESULT_STLINK_STATE_ERROR;
   }
 
-  while (!g_abort_trace && read_trace(stlink, &trace)) {
+  metrics_start(&probe.metrics, host_time_ns());
+
+  while (!g_abort_trace && read_trace(stlink, &trace, NULL)) {
     check_for_configuration_error(stlink, &trace, trace_frequency);
+    report_metrics(NULL, &trace, &probe.metrics, host_time_ns());
   }
 
   stlink_trace_disable(stlink);
@@ -19,25 +19,59 @@
 
 static const char hex[] = "0123456789abcdef";
 
-int32_t gdb_send_packet(int32_t fd, char* data) {
+// encodes len bytes as 2 * len hex digits, out is not terminated
+void gdb_hex_encode(char* out, const uint8_t* in, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        out[i * 2 + 0] = hex[in[i] >> 4];
+        out[i * 2 + 1] = hex[in[i] & 0xf];
+    }
+}
+
+// decodes len bytes from 2 * len hex digits
+void gdb_hex_decode(uint8_t* out, const char* in, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        char hextmp[3] = { in[i * 2], in[i * 2 + 1], 0 };
+        out[i] = (uint8_t) strtoul(hextmp, NULL, 16);
+    }
+}
+
+// lead, "name:" if there is one, data, '#' and the checksum, not terminated
+static char* gdb_frame(char lead, const char* name, const char* data, int32_t* length) {
+    uint32_t name_length = name ? (uint32_t) strlen(name) + 1 : 0;
     uint32_t data_length = (uint32_t) strlen(data);
-    int32_t length = data_length + 4;
-    char* packet = malloc(length); // '$' data (hex) '#' cksum (hex)
+    char* packet = malloc(name_length + data_length + 4);
+    uint32_t n = 0;
 
-    memset(packet, 0, length);
+    if (packet == NULL) { return (NULL); }
 
-    packet[0] = '$';
+    packet[n++] = lead;
+
+    if (name) {
+        memcpy(&packet[n], name, name_length - 1);
+        n += name_length - 1;
+        packet[n++] = ':';
+    }
+
+    memcpy(&packet[n], data, data_length);
+    n += data_length;
 
     uint8_t cksum = 0;
 
-    for (uint32_t i = 0; i < data_length; i++) {
-        packet[i + 1] = data[i];
-        cksum += data[i];
-    }
+    for (uint32_t i = 1; i < n; i++) { cksum += packet[i]; }
+
+    packet[n++] = '#';
+    packet[n++] = hex[cksum >> 4];
+    packet[n++] = hex[cksum & 0xf];
+
+    *length = n;
+    return (packet);
+}
+
+int32_t gdb_send_packet(int32_t fd, char* data) {
+    int32_t length;
+    char* packet = gdb_frame('$', NULL, data, &length); // '$' data (hex) '#' cksum (hex)
 
-    packet[length - 3] = '#';
-    packet[length - 2] = hex[cksum >> 4];
-    packet[length - 1] = hex[cksum & 0xf];
+    if (packet == NULL) { return (-2); }
 
     while (1) {
         if (write(fd, packet, length) != length) {
@@ -59,6 +93,21 @@ int32_t gdb_send_packet(int32_t fd, char* data) {
     }
 }
 
+/*
+ * Asynchronous notifications, '%' name ':' data '#' cksum, are not
+ * acknowledged by GDB.
+ */
+int32_t gdb_send_notification(int32_t fd, char* name, char* data) {
+    int32_t length;
+    char* packet = gdb_frame('%', name, data, &length);
+
+    if (packet == NULL) { return (-2); }
+
+    int32_t ret = write(fd, packet, length) == length ? 0 : -2;
+    free(packet);
+    return (ret);
+}
+
 #define ALLOC_STEP 1024
 
 int32_t gdb_recv_packet(int32_t fd, char** buffer) {
@@ -186,3 +235,16 @@ int32_t gdb_check_for_interrupt(int32_t fd) {
 
     return (0);
 }
+
+// waits up to timeout_ms for something to read, returns 1 if there is
+int32_t gdb_wait_for_packet(int32_t fd, int32_t timeout_ms) {
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    int32_t ret = poll(&pfd, 1, timeout_ms);
+
+    if (ret < 0) { return (-2); }
+
+    return (ret > 0 ? 1 : 0);
+}
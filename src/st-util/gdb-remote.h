@@ -4,7 +4,11 @@
 #include <stdint.h>
 
 int32_t gdb_send_packet(int32_t fd, char* data);
+int32_t gdb_send_notification(int32_t fd, char* name, char* data);
 int32_t gdb_recv_packet(int32_t fd, char** buffer);
 int32_t gdb_check_for_interrupt(int32_t fd);
+int32_t gdb_wait_for_packet(int32_t fd, int32_t timeout_ms);
+void gdb_hex_encode(char* out, const uint8_t* in, uint32_t len);
+void gdb_hex_decode(uint8_t* out, const char* in, uint32_t len);
 
 #endif // GDB_REMOTE_H
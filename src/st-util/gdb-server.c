@@ -23,6 +23,7 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #endif
 
@@ -30,7 +31,9 @@
 #include "gdb-server.h"
 #include "gdb-remote.h"
 #include "memory-map.h"
+#include "rtos.h"
 #include "semihosting.h"
+#include "svd.h"
 
 #include <chipid.h>
 #include <common_flash.h>
@@ -46,10 +49,15 @@
 // Semihosting doesn't have a short option, we define a value to identify it
 #define SEMIHOSTING_OPTION 128
 #define SERIAL_OPTION 127
+#define SVD_OPTION 126
+#define RAM_OPTION 125
 
 // always update the FLASH_PAGE before each use, by calling stlink_calculate_pagesize
 #define FLASH_PAGE (sl->flash_pgsz)
 
+// how often a running core is looked at in non-stop mode
+#define NON_STOP_POLL_MS 100
+
 static stlink_t *connected_stlink = NULL;
 
 #if defined(_WIN32)
@@ -61,8 +69,6 @@ static stlink_t *connected_stlink = NULL;
 #define IS_SOCK_VALID(__sock) ((__sock) > 0)
 #endif
 
-static const char hex[] = "0123456789abcdef";
-
 typedef struct _st_state_t {
     // things from command line, bleh
     int32_t logging_level;
@@ -73,6 +79,9 @@ typedef struct _st_state_t {
     char serialnumber[STLINK_SERIAL_BUFFER_SIZE];
     bool semihosting;
     const char* current_memory_map;
+    const char* svd_file;
+    bool ram_boot;
+    stm32_addr_t ram_vectors;   // 0 for the start of the SRAM
 } st_state_t;
 
 
@@ -109,6 +118,15 @@ BOOL WINAPI CtrlHandler(DWORD fdwCtrlType) {
 }
 #endif
 
+// With --ram, a reset starts the image in SRAM instead of the one in flash
+static void ram_boot(stlink_t *sl, const st_state_t *st) {
+    if (!st->ram_boot) { return; }
+
+    if (stlink_boot_sram(sl, st->ram_vectors ? st->ram_vectors : sl->sram_base)) {
+        WLOG("No image in SRAM to boot, the core stays at the reset vector of the flash\n");
+    }
+}
+
 int32_t parse_options(int32_t argc, char** argv, st_state_t *st) {
     static struct option long_options[] = {
         {"help", no_argument, NULL, 'h'},
@@ -122,6 +140,8 @@ int32_t parse_options(int32_t argc, char** argv, st_state_t *st) {
         {"version", no_argument, NULL, 'V'},
         {"semihosting", no_argument, NULL, SEMIHOSTING_OPTION},
         {"serial", required_argument, NULL, SERIAL_OPTION},
+        {"svd", required_argument, NULL, SVD_OPTION},
+        {"ram", optional_argument, NULL, RAM_OPTION},
         {0, 0, 0, 0},
     };
     const char * help_str = "%s - usage:\n\n"
@@ -145,6 +165,12 @@ int32_t parse_options(int32_t argc, char** argv, st_state_t *st) {
                             "\t\t\tEnable semihosting support.\n"
                             "  --serial <serial>\n"
                             "\t\t\tUse a specific serial number.\n"
+                            "  --svd <file>\n"
+                            "\t\t\tLoad a CMSIS-SVD file for the 'monitor svd' command.\n"
+                            "  --ram[=<addr>]\n"
+                            "\t\t\tBoot the image loaded in SRAM, with its vector table at addr\n"
+                            "\t\t\t(default: start of SRAM), after each reset by gdb:\n"
+                            "\t\t\t'load' then 'monitor reset' runs it without touching the flash.\n"
                             "\n"
                             "The STLINK device to use can be specified in the environment\n"
                             "variable STLINK_DEVICE on the format <USB_BUS>:<USB_ADDR>.\n"
@@ -210,6 +236,13 @@ int32_t parse_options(int32_t argc, char** argv, st_state_t *st) {
             printf("use serial %s\n", optarg);
             memcpy(st->serialnumber, optarg, STLINK_SERIAL_BUFFER_SIZE);
             break;
+        case SVD_OPTION:
+            st->svd_file = optarg;
+            break;
+        case RAM_OPTION:
+            st->ram_boot = true;
+            if (optarg) { st->ram_vectors = (stm32_addr_t) strtoul(optarg, NULL, 0); }
+            break;
         }
 
 
@@ -239,6 +272,8 @@ int32_t main(int32_t argc, char** argv) {
 
     init_chipids (STLINK_CHIPS_DIR);
 
+    if (state.svd_file != NULL && svd_load(state.svd_file)) { return (1); }
+
     sl = stlink_open_usb(state.logging_level, state.connect_mode, state.serialnumber, state.freq);
     if (sl == NULL) { return (1); }
 
@@ -680,50 +715,34 @@ static int32_t flash_populate(stm32_addr_t addr, uint8_t* data, uint32_t length)
 
 static int32_t flash_go(stlink_t *sl, st_state_t *st) {
     int32_t error = -1;
-    int32_t ret;
-    flash_loader_t fl;
+    struct stlink_flash_session fs;
 
     stlink_target_connect(sl, st->connect_mode);
     stlink_force_debug(sl);
 
+    // one session for all the blocks: the loader is uploaded once
+    if (stlink_flash_session_begin(sl, &fs)) { goto error; }
+
     for (struct flash_block* fb = flash_root; fb; fb = fb->next) {
         ILOG("flash_erase: block %08x -> %04x\n", fb->addr, fb->length);
 
-        for (stm32_addr_t page = fb->addr; page < fb->addr + fb->length; page += (uint32_t) FLASH_PAGE) {
-            // update FLASH_PAGE
-            stlink_calculate_pagesize(sl, page);
-
-            ILOG("flash_erase: page %08x\n", page);
-            ret = stlink_erase_flash_page(sl, page);
-            if (ret) { goto error; }
-        }
+        if (stlink_flash_session_erase(sl, &fs, fb->addr, fb->length)) { goto error; }
     }
 
-    ret = stlink_flashloader_start(sl, &fl);
-    if (ret) { goto error; }
-
     for (struct flash_block* fb = flash_root; fb; fb = fb->next) {
         ILOG("flash_do: block %08x -> %04x\n", fb->addr, fb->length);
 
-        for (stm32_addr_t page = fb->addr; page < fb->addr + fb->length; page += (uint32_t) FLASH_PAGE) {
-            uint32_t length = fb->length - (page - fb->addr);
-
-            // update FLASH_PAGE
-            stlink_calculate_pagesize(sl, page);
-
-            ILOG("flash_do: page %08x\n", page);
-            uint32_t len = (length > FLASH_PAGE) ? (uint32_t) FLASH_PAGE : length;
-            ret = stlink_flashloader_write(sl, &fl, page, fb->data + (page - fb->addr), len);
-            if (ret) { goto error; }
-        }
+        if (stlink_flash_session_write(sl, &fs, fb->addr, fb->data, fb->length)) { goto error; }
     }
 
-    stlink_flashloader_stop(sl, &fl);
-    stlink_reset(sl, RESET_SOFT_AND_HALT);
     error = 0;
 
 error:
 
+    if (fs.started) { stlink_flash_session_end(sl, &fs); }
+
+    if (!error) { stlink_reset(sl, RESET_SOFT_AND_HALT); }
+
     for (struct flash_block* fb = flash_root, *next; fb; fb = next) {
         next = fb->next;
         free(fb->data);
@@ -874,6 +893,328 @@ static void cache_sync(stlink_t *sl) {
     if (ccr & (STLINK_REG_CM7_CCR_IC | STLINK_REG_CM7_CCR_DC)) { cache_flush(sl, ccr); }
 }
 
+/*
+ * Software breakpoints for code executing from RAM.
+ *
+ * The FPB only has a handful of comparators, but code placed in RAM can be
+ * patched with a BKPT instruction instead. The original halfwords are kept
+ * in a host-side shadow, sorted by address. Z0/z0 only edit the table; the
+ * target is patched in as few read-modify-write bursts as possible right
+ * before the core is resumed, and restored as soon as it halts again, so
+ * GDB never sees the BKPT opcodes in memory reads.
+ */
+
+#define SOFT_BREAK_INSN       0xBE00
+#define SOFT_BREAK_WINDOW_MAX 0x1800 // largest single read/write burst, same as for 'm'
+#define RAM_REGION_NUM_MAX    16
+
+struct code_sw_breakpoint {
+    stm32_addr_t addr;
+    uint16_t insn; // original instruction, valid while patched
+    bool patched;  // the BKPT is in place; not when reading the original failed
+};
+
+struct ram_region {
+    stm32_addr_t start;
+    uint32_t length;
+};
+
+static struct code_sw_breakpoint* soft_breaks;
+static uint32_t soft_break_num;
+static uint32_t soft_break_cap;
+static int32_t soft_breaks_inserted;
+
+static struct ram_region ram_regions[RAM_REGION_NUM_MAX];
+static uint32_t ram_region_num;
+
+static void init_ram_regions(const char* map) {
+    const char* p = map;
+    ram_region_num = 0;
+
+    while (p && (p = strstr(p, "<memory type=\"ram\"")) != NULL) {
+        uint32_t start, length;
+
+        if (sscanf(p, "<memory type=\"ram\" start=\"%x\" length=\"%x\"", &start, &length) == 2) {
+            // only the code and SRAM regions; the external bus may be read-only
+            // flash in disguise, the rest is execute-never
+            if (start < 0x40000000) {
+                if (ram_region_num < RAM_REGION_NUM_MAX) {
+                    ram_regions[ram_region_num].start = start;
+                    ram_regions[ram_region_num].length = length;
+                    ram_region_num++;
+                }
+            }
+        }
+
+        p++;
+    }
+}
+
+static int32_t is_ram_address(stm32_addr_t addr) {
+    for (uint32_t i = 0; i < ram_region_num; i++)
+        if (addr >= ram_regions[i].start && addr - ram_regions[i].start < ram_regions[i].length) {
+            return (1);
+        }
+
+    return (0);
+}
+
+static int32_t soft_breakpoint_index(stm32_addr_t addr) {
+    for (uint32_t i = 0; i < soft_break_num; i++)
+        if (soft_breaks[i].addr == addr) { return ((int32_t)i); }
+
+    return (-1);
+}
+
+static int32_t has_soft_breakpoint(stm32_addr_t addr) {
+    return (soft_breakpoint_index(addr) >= 0);
+}
+
+/*
+ * Patch (insert != 0) or restore all soft breakpoints. Neighbouring entries
+ * share one aligned window, so each burst costs one read and one write
+ * regardless of how many breakpoints it covers. Only the entries actually
+ * patched are restored, a failed read leaves its window untouched.
+ */
+static int32_t soft_breakpoints_apply(stlink_t *sl, int32_t insert) {
+    uint32_t i = 0;
+    int32_t err = 0;
+
+    if ((insert != 0) == (soft_breaks_inserted != 0)) { return (0); }
+
+    // with an empty table too, so that breakpoints added while running get patched in
+    if (soft_break_num == 0) {
+        soft_breaks_inserted = insert;
+        return (0);
+    }
+
+    while (i < soft_break_num) {
+        stm32_addr_t start = soft_breaks[i].addr & ~3u;
+        stm32_addr_t end = (soft_breaks[i].addr + 2 + 3) & ~3u;
+        uint32_t j = i;
+
+        while (j + 1 < soft_break_num &&
+               ((soft_breaks[j + 1].addr + 2 + 3) & ~3u) - start <= SOFT_BREAK_WINDOW_MAX) {
+            j++;
+            end = (soft_breaks[j].addr + 2 + 3) & ~3u;
+        }
+
+        uint32_t len = end - start;
+        bool change = false;
+
+        for (uint32_t k = i; k <= j; k++) {
+            if (soft_breaks[k].patched != (insert != 0)) { change = true; }
+        }
+
+        if (!change) {
+            i = j + 1;
+            continue;
+        }
+
+        if (stlink_read_mem32(sl, start, (uint16_t)len)) {
+            ELOG("soft breakpoints: cannot read %08x (%u bytes)\n", start, len);
+            err = -1;
+            i = j + 1;
+            continue;
+        }
+
+        for (uint32_t k = i; k <= j; k++) {
+            uint8_t* p = &sl->q_buf[soft_breaks[k].addr - start];
+
+            if (soft_breaks[k].patched == (insert != 0)) { continue; }
+
+            // the original is known from here on, even if the write fails
+            if (insert) {
+                soft_breaks[k].insn = (uint16_t)(p[0] | (p[1] << 8));
+                p[0] = SOFT_BREAK_INSN & 0xff;
+                p[1] = SOFT_BREAK_INSN >> 8;
+            } else {
+                p[0] = soft_breaks[k].insn & 0xff;
+                p[1] = soft_breaks[k].insn >> 8;
+            }
+
+            soft_breaks[k].patched = (insert != 0);
+        }
+
+        if (stlink_write_mem32(sl, start, (uint16_t)len)) {
+            ELOG("soft breakpoints: cannot write %08x (%u bytes)\n", start, len);
+            err = -1;
+        }
+
+        cache_change(start, len);
+        DLOG("%s %u soft breaks in %08x..%08x\n", insert ? "inserted" : "removed", j - i + 1, start, end);
+        i = j + 1;
+    }
+
+    soft_breaks_inserted = insert;
+    return (err);
+}
+
+static void soft_breakpoints_flush(stlink_t *sl) {
+    soft_breakpoints_apply(sl, 1);
+}
+
+static void soft_breakpoints_restore(stlink_t *sl) {
+    soft_breakpoints_apply(sl, 0);
+}
+
+// replace patched BKPT opcodes in a buffer read from the target by the originals
+static void soft_breakpoints_shadow(stm32_addr_t start, uint8_t* buf, uint32_t count) {
+    if (!soft_breaks_inserted) { return; }
+
+    for (uint32_t i = 0; i < soft_break_num; i++) {
+        stm32_addr_t addr = soft_breaks[i].addr;
+
+        if (!soft_breaks[i].patched) { continue; }
+
+        if (addr >= start && addr - start < count) { buf[addr - start] = soft_breaks[i].insn & 0xff; }
+
+        if (addr + 1 >= start && addr + 1 - start < count) { buf[addr + 1 - start] = soft_breaks[i].insn >> 8; }
+    }
+}
+
+/*
+ * The opposite for a buffer about to be written to the target: bytes over
+ * patched BKPT opcodes become the new originals, restored at the next stop,
+ * and the opcodes stay in place.
+ */
+static void soft_breakpoints_overlay(stm32_addr_t start, uint8_t* buf, uint32_t count) {
+    if (!soft_breaks_inserted) { return; }
+
+    for (uint32_t i = 0; i < soft_break_num; i++) {
+        stm32_addr_t addr = soft_breaks[i].addr;
+
+        if (!soft_breaks[i].patched) { continue; }
+
+        if (addr >= start && addr - start < count) {
+            soft_breaks[i].insn = (uint16_t)((soft_breaks[i].insn & 0xff00) | buf[addr - start]);
+            buf[addr - start] = SOFT_BREAK_INSN & 0xff;
+        }
+
+        if (addr + 1 >= start && addr + 1 - start < count) {
+            soft_breaks[i].insn = (uint16_t)((soft_breaks[i].insn & 0x00ff) | (buf[addr + 1 - start] << 8));
+            buf[addr + 1 - start] = SOFT_BREAK_INSN >> 8;
+        }
+    }
+}
+
+/*
+ * Patch (insert != 0) or restore the one soft breakpoint at index id, leaving
+ * the others alone. Used while the breakpoints are inserted and the core runs.
+ */
+static int32_t soft_breakpoint_patch(stlink_t *sl, uint32_t id, int32_t insert) {
+    stm32_addr_t start = soft_breaks[id].addr & ~3u;
+    uint8_t* p = &sl->q_buf[soft_breaks[id].addr - start];
+
+    if (soft_breaks[id].patched == (insert != 0)) { return (0); }
+
+    if (stlink_read_mem32(sl, start, 4)) {
+        ELOG("soft breakpoints: cannot read %08x (4 bytes)\n", start);
+        return (-1);
+    }
+
+    if (insert) {
+        soft_breaks[id].insn = (uint16_t)(p[0] | (p[1] << 8));
+        p[0] = SOFT_BREAK_INSN & 0xff;
+        p[1] = SOFT_BREAK_INSN >> 8;
+    } else {
+        p[0] = soft_breaks[id].insn & 0xff;
+        p[1] = soft_breaks[id].insn >> 8;
+    }
+
+    soft_breaks[id].patched = (insert != 0);
+
+    if (stlink_write_mem32(sl, start, 4)) {
+        ELOG("soft breakpoints: cannot write %08x (4 bytes)\n", start);
+        return (-1);
+    }
+
+    cache_change(start, 4);
+    return (0);
+}
+
+static int32_t update_soft_breakpoint(stlink_t *sl, stm32_addr_t addr, int32_t set) {
+    int32_t id;
+
+    if (addr & 1) {
+        ELOG("update_soft_breakpoint: unaligned address %08x\n", addr);
+        return (-1);
+    }
+
+    /*
+     * While the core runs in non-stop mode the breakpoints stay inserted and
+     * only the one at addr is patched in or out; otherwise the table only
+     * changes while the original code is in place.
+     */
+    id = soft_breakpoint_index(addr);
+
+    if (!set) {
+        if (id >= 0) {
+            if (soft_breaks_inserted && soft_breakpoint_patch(sl, (uint32_t)id, 0)) { return (-1); }
+
+            soft_break_num--;
+            memmove(&soft_breaks[id], &soft_breaks[id + 1],
+                    (soft_break_num - (uint32_t)id) * sizeof(*soft_breaks));
+            DLOG("clearing soft break at %08x\n", addr);
+        }
+
+        return (0);
+    }
+
+    if (id >= 0) { return (0); }
+
+    if (soft_break_num == soft_break_cap) {
+        uint32_t cap = soft_break_cap ? soft_break_cap * 2 : 32;
+        struct code_sw_breakpoint* tmp = realloc(soft_breaks, cap * sizeof(*soft_breaks));
+
+        if (tmp == NULL) { return (-1); }
+
+        soft_breaks = tmp;
+        soft_break_cap = cap;
+    }
+
+    uint32_t pos = 0;
+
+    while (pos < soft_break_num && soft_breaks[pos].addr < addr) { pos++; }
+
+    memmove(&soft_breaks[pos + 1], &soft_breaks[pos], (soft_break_num - pos) * sizeof(*soft_breaks));
+    soft_breaks[pos].addr = addr;
+    soft_breaks[pos].insn = 0;
+    soft_breaks[pos].patched = false;
+    soft_break_num++;
+    DLOG("setting soft break at %08x\n", addr);
+
+    if (soft_breaks_inserted && soft_breakpoint_patch(sl, pos, 1)) {
+        soft_break_num--;
+        memmove(&soft_breaks[pos], &soft_breaks[pos + 1], (soft_break_num - pos) * sizeof(*soft_breaks));
+        return (-1);
+    }
+
+    return (0);
+}
+
+static void init_soft_breakpoints(stlink_t *sl) {
+    soft_breakpoints_restore(sl);
+    soft_break_num = 0;
+    soft_breaks_inserted = 0;
+}
+
+// monitor command output is shown on the GDB console with 'O' packets
+static void send_console_output(SOCKET client, const char *text) {
+    char packet[1 + 2 * 256 + 1];
+    uint32_t len = (uint32_t) strlen(text);
+
+    for (uint32_t off = 0; off < len; off += 256) {
+        uint32_t n = (len - off > 256) ? 256 : len - off;
+
+        packet[0] = 'O';
+
+        gdb_hex_encode(packet + 1, (const uint8_t *) text + off, n);
+        packet[1 + n * 2] = '\0';
+        gdb_send_packet(client, packet);
+    }
+}
+
 static uint32_t unhexify(const char *in, char *out, uint32_t out_count) {
     uint32_t i;
     uint32_t c;
@@ -887,6 +1228,84 @@ static uint32_t unhexify(const char *in, char *out, uint32_t out_count) {
     return (i);
 }
 
+/*
+ * Polls the core, true once it has halted. A halt on a semihosting breakpoint
+ * is served and the core resumed, it still runs then.
+ */
+static bool core_halted(stlink_t *sl, const st_state_t *st) {
+    struct stlink_reg reg;
+    stm32_addr_t pc;
+    stm32_addr_t addr;
+    int32_t offset = 0;
+    uint16_t insn;
+    int32_t ret = stlink_status(sl);
+
+    if (ret) { DLOG("Semihost: status failed\n"); }
+
+    if (sl->core_stat != TARGET_HALTED) { return (false); }
+
+    if (!st->semihosting) { return (true); }
+
+    ret = stlink_read_all_regs (sl, &reg);
+
+    if (ret) { DLOG("Semihost: read_all_regs failed\n"); }
+
+    // read PC
+    pc = reg.r[15];
+
+    // compute aligned value
+    offset = pc % 4;
+    addr = pc - offset;
+
+    // read instructions (address and length must be aligned).
+    ret = stlink_read_mem32(sl, addr, (offset > 2 ? 8 : 4));
+
+    if (ret != 0) {
+        DLOG("Semihost: cannot read instructions at: 0x%08x\n", addr);
+        return (true);
+    }
+
+    memcpy(&insn, &sl->q_buf[offset], sizeof(insn));
+
+    if (insn != 0xBEAB || has_breakpoint(addr)) { return (true); }
+
+    ret = do_semihosting (sl, reg.r[0], reg.r[1], &reg.r[0]);
+
+    if (ret) { DLOG("Semihost: do_semihosting failed\n"); }
+
+    // write return value
+    ret = stlink_write_reg(sl, reg.r[0], 0);
+
+    if (ret) { DLOG("Semihost: write_reg failed for return value\n"); }
+
+    // jump over the break instruction
+    ret = stlink_write_reg(sl, reg.r[15] + 2, 15);
+
+    if (ret) { DLOG("Semihost: write_reg failed for jumping over break\n"); }
+
+    // continue execution
+    cache_sync(sl);
+    ret = stlink_run(sl, RUN_NORMAL);
+
+    if (ret) { DLOG("Semihost: continue execution failed with stlink_run\n"); }
+
+    return (false);
+}
+
+// non-stop: the core has halted, GDB gets a %Stop and then asks for the rest with vStopped
+static int32_t notify_stop(SOCKET client, stlink_t *sl, uint32_t signal) {
+    char* reply = rtos_stop_reply(sl, signal);
+
+    DLOG("notify: Stop:%s\n", reply);
+
+    int32_t ret = gdb_send_notification(client, "Stop", reply);
+
+    if (ret != 0) { ELOG("cannot notify: %d\n", ret); }
+
+    free(reply);
+    return (ret);
+}
+
 int32_t serve(stlink_t *sl, st_state_t *st) {
     SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
 
@@ -929,6 +1348,9 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
 
     close_socket(sock);
 
+    // the ack and the reply go out as separate writes, don't let Nagle hold the reply
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, (char *)&val, sizeof(val));
+
     uint32_t chip_id = sl->chip_id;
 
     stlink_target_connect(sl, st->connect_mode);
@@ -944,6 +1366,9 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
     init_cache(sl);
 
     st->current_memory_map = make_memory_map(sl);
+    init_ram_regions(st->current_memory_map);
+    init_soft_breakpoints(sl);
+    rtos_init();
 
     ILOG("GDB connected.\n");
 
@@ -955,12 +1380,52 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
     // if a critical error is detected, break from the loop
     int32_t critical_error = 0;
     int32_t ret;
+    // thread selected with 'Hg', 0 is the running one
+    uint32_t thread = 0;
+    /*
+     * In non-stop mode packets are still served while the core runs, which
+     * the debug AP allows for memory, and its halting is notified by a %Stop
+     * when GDB asks nothing. That is also when the core is looked at, or at
+     * least every NON_STOP_POLL_MS while packets keep coming.
+     */
+    uint32_t non_stop = 0;
+    uint32_t running = 0;
+    uint32_t polled = 0;
+    // signal of a halt to notify after the reply, -1 for none
+    int32_t notify;
 
     while (1) {
         ret = 0;
+        notify = -1;
         char* packet;
+        int32_t status;
+
+        while (running) {
+            status = gdb_wait_for_packet(client, NON_STOP_POLL_MS);
+
+            if (status < 0) {
+                ELOG("cannot wait for packet: %d\n", status);
+                close_socket(client);
+                return (1);
+            }
+
+            if (status == 1 && time_ms() - polled < NON_STOP_POLL_MS) { break; }
+
+            polled = time_ms();
+
+            if (core_halted(sl, st)) {
+                running = 0;
+                soft_breakpoints_restore(sl);
+                rtos_invalidate(); // threads read while running are stale
 
-        int32_t status = gdb_recv_packet(client, &packet);
+                if (notify_stop(client, sl, 5) != 0) { // TRAP
+                    close_socket(client);
+                    return (1);
+                }
+            }
+        }
+
+        status = gdb_recv_packet(client, &packet);
 
         if (status < 0) {
             ELOG("cannot recv: %d\n", status);
@@ -973,8 +1438,22 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
         char* reply = NULL;
         struct stlink_reg regp;
 
-        switch (packet[0]) {
+        if (running && packet[0] && strchr("gGpPcs", packet[0])) {
+            // non-stop: the registers of a running core cannot be accessed, nor can it be run
+            reply = strdup("E01");
+        } else switch (packet[0]) {
         case 'q': {
+            if (!strcmp(packet, "qC")) {
+                if (rtos_active(sl)) {
+                    reply = calloc(1, 16);
+                    sprintf(reply, "QC%x", rtos_current_thread(sl));
+                } else {
+                    reply = strdup("");
+                }
+
+                break;
+            }
+
             if (packet[1] == 'P' || packet[1] == 'C' || packet[1] == 'L') {
                 reply = strdup("");
                 break;
@@ -995,7 +1474,13 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
             DLOG("query: %s;%s\n", queryName, params);
 
             if (!strcmp(queryName, "Supported")) {
-                reply = strdup("PacketSize=3fff;qXfer:memory-map:read+;qXfer:features:read+");
+                reply = strdup("PacketSize=3fff;qXfer:memory-map:read+;qXfer:features:read+;QNonStop+");
+            } else if (!strcmp(queryName, "Symbol")) {
+                reply = rtos_symbol_query(params);
+            } else if (!strcmp(queryName, "fThreadInfo") || !strcmp(queryName, "sThreadInfo")) {
+                if (rtos_active(sl)) { reply = rtos_thread_info(sl, queryName[0] == 'f'); }
+            } else if (!strncmp(queryName, "ThreadExtraInfo,", 16)) {
+                reply = rtos_thread_extra_info(sl, (uint32_t) strtoul(&queryName[16], NULL, 16));
             } else if (!strcmp(queryName, "Xfer")) {
                 char *type, *op, *__s_addr, *s_length;
                 char *tok = params;
@@ -1065,7 +1550,9 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
 
                 if (!strncmp(cmd, "resume", 6)) {                               // resume
                     DLOG("Rcmd: resume\n");
+                    soft_breakpoints_flush(sl);
                     cache_sync(sl);
+                    rtos_invalidate();
                     ret = stlink_run(sl, RUN_NORMAL);
 
                     if (ret) {
@@ -1077,6 +1564,8 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
 
                 } else if (!strncmp(cmd, "halt", 4)) {                          // halt
                     ret = stlink_force_debug(sl);
+                    soft_breakpoints_restore(sl);
+                    rtos_invalidate();
 
                     if (ret) {
                         DLOG("Rcmd: halt failed\n");
@@ -1119,14 +1608,27 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
                         reply = strdup("E00");
                     }
 
+                    ram_boot(sl, st);
+
                     init_code_breakpoints(sl);
+                    init_soft_breakpoints(sl);
                     init_data_watchpoints(sl);
+                    rtos_invalidate();
 
                     if (reply == NULL) {
                         reply = strdup("OK");
                         DLOG("Rcmd: reset\n");
                     }
 
+                } else if (!strncmp(cmd, "svd", 3) && (cmd[3] == '\0' || isspace(cmd[3]))) {
+                    char *out = svd_command(sl, cmd + 3);
+
+                    if (out != NULL) {
+                        send_console_output(client, out);
+                        free(out);
+                    }
+
+                    reply = strdup("OK");
                 } else if (!strncmp(cmd, "semihosting ", 12)) {
                     DLOG("Rcmd: got semihosting cmd '%s'", cmd);
                     char *arg = cmd + 12;
@@ -1155,6 +1657,16 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
             break;
         }
 
+        case 'Q':
+            if (!strncmp(packet, "QNonStop:", 9)) {
+                non_stop = packet[9] == '1';
+                reply = strdup("OK");
+            } else {
+                reply = strdup("");
+            }
+
+            break;
+
         case 'v': {
             char *params = NULL;
             char *cmdName = strtok_r(packet, ":;", &params);
@@ -1216,6 +1728,9 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
 
                 free(decoded);
             } else if (!strcmp(cmdName, "FlashDone")) {
+                rtos_invalidate();
+                running = 0;
+
                 if (flash_go(sl, st)) {
                     reply = strdup("E08");
                 } else {
@@ -1224,6 +1739,79 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
             } else if (!strcmp(cmdName, "Kill")) {
                 attached = 0;
                 reply = strdup("OK");
+            } else if (!strcmp(cmdName, "Cont?")) {
+                // all-stop keeps to 'c' and 's'
+                if (non_stop) { reply = strdup("vCont;c;C;s;S;t"); }
+            } else if (!strcmp(cmdName, "Cont") && non_stop) {
+                // one core: the first action applies to it
+                switch (params[0]) {
+                case 'c':
+                case 'C':
+                    if (!running) {
+                        soft_breakpoints_flush(sl);
+                        cache_sync(sl);
+                        rtos_invalidate();
+                        thread = 0;
+                        ret = stlink_run(sl, RUN_NORMAL);
+
+                        if (ret) { DLOG("vCont: stlink_run failed\n"); }
+
+                        running = 1;
+                        polled = time_ms();
+                    }
+
+                    reply = strdup("OK");
+                    break;
+                case 's':
+                case 'S':
+                    // stepping needs a halted core, as for 's'
+                    if (running) {
+                        reply = strdup("E01");
+                        break;
+                    }
+
+                    soft_breakpoints_flush(sl);
+                    cache_sync(sl);
+                    rtos_invalidate();
+                    thread = 0;
+                    ret = stlink_step(sl);
+                    soft_breakpoints_restore(sl);
+
+                    if (ret) {
+                        ELOG("vCont: cannot send step request\n");
+                        reply = strdup("E00");
+                    } else {
+                        reply = strdup("OK");
+                        notify = 5; // TRAP
+                    }
+
+                    break;
+                case 't':
+                    // a core already halted has nothing to report
+                    if (running) {
+                        stlink_force_debug(sl);
+                        running = 0;
+                        soft_breakpoints_restore(sl);
+                        rtos_invalidate();
+                        notify = 0;
+                    }
+
+                    reply = strdup("OK");
+                    break;
+                }
+            } else if (!strcmp(cmdName, "CtrlC")) {
+                if (running) {
+                    stlink_force_debug(sl);
+                    running = 0;
+                    soft_breakpoints_restore(sl);
+                    rtos_invalidate();
+                    notify = 2; // INT
+                }
+
+                reply = strdup("OK");
+            } else if (!strcmp(cmdName, "Stopped")) {
+                // a single core has no more halts to report
+                reply = strdup("OK");
             }
 
             if (reply == NULL) { reply = strdup(""); }
@@ -1232,7 +1820,10 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
         }
 
         case 'c':
+            soft_breakpoints_flush(sl);
             cache_sync(sl);
+            rtos_invalidate();
+            thread = 0;
             ret = stlink_run(sl, RUN_NORMAL);
 
             if (ret) { DLOG("Semihost: run failed\n"); }
@@ -1251,75 +1842,22 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
                     break;
                 }
 
-                ret = stlink_status(sl);
-
-                if (ret) { DLOG("Semihost: status failed\n"); }
-
-                if (sl->core_stat == TARGET_HALTED) {
-                    struct stlink_reg reg;
-                    stm32_addr_t pc;
-                    stm32_addr_t addr;
-                    int32_t offset = 0;
-                    uint16_t insn;
-
-                    if (!st->semihosting) { break; }
-
-                    ret = stlink_read_all_regs (sl, &reg);
-
-                    if (ret) { DLOG("Semihost: read_all_regs failed\n"); }
-
-                    // read PC
-                    pc = reg.r[15];
-
-                    // compute aligned value
-                    offset = pc % 4;
-                    addr = pc - offset;
-
-                    // read instructions (address and length must be aligned).
-                    ret = stlink_read_mem32(sl, addr, (offset > 2 ? 8 : 4));
-
-                    if (ret != 0) {
-                        DLOG("Semihost: cannot read instructions at: 0x%08x\n", addr);
-                        break;
-                    }
-
-                    memcpy(&insn, &sl->q_buf[offset], sizeof(insn));
-
-                    if (insn == 0xBEAB && !has_breakpoint(addr)) {
-
-                        ret = do_semihosting (sl, reg.r[0], reg.r[1], &reg.r[0]);
-
-                        if (ret) { DLOG("Semihost: do_semihosting failed\n"); }
-
-                        // write return value
-                        ret = stlink_write_reg(sl, reg.r[0], 0);
-
-                        if (ret) { DLOG("Semihost: write_reg failed for return value\n"); }
-
-                        // jump over the break instruction
-                        ret = stlink_write_reg(sl, reg.r[15] + 2, 15);
-
-                        if (ret) { DLOG("Semihost: write_reg failed for jumping over break\n"); }
-
-                        // continue execution
-                        cache_sync(sl);
-                        ret = stlink_run(sl, RUN_NORMAL);
-
-                        if (ret) { DLOG("Semihost: continue execution failed with stlink_run\n"); }
-                    } else {
-                        break;
-                    }
-                }
+                if (core_halted(sl, st)) { break; }
 
                 usleep(100000);
             }
 
-            reply = strdup("S05"); // TRAP
+            soft_breakpoints_restore(sl);
+            reply = rtos_stop_reply(sl, 5); // TRAP
             break;
 
         case 's':
+            soft_breakpoints_flush(sl);
             cache_sync(sl);
+            rtos_invalidate();
+            thread = 0;
             ret = stlink_step(sl);
+            soft_breakpoints_restore(sl);
 
             if (ret) {
                 // ... having a problem sending step packet
@@ -1327,14 +1865,17 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
                 reply = strdup("E00");
                 critical_error = 1; // absolutely critical
             } else {
-                reply = strdup("S05"); // TRAP
+                reply = rtos_stop_reply(sl, 5); // TRAP
             }
 
             break;
 
         case '?':
 
-            if (attached) {
+            if (attached && non_stop) {
+                // the halted core, the running one is not reported
+                reply = running ? strdup("OK") : rtos_stop_reply(sl, 5); // TRAP
+            } else if (attached) {
                 reply = strdup("S05"); // TRAP
             } else {
                 reply = strdup("OK"); // stub shall reply OK if not attached
@@ -1342,8 +1883,34 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
 
             break;
 
+        case 'H':
+            // 'Hg' selects the thread for register access, 'Hc' is ignored
+            if (packet[1] == 'g') {
+                int32_t id = (int32_t) strtol(&packet[2], NULL, 16);
+                thread = (id > 0) ? (uint32_t)id : 0;
+            }
+
+            reply = strdup("OK");
+            break;
+
+        case 'T': {
+            uint32_t id = (uint32_t) strtoul(&packet[1], NULL, 16);
+
+            if (rtos_active(sl)) {
+                reply = strdup(rtos_thread_alive(sl, id) ? "OK" : "E01");
+            } else {
+                reply = strdup("OK");
+            }
+
+            break;
+        }
+
         case 'g':
-            ret = stlink_read_all_regs(sl, &regp);
+            if (thread && rtos_read_thread_regs(sl, thread, &regp) == 1) {
+                ret = 0;
+            } else {
+                ret = stlink_read_all_regs(sl, &regp);
+            }
 
             if (ret) { DLOG("g packet: read_all_regs failed\n"); }
 
@@ -1359,7 +1926,10 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
             uint32_t id = (uint32_t) strtoul(&packet[1], NULL, 16);
             uint32_t myreg = 0xDEADDEAD;
 
-            if (id < 16) {
+            if ((id < 16 || id == 0x19) && thread && rtos_read_thread_regs(sl, thread, &regp) == 1) {
+                ret = 0;
+                myreg = htonl(id < 16 ? regp.r[id] : regp.xpsr);
+            } else if (id < 16) {
                 ret = stlink_read_reg(sl, id, &regp);
                 myreg = htonl(regp.r[id]);
             } else if (id == 0x19) {
@@ -1412,8 +1982,11 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
             uint32_t reg   = (uint32_t) strtoul(s_reg,   NULL, 16);
             uint32_t value = (uint32_t) strtoul(s_value, NULL, 16);
 
-
-            if (reg < 16) {
+            // registers of suspended threads are read-only
+            if (thread && rtos_active(sl) && thread != rtos_current_thread(sl)) {
+                ret = 1;
+                reply = strdup("E00");
+            } else if (reg < 16) {
                 ret = stlink_write_reg(sl, ntohl(value), reg);
             } else if (reg == 0x19) {
                 ret = stlink_write_reg(sl, ntohl(value), 16);
@@ -1447,6 +2020,11 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
 
         case 'G':
 
+            if (thread && rtos_active(sl) && thread != rtos_current_thread(sl)) {
+                reply = strdup("E00");
+                break;
+            }
+
             for (int32_t i = 0; i < 16; i++) {
                 char str[9] = {0};
                 strncpy(str, &packet[1 + i * 8], 8);
@@ -1479,12 +2057,10 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
 
             // read failed somehow, don't return stale buffer
 
+            soft_breakpoints_shadow(start - adj_start, sl->q_buf, count_rnd);
             reply = calloc(1, count * 2 + 1);
 
-            for (uint32_t i = 0; i < count; i++) {
-                reply[i * 2 + 0] = hex[sl->q_buf[i + adj_start] >> 4];
-                reply[i * 2 + 1] = hex[sl->q_buf[i + adj_start] & 0xf];
-            }
+            gdb_hex_encode(reply, sl->q_buf + adj_start, count);
 
             break;
         }
@@ -1498,16 +2074,15 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
             uint32_t count = (uint32_t) strtoul(s_count, NULL, 16);
             int32_t err = 0;
 
+            rtos_invalidate();
+
             if (start % 4) {
                 uint32_t align_count = 4 - start % 4;
 
                 if (align_count > count) { align_count = count; }
 
-                for (uint32_t i = 0; i < align_count; i++) {
-                    char hextmp[3] = { hexdata[i * 2], hexdata[i * 2 + 1], 0 };
-                    uint8_t byte = (uint8_t) strtoul(hextmp, NULL, 16);
-                    sl->q_buf[i] = byte;
-                }
+                gdb_hex_decode(sl->q_buf, hexdata, align_count);
+                soft_breakpoints_overlay(start, sl->q_buf, align_count);
 
                 err |= stlink_write_mem8(sl, start, align_count);
                 cache_change(start, align_count);
@@ -1519,11 +2094,8 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
             if (count - count % 4) {
                 uint32_t aligned_count = count - count % 4;
 
-                for (uint32_t i = 0; i < aligned_count; i++) {
-                    char hextmp[3] = { hexdata[i * 2], hexdata[i * 2 + 1], 0 };
-                    uint8_t byte = (uint8_t) strtoul(hextmp, NULL, 16);
-                    sl->q_buf[i] = byte;
-                }
+                gdb_hex_decode(sl->q_buf, hexdata, aligned_count);
+                soft_breakpoints_overlay(start, sl->q_buf, aligned_count);
 
                 err |= stlink_write_mem32(sl, start, aligned_count);
                 cache_change(start, aligned_count);
@@ -1533,11 +2105,8 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
             }
 
             if (count) {
-                for (uint32_t i = 0; i < count; i++) {
-                    char hextmp[3] = { hexdata[i * 2], hexdata[i * 2 + 1], 0 };
-                    uint8_t byte = (uint8_t) strtoul(hextmp, NULL, 16);
-                    sl->q_buf[i] = byte;
-                }
+                gdb_hex_decode(sl->q_buf, hexdata, count);
+                soft_breakpoints_overlay(start, sl->q_buf, count);
 
                 err |= stlink_write_mem8(sl, start, count);
                 cache_change(start, count);
@@ -1553,9 +2122,16 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
             stm32_addr_t len  = (stm32_addr_t) strtoul(&endptr[1], NULL, 16);
 
             switch (packet[1]) {
+            case '0':           // insert sw breakpoint, patched in RAM
             case '1':
 
-                if (update_code_breakpoint(sl, addr, 1) < 0) {
+                if (packet[1] == '0' && is_ram_address(addr)) {
+                    if (update_soft_breakpoint(sl, addr, 1) < 0) {
+                        reply = strdup("E00");
+                    } else {
+                        reply = strdup("OK");
+                    }
+                } else if (update_code_breakpoint(sl, addr, 1) < 0) {
                     reply = strdup("E00");
                 } else {
                     reply = strdup("OK");
@@ -1596,8 +2172,14 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
             // stm32_addr_t len  = strtoul(&endptr[1], NULL, 16);
 
             switch (packet[1]) {
+            case '0':          // remove sw breakpoint
             case '1':          // remove breakpoint
-                update_code_breakpoint(sl, addr, 0);
+                if (has_soft_breakpoint(addr)) {
+                    update_soft_breakpoint(sl, addr, 0);
+                } else {
+                    update_code_breakpoint(sl, addr, 0);
+                }
+
                 reply = strdup("OK");
                 break;
 
@@ -1633,8 +2215,13 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
             ret = stlink_reset(sl, RESET_SOFT_AND_HALT);
             if (ret) { DLOG("R packet : stlink_reset failed\n"); }
 
+            ram_boot(sl, st);
+            running = 0;
+
             init_code_breakpoints(sl);
+            init_soft_breakpoints(sl);
             init_data_watchpoints(sl);
+            rtos_invalidate();
 
             attached = 1;
 
@@ -1643,6 +2230,7 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
         }
         case 'k':
             // kill request - reset the connection itself
+            soft_breakpoints_restore(sl);
             ret = stlink_run(sl, RUN_NORMAL);
             if (ret) { DLOG("Kill: stlink_run failed\n"); }
 
@@ -1661,8 +2249,10 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
 
             init_cache(sl);
             init_code_breakpoints(sl);
+            init_soft_breakpoints(sl);
             init_data_watchpoints(sl);
 
+            running = 0;
             reply = NULL; // no response
             break;
 
@@ -1686,6 +2276,12 @@ int32_t serve(stlink_t *sl, st_state_t *st) {
             free(reply);
         }
 
+        if (notify >= 0 && notify_stop(client, sl, notify) != 0) {
+            free(packet);
+            close_socket(client);
+            return (1);
+        }
+
         if (critical_error) {
             close_socket(client);
             return (1);
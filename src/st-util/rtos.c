@@ -0,0 +1,438 @@
+/*
+ * File: rtos.c
+ *
+ * FreeRTOS thread awareness for st-util
+ *
+ * The kernel's task lists are walked to report one GDB thread per task. The
+ * symbols are requested from GDB with qSymbol. Target memory is only accessed
+ * through a small page cache which is dropped whenever the core is resumed
+ * or written to, so that listing tasks, their names and stacked registers
+ * costs a handful of bulk reads per halt instead of one transaction per list
+ * item.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <stlink.h>
+#include "rtos.h"
+
+#include <logging.h>
+#include <read_write.h>
+#include <register.h>
+
+#define RTOS_PAGE_SIZE       0x1000 // below the 0x1800 limit of a single read
+#define RTOS_PAGE_NUM        16
+#define RTOS_THREAD_NUM_MAX  256
+#define RTOS_READY_LISTS_MAX 64
+
+/*
+ * FreeRTOS data layout on Cortex-M with the default configuration
+ * (no MPU wrappers, no list integrity check bytes)
+ */
+#define FREERTOS_LIST_SIZE         20 // uxNumberOfItems, pxIndex, xListEnd (MiniListItem_t)
+#define FREERTOS_LIST_END_OFFSET   8
+#define FREERTOS_ITEM_NEXT_OFFSET  4
+#define FREERTOS_ITEM_OWNER_OFFSET 12
+#define FREERTOS_TCB_PRIO_OFFSET   44
+#define FREERTOS_TCB_NAME_OFFSET   52
+#define FREERTOS_TCB_NAME_LEN      16
+
+enum freertos_symbol {
+    SYM_pxCurrentTCB = 0,
+    SYM_pxReadyTasksLists,
+    SYM_xDelayedTaskList1,
+    SYM_xDelayedTaskList2,
+    SYM_xPendingReadyList,
+    SYM_xSuspendedTaskList,
+    SYM_xTasksWaitingTermination,
+    SYM_uxTopUsedPriority,
+    SYM_NUM
+};
+
+static const char* const symbol_names[SYM_NUM] = {
+    "pxCurrentTCB",
+    "pxReadyTasksLists",
+    "xDelayedTaskList1",
+    "xDelayedTaskList2",
+    "xPendingReadyList",
+    "xSuspendedTaskList",
+    "xTasksWaitingTermination",
+    "uxTopUsedPriority",
+};
+
+// symbols which must be known to enable thread awareness
+#define SYM_REQUIRED_NUM (SYM_xPendingReadyList + 1)
+
+struct rtos_page {
+    stm32_addr_t addr;
+    int32_t valid;
+    uint8_t data[RTOS_PAGE_SIZE];
+};
+
+struct rtos_thread {
+    uint32_t tcb;
+    uint32_t top_of_stack;
+    uint32_t priority;
+    const char* state;
+    char name[FREERTOS_TCB_NAME_LEN + 1];
+};
+
+static uint32_t symbols[SYM_NUM];
+static uint32_t symbol_next;
+
+static struct rtos_page pages[RTOS_PAGE_NUM];
+static uint32_t page_victim;
+
+static struct rtos_thread threads[RTOS_THREAD_NUM_MAX];
+static uint32_t thread_num;
+static uint32_t thread_current;
+static int32_t threads_valid;
+static int32_t fpu_frames;
+
+void rtos_init(void) {
+    memset(symbols, 0, sizeof(symbols));
+    symbol_next = 0;
+    rtos_invalidate();
+}
+
+// start a new halt epoch: everything read from the target before is stale
+void rtos_invalidate(void) {
+    for (uint32_t i = 0; i < RTOS_PAGE_NUM; i++) { pages[i].valid = 0; }
+
+    threads_valid = 0;
+}
+
+static int32_t rtos_read(stlink_t *sl, stm32_addr_t addr, void *data, uint32_t len) {
+    uint8_t *out = data;
+
+    while (len) {
+        stm32_addr_t page_addr = addr & ~(RTOS_PAGE_SIZE - 1);
+        uint32_t offset = addr - page_addr;
+        uint32_t chunk = RTOS_PAGE_SIZE - offset;
+
+        if (chunk > len) { chunk = len; }
+
+        if (page_addr < sl->sram_base || page_addr + RTOS_PAGE_SIZE > sl->sram_base + sl->sram_size) {
+            // outside of the main SRAM, only fetch what was asked for
+            stm32_addr_t start = addr & ~3u;
+            uint32_t count = (addr + chunk - start + 3) & ~3u;
+
+            if (count > RTOS_PAGE_SIZE) {
+                count = RTOS_PAGE_SIZE;
+                chunk = count - (addr - start);
+            }
+
+            if (stlink_read_mem32(sl, start, (uint16_t)count)) { return (-1); }
+
+            memcpy(out, &sl->q_buf[addr - start], chunk);
+        } else {
+            struct rtos_page *page = NULL;
+
+            for (uint32_t i = 0; i < RTOS_PAGE_NUM; i++)
+                if (pages[i].valid && pages[i].addr == page_addr) {
+                    page = &pages[i];
+                    break;
+                }
+
+            if (page == NULL) {
+                page = &pages[page_victim];
+                page_victim = (page_victim + 1) % RTOS_PAGE_NUM;
+
+                if (stlink_read_mem32(sl, page_addr, RTOS_PAGE_SIZE)) {
+                    page->valid = 0;
+                    return (-1);
+                }
+
+                memcpy(page->data, sl->q_buf, RTOS_PAGE_SIZE);
+                page->addr = page_addr;
+                page->valid = 1;
+            }
+
+            memcpy(out, &page->data[offset], chunk);
+        }
+
+        out += chunk;
+        addr += chunk;
+        len -= chunk;
+    }
+
+    return (0);
+}
+
+static int32_t rtos_read_u32(stlink_t *sl, stm32_addr_t addr, uint32_t *val) {
+    uint8_t buf[4];
+
+    if (rtos_read(sl, addr, buf, 4)) { return (-1); }
+
+    *val = read_uint32(buf, 0);
+    return (0);
+}
+
+static struct rtos_thread* find_thread(uint32_t id) {
+    for (uint32_t i = 0; i < thread_num; i++)
+        if (threads[i].tcb == id) { return (&threads[i]); }
+
+    return (NULL);
+}
+
+static void add_list_threads(stlink_t *sl, stm32_addr_t list, const char* state) {
+    uint8_t hdr[FREERTOS_LIST_SIZE];
+    uint8_t item[FREERTOS_ITEM_OWNER_OFFSET + 4];
+
+    if (list == 0 || rtos_read(sl, list, hdr, sizeof(hdr))) { return; }
+
+    uint32_t count = read_uint32(hdr, 0);
+    stm32_addr_t end = list + FREERTOS_LIST_END_OFFSET;
+    stm32_addr_t next = read_uint32(hdr, FREERTOS_LIST_END_OFFSET + FREERTOS_ITEM_NEXT_OFFSET);
+
+    // the item count bounds the walk in case the list is corrupt
+    while (next != end && count-- > 0 && thread_num < RTOS_THREAD_NUM_MAX) {
+        if (rtos_read(sl, next, item, sizeof(item))) { return; }
+
+        uint32_t tcb = read_uint32(item, FREERTOS_ITEM_OWNER_OFFSET);
+
+        if (tcb && find_thread(tcb) == NULL) {
+            threads[thread_num].tcb = tcb;
+            threads[thread_num].state = state;
+            thread_num++;
+        }
+
+        next = read_uint32(item, FREERTOS_ITEM_NEXT_OFFSET);
+    }
+}
+
+static uint32_t ready_list_num(stlink_t *sl) {
+    uint32_t top;
+
+    if (symbols[SYM_uxTopUsedPriority] && !rtos_read_u32(sl, symbols[SYM_uxTopUsedPriority], &top) &&
+        top < RTOS_READY_LISTS_MAX) {
+        return (top + 1);
+    }
+
+    // pxReadyTasksLists[configMAX_PRIORITIES] is directly followed by xDelayedTaskList1 in tasks.c
+    if (symbols[SYM_xDelayedTaskList1] > symbols[SYM_pxReadyTasksLists]) {
+        uint32_t span = symbols[SYM_xDelayedTaskList1] - symbols[SYM_pxReadyTasksLists];
+
+        if (span % FREERTOS_LIST_SIZE == 0 && span / FREERTOS_LIST_SIZE <= RTOS_READY_LISTS_MAX) {
+            return (span / FREERTOS_LIST_SIZE);
+        }
+    }
+
+    return (1);
+}
+
+static void update_threads(stlink_t *sl) {
+    uint32_t cpacr;
+
+    if (threads_valid) { return; }
+
+    threads_valid = 1;
+    thread_num = 0;
+    thread_current = 0;
+
+    for (uint32_t i = 0; i < SYM_REQUIRED_NUM; i++)
+        if (symbols[i] == 0) { return; }
+
+    // scheduler not started yet
+    if (rtos_read_u32(sl, symbols[SYM_pxCurrentTCB], &thread_current) || thread_current == 0) {
+        thread_current = 0;
+        return;
+    }
+
+    uint32_t lists = ready_list_num(sl);
+
+    for (uint32_t i = 0; i < lists; i++) {
+        add_list_threads(sl, symbols[SYM_pxReadyTasksLists] + i * FREERTOS_LIST_SIZE, "Ready");
+    }
+
+    add_list_threads(sl, symbols[SYM_xPendingReadyList], "Ready");
+    add_list_threads(sl, symbols[SYM_xDelayedTaskList1], "Blocked");
+    add_list_threads(sl, symbols[SYM_xDelayedTaskList2], "Blocked");
+    add_list_threads(sl, symbols[SYM_xSuspendedTaskList], "Suspended");
+    add_list_threads(sl, symbols[SYM_xTasksWaitingTermination], "Deleted");
+
+    if (find_thread(thread_current) == NULL && thread_num < RTOS_THREAD_NUM_MAX) {
+        threads[thread_num++].tcb = thread_current;
+    }
+
+    for (uint32_t i = 0; i < thread_num; i++) {
+        uint8_t tcb[FREERTOS_TCB_NAME_OFFSET + FREERTOS_TCB_NAME_LEN];
+        struct rtos_thread *t = &threads[i];
+
+        if (t->tcb == thread_current) { t->state = "Running"; }
+
+        if (rtos_read(sl, t->tcb, tcb, sizeof(tcb))) {
+            t->name[0] = '\0';
+            continue;
+        }
+
+        t->top_of_stack = read_uint32(tcb, 0);
+        t->priority = read_uint32(tcb, FREERTOS_TCB_PRIO_OFFSET);
+        memcpy(t->name, &tcb[FREERTOS_TCB_NAME_OFFSET], FREERTOS_TCB_NAME_LEN);
+        t->name[FREERTOS_TCB_NAME_LEN] = '\0';
+    }
+
+    // the CM4F/CM7 ports stack EXC_RETURN and, for FPU contexts, s16-s31
+    fpu_frames = (!stlink_read_debug32(sl, STLINK_REG_CPACR, &cpacr) && (cpacr & STLINK_REG_CPACR_CP10_CP11));
+
+    DLOG("rtos: %u threads, current %08x\n", thread_num, thread_current);
+}
+
+int32_t rtos_active(stlink_t *sl) {
+    update_threads(sl);
+    return (thread_num > 0);
+}
+
+static char* hexify(const char* str) {
+    uint32_t len = (uint32_t) strlen(str);
+    char* out = calloc(1, len * 2 + 1);
+
+    for (uint32_t i = 0; i < len; i++) { sprintf(&out[i * 2], "%02x", (uint8_t)str[i]); }
+
+    return (out);
+}
+
+// ask GDB for the next symbol, or finish the lookup sequence
+static char* symbol_request(void) {
+    char* hexname;
+    char* reply;
+
+    if (symbol_next >= SYM_NUM) { return (strdup("OK")); }
+
+    hexname = hexify(symbol_names[symbol_next]);
+    reply = calloc(1, strlen(hexname) + 9);
+    sprintf(reply, "qSymbol:%s", hexname);
+    free(hexname);
+    return (reply);
+}
+
+/*
+ * qSymbol::               GDB is ready to serve symbol lookups
+ * qSymbol:<addr>:<name>   lookup result, <addr> is empty for unknown symbols
+ */
+char* rtos_symbol_query(const char* params) {
+    const char* name = strchr(params, ':');
+
+    if (name == NULL || name[1] == '\0') {
+        rtos_init();
+    } else if (symbol_next < SYM_NUM) {
+        symbols[symbol_next] = (name != params) ? (uint32_t) strtoul(params, NULL, 16) : 0;
+        DLOG("rtos: %s = %08x\n", symbol_names[symbol_next], symbols[symbol_next]);
+        symbol_next++;
+    }
+
+    threads_valid = 0;
+    return (symbol_request());
+}
+
+char* rtos_thread_info(stlink_t *sl, int32_t first) {
+    if (!first || !rtos_active(sl)) { return (strdup("l")); }
+
+    char* reply = calloc(1, thread_num * 9 + 2);
+    char* p = reply;
+
+    *p++ = 'm';
+
+    for (uint32_t i = 0; i < thread_num; i++) { p += sprintf(p, i ? ",%x" : "%x", threads[i].tcb); }
+
+    return (reply);
+}
+
+char* rtos_thread_extra_info(stlink_t *sl, uint32_t id) {
+    struct rtos_thread *t;
+    char info[64];
+
+    update_threads(sl);
+    t = find_thread(id);
+
+    if (t == NULL) { return (strdup("E00")); }
+
+    snprintf(info, sizeof(info), "%s [%s, prio %u]", t->name, t->state ? t->state : "Unknown", t->priority);
+    return (hexify(info));
+}
+
+char* rtos_stop_reply(stlink_t *sl, uint32_t signal) {
+    char* reply = calloc(1, 32);
+
+    if (!rtos_active(sl)) {
+        sprintf(reply, "S%02x", signal);
+    } else {
+        sprintf(reply, "T%02xthread:%x;", signal, thread_current);
+    }
+
+    return (reply);
+}
+
+uint32_t rtos_current_thread(stlink_t *sl) {
+    update_threads(sl);
+    return (thread_current);
+}
+
+int32_t rtos_thread_alive(stlink_t *sl, uint32_t id) {
+    update_threads(sl);
+    return (find_thread(id) != NULL);
+}
+
+/*
+ * Fetch the registers of a task which is not running from its stack.
+ * Returns 1 if regp was filled in, 0 if id refers to the running task (or no
+ * task at all) and the core registers apply, -1 on error.
+ */
+int32_t rtos_read_thread_regs(stlink_t *sl, uint32_t id, struct stlink_reg *regp) {
+    uint8_t frame[51 * 4];
+    uint32_t offset = 0;
+    uint32_t exc_return = 0xFFFFFFFD;
+    struct rtos_thread *t;
+
+    update_threads(sl);
+
+    if (id == 0 || id == thread_current || (t = find_thread(id)) == NULL) { return (0); }
+
+    if (rtos_read(sl, t->top_of_stack, frame, sizeof(frame))) { return (-1); }
+
+    memset(regp, 0, sizeof(*regp));
+
+    // r4-r11 are saved by the context switch
+    for (uint32_t i = 0; i < 8; i++) { regp->r[4 + i] = read_uint32(frame, (i * 4)); }
+
+    offset = 8 * 4;
+
+    if (fpu_frames) {
+        exc_return = read_uint32(frame, offset);
+        offset += 4;
+
+        if (!(exc_return & 0x10)) {
+            for (uint32_t i = 0; i < 16; i++) { regp->s[16 + i] = read_uint32(frame, offset + i * 4); }
+
+            offset += 16 * 4;
+        }
+    }
+
+    // exception frame stacked by the hardware
+    regp->r[0] = read_uint32(frame, offset + 0);
+    regp->r[1] = read_uint32(frame, offset + 4);
+    regp->r[2] = read_uint32(frame, offset + 8);
+    regp->r[3] = read_uint32(frame, offset + 12);
+    regp->r[12] = read_uint32(frame, offset + 16);
+    regp->r[14] = read_uint32(frame, offset + 20);
+    regp->r[15] = read_uint32(frame, offset + 24);
+    regp->xpsr = read_uint32(frame, offset + 28);
+    offset += 8 * 4;
+
+    if (fpu_frames && !(exc_return & 0x10)) {
+        for (uint32_t i = 0; i < 16; i++) { regp->s[i] = read_uint32(frame, offset + i * 4); }
+
+        regp->fpscr = read_uint32(frame, offset + 16 * 4);
+        offset += 18 * 4;
+    }
+
+    // stack realignment on exception entry
+    if (regp->xpsr & (1 << 9)) { offset += 4; }
+
+    regp->r[13] = t->top_of_stack + offset;
+    regp->process_sp = regp->r[13];
+    return (1);
+}
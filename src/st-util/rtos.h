@@ -0,0 +1,20 @@
+#ifndef RTOS_H
+#define RTOS_H
+
+#include <stdint.h>
+
+#include <stlink.h>
+
+void rtos_init(void);
+void rtos_invalidate(void);
+int32_t rtos_active(stlink_t *sl);
+
+char* rtos_symbol_query(const char* params);
+char* rtos_thread_info(stlink_t *sl, int32_t first);
+char* rtos_thread_extra_info(stlink_t *sl, uint32_t id);
+char* rtos_stop_reply(stlink_t *sl, uint32_t signal);
+uint32_t rtos_current_thread(stlink_t *sl);
+int32_t rtos_thread_alive(stlink_t *sl, uint32_t id);
+int32_t rtos_read_thread_regs(stlink_t *sl, uint32_t id, struct stlink_reg *regp);
+
+#endif // RTOS_H
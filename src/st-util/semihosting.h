@@ -27,10 +27,15 @@
 
 #define SEMIHOST_SYS_GET_CMD  0x15
 #define SEMIHOST_SYS_HEAPINFO 0x16
+#define SEMIHOST_SYS_EXIT     0x18
+#define SEMIHOST_SYS_EXIT_EXTENDED 0x20
 
 #define SEMIHOST_SYS_ELAPSED  0x30
 #define SEMIHOST_SYS_TICKFREQ 0x31
 
+// SYS_EXIT reason of a normal termination, anything else is a failure
+#define SEMIHOST_ADP_STOPPED_APPLICATION_EXIT 0x20026
+
 int32_t do_semihosting(stlink_t *sl, uint32_t r0, uint32_t r1, uint32_t *ret);
 
 #endif // SEMIHOSTING_H
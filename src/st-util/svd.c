@@ -0,0 +1,767 @@
+/*
+ * File: svd.c
+ *
+ * CMSIS-SVD peripheral register snapshots for st-util
+ *
+ * The SVD file is parsed once at startup into a table of peripherals sorted
+ * by name, each holding its registers sorted by offset. A snapshot reads the
+ * registers of a peripheral with as few bulk reads as possible: neighbouring
+ * registers share one read unless a read-sensitive register lies in between.
+ * Registers which are write-only or have a readAction (flags cleared on
+ * read, FIFOs, ...) are never read.
+ */
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <stlink.h>
+#include "svd.h"
+
+#include <helper.h>
+#include <logging.h>
+#include <read_write.h>
+
+#define SVD_NAME_LEN 32
+#define SVD_READ_MAX 0x1800 // largest single read the probes handle reliably
+#define SVD_GAP_MAX  16     // reserved words read along instead of splitting the read
+
+struct xml_node {
+    char* name;
+    char* text;
+    char* derived_from; // the only attribute needed from an SVD file
+    struct xml_node* parent;
+    struct xml_node* child;
+    struct xml_node* last;
+    struct xml_node* next;
+};
+
+struct svd_field {
+    char name[SVD_NAME_LEN];
+    uint32_t offset;
+    uint32_t width;
+};
+
+struct svd_register {
+    char name[SVD_NAME_LEN];
+    uint32_t offset;
+    uint32_t size;    // in bytes
+    int32_t readable; // 0 for write-only and read-sensitive registers
+    uint32_t field_num;
+    struct svd_field* fields;
+    uint32_t value;
+    uint32_t prev;
+    int32_t valid;
+    int32_t prev_valid;
+};
+
+struct svd_peripheral {
+    char name[SVD_NAME_LEN];
+    char derived_from[SVD_NAME_LEN];
+    stm32_addr_t base;
+    uint32_t reg_num;
+    uint32_t reg_cap;
+    struct svd_register* regs;
+};
+
+// register properties inherited from the device and peripheral level
+struct svd_props {
+    uint32_t size; // in bits
+    int32_t readable;
+};
+
+struct svd_out {
+    char* buf;
+    size_t len;
+    size_t cap;
+};
+
+static struct svd_peripheral* periphs = NULL;
+static uint32_t periph_num = 0;
+
+static char* xml_strndup(const char* s, size_t len) {
+    char* r = malloc(len + 1);
+
+    if (r != NULL) {
+        memcpy(r, s, len);
+        r[len] = '\0';
+    }
+
+    return (r);
+}
+
+static void xml_free(struct xml_node* n) {
+    while (n != NULL) {
+        struct xml_node* next = n->next;
+        xml_free(n->child);
+        free(n->name);
+        free(n->text);
+        free(n->derived_from);
+        free(n);
+        n = next;
+    }
+}
+
+static void xml_set_text(struct xml_node* n, const char* s, const char* end) {
+    while (s < end && isspace((unsigned char)*s)) { s++; }
+
+    while (end > s && isspace((unsigned char)end[-1])) { end--; }
+
+    if (s < end && n->text == NULL) { n->text = xml_strndup(s, end - s); }
+}
+
+static char* xml_attribute(const char* tag, const char* end, const char* attr) {
+    size_t len = strlen(attr);
+
+    for (const char* p = tag + 1; p + len < end; p++) {
+        if (strncmp(p, attr, len) || !isspace((unsigned char)p[-1])) { continue; }
+
+        const char* q = p + len;
+
+        while (q < end && isspace((unsigned char)*q)) { q++; }
+
+        if (q >= end || *q++ != '=') { continue; }
+
+        while (q < end && isspace((unsigned char)*q)) { q++; }
+
+        if (q >= end || (*q != '"' && *q != '\'')) { continue; }
+
+        const char* value = q + 1;
+        const char* value_end = memchr(value, *q, end - value);
+        return (value_end ? xml_strndup(value, value_end - value) : NULL);
+    }
+
+    return (NULL);
+}
+
+/*
+ * Minimal XML reader, good enough for SVD files: elements, character data,
+ * comments and CDATA. Entities are not decoded, names never contain any.
+ */
+static struct xml_node* xml_parse(const char* p) {
+    struct xml_node* root = calloc(1, sizeof(*root));
+    struct xml_node* cur = root;
+
+    if (root == NULL) { return (NULL); }
+
+    while (p != NULL && *p) {
+        if (*p != '<') {
+            const char* end = strchr(p, '<');
+
+            if (end == NULL) { break; }
+
+            xml_set_text(cur, p, end);
+            p = end;
+        } else if (!strncmp(p, "<!--", 4)) {
+            p = strstr(p + 4, "-->");
+            p = p ? p + 3 : NULL;
+        } else if (!strncmp(p, "<![CDATA[", 9)) {
+            const char* end = strstr(p + 9, "]]>");
+
+            if (end == NULL) { break; }
+
+            xml_set_text(cur, p + 9, end);
+            p = end + 3;
+        } else if (p[1] == '?' || p[1] == '!') {
+            p = strchr(p, '>');
+            p = p ? p + 1 : NULL;
+        } else if (p[1] == '/') {
+            if (cur->parent != NULL) { cur = cur->parent; }
+
+            p = strchr(p, '>');
+            p = p ? p + 1 : NULL;
+        } else {
+            const char* end = strchr(p, '>');
+            struct xml_node* node;
+
+            if (end == NULL || (node = calloc(1, sizeof(*node))) == NULL) { break; }
+
+            node->name = xml_strndup(p + 1, strcspn(p + 1, " \t\r\n/>"));
+            node->derived_from = xml_attribute(p, end, "derivedFrom");
+            node->parent = cur;
+
+            if (cur->last != NULL) {
+                cur->last->next = node;
+            } else {
+                cur->child = node;
+            }
+
+            cur->last = node;
+
+            if (end[-1] != '/') { cur = node; }
+
+            p = end + 1;
+        }
+    }
+
+    return (root);
+}
+
+static const struct xml_node* xml_child(const struct xml_node* n, const char* name) {
+    for (n = n ? n->child : NULL; n != NULL; n = n->next) {
+        if (n->name != NULL && !strcmp(n->name, name)) { return (n); }
+    }
+
+    return (NULL);
+}
+
+static const char* xml_text(const struct xml_node* n, const char* name) {
+    n = xml_child(n, name);
+    return (n ? n->text : NULL);
+}
+
+static uint32_t svd_number(const char* s, uint32_t def) {
+    if (s == NULL) { return (def); }
+
+    if (s[0] == '#') { return ((uint32_t)strtoul(s + 1, NULL, 2)); }
+
+    if (s[0] == '0' && (s[1] == 'b' || s[1] == 'B')) { return ((uint32_t)strtoul(s + 2, NULL, 2)); }
+
+    return ((uint32_t)strtoul(s, NULL, 0));
+}
+
+static int32_t svd_name_cmp(const char* a, const char* b) {
+    while (*a && toupper((unsigned char)*a) == toupper((unsigned char)*b)) {
+        a++;
+        b++;
+    }
+
+    return (toupper((unsigned char)*a) - toupper((unsigned char)*b));
+}
+
+// a trailing '*' matches any suffix, e.g. GPIO* or TIM*
+static int32_t svd_name_match(const char* pattern, const char* name) {
+    size_t len = strlen(pattern);
+
+    if (len && pattern[len - 1] == '*') {
+        for (size_t i = 0; i < len - 1; i++) {
+            if (toupper((unsigned char)pattern[i]) != toupper((unsigned char)name[i])) { return (0); }
+        }
+
+        return (1);
+    }
+
+    return (svd_name_cmp(pattern, name) == 0);
+}
+
+static struct svd_props svd_inherit(const struct xml_node* n, struct svd_props props) {
+    const char* access = xml_text(n, "access");
+
+    props.size = svd_number(xml_text(n, "size"), props.size);
+
+    if (access != NULL) { props.readable = strcmp(access, "write-only") && strcmp(access, "writeOnce"); }
+
+    return (props);
+}
+
+// index i of a dimIndex list ("0-7", "A,B,C") as text
+static void svd_dim_index(const char* list, uint32_t i, char* out) {
+    if (list != NULL && strchr(list, ',') != NULL) {
+        while (i-- && list != NULL) {
+            list = strchr(list, ',');
+            list = list ? list + 1 : NULL;
+        }
+
+        snprintf(out, SVD_NAME_LEN, "%.*s", list ? (int32_t)strcspn(list, ",") : 0, list ? list : "");
+    } else if (list != NULL && isalpha((unsigned char)list[0])) {
+        snprintf(out, SVD_NAME_LEN, "%c", list[0] + i);
+    } else {
+        snprintf(out, SVD_NAME_LEN, "%u", (list ? (uint32_t)strtoul(list, NULL, 0) : 0) + i);
+    }
+}
+
+// append at most len characters of src, names are cut at SVD_NAME_LEN
+static void svd_append_name(char* dst, const char* src, size_t len) {
+    size_t used = strlen(dst);
+
+    while (len-- && *src && used < SVD_NAME_LEN - 1) { dst[used++] = *src++; }
+
+    dst[used] = '\0';
+}
+
+static void svd_set_name(char* dst, const char* src) {
+    dst[0] = '\0';
+    svd_append_name(dst, src, strlen(src));
+}
+
+// name with "%s" replaced by the dim index
+static void svd_dim_name(const char* name, const char* index, char* out) {
+    const char* s = strstr(name, "%s");
+
+    out[0] = '\0';
+
+    if (s != NULL) {
+        svd_append_name(out, name, s - name);
+        svd_append_name(out, index, strlen(index));
+        svd_append_name(out, s + 2, strlen(s + 2));
+    } else {
+        svd_append_name(out, name, strlen(name));
+    }
+}
+
+static struct svd_register* svd_new_register(struct svd_peripheral* p) {
+    if (p->reg_num == p->reg_cap) {
+        uint32_t cap = p->reg_cap ? p->reg_cap * 2 : 16;
+        struct svd_register* regs = realloc(p->regs, cap * sizeof(*regs));
+
+        if (regs == NULL) { return (NULL); }
+
+        p->regs = regs;
+        p->reg_cap = cap;
+    }
+
+    struct svd_register* r = &p->regs[p->reg_num++];
+    memset(r, 0, sizeof(*r));
+    return (r);
+}
+
+static void svd_parse_fields(struct svd_register* r, const struct xml_node* reg) {
+    const struct xml_node* fields = xml_child(reg, "fields");
+    const struct xml_node* f;
+    uint32_t num = 0;
+
+    for (f = fields ? fields->child : NULL; f != NULL; f = f->next) {
+        if (!strcmp(f->name, "field")) { num++; }
+    }
+
+    if (num == 0 || (r->fields = calloc(num, sizeof(*r->fields))) == NULL) { return; }
+
+    for (f = fields->child; f != NULL; f = f->next) {
+        struct svd_field* field = &r->fields[r->field_num];
+        const char* range = xml_text(f, "bitRange");
+        uint32_t msb, lsb;
+
+        if (strcmp(f->name, "field")) { continue; }
+
+        if (xml_text(f, "bitOffset") != NULL) {
+            field->offset = svd_number(xml_text(f, "bitOffset"), 0);
+            field->width = svd_number(xml_text(f, "bitWidth"), 1);
+        } else if (xml_text(f, "lsb") != NULL) {
+            lsb = svd_number(xml_text(f, "lsb"), 0);
+            msb = svd_number(xml_text(f, "msb"), lsb);
+            field->offset = lsb;
+            field->width = msb - lsb + 1;
+        } else if (range != NULL && sscanf(range, "[%u:%u]", &msb, &lsb) == 2) {
+            field->offset = lsb;
+            field->width = msb - lsb + 1;
+        } else {
+            continue;
+        }
+
+        // reading one field with side effects makes the whole register sensitive
+        if (xml_child(f, "readAction") != NULL) { r->readable = 0; }
+
+        svd_set_name(field->name, xml_text(f, "name") ? xml_text(f, "name") : "?");
+        r->field_num++;
+    }
+}
+
+static void svd_parse_registers(struct svd_peripheral* p, const struct xml_node* block, const char* prefix,
+                                uint32_t base, struct svd_props props) {
+    for (const struct xml_node* n = block->child; n != NULL; n = n->next) {
+        int32_t cluster = !strcmp(n->name, "cluster");
+        const char* name = xml_text(n, "name");
+
+        if ((!cluster && strcmp(n->name, "register")) || name == NULL) { continue; }
+
+        struct svd_props reg_props = svd_inherit(n, props);
+        uint32_t offset = base + svd_number(xml_text(n, "addressOffset"), 0);
+        uint32_t dim = svd_number(xml_text(n, "dim"), 1);
+        uint32_t increment = svd_number(xml_text(n, "dimIncrement"), 0);
+
+        for (uint32_t i = 0; i < dim; i++) {
+            char index[SVD_NAME_LEN];
+            char dim_name[SVD_NAME_LEN];
+            char full_name[SVD_NAME_LEN];
+
+            svd_dim_index(xml_text(n, "dimIndex"), i, index);
+            svd_dim_name(name, index, dim_name);
+            svd_set_name(full_name, prefix);
+            svd_append_name(full_name, dim_name, strlen(dim_name));
+
+            if (cluster) {
+                svd_append_name(full_name, "_", 1);
+                svd_parse_registers(p, n, full_name, offset + i * increment, reg_props);
+                continue;
+            }
+
+            struct svd_register* r = svd_new_register(p);
+
+            if (r == NULL) { return; }
+
+            svd_set_name(r->name, full_name);
+            r->offset = offset + i * increment;
+            r->size = reg_props.size / 8;
+
+            if (r->size != 1 && r->size != 2) { r->size = 4; }
+
+            r->readable = reg_props.readable && xml_child(n, "readAction") == NULL;
+            svd_parse_fields(r, n);
+        }
+    }
+}
+
+static int register_cmp(const void* a, const void* b) {
+    const struct svd_register* ra = a;
+    const struct svd_register* rb = b;
+    return ((ra->offset > rb->offset) - (ra->offset < rb->offset));
+}
+
+static int peripheral_cmp(const void* a, const void* b) {
+    return (svd_name_cmp(((const struct svd_peripheral*)a)->name, ((const struct svd_peripheral*)b)->name));
+}
+
+static struct svd_peripheral* svd_find(const char* name) {
+    struct svd_peripheral key;
+    svd_set_name(key.name, name);
+    return (bsearch(&key, periphs, periph_num, sizeof(*periphs), peripheral_cmp));
+}
+
+static void svd_copy_registers(struct svd_peripheral* dst, const struct svd_peripheral* src) {
+    dst->regs = calloc(src->reg_num, sizeof(*dst->regs));
+
+    if (dst->regs == NULL) { return; }
+
+    for (uint32_t i = 0; i < src->reg_num; i++) {
+        dst->regs[i] = src->regs[i];
+        dst->regs[i].fields = NULL;
+        dst->regs[i].field_num = 0;
+
+        if (src->regs[i].field_num &&
+            (dst->regs[i].fields = malloc(src->regs[i].field_num * sizeof(struct svd_field))) != NULL) {
+            memcpy(dst->regs[i].fields, src->regs[i].fields, src->regs[i].field_num * sizeof(struct svd_field));
+            dst->regs[i].field_num = src->regs[i].field_num;
+        }
+    }
+
+    dst->reg_num = dst->reg_cap = src->reg_num;
+}
+
+static void svd_parse_device(const struct xml_node* device) {
+    const struct xml_node* list = xml_child(device, "peripherals");
+    struct svd_props props = {32, 1};
+    uint32_t num = 0;
+
+    props = svd_inherit(device, props);
+
+    for (const struct xml_node* n = list ? list->child : NULL; n != NULL; n = n->next) { num++; }
+
+    if (num == 0 || (periphs = calloc(num, sizeof(*periphs))) == NULL) { return; }
+
+    for (const struct xml_node* n = list->child; n != NULL; n = n->next) {
+        const struct xml_node* regs = xml_child(n, "registers");
+        struct svd_peripheral* p = &periphs[periph_num];
+
+        if (strcmp(n->name, "peripheral") || xml_text(n, "name") == NULL) { continue; }
+
+        svd_set_name(p->name, xml_text(n, "name"));
+        svd_set_name(p->derived_from, n->derived_from ? n->derived_from : "");
+        p->base = svd_number(xml_text(n, "baseAddress"), 0);
+
+        if (regs != NULL) { svd_parse_registers(p, regs, "", 0, svd_inherit(n, props)); }
+
+        qsort(p->regs, p->reg_num, sizeof(*p->regs), register_cmp);
+        periph_num++;
+    }
+
+    qsort(periphs, periph_num, sizeof(*periphs), peripheral_cmp);
+
+    // a derived peripheral without registers of its own shares its source's layout
+    for (uint32_t i = 0; i < periph_num; i++) {
+        struct svd_peripheral* src;
+
+        if (periphs[i].reg_num || !periphs[i].derived_from[0]) { continue; }
+
+        if ((src = svd_find(periphs[i].derived_from)) != NULL) { svd_copy_registers(&periphs[i], src); }
+    }
+}
+
+void svd_free(void) {
+    for (uint32_t i = 0; i < periph_num; i++) {
+        for (uint32_t j = 0; j < periphs[i].reg_num; j++) { free(periphs[i].regs[j].fields); }
+
+        free(periphs[i].regs);
+    }
+
+    free(periphs);
+    periphs = NULL;
+    periph_num = 0;
+}
+
+int32_t svd_load(const char* path) {
+    FILE* fp = fopen(path, "rb");
+    const struct xml_node* device;
+    struct xml_node* root;
+    char* buf = NULL;
+    long len = 0;
+
+    if (fp == NULL) {
+        ELOG("Cannot open SVD file %s\n", path);
+        return (-1);
+    }
+
+    if (fseek(fp, 0, SEEK_END) == 0 && (len = ftell(fp)) > 0 && fseek(fp, 0, SEEK_SET) == 0 &&
+        (buf = malloc(len + 1)) != NULL && fread(buf, 1, len, fp) == (size_t)len) {
+        buf[len] = '\0';
+    } else {
+        free(buf);
+        buf = NULL;
+    }
+
+    fclose(fp);
+
+    if (buf == NULL) {
+        ELOG("Cannot read SVD file %s\n", path);
+        return (-1);
+    }
+
+    root = xml_parse(buf);
+    free(buf);
+    device = xml_child(root, "device");
+
+    if (device == NULL) {
+        ELOG("%s is not an SVD file\n", path);
+        xml_free(root);
+        return (-1);
+    }
+
+    svd_free();
+    svd_parse_device(device);
+    xml_free(root);
+
+    ILOG("Loaded %u peripherals from %s\n", periph_num, path);
+    return (0);
+}
+
+static void out_printf(struct svd_out* out, const char* fmt, ...) {
+    va_list args;
+    int32_t n;
+
+    va_start(args, fmt);
+    n = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+
+    if (n < 0) { return; }
+
+    if (out->len + n + 1 > out->cap) {
+        size_t cap = out->cap ? out->cap : 4096;
+
+        while (out->len + n + 1 > cap) { cap *= 2; }
+
+        char* buf = realloc(out->buf, cap);
+
+        if (buf == NULL) { return; }
+
+        out->buf = buf;
+        out->cap = cap;
+    }
+
+    va_start(args, fmt);
+    vsnprintf(out->buf + out->len, out->cap - out->len, fmt, args);
+    va_end(args);
+    out->len += n;
+}
+
+static uint32_t svd_register_end(const struct svd_register* r) {
+    return ((r->offset + r->size + 3) & ~3u);
+}
+
+// returns the number of reads, the values of failed reads are marked invalid
+static uint32_t svd_read_peripheral(stlink_t *sl, struct svd_peripheral* p) {
+    uint32_t reads = 0;
+    uint32_t i, j;
+
+    for (i = 0; i < p->reg_num; i++) {
+        p->regs[i].prev = p->regs[i].value;
+        p->regs[i].prev_valid = p->regs[i].valid;
+        p->regs[i].valid = 0;
+    }
+
+    for (i = 0; i < p->reg_num; i = j) {
+        uint32_t start = p->regs[i].offset & ~3u;
+        uint32_t end = svd_register_end(&p->regs[i]);
+
+        if (!p->regs[i].readable) {
+            j = i + 1;
+            continue;
+        }
+
+        for (j = i + 1; j < p->reg_num; j++) {
+            const struct svd_register* next = &p->regs[j];
+
+            if (!next->readable || next->offset > end + SVD_GAP_MAX ||
+                svd_register_end(next) - start > SVD_READ_MAX) {
+                break;
+            }
+
+            if (svd_register_end(next) > end) { end = svd_register_end(next); }
+        }
+
+        reads++;
+
+        if (stlink_read_mem32(sl, p->base + start, (uint16_t)(end - start))) {
+            WLOG("Cannot read %s at %#010x\n", p->name, p->base + start);
+            continue;
+        }
+
+        for (uint32_t k = i; k < j; k++) {
+            struct svd_register* r = &p->regs[k];
+            const uint8_t* data = &sl->q_buf[r->offset - start];
+
+            r->value = (r->size == 1) ? data[0] : (r->size == 2) ? read_uint16(data, 0) : read_uint32(data, 0);
+            r->valid = 1;
+        }
+    }
+
+    return (reads);
+}
+
+static uint32_t svd_field_value(const struct svd_field* f, uint32_t value) {
+    uint32_t mask = (f->width >= 32) ? 0xFFFFFFFF : (1u << f->width) - 1;
+    return ((value >> f->offset) & mask);
+}
+
+static void svd_print_value(struct svd_out* out, const struct svd_field* f, uint32_t value) {
+    out_printf(out, f->width == 1 ? "%u" : "%#x", svd_field_value(f, value));
+}
+
+static void svd_print_register(struct svd_out* out, const struct svd_register* r) {
+    if (!r->readable) {
+        out_printf(out, "  %-20s (read-sensitive, not read)\n", r->name);
+        return;
+    } else if (!r->valid) {
+        out_printf(out, "  %-20s (read failed)\n", r->name);
+        return;
+    }
+
+    out_printf(out, "  %-20s 0x%0*x\n", r->name, (int32_t)(r->size * 2), r->value);
+
+    for (uint32_t i = 0; i < r->field_num; i++) {
+        out_printf(out, "    %-18s ", r->fields[i].name);
+        svd_print_value(out, &r->fields[i], r->value);
+        out_printf(out, "\n");
+    }
+}
+
+static int32_t svd_print_diff(struct svd_out* out, const struct svd_register* r) {
+    if (!r->valid || !r->prev_valid || r->value == r->prev) { return (0); }
+
+    out_printf(out, "  %-20s 0x%0*x -> 0x%0*x\n", r->name, (int32_t)(r->size * 2), r->prev,
+               (int32_t)(r->size * 2), r->value);
+
+    for (uint32_t i = 0; i < r->field_num; i++) {
+        const struct svd_field* f = &r->fields[i];
+
+        if (svd_field_value(f, r->prev) == svd_field_value(f, r->value)) { continue; }
+
+        out_printf(out, "    %-18s ", f->name);
+        svd_print_value(out, f, r->prev);
+        out_printf(out, " -> ");
+        svd_print_value(out, f, r->value);
+        out_printf(out, "\n");
+    }
+
+    return (1);
+}
+
+/*
+ * monitor svd <peripheral>...       snapshot and decode the peripherals
+ * monitor svd diff <peripheral>...  snapshot and show what changed since the last one
+ * monitor svd list                  list the peripherals of the SVD file
+ */
+char* svd_command(stlink_t *sl, const char* args) {
+    struct svd_out out = {NULL, 0, 0};
+    char* copy = strdup(args);
+    char* saveptr = NULL;
+    char* tok = copy ? strtok_r(copy, " \t", &saveptr) : NULL;
+    uint8_t* selected;
+    int32_t diff = 0;
+
+    if (periph_num == 0) {
+        out_printf(&out, "No SVD file loaded, start st-util with --svd <file>\n");
+        free(copy);
+        return (out.buf);
+    }
+
+    if (tok != NULL && !strcmp(tok, "list")) {
+        for (uint32_t i = 0; i < periph_num; i++) {
+            out_printf(&out, "%-20s 0x%08x %u registers\n", periphs[i].name, periphs[i].base, periphs[i].reg_num);
+        }
+
+        free(copy);
+        return (out.buf);
+    }
+
+    if (tok != NULL && !strcmp(tok, "diff")) {
+        diff = 1;
+        tok = strtok_r(NULL, " \t", &saveptr);
+    }
+
+    if (tok == NULL || (selected = calloc(periph_num, 1)) == NULL) {
+        out_printf(&out, "usage: monitor svd [diff] <peripheral>... (GPIO* matches all GPIO ports)\n"
+                   "       monitor svd list\n");
+        free(copy);
+        return (out.buf);
+    }
+
+    for (; tok != NULL; tok = strtok_r(NULL, " \t", &saveptr)) {
+        int32_t found = 0;
+
+        for (uint32_t i = 0; i < periph_num; i++) {
+            if (svd_name_match(tok, periphs[i].name)) { selected[i] = found = 1; }
+        }
+
+        if (!found) { out_printf(&out, "Unknown peripheral %s\n", tok); }
+    }
+
+    uint32_t start = time_ms();
+    uint32_t reads = 0, regs = 0, num = 0, changed = 0;
+
+    for (uint32_t i = 0; i < periph_num; i++) {
+        if (!selected[i]) { continue; }
+
+        reads += svd_read_peripheral(sl, &periphs[i]);
+        regs += periphs[i].reg_num;
+        num++;
+    }
+
+    uint32_t elapsed = time_ms() - start;
+
+    for (uint32_t i = 0; i < periph_num; i++) {
+        const struct svd_peripheral* p = &periphs[i];
+        size_t header = out.len;
+
+        if (!selected[i]) { continue; }
+
+        out_printf(&out, "%s @ 0x%08x\n", p->name, p->base);
+
+        if (!diff) {
+            for (uint32_t j = 0; j < p->reg_num; j++) { svd_print_register(&out, &p->regs[j]); }
+
+            continue;
+        }
+
+        uint32_t n = 0;
+
+        for (uint32_t j = 0; j < p->reg_num; j++) { n += svd_print_diff(&out, &p->regs[j]); }
+
+        // only list the peripherals which changed
+        if (n == 0 && out.buf != NULL) {
+            out.len = header;
+            out.buf[header] = '\0';
+        }
+
+        changed += n;
+    }
+
+    if (diff) { out_printf(&out, "%u registers changed\n", changed); }
+
+    out_printf(&out, "%u registers of %u peripherals in %u reads, %u ms\n", regs, num, reads, elapsed);
+
+    free(selected);
+    free(copy);
+    return (out.buf);
+}
@@ -0,0 +1,12 @@
+#ifndef SVD_H
+#define SVD_H
+
+#include <stdint.h>
+
+#include <stlink.h>
+
+int32_t svd_load(const char* path);
+void svd_free(void);
+char* svd_command(stlink_t *sl, const char* args);
+
+#endif // SVD_H
@@ -41,13 +41,20 @@ static void stlink_gui_init(STlinkGUI *self) {
     self->progress.activity_mode = FALSE;
     self->progress.fraction      = 0;
 
-    self->flash_mem.memory = NULL;
-    self->flash_mem.size   = 0;
-    self->flash_mem.base   = 0;
-
     self->file_mem.memory = NULL;
     self->file_mem.size   = 0;
     self->file_mem.base   = 0;
+
+    self->live.timer = 0;
+
+    self->jobs.queue   = g_async_queue_new();
+    self->jobs.pending = 0;
+    self->jobs.cancel  = 0;
+    g_mutex_init(&self->jobs.lock);
+
+    self->devmem_model  = NULL;
+    self->filemem_model = NULL;
+    g_mutex_init(&self->sl_lock);
 }
 
 static void help(void)
@@ -84,11 +91,12 @@ static void stlink_gui_set_info_error_message(STlinkGUI *gui, const gchar *messa
 }
 
 static void stlink_gui_set_sensitivity(STlinkGUI *gui, gboolean sensitivity) {
+    // flash, erase and export queue up, but sl must stay while jobs are pending
+    gboolean idle = sensitivity && (gui->jobs.pending == 0);
+
     gtk_widget_set_sensitive(GTK_WIDGET(gui->open_button), sensitivity);
 
-    if (sensitivity && gui->sl) {
-        gtk_widget_set_sensitive(GTK_WIDGET(gui->disconnect_button), sensitivity);
-    }
+    gtk_widget_set_sensitive(GTK_WIDGET(gui->disconnect_button), idle && (gui->sl != NULL));
 
     if (sensitivity && !gui->sl) {
         gtk_widget_set_sensitive(GTK_WIDGET(gui->connect_button), sensitivity);
@@ -98,9 +106,11 @@ static void stlink_gui_set_sensitivity(STlinkGUI *gui, gboolean sensitivity) {
         gtk_widget_set_sensitive(GTK_WIDGET(gui->flash_button), sensitivity);
     }
 
-    gtk_widget_set_sensitive(GTK_WIDGET(gui->reset_button), sensitivity && (gui->sl != NULL));
+    gtk_widget_set_sensitive(GTK_WIDGET(gui->reset_button), idle && (gui->sl != NULL));
 
     gtk_widget_set_sensitive(GTK_WIDGET(gui->export_button), sensitivity && (gui->sl != NULL));
+    gtk_widget_set_sensitive(GTK_WIDGET(gui->erase_button), sensitivity && (gui->sl != NULL));
+    gtk_widget_set_sensitive(GTK_WIDGET(gui->jobs.cancel_button), gui->jobs.pending > 0);
 }
 
 static void mem_view_init_headers(GtkTreeView *view) {
@@ -112,54 +122,36 @@ static void mem_view_init_headers(GtkTreeView *view) {
     renderer = gtk_cell_renderer_text_new();
     gtk_tree_view_insert_column_with_attributes(view, -1, "Address", renderer, "text", 0, /* column */ NULL);
 
-    for (i = 0; i < 4; i++) {
+    for (i = 0; i < MEM_MODEL_N_WORDS; i++) {
         gchar *label;
 
         label = g_strdup_printf("%X", i * 4);
         renderer = gtk_cell_renderer_text_new();
-        gtk_tree_view_insert_column_with_attributes(view, -1, label, renderer, "text", (i + 1), /* column */ NULL);
+        gtk_tree_view_insert_column_with_attributes(view, -1, label, renderer,
+                                                    "text", (i + 1),
+                                                    "background", (MEM_MODEL_COL_BG + i), /* column */ NULL);
         g_free(label);
     }
 
-    for (i = 0; i < 5; i++) {
+    for (i = 0; i < 1 + MEM_MODEL_N_WORDS; i++) {
         GtkTreeViewColumn *column = gtk_tree_view_get_column(view, i);
+        gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+        gtk_tree_view_column_set_fixed_width(column, 100);
         gtk_tree_view_column_set_expand(column, TRUE);
     }
-}
-
-static void mem_view_add_as_hex(GtkListStore *store,
-                                GtkTreeIter *iter,
-                                gint column,
-                                guint32 value) {
-    gchar     *hex_str;
 
-    hex_str = g_strdup_printf("0x%08X", value);
-    gtk_list_store_set(store, iter, column, hex_str, -1);
-    g_free(hex_str);
+    // all rows have the same height, without this the view would ask for every row to measure it
+    gtk_tree_view_set_fixed_height_mode(view, TRUE);
 }
 
-static void mem_view_add_buffer(GtkListStore *store,
-                                GtkTreeIter *iter,
-                                guint32 address,
-                                guchar *buffer,
-                                gint len) {
-    guint32 *word;
-    gint i, step;
-    gint column = 0;
-
-    step = sizeof(*word);
-
-    for (i = 0; i < len; i += step) {
-        word = (guint *)&buffer[i];
-
-        if (column == 0) {
-            gtk_list_store_append(store, iter); // new row
-            mem_view_add_as_hex(store, iter, column, (address + i)); // add address
-        }
-
-        mem_view_add_as_hex(store, iter, (column + 1), *word);
-        column = (column + 1) % step;
+static void mem_view_set_model(GtkTreeView *view, STlinkMemModel **slot, STlinkMemModel *model) {
+    if (*slot != NULL) {
+        stlink_mem_model_shutdown(*slot);
+        g_object_unref(*slot);
     }
+
+    *slot = model;
+    gtk_tree_view_set_model(view, model ? GTK_TREE_MODEL(model) : NULL);
 }
 
 static guint32 hexstr_to_guint32(const gchar *str, GError **err) {
@@ -181,68 +173,107 @@ static guint32 hexstr_to_guint32(const gchar *str, GError **err) {
     return (val);
 }
 
-static void stlink_gui_update_mem_view(STlinkGUI *gui, struct mem_t *mem, GtkTreeView *view) {
-    GtkListStore *store;
-    GtkTreeIter iter;
+static gboolean devmem_read(gpointer data, guint32 addr, guchar *buf, guint len) {
+    STlinkGUI *gui = STLINK_GUI(data);
+    gboolean ok = FALSE;
 
-    store = GTK_LIST_STORE(gtk_tree_view_get_model(view));
+    g_mutex_lock(&gui->sl_lock);
 
-    mem_view_add_buffer(store, &iter, mem->base, mem->memory, (gint)mem->size);
+    if (gui->sl != NULL && stlink_read_mem32(gui->sl, addr, (uint16_t)len) == 0) {
+        memcpy(buf, gui->sl->q_buf, len);
+        ok = TRUE;
+    }
 
-    gtk_widget_hide(GTK_WIDGET(gui->progress.bar));
-    gtk_progress_bar_set_fraction(gui->progress.bar, 0);
-    stlink_gui_set_sensitivity(gui, TRUE);
+    g_mutex_unlock(&gui->sl_lock);
+    return (ok);
 }
 
-static gboolean stlink_gui_update_devmem_view(STlinkGUI *gui) {
-    stlink_gui_update_mem_view(gui, &gui->flash_mem, gui->devmem_treeview);
-    return (FALSE);
+static void devmem_set_model(STlinkGUI *gui, STlinkMemModel *model) {
+    mem_view_set_model(gui->devmem_treeview, &gui->devmem_model, model);
+    gui->live.refreshes = 0;
+    gui->live.since = g_get_monotonic_time();
 }
 
-static gpointer stlink_gui_populate_devmem_view(gpointer data) {
-    guint off;
-    stm32_addr_t addr;
+static gboolean live_refresh_timeout(STlinkGUI *gui) {
+    GtkTreePath *start, *end;
+    gint64 now = g_get_monotonic_time();
 
-    g_return_val_if_fail(STLINK_IS_GUI(data), NULL);
-    STlinkGUI *gui = (STlinkGUI *)data;
+    if (gui->devmem_model == NULL) { return (TRUE); }
 
-    g_return_val_if_fail((gui != NULL), NULL);
-    g_return_val_if_fail((gui->sl != NULL), NULL);
+    // only the rows on screen, a refresh still in progress makes this one a no-op
+    if (gtk_tree_view_get_visible_range(gui->devmem_treeview, &start, &end)) {
+        stlink_mem_model_refresh(gui->devmem_model,
+                                 (guint)gtk_tree_path_get_indices(start)[0],
+                                 (guint)gtk_tree_path_get_indices(end)[0]);
+        gtk_tree_path_free(start);
+        gtk_tree_path_free(end);
+    }
 
-    addr = gui->sl->flash_base;
+    if (now - gui->live.since >= G_USEC_PER_SEC) {
+        guint refreshes = stlink_mem_model_get_refreshes(gui->devmem_model);
+        gchar *text;
 
-    if (gui->flash_mem.memory) {
-        g_free(gui->flash_mem.memory);
+        text = g_strdup_printf("%.1f Hz", (refreshes - gui->live.refreshes) * (gdouble)G_USEC_PER_SEC /
+                               (gdouble)(now - gui->live.since));
+        gtk_label_set_text(gui->live.label, text);
+        g_free(text);
+
+        gui->live.refreshes = refreshes;
+        gui->live.since = now;
     }
 
-    gui->flash_mem.memory = g_malloc(gui->sl->flash_size);
-    gui->flash_mem.size   = gui->sl->flash_size;
-    gui->flash_mem.base   = gui->sl->flash_base;
+    return (TRUE);
+}
 
-    for (off = 0; off < gui->sl->flash_size; off += MEM_READ_SIZE) {
-        guint n_read = MEM_READ_SIZE;
+static void live_stop(STlinkGUI *gui) {
+    if (gui->live.timer != 0) {
+        g_source_remove(gui->live.timer);
+        gui->live.timer = 0;
+    }
 
-        if (off + MEM_READ_SIZE > gui->sl->flash_size) {
-            n_read = (guint)gui->sl->flash_size - off;
+    gtk_label_set_text(gui->live.label, "");
+}
 
-            if (n_read & 3) { n_read = (n_read + 4) & ~(3); } // align if needed
-        }
+static void live_start(STlinkGUI *gui) {
+    gint rate = gtk_spin_button_get_value_as_int(gui->live.rate);
 
-        stlink_read_mem32(gui->sl, addr + off, n_read); // reads to sl->q_buf
+    live_stop(gui);
 
-        if (gui->sl->q_len < 0) {
-            stlink_gui_set_info_error_message(gui, "Failed to read memory");
-            g_free(gui->flash_mem.memory);
-            gui->flash_mem.memory = NULL;
-            return (NULL);
-        }
+    gui->live.refreshes = gui->devmem_model ? stlink_mem_model_get_refreshes(gui->devmem_model) : 0;
+    gui->live.since = g_get_monotonic_time();
+    gui->live.timer = g_timeout_add(1000 / MAX(rate, 1), (GSourceFunc)live_refresh_timeout, gui);
+}
+
+static void live_toggled_cb(GtkToggleButton *button, gpointer data) {
+    STlinkGUI *gui = STLINK_GUI(data);
 
-        memcpy(gui->flash_mem.memory + off, gui->sl->q_buf, n_read);
-        gui->progress.fraction = (gdouble)(off + n_read) / gui->sl->flash_size;
+    if (gtk_toggle_button_get_active(button)) {
+        live_start(gui);
+    } else {
+        live_stop(gui);
     }
+}
 
-    g_idle_add((GSourceFunc)stlink_gui_update_devmem_view, gui);
-    return (NULL);
+static void live_rate_changed_cb(GtkSpinButton *button, gpointer data) {
+    STlinkGUI *gui = STLINK_GUI(data);
+    (void)button;
+
+    if (gui->live.timer != 0) { live_start(gui); }
+}
+
+static gboolean filemem_read(gpointer data, guint32 addr, guchar *buf, guint len) {
+    STlinkGUI *gui = STLINK_GUI(data);
+    gsize offset = addr - gui->file_mem.base;
+
+    if (gui->file_mem.memory == NULL || offset >= gui->file_mem.size) { return (FALSE); }
+
+    if (len > gui->file_mem.size - offset) {
+        memset(buf, 0, len);
+        len = (guint)(gui->file_mem.size - offset);
+    }
+
+    memcpy(buf, gui->file_mem.memory + offset, len);
+    return (TRUE);
 }
 
 static gboolean stlink_gui_update_filemem_view(STlinkGUI *gui) {
@@ -253,7 +284,14 @@ static gboolean stlink_gui_update_filemem_view(STlinkGUI *gui) {
         gui->notebook, GTK_WIDGET(gtk_notebook_get_nth_page(gui->notebook, 1)), basename);
     g_free(basename);
 
-    stlink_gui_update_mem_view(gui, &gui->file_mem, gui->filemem_treeview);
+    mem_view_set_model(gui->filemem_treeview, &gui->filemem_model,
+                       stlink_mem_model_new(gui->file_mem.base, gui->file_mem.size, filemem_read, gui, FALSE));
+
+    // the bar is shared with the jobs, which may still be running
+    if (gui->jobs.pending == 0) { gtk_widget_hide(GTK_WIDGET(gui->progress.bar)); }
+
+    gtk_progress_bar_set_fraction(gui->progress.bar, 0);
+    stlink_gui_set_sensitivity(gui, TRUE);
     return (FALSE);
 }
 
@@ -357,64 +395,54 @@ static void mem_jmp(GtkTreeView *view,
                     guint32 base_addr,
                     gsize size,
                     GError **err) {
-    GtkTreeModel *model;
+    GtkTreePath *path;
     guint32 jmp_addr;
-    GtkTreeIter iter;
 
     jmp_addr = hexstr_to_guint32(gtk_entry_get_text(entry), err);
 
     if (err && *err) { return; }
 
-    if (jmp_addr < base_addr || jmp_addr > base_addr + size) {
+    if (jmp_addr < base_addr || jmp_addr >= base_addr + size) {
         g_set_error(err, g_quark_from_string("mem_jmp"), 1, "Invalid address");
         return;
     }
 
-    model = gtk_tree_view_get_model(view);
+    if (!gtk_tree_view_get_model(view)) { return; }
 
-    if (!model) { return; }
-
-    if (gtk_tree_model_get_iter_first(model, &iter)) {
-        do {
-            guint32 addr;
-            GValue value = G_VALUE_INIT;
-
-            gtk_tree_model_get_value(model, &iter, 0, &value);
-
-            if (G_VALUE_HOLDS_STRING(&value)) {
-                addr = hexstr_to_guint32(g_value_get_string(&value), err);
-
-                if (!*err) {
-                    if (addr == (jmp_addr & 0xFFFFFFF0)) {
-                        GtkTreeSelection *selection;
-                        GtkTreePath *path;
-
-                        selection = gtk_tree_view_get_selection(view);
-                        path      = gtk_tree_model_get_path(model, &iter);
-
-                        gtk_tree_selection_select_iter(selection, &iter);
-                        gtk_tree_view_scroll_to_cell(view, path, NULL, TRUE, 0.0, 0.0);
-                        gtk_tree_path_free(path);
-                    }
-                }
-            }
-
-            g_value_unset(&value);
-        } while (gtk_tree_model_iter_next(model, &iter));
-    }
+    // rows are 16 bytes each, no need to search the model
+    path = gtk_tree_path_new_from_indices((jmp_addr - base_addr) / MEM_MODEL_ROW_SIZE, -1);
+    gtk_tree_selection_select_path(gtk_tree_view_get_selection(view), path);
+    gtk_tree_view_scroll_to_cell(view, path, NULL, TRUE, 0.0, 0.0);
+    gtk_tree_path_free(path);
 }
 
 static void devmem_jmp_cb(GtkWidget *widget, gpointer data) {
     STlinkGUI *gui;
     GError *err = NULL;
+    guint32 addr, base;
+    gsize size;
     (void)widget;
 
     gui = STLINK_GUI(data);
+    base = gui->sl->flash_base;
+    size = gui->sl->flash_size;
+
+    // the buffers and counters worth watching live are in SRAM, switch to it when asked
+    addr = hexstr_to_guint32(gtk_entry_get_text(gui->devmem_jmp_entry), NULL);
+
+    if (addr >= gui->sl->sram_base && addr - gui->sl->sram_base < gui->sl->sram_size) {
+        base = gui->sl->sram_base;
+        size = gui->sl->sram_size;
+    }
+
+    if (gui->devmem_model == NULL || stlink_mem_model_get_base(gui->devmem_model) != base) {
+        devmem_set_model(gui, stlink_mem_model_new(base, (gsize)size, devmem_read, gui, TRUE));
+    }
 
     mem_jmp(gui->devmem_treeview,
             gui->devmem_jmp_entry,
-            gui->sl->flash_base,
-            gui->sl->flash_size,
+            base,
+            size,
             &err);
 
     if (err) {
@@ -434,7 +462,7 @@ static void filemem_jmp_cb(GtkWidget *widget, gpointer data) {
 
     mem_jmp(gui->filemem_treeview,
             gui->filemem_jmp_entry,
-            0,
+            gui->file_mem.base,
             gui->file_mem.size,
             &err);
 
@@ -461,8 +489,6 @@ static gchar *dev_format_mem_size(gsize flash_size) {
 
 static void stlink_gui_set_connected(STlinkGUI *gui) {
     gchar *tmp_str;
-    GtkListStore *store;
-    GtkTreeIter iter;
 
     gtk_statusbar_push(gui->statusbar, gtk_statusbar_get_context_id(gui->statusbar, "conn"), "Connected");
 
@@ -495,18 +521,11 @@ static void stlink_gui_set_connected(STlinkGUI *gui) {
     gtk_editable_set_editable(GTK_EDITABLE(gui->devmem_jmp_entry), TRUE);
     g_free(tmp_str);
 
-    store = GTK_LIST_STORE(gtk_tree_view_get_model(gui->devmem_treeview));
-
-    if (gtk_tree_model_get_iter_first(GTK_TREE_MODEL(store), &iter)) {
-        gtk_list_store_clear(store);
-    }
+    // rows are read in the background as they are scrolled into view
+    devmem_set_model(gui, stlink_mem_model_new(gui->sl->flash_base, gui->sl->flash_size, devmem_read, gui, TRUE));
 
-    stlink_gui_set_sensitivity(gui, FALSE);
     gtk_notebook_set_current_page(gui->notebook, PAGE_DEVMEM);
-    gtk_widget_show(GTK_WIDGET(gui->progress.bar));
-    gtk_progress_bar_set_text(gui->progress.bar, "Reading memory");
-
-    g_thread_new("devmem", (GThreadFunc)stlink_gui_populate_devmem_view, gui);
+    stlink_gui_set_sensitivity(gui, TRUE);
 }
 
 static void connect_button_cb(GtkWidget *widget, gpointer data) {
@@ -532,7 +551,9 @@ static void stlink_gui_set_disconnected(STlinkGUI *gui) {
 
     gtk_widget_set_sensitive(GTK_WIDGET(gui->device_frame), FALSE);
     gtk_widget_set_sensitive(GTK_WIDGET(gui->flash_button), FALSE);
+    gtk_widget_set_sensitive(GTK_WIDGET(gui->erase_button), FALSE);
     gtk_widget_set_sensitive(GTK_WIDGET(gui->export_button), FALSE);
+    gtk_widget_set_sensitive(GTK_WIDGET(gui->jobs.cancel_button), FALSE);
     gtk_widget_set_sensitive(GTK_WIDGET(gui->disconnect_button), FALSE);
     gtk_widget_set_sensitive(GTK_WIDGET(gui->connect_button), TRUE);
     gtk_widget_set_sensitive(GTK_WIDGET(gui->reset_button), FALSE);
@@ -544,20 +565,36 @@ static void disconnect_button_cb(GtkWidget *widget, gpointer data) {
 
     gui = STLINK_GUI(data);
 
+    gtk_toggle_button_set_active(gui->live.toggle, FALSE);
+
+    // waits for a read in progress, nothing touches sl afterwards
+    devmem_set_model(gui, NULL);
+
     if (gui->sl != NULL) {
+        g_mutex_lock(&gui->sl_lock);
         stlink_exit_debug_mode(gui->sl);
         stlink_close(gui->sl);
         gui->sl = NULL;
+        g_mutex_unlock(&gui->sl_lock);
     }
 
     stlink_gui_set_disconnected(gui);
 }
 
 
+static void stlink_gui_load_file(STlinkGUI *gui) {
+    // the model reads from file_mem, which the thread is about to replace
+    mem_view_set_model(gui->filemem_treeview, &gui->filemem_model, NULL);
+
+    stlink_gui_set_sensitivity(gui, FALSE);
+    gtk_notebook_set_current_page(gui->notebook, PAGE_FILEMEM);
+    gtk_widget_show(GTK_WIDGET(gui->progress.bar));
+    gtk_progress_bar_set_text(gui->progress.bar, "Reading file");
+    g_thread_new("file", (GThreadFunc)stlink_gui_populate_filemem_view, gui);
+}
+
 static void stlink_gui_open_file(STlinkGUI *gui) {
     GtkWidget *dialog;
-    GtkListStore *store;
-    GtkTreeIter iter;
 
     dialog = gtk_file_chooser_dialog_new("Open file",
                                          gui->window,
@@ -578,31 +615,15 @@ static void stlink_gui_open_file(STlinkGUI *gui) {
 
     if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
         gui->filename = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
-
-        store = GTK_LIST_STORE(gtk_tree_view_get_model(gui->filemem_treeview));
-
-        if (gtk_tree_model_get_iter_first(GTK_TREE_MODEL(store), &iter)) {
-            gtk_list_store_clear(store);
-        }
-
-        stlink_gui_set_sensitivity(gui, FALSE);
-        gtk_notebook_set_current_page(gui->notebook, PAGE_FILEMEM);
-        gtk_widget_show(GTK_WIDGET(gui->progress.bar));
-        gtk_progress_bar_set_text(gui->progress.bar, "Reading file");
-        g_thread_new("file", (GThreadFunc)stlink_gui_populate_filemem_view, gui);
+        stlink_gui_load_file(gui);
     }
 
     gtk_widget_destroy(dialog);
 }
 
 static gboolean open_file_from_args(STlinkGUI *gui) {
-    if (gui->filename != NULL) {
-        stlink_gui_set_sensitivity(gui, FALSE);
-        gtk_notebook_set_current_page(gui->notebook, PAGE_FILEMEM);
-        gtk_widget_show(GTK_WIDGET(gui->progress.bar));
-        gtk_progress_bar_set_text(gui->progress.bar, "Reading file");
-        g_thread_new("file", (GThreadFunc)stlink_gui_populate_filemem_view, gui);
-    }
+    if (gui->filename != NULL) { stlink_gui_load_file(gui); }
+
     return (FALSE);
 }
 
@@ -614,30 +635,180 @@ static void open_button_cb(GtkWidget *widget, gpointer data) {
     stlink_gui_open_file(gui);
 }
 
-static gboolean stlink_gui_write_flash_update(STlinkGUI *gui) {
-    stlink_gui_set_sensitivity(gui, TRUE);
-    gui->progress.activity_mode = FALSE;
-    gtk_widget_hide(GTK_WIDGET(gui->progress.bar));
+enum job_type_t {
+    JOB_FLASH,
+    JOB_ERASE,
+    JOB_EXPORT
+};
+
+struct job_t {
+    STlinkGUI *gui;
+    enum job_type_t type;
+    guint32 addr;
+    guchar *data;    // JOB_FLASH, a copy: the file may be reloaded meanwhile
+    gsize size;
+    gchar *filename; // JOB_EXPORT
+    int32_t result;
+    gboolean cancelled;
+};
+
+// called by the library on the worker thread, after each block
+static int32_t job_progress(void *arg, enum stlink_progress_phase phase, uint32_t done, uint32_t total) {
+    STlinkGUI *gui = STLINK_GUI(arg);
+    gint64 now = g_get_monotonic_time();
+
+    g_mutex_lock(&gui->jobs.lock);
+
+    // the throughput is per phase, erasing and writing do not compare
+    if (phase != gui->jobs.phase) {
+        gui->jobs.phase = phase;
+        gui->jobs.phase_start = gui->jobs.last_report;
+    }
+
+    gui->jobs.done = done;
+    gui->jobs.total = total;
+    gui->jobs.last_report = now;
+    g_mutex_unlock(&gui->jobs.lock);
+
+    return (g_atomic_int_get(&gui->jobs.cancel));
+}
+
+static void job_free(struct job_t *job) {
+    g_free(job->data);
+    g_free(job->filename);
+    g_free(job);
+}
+
+static gboolean stlink_gui_job_done(struct job_t *job) {
+    STlinkGUI *gui = job->gui;
+    static const gchar *const failed[] = {
+        "Failed to write to flash", "Failed to erase flash", "Failed to export flash"
+    };
+    static const gchar *const cancelled[] = {
+        "Flash write cancelled, the target range is erased", "Erase cancelled", "Export cancelled"
+    };
+
+    if (job->cancelled) {
+        stlink_gui_set_info_error_message(gui, cancelled[job->type]);
+    } else if (job->result != 0) {
+        stlink_gui_set_info_error_message(gui, failed[job->type]);
+    } else if (job->type == JOB_EXPORT) {
+        stlink_gui_set_info_error_message(gui, "Export successful");
+    }
+
+    // the cached pages of the device view are stale after a write or an erase
+    if (job->type != JOB_EXPORT && gui->devmem_model != NULL) {
+        devmem_set_model(gui, stlink_mem_model_new(stlink_mem_model_get_base(gui->devmem_model),
+                                                   stlink_mem_model_get_size(gui->devmem_model),
+                                                   devmem_read, gui, TRUE));
+    }
+
+    if (--gui->jobs.pending == 0) {
+        g_atomic_int_set(&gui->jobs.cancel, 0);
+        gui->progress.activity_mode = FALSE;
+        gtk_widget_hide(GTK_WIDGET(gui->progress.bar));
+        stlink_gui_set_sensitivity(gui, TRUE);
+    }
+
+    job_free(job);
     return (FALSE);
 }
 
-static gpointer stlink_gui_write_flash(gpointer data) {
-    g_return_val_if_fail(STLINK_IS_GUI(data), NULL);
-    STlinkGUI *gui = (STlinkGUI *)data;
+static gpointer stlink_gui_job_worker(gpointer data) {
+    STlinkGUI *gui = STLINK_GUI(data);
+
+    for (;;) {
+        struct job_t *job = g_async_queue_pop(gui->jobs.queue);
+        gint64 now = g_get_monotonic_time();
+
+        g_mutex_lock(&gui->jobs.lock);
+        gui->jobs.phase = (job->type == JOB_EXPORT) ? STLINK_PROGRESS_READ : STLINK_PROGRESS_ERASE;
+        gui->jobs.done = 0;
+        gui->jobs.total = 0;
+        gui->jobs.phase_start = now;
+        gui->jobs.last_report = now;
+        g_mutex_unlock(&gui->jobs.lock);
 
-    g_return_val_if_fail((gui->sl != NULL), NULL);
-    g_return_val_if_fail((gui->filename != NULL), NULL);
+        g_mutex_lock(&gui->sl_lock);
 
-    if (stlink_mwrite_flash(gui->sl, gui->file_mem.memory,
-                            (uint32_t) gui->file_mem.size, gui->sl->flash_base,
-                            SECTION_ERASE) < 0) {
-        stlink_gui_set_info_error_message(gui, "Failed to write to flash");
+        if (gui->sl == NULL || g_atomic_int_get(&gui->jobs.cancel)) {
+            // dropped from the queue by a cancel, nothing was done
+            job->result = -1;
+            job->cancelled = TRUE;
+        } else {
+            gui->sl->progress = job_progress;
+            gui->sl->progress_arg = gui;
+            gui->sl->cancelled = false;
+
+            switch (job->type) {
+            case JOB_FLASH:
+                job->result = stlink_mwrite_flash(gui->sl, job->data, (uint32_t)job->size, job->addr, SECTION_ERASE);
+                break;
+            case JOB_ERASE:
+                job->result = stlink_erase_flash_mass(gui->sl);
+                break;
+            case JOB_EXPORT:
+                job->result = stlink_fread(gui->sl, job->filename, g_str_has_suffix(job->filename, ".hex"),
+                                           gui->sl->flash_base, gui->sl->flash_size);
+                break;
+            }
+
+            job->cancelled = gui->sl->cancelled;
+            gui->sl->progress = NULL;
+        }
+
+        g_mutex_unlock(&gui->sl_lock);
+        g_idle_add((GSourceFunc)stlink_gui_job_done, job);
     }
 
-    g_idle_add((GSourceFunc)stlink_gui_write_flash_update, gui);
     return (NULL);
 }
 
+static void stlink_gui_queue_job(STlinkGUI *gui, struct job_t *job) {
+    job->gui = gui;
+
+    if (gui->jobs.pending++ == 0) {
+        gtk_progress_bar_set_fraction(gui->progress.bar, 0);
+        gtk_widget_show(GTK_WIDGET(gui->progress.bar));
+        stlink_gui_set_sensitivity(gui, TRUE); // disconnect and reset off, cancel on
+    }
+
+    g_async_queue_push(gui->jobs.queue, job);
+}
+
+static void stlink_gui_show_job_progress(STlinkGUI *gui) {
+    static const gchar *const phases[] = { "Erasing", "Writing", "Verifying", "Reading" };
+    enum stlink_progress_phase phase;
+    guint32 done, total;
+    gint64 elapsed;
+    GString *text;
+
+    g_mutex_lock(&gui->jobs.lock);
+    phase = gui->jobs.phase;
+    done = gui->jobs.done;
+    total = gui->jobs.total;
+    elapsed = gui->jobs.last_report - gui->jobs.phase_start;
+    g_mutex_unlock(&gui->jobs.lock);
+
+    text = g_string_new(phases[phase]);
+
+    if (total == 0) {
+        gtk_progress_bar_pulse(gui->progress.bar); // a mass erase does not tell
+    } else {
+        gtk_progress_bar_set_fraction(gui->progress.bar, (gdouble)done / total);
+        g_string_append_printf(text, " %u%%", (guint)((guint64)done * 100 / total));
+
+        if (elapsed > 0) {
+            g_string_append_printf(text, ", %.1f KiB/s", done * (gdouble)G_USEC_PER_SEC / elapsed / 1024);
+        }
+    }
+
+    if (gui->jobs.pending > 1) { g_string_append_printf(text, " (%u queued)", gui->jobs.pending - 1); }
+
+    gtk_progress_bar_set_text(gui->progress.bar, text->str);
+    g_string_free(text, TRUE);
+}
+
 static void flash_button_cb(GtkWidget *widget, gpointer data) {
     STlinkGUI *gui;
     gchar *tmp_str;
@@ -668,11 +839,14 @@ static void flash_button_cb(GtkWidget *widget, gpointer data) {
             } else if (address + gui->file_mem.size > gui->sl->flash_base + gui->sl->flash_size) {
                 stlink_gui_set_info_error_message(gui, "Binary overwrites flash");
             } else {
-                stlink_gui_set_sensitivity(gui, FALSE);
-                gtk_progress_bar_set_text(gui->progress.bar, "Writing to flash");
-                gui->progress.activity_mode = TRUE;
-                gtk_widget_show(GTK_WIDGET(gui->progress.bar));
-                g_thread_new("flash", (GThreadFunc)stlink_gui_write_flash, gui);
+                struct job_t *job = g_new0(struct job_t, 1);
+
+                job->type = JOB_FLASH;
+                job->addr = address;
+                job->size = gui->file_mem.size;
+                job->data = g_malloc(job->size);
+                memcpy(job->data, gui->file_mem.memory, job->size);
+                stlink_gui_queue_job(gui, job);
             }
         }
     }
@@ -686,23 +860,48 @@ static void reset_button_cb(GtkWidget *widget, gpointer data) {
     gui = STLINK_GUI(data);
     g_return_if_fail(gui->sl != NULL);
 
+    g_mutex_lock(&gui->sl_lock);
     stlink_exit_debug_mode(gui->sl);
     stlink_reset(gui->sl, RESET_AUTO);
     stlink_enter_swd_mode(gui->sl);
+    g_mutex_unlock(&gui->sl_lock);
 
 }
 
-int32_t export_to_file(const char*filename, const struct mem_t flash_mem) {
-    printf("%s\n", filename);
-    FILE * f = fopen(filename, "w");
+static void erase_button_cb(GtkWidget *widget, gpointer data) {
+    STlinkGUI *gui;
+    GtkWidget *dialog;
+    gint res;
+    (void)widget;
+
+    gui = STLINK_GUI(data);
+    g_return_if_fail(gui->sl != NULL);
 
-    if (f == NULL) { return (-1); }
+    dialog = gtk_message_dialog_new(gui->window,
+                                    GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+                                    GTK_MESSAGE_QUESTION,
+                                    GTK_BUTTONS_OK_CANCEL,
+                                    "Erase the whole flash memory?");
+    res = gtk_dialog_run(GTK_DIALOG(dialog));
+    gtk_widget_destroy(dialog);
 
-    for (gsize i = 0; i < flash_mem.size; i++)
-        if (fputc(flash_mem.memory[i], f) == EOF) { return (-1); }
+    if (res == GTK_RESPONSE_OK) {
+        struct job_t *job = g_new0(struct job_t, 1);
 
-    fclose(f);
-    return (0);
+        job->type = JOB_ERASE;
+        stlink_gui_queue_job(gui, job);
+    }
+}
+
+static void cancel_button_cb(GtkWidget *widget, gpointer data) {
+    STlinkGUI *gui;
+    (void)widget;
+
+    gui = STLINK_GUI(data);
+
+    // the library stops at the next block, a write erases what it has written
+    g_atomic_int_set(&gui->jobs.cancel, 1);
+    gtk_widget_set_sensitive(GTK_WIDGET(gui->jobs.cancel_button), FALSE);
 }
 
 static void export_button_cb(GtkWidget *widget, gpointer data) {
@@ -722,24 +921,21 @@ static void export_button_cb(GtkWidget *widget, gpointer data) {
     gint res = gtk_dialog_run(GTK_DIALOG(dialog));
 
     if (res == GTK_RESPONSE_ACCEPT) {
-        char *filename;
+        struct job_t *job = g_new0(struct job_t, 1);
 
-        filename = gtk_file_chooser_get_filename(chooser);
-
-        if (export_to_file(filename, gui->flash_mem) != 0) {
-            stlink_gui_set_info_error_message(gui, "Failed to export flash");
-        } else {
-            stlink_gui_set_info_error_message(gui, "Export successful");
-        }
-
-        g_free(filename);
+        // the device view holds no copy of the flash, it is read into the file
+        job->type = JOB_EXPORT;
+        job->filename = gtk_file_chooser_get_filename(chooser);
+        stlink_gui_queue_job(gui, job);
     }
 
     gtk_widget_destroy(dialog);
 }
 
 static gboolean progress_pulse_timeout(STlinkGUI *gui) {
-    if (gui->progress.activity_mode) {
+    if (gui->jobs.pending > 0) {
+        stlink_gui_show_job_progress(gui);
+    } else if (gui->progress.activity_mode) {
         gtk_progress_bar_pulse(gui->progress.bar);
     } else {
         gtk_progress_bar_set_fraction(gui->progress.bar, gui->progress.fraction);
@@ -775,8 +971,6 @@ static void dnd_received_cb(GtkWidget *widget,
     gchar **file_list;
     const guchar *file_data;
     STlinkGUI *gui = STLINK_GUI(data);
-    GtkListStore *store;
-    GtkTreeIter iter;
     (void)widget;
     (void)x;
     (void)y;
@@ -798,17 +992,7 @@ static void dnd_received_cb(GtkWidget *widget,
             g_strfreev(file_list);
             g_object_unref(file_uri);
 
-            store = GTK_LIST_STORE(gtk_tree_view_get_model(gui->devmem_treeview));
-
-            if (gtk_tree_model_get_iter_first(GTK_TREE_MODEL(store), &iter)) {
-                gtk_list_store_clear(store);
-            }
-
-            stlink_gui_set_sensitivity(gui, FALSE);
-            gtk_notebook_set_current_page(gui->notebook, PAGE_FILEMEM);
-            gtk_widget_show(GTK_WIDGET(gui->progress.bar));
-            gtk_progress_bar_set_text(gui->progress.bar, "Reading file");
-            g_thread_new("file", (GThreadFunc)stlink_gui_populate_filemem_view, gui);
+            stlink_gui_load_file(gui);
             break;
         }
     }
@@ -837,8 +1021,6 @@ void stlink_gui_init_dnd(STlinkGUI *gui) {
 
 static void stlink_gui_build_ui(STlinkGUI *gui) {
     GtkBuilder *builder;
-    GtkListStore *devmem_store;
-    GtkListStore *filemem_store;
     gchar *ui_file = STLINK_UI_DIR "/stlink-gui.ui";
 
     if (!g_file_test(ui_file, G_FILE_TEST_EXISTS)) { ui_file = "stlink-gui.ui"; }
@@ -872,27 +1054,17 @@ static void stlink_gui_build_ui(STlinkGUI *gui) {
     gui->export_button = GTK_TOOL_BUTTON(gtk_builder_get_object(builder, "export_button"));
     g_signal_connect(G_OBJECT(gui->export_button), "clicked", G_CALLBACK(export_button_cb), gui);
 
+    gui->erase_button = GTK_TOOL_BUTTON(gtk_builder_get_object(builder, "erase_button"));
+    g_signal_connect(G_OBJECT(gui->erase_button), "clicked", G_CALLBACK(erase_button_cb), gui);
+
+    gui->jobs.cancel_button = GTK_TOOL_BUTTON(gtk_builder_get_object(builder, "cancel_button"));
+    g_signal_connect(G_OBJECT(gui->jobs.cancel_button), "clicked", G_CALLBACK(cancel_button_cb), gui);
+
     gui->devmem_treeview = GTK_TREE_VIEW(gtk_builder_get_object(builder, "devmem_treeview"));
     mem_view_init_headers(gui->devmem_treeview);
-    devmem_store = gtk_list_store_new(5,
-                                      G_TYPE_STRING,
-                                      G_TYPE_STRING,
-                                      G_TYPE_STRING,
-                                      G_TYPE_STRING,
-                                      G_TYPE_STRING);
-    gtk_tree_view_set_model(gui->devmem_treeview, GTK_TREE_MODEL(devmem_store));
-    g_object_unref(devmem_store);
 
     gui->filemem_treeview = GTK_TREE_VIEW(gtk_builder_get_object(builder, "filemem_treeview"));
     mem_view_init_headers(gui->filemem_treeview);
-    filemem_store = gtk_list_store_new(5,
-                                       G_TYPE_STRING,
-                                       G_TYPE_STRING,
-                                       G_TYPE_STRING,
-                                       G_TYPE_STRING,
-                                       G_TYPE_STRING);
-    gtk_tree_view_set_model(gui->filemem_treeview, GTK_TREE_MODEL(filemem_store));
-    g_object_unref(filemem_store);
 
     gui->core_id_label = GTK_LABEL(gtk_builder_get_object(builder, "core_id_value"));
     gui->chip_id_label = GTK_LABEL(gtk_builder_get_object(builder, "chip_id_value"));
@@ -909,6 +1081,12 @@ static void stlink_gui_build_ui(STlinkGUI *gui) {
     gui->devmem_jmp_entry = GTK_ENTRY(gtk_builder_get_object(builder, "devmem_jmp_entry"));
     g_signal_connect(gui->devmem_jmp_entry, "activate", G_CALLBACK(devmem_jmp_cb), gui);
 
+    gui->live.toggle = GTK_TOGGLE_BUTTON(gtk_builder_get_object(builder, "devmem_live_check"));
+    g_signal_connect(gui->live.toggle, "toggled", G_CALLBACK(live_toggled_cb), gui);
+    gui->live.rate = GTK_SPIN_BUTTON(gtk_builder_get_object(builder, "devmem_live_rate"));
+    g_signal_connect(gui->live.rate, "value-changed", G_CALLBACK(live_rate_changed_cb), gui);
+    gui->live.label = GTK_LABEL(gtk_builder_get_object(builder, "devmem_live_value"));
+
     gui->filemem_jmp_entry = GTK_ENTRY(gtk_builder_get_object(builder, "filemem_jmp_entry"));
     g_signal_connect(gui->filemem_jmp_entry, "activate", G_CALLBACK(filemem_jmp_cb), gui);
     gtk_editable_set_editable(GTK_EDITABLE(gui->filemem_jmp_entry), TRUE);
@@ -938,6 +1116,8 @@ static void stlink_gui_build_ui(STlinkGUI *gui) {
     gtk_widget_hide(GTK_WIDGET(gui->progress.bar));
 
     stlink_gui_set_disconnected(gui);
+
+    g_thread_new("jobs", stlink_gui_job_worker, gui);
 }
 
 int32_t main(int32_t argc, char **argv) {
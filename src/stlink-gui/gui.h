@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include <glib-object.h>
 
+#include "mem-model.h"
+
 #define STLINK_TYPE_GUI             (stlink_gui_get_type())
 #define STLINK_GUI(obj)             (G_TYPE_CHECK_INSTANCE_CAST((obj), STLINK_TYPE_GUI, STlinkGUI))
 #define STLINK_IS_GUI(obj)          (G_TYPE_CHECK_INSTANCE_TYPE((obj), STLINK_TYPE_GUI))
@@ -33,6 +35,34 @@ struct progress_t {
     gdouble fraction;
 };
 
+/*
+ * Flash, erase and export run one after the other on a worker thread. The
+ * worker publishes the progress reported by the library, the main loop
+ * shows it from the progress timer.
+ */
+struct jobs_t {
+    GAsyncQueue   *queue;
+    GtkToolButton *cancel_button;
+    guint pending; // queued or running, main loop only
+    gint  cancel;  // atomic, cancels the running job and drops the queued ones
+
+    GMutex lock;   // guards the progress of the running job
+    enum stlink_progress_phase phase;
+    guint32 done;
+    guint32 total;
+    gint64  phase_start;
+    gint64  last_report;
+};
+
+struct live_t {
+    GtkToggleButton *toggle;
+    GtkSpinButton   *rate;
+    GtkLabel        *label;
+    guint timer;
+    guint refreshes; // count of the model when the rate was last shown
+    gint64 since;
+};
+
 struct mem_t {
     guchar *memory;
     gsize size;
@@ -63,6 +93,7 @@ struct _STlinkGUI {
     GtkToolButton  *connect_button;
     GtkToolButton  *disconnect_button;
     GtkToolButton  *flash_button;
+    GtkToolButton  *erase_button;
     GtkToolButton  *export_button;
     GtkToolButton  *open_button;
     GtkToolButton  *reset_button;
@@ -74,12 +105,17 @@ struct _STlinkGUI {
     GtkEntry   *flash_dialog_entry;
 
     struct progress_t progress;
-    struct mem_t flash_mem;
+    struct live_t live;
+    struct jobs_t jobs;
     struct mem_t file_mem;
 
+    STlinkMemModel *devmem_model;
+    STlinkMemModel *filemem_model;
+
     gchar    *error_message;
     gchar    *filename;
     stlink_t *sl;
+    GMutex    sl_lock; // sl is shared by the main loop and the worker threads
 };
 
 struct _STlinkGUIClass {
@@ -89,6 +125,5 @@ struct _STlinkGUIClass {
 };
 
 GType stlink_gui_get_type(void);
-int32_t export_to_file(const char*filename, const struct mem_t flash_mem);
 
 #endif // GUI_H
@@ -0,0 +1,499 @@
+/*
+ * File: mem-model.c
+ *
+ * Virtual GtkTreeModel for the memory views
+ *
+ * The model has one row per 16 bytes but keeps no rows: cells are formatted
+ * when the view asks for them, i.e. only for the rows on screen. The bytes
+ * come from a small LRU cache of pages. A page missing from the cache is
+ * read on a worker thread (asynchronous models) and its rows are updated
+ * once the read completes; until then the cells show a placeholder.
+ *
+ * A refresh re-reads a range of rows, normally those on screen, in as few
+ * reads as the probe allows. The words that differ from the cached copy
+ * get a highlighted background for a while.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <gtk/gtk.h>
+
+#include "mem-model.h"
+
+struct mem_page {
+    guint index;     // page number, G_MAXUINT while unused
+    guint used;      // tick of the last access, for the LRU replacement
+    gboolean valid;  // FALSE if the read failed
+    guchar data[MEM_MODEL_PAGE_SIZE];
+    gint64 changed[MEM_MODEL_PAGE_SIZE / 4]; // when each word last changed, 0 if never
+};
+
+#define MEM_MODEL_PAGE_ROWS    (MEM_MODEL_PAGE_SIZE / MEM_MODEL_ROW_SIZE)
+#define MEM_MODEL_HIGHLIGHT_US (1000 * 1000)
+#define MEM_MODEL_HIGHLIGHT    "#FFD27F"
+
+struct mem_job {
+    STlinkMemModel *model;
+    gboolean refresh; // a range of rows, otherwise a single page
+    guint32 offset;   // from the base of the model
+    guint len;
+    guint seq;
+    guint generation;
+    gboolean ok;
+    guchar *data;
+};
+
+struct _STlinkMemModel {
+    GObject parent_instance;
+
+    /* < private > */
+    gint stamp;
+    guint32 base;
+    gsize size;
+    guint n_rows;
+    STlinkMemReadFunc read;
+    gpointer user_data;
+
+    struct mem_page pages[MEM_MODEL_PAGE_NUM];
+    guint tick;
+
+    GThreadPool *pool;    // NULL for synchronous models
+    GHashTable *pending;  // pages queued on the worker
+    guint seq;
+    guint generation;
+    gint shutdown;
+
+    gboolean refreshing; // a refresh is queued or running
+    guint refreshes;     // completed refreshes
+    gint64 refreshed;    // time of the last one
+};
+
+struct _STlinkMemModelClass {
+    GObjectClass parent_class;
+};
+
+static void stlink_mem_model_tree_model_init(GtkTreeModelIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(STlinkMemModel, stlink_mem_model, G_TYPE_OBJECT,
+                        G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_MODEL, stlink_mem_model_tree_model_init));
+
+static gboolean mem_model_read(STlinkMemModel *model, guint32 offset, guint len, guchar *buf) {
+    if (offset + len > model->size) {
+        len = (guint)(model->size - offset);
+
+        if (len & 3) { len = (len + 4) & ~(3); } // align if needed
+    }
+
+    while (len > 0) {
+        guint chunk = MIN(len, MEM_MODEL_READ_MAX);
+
+        if (!model->read(model->user_data, model->base + offset, buf, chunk)) { return (FALSE); }
+
+        offset += chunk;
+        buf += chunk;
+        len -= chunk;
+    }
+
+    return (TRUE);
+}
+
+static struct mem_page *mem_model_store(STlinkMemModel *model, guint page) {
+    struct mem_page *victim = &model->pages[0];
+
+    for (guint i = 1; i < MEM_MODEL_PAGE_NUM; i++) {
+        if (model->pages[i].used < victim->used) { victim = &model->pages[i]; }
+    }
+
+    victim->index = page;
+    victim->used  = ++model->tick;
+    memset(victim->changed, 0, sizeof(victim->changed));
+    return (victim);
+}
+
+static struct mem_page *mem_model_find(STlinkMemModel *model, guint page) {
+    for (guint i = 0; i < MEM_MODEL_PAGE_NUM; i++) {
+        if (model->pages[i].index == page) { return (&model->pages[i]); }
+    }
+
+    return (NULL);
+}
+
+static void mem_model_rows_changed(STlinkMemModel *model, guint row, guint end) {
+    GtkTreeIter iter;
+
+    if (end > model->n_rows) { end = model->n_rows; }
+
+    iter.stamp = model->stamp;
+
+    for (; row < end; row++) {
+        GtkTreePath *path = gtk_tree_path_new_from_indices(row, -1);
+        iter.user_data = GUINT_TO_POINTER(row);
+        gtk_tree_model_row_changed(GTK_TREE_MODEL(model), path, &iter);
+        gtk_tree_path_free(path);
+    }
+}
+
+static void mem_model_page_done(STlinkMemModel *model, struct mem_job *job) {
+    guint page = job->offset / MEM_MODEL_PAGE_SIZE;
+    struct mem_page *p = mem_model_store(model, page);
+
+    memcpy(p->data, job->data, MEM_MODEL_PAGE_SIZE);
+    p->valid = job->ok;
+    g_hash_table_remove(model->pending, GUINT_TO_POINTER(page + 1));
+    mem_model_rows_changed(model, page * MEM_MODEL_PAGE_ROWS, (page + 1) * MEM_MODEL_PAGE_ROWS);
+}
+
+static void mem_model_refresh_done(STlinkMemModel *model, struct mem_job *job) {
+    gint64 now = g_get_monotonic_time();
+    guint32 offset = job->offset;
+    guint32 end = job->offset + job->len;
+
+    model->refreshing = FALSE;
+
+    if (!job->ok) { return; } // keep the old contents, the rate shows that nothing arrives
+
+    // the range may span pages, update the part of each page that is cached
+    while (offset < end) {
+        guint page = offset / MEM_MODEL_PAGE_SIZE;
+        guint32 stop = MIN(end, (page + 1) * MEM_MODEL_PAGE_SIZE);
+        struct mem_page *p = mem_model_find(model, page);
+
+        if (p != NULL && p->valid) {
+            for (guint32 i = offset; i < stop; i += 4) {
+                guchar *word = &p->data[i % MEM_MODEL_PAGE_SIZE];
+
+                if (memcmp(word, &job->data[i - job->offset], 4) != 0) {
+                    memcpy(word, &job->data[i - job->offset], 4);
+                    p->changed[(i % MEM_MODEL_PAGE_SIZE) / 4] = now;
+                }
+            }
+        }
+
+        offset = stop;
+    }
+
+    model->refreshes++;
+    model->refreshed = now;
+
+    // all rows of the range, highlights also need to fade
+    mem_model_rows_changed(model, job->offset / MEM_MODEL_ROW_SIZE,
+                           (end + MEM_MODEL_ROW_SIZE - 1) / MEM_MODEL_ROW_SIZE);
+}
+
+static gboolean mem_model_job_done(gpointer data) {
+    struct mem_job *job = data;
+    STlinkMemModel *model = job->model;
+
+    if (job->generation == model->generation) {
+        if (job->refresh) {
+            mem_model_refresh_done(model, job);
+        } else {
+            mem_model_page_done(model, job);
+        }
+    }
+
+    g_object_unref(model);
+    g_free(job->data);
+    g_free(job);
+    return (FALSE);
+}
+
+static void mem_model_worker(gpointer data, gpointer user_data) {
+    struct mem_job *job = data;
+    STlinkMemModel *model = user_data;
+
+    if (!g_atomic_int_get(&model->shutdown)) {
+        job->ok = mem_model_read(model, job->offset, job->len, job->data);
+    }
+
+    g_idle_add(mem_model_job_done, job);
+}
+
+// the most recent request first, the rows on screen are those scrolled to last
+static gint mem_model_job_cmp(gconstpointer a, gconstpointer b, gpointer user_data) {
+    const struct mem_job *ja = a;
+    const struct mem_job *jb = b;
+    (void)user_data;
+
+    return ((ja->seq < jb->seq) - (ja->seq > jb->seq));
+}
+
+static void mem_model_request(STlinkMemModel *model, guint page) {
+    struct mem_job *job;
+
+    if (model->pool == NULL || g_hash_table_contains(model->pending, GUINT_TO_POINTER(page + 1))) {
+        return;
+    }
+
+    g_hash_table_add(model->pending, GUINT_TO_POINTER(page + 1));
+
+    job = g_new0(struct mem_job, 1);
+    job->model = g_object_ref(model);
+    job->offset = page * MEM_MODEL_PAGE_SIZE;
+    job->len = MEM_MODEL_PAGE_SIZE;
+    job->data = g_malloc0(MEM_MODEL_PAGE_SIZE);
+    job->seq = ++model->seq;
+    job->generation = model->generation;
+    g_thread_pool_push(model->pool, job, NULL);
+}
+
+// returns NULL while the page is being read
+static const struct mem_page *mem_model_lookup(STlinkMemModel *model, guint page) {
+    struct mem_page *p = mem_model_find(model, page);
+
+    if (p != NULL) {
+        p->used = ++model->tick;
+        return (p);
+    }
+
+    if (model->read == NULL) { return (NULL); }
+
+    if (model->pool != NULL) {
+        mem_model_request(model, page);
+        return (NULL);
+    }
+
+    p = mem_model_store(model, page);
+    p->valid = mem_model_read(model, page * MEM_MODEL_PAGE_SIZE, MEM_MODEL_PAGE_SIZE, p->data);
+    return (p);
+}
+
+static GtkTreeModelFlags mem_model_get_flags(GtkTreeModel *tree_model) {
+    (void)tree_model;
+    return (GTK_TREE_MODEL_LIST_ONLY | GTK_TREE_MODEL_ITERS_PERSIST);
+}
+
+static gint mem_model_get_n_columns(GtkTreeModel *tree_model) {
+    (void)tree_model;
+    return (MEM_MODEL_N_COLUMNS);
+}
+
+static GType mem_model_get_column_type(GtkTreeModel *tree_model, gint index) {
+    (void)tree_model;
+    (void)index;
+    return (G_TYPE_STRING);
+}
+
+static gboolean mem_model_iter_nth(STlinkMemModel *model, GtkTreeIter *iter, gint n) {
+    if (n < 0 || (guint)n >= model->n_rows) { return (FALSE); }
+
+    iter->stamp     = model->stamp;
+    iter->user_data = GUINT_TO_POINTER(n);
+    return (TRUE);
+}
+
+static gboolean mem_model_get_iter(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreePath *path) {
+    if (gtk_tree_path_get_depth(path) != 1) { return (FALSE); }
+
+    return (mem_model_iter_nth(STLINK_MEM_MODEL(tree_model), iter, gtk_tree_path_get_indices(path)[0]));
+}
+
+static GtkTreePath *mem_model_get_path(GtkTreeModel *tree_model, GtkTreeIter *iter) {
+    (void)tree_model;
+    return (gtk_tree_path_new_from_indices(GPOINTER_TO_UINT(iter->user_data), -1));
+}
+
+static void mem_model_get_value(GtkTreeModel *tree_model, GtkTreeIter *iter, gint column, GValue *value) {
+    STlinkMemModel *model = STLINK_MEM_MODEL(tree_model);
+    guint32 offset = GPOINTER_TO_UINT(iter->user_data) * MEM_MODEL_ROW_SIZE;
+    const struct mem_page *p;
+    gboolean background = FALSE;
+    gchar text[16];
+    guint32 word;
+
+    g_value_init(value, G_TYPE_STRING);
+
+    if (column == 0) {
+        g_snprintf(text, sizeof(text), "0x%08X", model->base + offset);
+        g_value_set_string(value, text);
+        return;
+    }
+
+    if (column >= MEM_MODEL_COL_BG) {
+        background = TRUE;
+        column -= MEM_MODEL_N_WORDS;
+    }
+
+    offset += (column - 1) * sizeof(word);
+
+    if (offset >= model->size) { return; } // beyond the end of the last row
+
+    p = mem_model_lookup(model, offset / MEM_MODEL_PAGE_SIZE);
+
+    if (background) {
+        gint64 changed = p ? p->changed[(offset % MEM_MODEL_PAGE_SIZE) / 4] : 0;
+
+        // changed by the last refresh, or recently enough to be noticed at slow rates
+        if (changed != 0 && (changed == model->refreshed ||
+                             g_get_monotonic_time() - changed < MEM_MODEL_HIGHLIGHT_US)) {
+            g_value_set_static_string(value, MEM_MODEL_HIGHLIGHT);
+        }
+    } else if (p == NULL) {
+        g_value_set_static_string(value, "...");
+    } else if (!p->valid) {
+        g_value_set_static_string(value, "??");
+    } else {
+        memcpy(&word, &p->data[offset % MEM_MODEL_PAGE_SIZE], sizeof(word));
+        g_snprintf(text, sizeof(text), "0x%08X", word);
+        g_value_set_string(value, text);
+    }
+}
+
+static gboolean mem_model_iter_next(GtkTreeModel *tree_model, GtkTreeIter *iter) {
+    return (mem_model_iter_nth(STLINK_MEM_MODEL(tree_model), iter, GPOINTER_TO_UINT(iter->user_data) + 1));
+}
+
+static gboolean mem_model_iter_children(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *parent) {
+    if (parent != NULL) { return (FALSE); }
+
+    return (mem_model_iter_nth(STLINK_MEM_MODEL(tree_model), iter, 0));
+}
+
+static gboolean mem_model_iter_has_child(GtkTreeModel *tree_model, GtkTreeIter *iter) {
+    (void)tree_model;
+    (void)iter;
+    return (FALSE);
+}
+
+static gint mem_model_iter_n_children(GtkTreeModel *tree_model, GtkTreeIter *iter) {
+    return (iter == NULL ? (gint)STLINK_MEM_MODEL(tree_model)->n_rows : 0);
+}
+
+static gboolean mem_model_iter_nth_child(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *parent,
+                                         gint n) {
+    if (parent != NULL) { return (FALSE); }
+
+    return (mem_model_iter_nth(STLINK_MEM_MODEL(tree_model), iter, n));
+}
+
+static gboolean mem_model_iter_parent(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *child) {
+    (void)tree_model;
+    (void)iter;
+    (void)child;
+    return (FALSE);
+}
+
+static void stlink_mem_model_tree_model_init(GtkTreeModelIface *iface) {
+    iface->get_flags       = mem_model_get_flags;
+    iface->get_n_columns   = mem_model_get_n_columns;
+    iface->get_column_type = mem_model_get_column_type;
+    iface->get_iter        = mem_model_get_iter;
+    iface->get_path        = mem_model_get_path;
+    iface->get_value       = mem_model_get_value;
+    iface->iter_next       = mem_model_iter_next;
+    iface->iter_children   = mem_model_iter_children;
+    iface->iter_has_child  = mem_model_iter_has_child;
+    iface->iter_n_children = mem_model_iter_n_children;
+    iface->iter_nth_child  = mem_model_iter_nth_child;
+    iface->iter_parent     = mem_model_iter_parent;
+}
+
+static void stlink_mem_model_dispose(GObject *gobject) {
+    stlink_mem_model_shutdown(STLINK_MEM_MODEL(gobject));
+    G_OBJECT_CLASS(stlink_mem_model_parent_class)->dispose(gobject);
+}
+
+static void stlink_mem_model_finalize(GObject *gobject) {
+    g_hash_table_destroy(STLINK_MEM_MODEL(gobject)->pending);
+    G_OBJECT_CLASS(stlink_mem_model_parent_class)->finalize(gobject);
+}
+
+static void stlink_mem_model_class_init(STlinkMemModelClass *klass) {
+    GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+    gobject_class->dispose  = stlink_mem_model_dispose;
+    gobject_class->finalize = stlink_mem_model_finalize;
+}
+
+static void stlink_mem_model_init(STlinkMemModel *self) {
+    self->stamp   = (gint)g_random_int();
+    self->pending = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+    for (guint i = 0; i < MEM_MODEL_PAGE_NUM; i++) {
+        self->pages[i].index = G_MAXUINT;
+        self->pages[i].used  = 0;
+    }
+}
+
+STlinkMemModel *stlink_mem_model_new(guint32 base, gsize size, STlinkMemReadFunc read,
+                                     gpointer user_data, gboolean async) {
+    STlinkMemModel *model = g_object_new(STLINK_TYPE_MEM_MODEL, NULL);
+
+    model->base      = base;
+    model->size      = size;
+    model->n_rows    = (guint)((size + MEM_MODEL_ROW_SIZE - 1) / MEM_MODEL_ROW_SIZE);
+    model->read      = read;
+    model->user_data = user_data;
+
+    if (async) {
+        // a single worker, the probe serves one request at a time anyway
+        model->pool = g_thread_pool_new(mem_model_worker, model, 1, FALSE, NULL);
+        g_thread_pool_set_sort_function(model->pool, mem_model_job_cmp, NULL);
+    }
+
+    return (model);
+}
+
+/*
+ * Stops all reads, waiting for the one in progress. Afterwards the model no
+ * longer calls its read function, so its source may go away.
+ */
+void stlink_mem_model_shutdown(STlinkMemModel *model) {
+    g_return_if_fail(STLINK_IS_MEM_MODEL(model));
+
+    g_atomic_int_set(&model->shutdown, 1);
+
+    if (model->pool != NULL) {
+        // the queued jobs skip their read and only post their completion
+        g_thread_pool_free(model->pool, FALSE, TRUE);
+        model->pool = NULL;
+    }
+
+    model->read = NULL;
+    model->generation++; // drop the completions still in the main loop
+    model->refreshing = FALSE;
+}
+
+guint32 stlink_mem_model_get_base(STlinkMemModel *model) {
+    g_return_val_if_fail(STLINK_IS_MEM_MODEL(model), 0);
+    return (model->base);
+}
+
+gsize stlink_mem_model_get_size(STlinkMemModel *model) {
+    g_return_val_if_fail(STLINK_IS_MEM_MODEL(model), 0);
+    return (model->size);
+}
+
+/*
+ * Re-reads rows first_row to last_row of an asynchronous model. Only one
+ * refresh runs at a time: returns FALSE while the previous one is pending,
+ * so a caller polling faster than the probe can read simply skips a beat.
+ */
+gboolean stlink_mem_model_refresh(STlinkMemModel *model, guint first_row, guint last_row) {
+    struct mem_job *job;
+
+    g_return_val_if_fail(STLINK_IS_MEM_MODEL(model), FALSE);
+
+    if (model->pool == NULL || model->refreshing || model->n_rows == 0) { return (FALSE); }
+
+    if (last_row >= model->n_rows) { last_row = model->n_rows - 1; }
+
+    if (first_row > last_row) { return (FALSE); }
+
+    job = g_new0(struct mem_job, 1);
+    job->model = g_object_ref(model);
+    job->refresh = TRUE;
+    job->offset = first_row * MEM_MODEL_ROW_SIZE;
+    job->len = (last_row - first_row + 1) * MEM_MODEL_ROW_SIZE;
+    job->data = g_malloc0(job->len + 4); // room for the alignment of a short last row
+    job->seq = ++model->seq; // the rows on screen, ahead of any queued page
+    job->generation = model->generation;
+
+    model->refreshing = TRUE;
+    g_thread_pool_push(model->pool, job, NULL);
+    return (TRUE);
+}
+
+guint stlink_mem_model_get_refreshes(STlinkMemModel *model) {
+    g_return_val_if_fail(STLINK_IS_MEM_MODEL(model), 0);
+    return (model->refreshes);
+}
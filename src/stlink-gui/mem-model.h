@@ -0,0 +1,37 @@
+#ifndef MEM_MODEL_H
+#define MEM_MODEL_H
+
+#include <stdint.h>
+#include <gtk/gtk.h>
+
+#define STLINK_TYPE_MEM_MODEL      (stlink_mem_model_get_type())
+#define STLINK_MEM_MODEL(obj)      (G_TYPE_CHECK_INSTANCE_CAST((obj), STLINK_TYPE_MEM_MODEL, STlinkMemModel))
+#define STLINK_IS_MEM_MODEL(obj)   (G_TYPE_CHECK_INSTANCE_TYPE((obj), STLINK_TYPE_MEM_MODEL))
+
+#define MEM_MODEL_N_WORDS   4
+#define MEM_MODEL_COL_BG    (1 + MEM_MODEL_N_WORDS)   // background of the words, NULL unless changed
+#define MEM_MODEL_N_COLUMNS (1 + 2 * MEM_MODEL_N_WORDS) // address, words, backgrounds
+#define MEM_MODEL_ROW_SIZE  16
+#define MEM_MODEL_PAGE_SIZE 1024   // 64 rows, fetched with a single read
+#define MEM_MODEL_PAGE_NUM  64     // cached pages, whatever the size of the memory
+#define MEM_MODEL_READ_MAX  0x1800 // largest read the probe handles in one transfer
+
+typedef struct _STlinkMemModel STlinkMemModel;
+typedef struct _STlinkMemModelClass STlinkMemModelClass;
+
+/*
+ * Reads len bytes at addr into buf, returns FALSE on failure. Asynchronous
+ * models call it from their worker thread, synchronous ones from the main loop.
+ */
+typedef gboolean (*STlinkMemReadFunc)(gpointer user_data, guint32 addr, guchar *buf, guint len);
+
+GType stlink_mem_model_get_type(void);
+STlinkMemModel *stlink_mem_model_new(guint32 base, gsize size, STlinkMemReadFunc read,
+                                     gpointer user_data, gboolean async);
+void stlink_mem_model_shutdown(STlinkMemModel *model);
+guint32 stlink_mem_model_get_base(STlinkMemModel *model);
+gsize stlink_mem_model_get_size(STlinkMemModel *model);
+gboolean stlink_mem_model_refresh(STlinkMemModel *model, guint first_row, guint last_row);
+guint stlink_mem_model_get_refreshes(STlinkMemModel *model);
+
+#endif // MEM_MODEL_H
@@ -349,23 +349,30 @@ int32_t stlink_reset(stlink_t *sl, enum reset_type type) {
   if (type == RESET_HARD || type == RESET_AUTO) {
     // hardware target reset
     if (sl->version.stlink_v > 1) {
+      // the minimum reset pulse duration of 20 us (RM0008, 8.1.2 Power reset)
+      // is shorter than the round trip of the second command
       stlink_jtag_reset(sl, STLINK_DEBUG_APIV2_DRIVE_NRST_LOW);
-      // minimum reset pulse duration of 20 us (RM0008, 8.1.2 Power reset)
-      usleep(100);
       stlink_jtag_reset(sl, STLINK_DEBUG_APIV2_DRIVE_NRST_HIGH);
     }
     sl->backend->reset(sl);
-    usleep(10000);
-  }
 
-  if (type == RESET_AUTO) {
     /* Check if the S_RESET_ST bit is set in DHCSR
      * This means that a reset has occurred
      * DDI0337E, p. 10-4, Debug Halting Control and Status Register
+     *
+     * Polled for up to 10 ms rather than read once after sleeping that long:
+     * the reset is usually seen on the first read.
      */
+    int32_t res;
+    timeout = time_ms() + 10;
+
+    do {
+      dhcsr = 0;
+      res = stlink_read_debug32(sl, STLINK_REG_DHCSR, &dhcsr);
+    } while (!res && (dhcsr & STLINK_REG_DHCSR_S_RESET_ST) == 0 && time_ms() < timeout);
+
+    if (type == RESET_HARD) { return (0); }
 
-    dhcsr = 0;
-    int32_t res = stlink_read_debug32(sl, STLINK_REG_DHCSR, &dhcsr);
     if ((dhcsr & STLINK_REG_DHCSR_S_RESET_ST) == 0 && !res) {
       // reset not done yet --> try reset through AIRCR so that NRST does not need to be connected
       ILOG("NRST is not connected --> using software reset via AIRCR\n");
@@ -393,9 +400,29 @@ int32_t stlink_reset(stlink_t *sl, enum reset_type type) {
   return (0);
 }
 
+/*
+ * Polls a debug register until (value & mask) == match, for up to timeout_ms:
+ * back to back for the first millisecond, which is all a fast target needs,
+ * then once a millisecond.
+ */
+static int32_t wait_debug32(stlink_t *sl, uint32_t addr, uint32_t mask, uint32_t match,
+                            uint32_t timeout_ms, uint32_t *value) {
+  uint64_t start = time_us();
+  uint64_t elapsed = 0;
+
+  while (elapsed < (uint64_t) timeout_ms * 1000) {
+    if (stlink_read_debug32(sl, addr, value) == 0 && (*value & mask) == match) { return (0); }
+
+    elapsed = time_us() - start;
+
+    if (elapsed > 1000) { usleep(1000); }
+  }
+
+  return (-1);
+}
+
 int32_t stlink_soft_reset(stlink_t *sl, int32_t halt_on_reset) {
   int32_t ret;
-  uint32_t timeout;
   uint32_t dhcsr, dfsr;
 
   DLOG("*** stlink_soft_reset %s***\n", halt_on_reset ? "(halt) " : "");
@@ -420,10 +447,10 @@ int32_t stlink_soft_reset(stlink_t *sl, int32_t halt_on_reset) {
                          STLINK_REG_CM3_DEMCR_TRCENA |
                              STLINK_REG_CM3_DEMCR_VC_HARDERR |
                              STLINK_REG_CM3_DEMCR_VC_BUSERR);
-  }
 
-  // clear S_RESET_ST in the DHCSR register
-  stlink_read_debug32(sl, STLINK_REG_DHCSR, &dhcsr);
+    // clear S_RESET_ST in the DHCSR register
+    stlink_read_debug32(sl, STLINK_REG_DHCSR, &dhcsr);
+  }
 
   // soft reset (core reset) by SYSRESETREQ (DDI0337E, p. 8-23)
   ret = stlink_write_debug32(sl, STLINK_REG_AIRCR,
@@ -435,31 +462,21 @@ int32_t stlink_soft_reset(stlink_t *sl, int32_t halt_on_reset) {
   }
 
   // waiting for a reset within 500ms
-  // DDI0337E, p. 10-4, Debug Halting Control and Status Register
-  timeout = time_ms() + 500;
-  while (time_ms() < timeout) {
+  if (halt_on_reset) {
+    // the reset vector catch is the one event that matters, and it can only be
+    // set once the core is out of reset and halted
+    // DDI0403E, p. C1-699, Debug Fault Status Register
+    ret = wait_debug32(sl, STLINK_REG_DFSR, STLINK_REG_DFSR_VCATCH, STLINK_REG_DFSR_VCATCH, 500, &dfsr);
+  } else {
     // DDI0337E, p. 10-4, Debug Halting Control and Status Register
-    dhcsr = STLINK_REG_DHCSR_S_RESET_ST;
-    stlink_read_debug32(sl, STLINK_REG_DHCSR, &dhcsr);
-    if ((dhcsr & STLINK_REG_DHCSR_S_RESET_ST) == 0) {
-      if (halt_on_reset) {
-        // waiting halt by the SYSRESETREQ exception
-        // DDI0403E, p. C1-699, Debug Fault Status Register
-        dfsr = 0;
-        stlink_read_debug32(sl, STLINK_REG_DFSR, &dfsr);
-        if ((dfsr & STLINK_REG_DFSR_VCATCH) == 0) {
-          continue;
-        }
-      }
-      timeout = 0;
-      break;
-    }
+    ret = wait_debug32(sl, STLINK_REG_DHCSR, STLINK_REG_DHCSR_S_RESET_ST, STLINK_REG_DHCSR_S_RESET_ST, 500,
+                       &dhcsr);
   }
 
   // reset DFSR register. DFSR is power-on reset only (DDI0337H, p. 7-5)
   stlink_write_debug32(sl, STLINK_REG_DFSR, STLINK_REG_DFSR_CLEAR);
 
-  if (timeout) {
+  if (ret) {
     ELOG("Soft reset failed: timeout\n");
     return (-1);
   }
@@ -668,12 +685,12 @@ int32_t stlink_mwrite_sram(stlink_t *sl, uint8_t *data, uint32_t length, stm32_a
       size += 2;
     } // round size if needed
 
-    stlink_write_mem32(sl, addr + off, (uint16_t) size);
+    if (stlink_write_mem32(sl, addr + off, (uint16_t) size)) { goto on_error; }
   }
 
   if (length > len) {
     memcpy(sl->q_buf, data + len, length - len);
-    stlink_write_mem8(sl, addr + len, (uint16_t) (length - len));
+    if (stlink_write_mem8(sl, addr + len, (uint16_t) (length - len))) { goto on_error; }
   }
 
   error = 0; // success
@@ -736,12 +753,12 @@ int32_t stlink_fwrite_sram(stlink_t *sl, const char *path, stm32_addr_t addr) {
       size += 2;
     } // round size if needed
 
-    stlink_write_mem32(sl, addr + off, (uint16_t) size);
+    if (stlink_write_mem32(sl, addr + off, (uint16_t) size)) { goto on_error; }
   }
 
   if (mf.len > len) {
     memcpy(sl->q_buf, mf.base + len, mf.len - len);
-    stlink_write_mem8(sl, addr + len, (uint16_t) (mf.len - len));
+    if (stlink_write_mem8(sl, addr + len, (uint16_t) (mf.len - len))) { goto on_error; }
   }
 
   // check the file has been written
@@ -766,6 +783,8 @@ int32_t stlink_fread(stlink_t *sl, const char *path, bool is_ihex, stm32_addr_t
   int32_t error;
   int32_t fd = open(path, O_RDWR | O_TRUNC | O_CREAT | O_BINARY, 00700);
 
+  sl->cancelled = false;
+
   if (fd == -1) {
     fprintf(stderr, "open(%s) == -1\n", path);
     return (-1);
@@ -789,6 +808,10 @@ int32_t stlink_fread(stlink_t *sl, const char *path, bool is_ihex, stm32_addr_t
   }
 
   close(fd);
+
+  // no truncated image is left behind
+  if (sl->cancelled) { remove(path); }
+
   return (error);
 }
 
@@ -1027,6 +1050,11 @@ uint8_t stlink_get_erased_pattern(stlink_t *sl) {
 
 // 322
 int32_t stlink_target_connect(stlink_t *sl, enum connect_type connect) {
+  stlink_connect_times_t *times = &sl->connect_times;
+  uint64_t start = time_us();
+  uint64_t now;
+  int32_t ret;
+
   if (connect == CONNECT_UNDER_RESET) {
     stlink_enter_swd_mode(sl);
 
@@ -1041,17 +1069,25 @@ int32_t stlink_target_connect(stlink_t *sl, enum connect_type connect) {
 
     stlink_jtag_reset(sl, STLINK_DEBUG_APIV2_DRIVE_NRST_HIGH);
 
-    // try to halt the core after reset
+    // try to halt the core after reset, until it is seen halted
     uint32_t timeout = time_ms() + 10;
+    uint32_t dhcsr = 0;
+    bool reset_seen = false;
+
     while (time_ms() < timeout) {
       sl->backend->force_debug(sl);
+
+      if (stlink_read_debug32(sl, STLINK_REG_DHCSR, &dhcsr) == 0) {
+        if (dhcsr & STLINK_REG_DHCSR_S_RESET_ST) { reset_seen = true; }
+
+        if (dhcsr & STLINK_REG_DHCSR_S_HALT) { break; }
+      }
+
       usleep(100);
     }
 
     // check NRST connection
-    uint32_t dhcsr = 0;
-    stlink_read_debug32(sl, STLINK_REG_DHCSR, &dhcsr);
-    if ((dhcsr & STLINK_REG_DHCSR_S_RESET_ST) == 0) {
+    if (!reset_seen) {
       WLOG("NRST is not connected\n");
     }
 
@@ -1065,11 +1101,24 @@ int32_t stlink_target_connect(stlink_t *sl, enum connect_type connect) {
     return -1;
   }
 
+  now = time_us();
+  times->swd = (uint32_t) (now - start);
+  start = now;
+
   if (connect == CONNECT_NORMAL) {
     stlink_reset(sl, RESET_AUTO);
   }
 
-  return stlink_load_device_params(sl);
+  now = time_us();
+  times->reset = (uint32_t) (now - start);
+  start = now;
+
+  ret = stlink_load_device_params(sl);
+  times->identify = (uint32_t) (time_us() - start);
+
+  DLOG("connect: usb %u us, swd %u us, reset %u us, identify %u us\n",
+       times->usb, times->swd, times->reset, times->identify);
+  return (ret);
 }
 
 // End of delegates....  functions below are private to this module
@@ -1201,6 +1250,66 @@ void stlink_run_at(stlink_t *sl, stm32_addr_t addr) {
   }
 }
 
+/*
+ * Sets up the halted core to start the image loaded in SRAM with its vector
+ * table at vectors, the way the boot ROM starts one from flash: VTOR points to
+ * the table, MSP and PC come from its first two entries. The core stays halted
+ * and the caller runs it. Returns -1 if the table does not look like one of an
+ * image in SRAM.
+ */
+int32_t stlink_boot_sram(stlink_t *sl, stm32_addr_t vectors) {
+  uint32_t msp;
+  uint32_t reset;
+
+  if (vectors < sl->sram_base || vectors - sl->sram_base + 8 > sl->sram_size) {
+    ELOG("Vector table at %#010x is not in SRAM\n", vectors);
+    return (-1);
+  }
+
+  if (vectors & 0x7f) {
+    ELOG("Vector table at %#010x is not aligned for VTOR\n", vectors);
+    return (-1);
+  }
+
+  if (stlink_read_debug32(sl, vectors, &msp) || stlink_read_debug32(sl, vectors + 4, &reset)) {
+    return (-1);
+  }
+
+  if (!(reset & 1) || (reset & ~1u) < sl->sram_base || (reset & ~1u) - sl->sram_base >= sl->sram_size ||
+      msp == 0 || (msp & 3)) {
+    ELOG("No SRAM image at %#010x (stack %#010x, reset %#010x)\n", vectors, msp, reset);
+    return (-1);
+  }
+
+  DLOG("Boot from SRAM: VTOR %#010x, MSP %#010x, PC %#010x\n", vectors, msp, reset & ~1u);
+
+  if (stlink_write_debug32(sl, STLINK_REG_VTOR, vectors) ||
+      stlink_write_reg(sl, msp, 17) ||                 // MSP
+      stlink_write_reg(sl, 0x01000000, 16) ||          // xPSR, Thumb state only
+      stlink_write_reg(sl, reset & ~1u, 15)) {         // PC
+    return (-1);
+  }
+
+  return (0);
+}
+
+/*
+ * Reports progress to the hook of the application, if any. Returns -1 once
+ * the hook asks to cancel; the caller stops at this point.
+ */
+int32_t stlink_progress(stlink_t *sl, enum stlink_progress_phase phase, uint32_t done, uint32_t total) {
+  if (sl->progress == NULL) { return (0); }
+
+  if (sl->progress(sl->progress_arg, phase, done, total) != 0) {
+    if (!sl->cancelled) { ILOG("Operation cancelled\n"); }
+
+    sl->cancelled = true;
+    return (-1);
+  }
+
+  return (0);
+}
+
 static int32_t stlink_read(stlink_t *sl, stm32_addr_t addr, uint32_t size, save_block_fn fn, void *fn_arg) {
 
   int32_t error = -1;
@@ -1234,6 +1343,10 @@ static int32_t stlink_read(stlink_t *sl, stm32_addr_t addr, uint32_t size, save_
     if (!fn(fn_arg, sl->q_buf, aligned_size)) {
       goto on_error;
     }
+
+    if (stlink_progress(sl, STLINK_PROGRESS_READ, off + cmp_size, size)) {
+      goto on_error;
+    }
   }
 
   error = 0; // success
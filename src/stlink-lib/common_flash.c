@@ -990,6 +990,51 @@ static void set_flash_cr_mer(stlink_t *sl, bool v, uint32_t bank) {
   stlink_write_debug32(sl, cr_reg, val);
 }
 
+/*
+ * Starts the erase of the page or sector at flashaddr on F2/F4/F7/L4 and
+ * returns without waiting: the caller polls wait_flash_busy() and
+ * check_flash_error(). The flash must not be busy.
+ */
+void stlink_erase_flash_page_start(stlink_t *sl, stm32_addr_t flashaddr) {
+  // unlock if locked
+  unlock_flash_if(sl);
+
+  // select the page to erase
+  if (sl->flash_type == STM32_FLASH_TYPE_L4) {
+    // calculate the actual bank+page from the address
+    uint32_t page = calculate_L4_page(sl, flashaddr);
+
+    fprintf(stderr, "EraseFlash - Page:0x%x Size:0x%x ", page,
+            stlink_calculate_pagesize(sl, flashaddr));
+
+    write_flash_cr_bker_pnb(sl, page);
+  } else if (sl->chip_id == STM32_CHIPID_F7 ||
+             sl->chip_id == STM32_CHIPID_F76xxx) {
+    // calculate the actual page from the address
+    uint32_t sector = calculate_F7_sectornum(flashaddr);
+
+    fprintf(stderr, "EraseFlash - Sector:0x%x Size:0x%x ", sector,
+            stlink_calculate_pagesize(sl, flashaddr));
+    write_flash_cr_snb(sl, sector, BANK_1);
+  } else {
+    // calculate the actual page from the address
+    uint32_t sector = calculate_F4_sectornum(flashaddr);
+
+    fprintf(stderr, "EraseFlash - Sector:0x%x Size:0x%x ", sector,
+            stlink_calculate_pagesize(sl, flashaddr));
+
+    // the SNB values for flash sectors in the second bank do not directly
+    // follow the values for the first bank on 2mb devices...
+    if (sector >= 12) {
+      sector += 4;
+    }
+
+    write_flash_cr_snb(sl, sector, BANK_1);
+  }
+
+  set_flash_cr_strt(sl, BANK_1); // start erase operation
+}
+
 /**
  * Erase a page of flash, assumes sl is fully populated with things like
  * chip/core ids
@@ -1006,43 +1051,7 @@ int32_t stlink_erase_flash_page(stlink_t *sl, stm32_addr_t flashaddr) {
   if (sl->flash_type == STM32_FLASH_TYPE_F2_F4 ||
       sl->flash_type == STM32_FLASH_TYPE_F7 ||
       sl->flash_type == STM32_FLASH_TYPE_L4) {
-    // unlock if locked
-    unlock_flash_if(sl);
-
-    // select the page to erase
-    if (sl->flash_type == STM32_FLASH_TYPE_L4) {
-      // calculate the actual bank+page from the address
-      uint32_t page = calculate_L4_page(sl, flashaddr);
-
-      fprintf(stderr, "EraseFlash - Page:0x%x Size:0x%x ", page,
-              stlink_calculate_pagesize(sl, flashaddr));
-
-      write_flash_cr_bker_pnb(sl, page);
-    } else if (sl->chip_id == STM32_CHIPID_F7 ||
-               sl->chip_id == STM32_CHIPID_F76xxx) {
-      // calculate the actual page from the address
-      uint32_t sector = calculate_F7_sectornum(flashaddr);
-
-      fprintf(stderr, "EraseFlash - Sector:0x%x Size:0x%x ", sector,
-              stlink_calculate_pagesize(sl, flashaddr));
-      write_flash_cr_snb(sl, sector, BANK_1);
-    } else {
-      // calculate the actual page from the address
-      uint32_t sector = calculate_F4_sectornum(flashaddr);
-
-      fprintf(stderr, "EraseFlash - Sector:0x%x Size:0x%x ", sector,
-              stlink_calculate_pagesize(sl, flashaddr));
-
-      // the SNB values for flash sectors in the second bank do not directly
-      // follow the values for the first bank on 2mb devices...
-      if (sector >= 12) {
-        sector += 4;
-      }
-
-      write_flash_cr_snb(sl, sector, BANK_1);
-    }
-
-    set_flash_cr_strt(sl, BANK_1); // start erase operation
+    stlink_erase_flash_page_start(sl, flashaddr);
     wait_flash_busy(sl);           // wait for completion
     lock_flash(sl);                // TODO: fails to program if this is in
 #if DEBUG_FLASH
@@ -1238,6 +1247,11 @@ int32_t stlink_erase_flash_section(stlink_t *sl, stm32_addr_t base_addr, uint32_
 
     // check the next page is within the range to erase
     addr += page_size;
+
+    // pages erased so far stay erased, the others keep their contents
+    if (stlink_progress(sl, STLINK_PROGRESS_ERASE, (addr - base_addr < size) ? addr - base_addr : size, size)) {
+      return (-1);
+    }
   } while (addr < (base_addr + size));
 
   fprintf(stdout, "\n");
@@ -1254,6 +1268,11 @@ int32_t stlink_erase_flash_mass(stlink_t *sl) {
     err = stlink_erase_flash_section(sl, sl->flash_base, sl->flash_size, false);
 
   } else {
+    // a single operation of unknown duration, it can only be cancelled before it starts
+    if (stlink_progress(sl, STLINK_PROGRESS_ERASE, 0, 0)) {
+      return (-1);
+    }
+
     wait_flash_busy(sl);
     clear_flash_error(sl);
     unlock_flash_if(sl);
@@ -1443,6 +1462,10 @@ int32_t stlink_verify_write_flash(stlink_t *sl, stm32_addr_t address, uint8_t *d
       ELOG("Verification of flash failed at offset: %u\n", off);
       return (-1);
     }
+
+    if (stlink_progress(sl, STLINK_PROGRESS_VERIFY, off + cmp_size, length)) {
+      return (-1);
+    }
   }
 
   ILOG("Flash written and verified! jolly good!\n");
@@ -1496,6 +1519,25 @@ int32_t stlink_check_address_alignment(stlink_t *sl, stm32_addr_t addr) {
   return 0;
 }
 
+/*
+ * A write cancelled half way would leave a truncated image that may still
+ * boot, or a partly erased range. Erase the whole range instead, the state
+ * any retry starts from. This applies to a cancel in any phase of
+ * stlink_write_flash(), the verification included.
+ */
+static void stlink_write_flash_cancelled(stlink_t *sl, stm32_addr_t addr, uint32_t len) {
+  stlink_progress_fn progress = sl->progress;
+
+  WLOG("Write cancelled, erasing %#x bytes at %#x\n", len, addr);
+  sl->progress = NULL; // this one must run to completion
+
+  if (stlink_erase_flash_section(sl, addr, len, true) < 0) {
+    ELOG("Failed to erase the partially written range\n");
+  }
+
+  sl->progress = progress;
+}
+
 int32_t stlink_write_flash(stlink_t *sl, stm32_addr_t addr, uint8_t *base,
                            uint32_t len, uint8_t eraseonly,
                            const enum erase_type_t erase_type) {
@@ -1522,29 +1564,54 @@ int32_t stlink_write_flash(stlink_t *sl, stm32_addr_t addr, uint8_t *base,
 
   // make sure we've loaded the context with the chip details
   stlink_core_id(sl);
+  sl->cancelled = false;
 
-  // Erase this section of the flash
-  if ((erase_type == SECTION_ERASE) &&
-      stlink_erase_flash_section(sl, addr, len, true) < 0) {
-    ELOG("Failed to erase the flash prior to writing\n");
-    return (-1);
-  }
+  if ((erase_type == SECTION_ERASE) && !eraseonly &&
+      (sl->flash_type == STM32_FLASH_TYPE_F2_F4 ||
+       sl->flash_type == STM32_FLASH_TYPE_F7)) {
+    // erase each sector right before programming it, behind the uploads
+    ret = stlink_flashloader_erase_write(sl, &fl, addr, base, len);
+  } else {
+    // Erase this section of the flash
+    if ((erase_type == SECTION_ERASE) &&
+        stlink_erase_flash_section(sl, addr, len, true) < 0) {
+      // an erase on its own stops where it was cancelled
+      if (sl->cancelled && !eraseonly) {
+        stlink_write_flash_cancelled(sl, addr, len);
+      } else {
+        ELOG("Failed to erase the flash prior to writing\n");
+      }
+
+      return (-1);
+    }
 
-  if (eraseonly) {
-    return (0);
+    if (eraseonly) {
+      return (0);
+    }
+
+    ret = stlink_flashloader_start(sl, &fl);
+    if (ret)
+      return ret;
+    ret = stlink_flashloader_write(sl, &fl, addr, base, len);
   }
- 
-  ret = stlink_flashloader_start(sl, &fl);
-  if (ret)
-    return ret;
-  ret = stlink_flashloader_write(sl, &fl, addr, base, len);
-  if (ret)
+  if (ret) {
+    // puts the flash, interrupts, DMA and clock back as they were
+    stlink_flashloader_stop(sl, &fl);
+    if (sl->cancelled)
+      stlink_write_flash_cancelled(sl, addr, len);
     return ret;
+  }
   ret = stlink_flashloader_stop(sl, &fl);
   if (ret)
     return ret;
 
-  return (stlink_verify_write_flash(sl, addr, base, len));
+  ret = stlink_verify_write_flash(sl, addr, base, len);
+
+  if (ret && sl->cancelled) {
+    stlink_write_flash_cancelled(sl, addr, len);
+  }
+
+  return (ret);
 }
 
 int32_t stlink_write_otp(stlink_t *sl, stm32_addr_t addr, uint8_t *base, uint32_t len) {
@@ -1564,8 +1631,10 @@ int32_t stlink_write_otp(stlink_t *sl, stm32_addr_t addr, uint8_t *base, uint32_
   if (ret)
     return ret;
   ret = stlink_flashloader_write(sl, &fl, addr, base, len);
-  if (ret)
+  if (ret) {
+    stlink_flashloader_stop(sl, &fl);
     return ret;
+  }
   ret = stlink_flashloader_stop(sl, &fl);
   if (ret)
     return ret;
@@ -1580,3 +1649,71 @@ void stlink_fwrite_finalize(stlink_t *sl, stm32_addr_t addr) {
   stlink_write_reg(sl, val, 15);
   stlink_run(sl, RUN_NORMAL);
 }
+
+int32_t stlink_flash_session_begin(stlink_t *sl, struct stlink_flash_session *fs) {
+  memset(fs, 0, sizeof(*fs));
+
+  // make sure we've loaded the context with the chip details
+  stlink_core_id(sl);
+  sl->cancelled = false;
+
+  if (stlink_flashloader_prepare(sl, &fs->fl)) {
+    stlink_flashloader_stop(sl, &fs->fl);
+    return (-1);
+  }
+
+  fs->started = true;
+  return (0);
+}
+
+/*
+ * Erases the pages, or sectors, of addr..addr+len, the last one whole. Page
+ * erases lock the flash, it is only unlocked for programming again by the
+ * next write.
+ */
+int32_t stlink_flash_session_erase(stlink_t *sl, struct stlink_flash_session *fs, stm32_addr_t addr, uint32_t len) {
+  if (!fs->started) { return (-1); }
+
+  if (fs->programming) {
+    stlink_flashloader_lock(sl);
+    fs->programming = false;
+  }
+
+  return (stlink_erase_flash_section(sl, addr, len, true));
+}
+
+// Writes addr..addr+len, which must have been erased
+int32_t stlink_flash_session_write(stlink_t *sl, struct stlink_flash_session *fs, stm32_addr_t addr,
+                                   uint8_t *base, uint32_t len) {
+  if (!fs->started || stlink_check_address_range_validity(sl, addr, len) < 0) { return (-1); }
+
+  ILOG("Attempting to write %d (%#x) bytes to stm32 address: %u (%#x)\n", len, len, addr, addr);
+
+  if (!fs->programming) {
+    if (stlink_flashloader_unlock(sl, &fs->fl)) { return (-1); }
+
+    fs->programming = true;
+  }
+
+  return (stlink_flashloader_write(sl, &fs->fl, addr, base, len));
+}
+
+int32_t stlink_flash_session_verify(stlink_t *sl, struct stlink_flash_session *fs, stm32_addr_t addr,
+                                    uint8_t *base, uint32_t len) {
+  if (!fs->started) { return (-1); }
+
+  return (stlink_verify_write_flash(sl, addr, base, len));
+}
+
+/*
+ * Locks the flash and puts the interrupts, DMA and clock back as they were.
+ * The core stays halted: resetting it, or running the new code, is up to the
+ * caller.
+ */
+int32_t stlink_flash_session_end(stlink_t *sl, struct stlink_flash_session *fs) {
+  if (!fs->started) { return (-1); }
+
+  fs->started = false;
+  fs->programming = false;
+  return (stlink_flashloader_stop(sl, &fs->fl));
+}
@@ -16,6 +16,17 @@ enum erase_type_t {
     MASS_ERASE = 2,
 };
 
+/*
+ * A flash session: the loader stays in SRAM, the interrupts masked and the DMA
+ * off from stlink_flash_session_begin() to stlink_flash_session_end(), across
+ * any number of erases, writes and verifies. Nothing resets the core.
+ */
+struct stlink_flash_session {
+    flash_loader_t fl;
+    bool started;
+    bool programming; // flash unlocked and in programming mode
+};
+
 uint32_t get_stm32l0_flash_base(stlink_t *);
 uint32_t read_flash_cr(stlink_t *, uint32_t);
 void lock_flash(stlink_t *);
@@ -42,6 +53,7 @@ void clear_flash_cr_pg(stlink_t *, uint32_t);
 // static inline void write_flash_cr_bker_pnb(stlink_t *sl, uint32_t n);
 // static void set_flash_cr_strt(stlink_t *sl, uint32_t bank);
 // static void set_flash_cr_mer(stlink_t *sl, bool v, uint32_t bank);
+void stlink_erase_flash_page_start(stlink_t *sl, stm32_addr_t flashaddr);
 int32_t stlink_erase_flash_page(stlink_t *sl, stm32_addr_t flashaddr);
 int32_t stlink_erase_flash_section(stlink_t *sl, stm32_addr_t base_addr, uint32_t size, bool align_size);
 int32_t stlink_erase_flash_mass(stlink_t *sl);
@@ -60,5 +72,12 @@ int32_t stlink_write_flash(stlink_t *sl, stm32_addr_t addr, uint8_t *base,
 int32_t stlink_write_otp(stlink_t *sl, stm32_addr_t addr, uint8_t *base,
                          uint32_t len);
 void stlink_fwrite_finalize(stlink_t *, stm32_addr_t);
+int32_t stlink_flash_session_begin(stlink_t *sl, struct stlink_flash_session *fs);
+int32_t stlink_flash_session_erase(stlink_t *sl, struct stlink_flash_session *fs, stm32_addr_t addr, uint32_t len);
+int32_t stlink_flash_session_write(stlink_t *sl, struct stlink_flash_session *fs, stm32_addr_t addr,
+                                   uint8_t *base, uint32_t len);
+int32_t stlink_flash_session_verify(stlink_t *sl, struct stlink_flash_session *fs, stm32_addr_t addr,
+                                    uint8_t *base, uint32_t len);
+int32_t stlink_flash_session_end(stlink_t *sl, struct stlink_flash_session *fs);
 
 #endif // COMMON_FLASH_H
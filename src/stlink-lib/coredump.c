@@ -0,0 +1,306 @@
+/*
+ * File: coredump.c
+ *
+ * ELF core dump of the target state
+ *
+ * The dump uses the layout of an ARM Linux core file (NT_PRSTATUS and
+ * NT_ARM_VFP notes plus one PT_LOAD segment per memory region), which
+ * is what GDB expects for 32-bit ARM. Open it with
+ *   arm-none-eabi-gdb -ex "set osabi GNU/Linux" firmware.elf core.elf
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <stlink.h>
+#include "coredump.h"
+
+#include "helper.h"
+#include "logging.h"
+#include "read_write.h"
+#include "register.h"
+
+#define ELF_HEADER_SIZE     52
+#define ELF_PHDR_SIZE       32
+#define ELF_ET_CORE         4
+#define ELF_EM_ARM          40
+#define ELF_PT_LOAD         1
+#define ELF_PT_NOTE         4
+#define ELF_PF_RWX          7
+
+#define NT_PRSTATUS         1
+#define NT_ARM_VFP          0x400
+#define PRSTATUS_SIZE       148
+#define PRSTATUS_REG_OFFSET 72
+#define ARM_VFP_SIZE        (32 * 8 + 4)
+#define NOTE_NAME           "CORE"
+#define NOTE_HEADER_SIZE    (12 + 8) // namesz, descsz, type and padded "CORE\0"
+
+#define SIGTRAP             5
+
+// largest single read the probes handle reliably
+#define COREDUMP_CHUNK      0x1800
+
+static void put_u16(uint8_t *buf, uint32_t offset, uint16_t val) {
+  write_uint16(&buf[offset], val);
+}
+
+static void put_u32(uint8_t *buf, uint32_t offset, uint32_t val) {
+  write_uint32(&buf[offset], val);
+}
+
+static uint32_t put_note(uint8_t *buf, uint32_t type, const uint8_t *desc, uint32_t size) {
+  put_u32(buf, 0, sizeof(NOTE_NAME));
+  put_u32(buf, 4, size);
+  put_u32(buf, 8, type);
+  memcpy(&buf[12], NOTE_NAME, sizeof(NOTE_NAME));
+  memcpy(&buf[NOTE_HEADER_SIZE], desc, size);
+  return (NOTE_HEADER_SIZE + ((size + 3) & ~3u));
+}
+
+static int32_t has_fpu(stlink_t *sl) {
+  uint32_t cpacr;
+
+  if (stlink_read_debug32(sl, STLINK_REG_CPACR, &cpacr)) {
+    return (0);
+  }
+
+  return ((cpacr & STLINK_REG_CPACR_CP10_CP11) != 0);
+}
+
+static int32_t dump_region(stlink_t *sl, FILE *fp, stm32_addr_t addr, uint32_t size) {
+  uint32_t off;
+
+  for (off = 0; off < size; off += COREDUMP_CHUNK) {
+    uint32_t len = size - off;
+
+    if (len > COREDUMP_CHUNK) {
+      len = COREDUMP_CHUNK;
+    }
+
+    if (stlink_read_mem32(sl, addr + off, (uint16_t)((len + 3) & ~3u))) {
+      WLOG("Cannot read %#010x, dumping zeros\n", addr + off);
+      memset(sl->q_buf, 0, len);
+    }
+
+    if (fwrite(sl->q_buf, 1, len, fp) != len) {
+      return (-1);
+    }
+  }
+
+  return (0);
+}
+
+/*
+ * RAM banks outside of sram_base/sram_size, by chip. The H7 parameters only
+ * describe the DTCM; banks whose clock is off read as zeros with a warning.
+ */
+struct coredump_sram_bank {
+  uint32_t chip_id;
+  stm32_addr_t addr;
+  uint32_t size;
+};
+
+static const struct coredump_sram_bank coredump_sram_banks[] = {
+  // CCM data RAM of the F405/F407, F42x/F43x and F46x/F47x
+  { STM32_CHIPID_F4,      0x10000000, 0x10000 },
+  { STM32_CHIPID_F4_HD,   0x10000000, 0x10000 },
+  { STM32_CHIPID_F4_DSI,  0x10000000, 0x10000 },
+  // H74x/H75x: ITCM, AXI SRAM, SRAM1-3, SRAM4, backup SRAM (RM0433)
+  { STM32_CHIPID_H74xxx,  0x00000000, 0x10000 },
+  { STM32_CHIPID_H74xxx,  0x24000000, 0x80000 },
+  { STM32_CHIPID_H74xxx,  0x30000000, 0x48000 },
+  { STM32_CHIPID_H74xxx,  0x38000000, 0x10000 },
+  { STM32_CHIPID_H74xxx,  0x38800000, 0x1000 },
+  // H72x/H73x: ITCM, AXI SRAM, SRAM1-2, SRAM4, backup SRAM (RM0468)
+  { STM32_CHIPID_H72x,    0x00000000, 0x10000 },
+  { STM32_CHIPID_H72x,    0x24000000, 0x50000 },
+  { STM32_CHIPID_H72x,    0x30000000, 0x8000 },
+  { STM32_CHIPID_H72x,    0x38000000, 0x4000 },
+  { STM32_CHIPID_H72x,    0x38800000, 0x1000 },
+  // H7Ax/H7Bx: ITCM, AXI SRAM1-3, AHB SRAM1-2, SRD SRAM, backup SRAM (RM0455)
+  { STM32_CHIPID_H7Ax,    0x00000000, 0x10000 },
+  { STM32_CHIPID_H7Ax,    0x24000000, 0x100000 },
+  { STM32_CHIPID_H7Ax,    0x30000000, 0x20000 },
+  { STM32_CHIPID_H7Ax,    0x38000000, 0x8000 },
+  { STM32_CHIPID_H7Ax,    0x38800000, 0x1000 },
+};
+
+/*
+ * Fills regions, COREDUMP_SRAM_REGION_NUM_MAX entries at most, with the SRAM
+ * of the chip: sram_base/sram_size first, then its other banks.
+ */
+uint32_t stlink_coredump_sram_regions(stlink_t *sl, struct stlink_coredump_region *regions) {
+  uint32_t count = 0;
+
+  regions[count].addr = sl->sram_base;
+  regions[count].size = sl->sram_size;
+  count++;
+
+  for (uint32_t i = 0; i < STLINK_ARRAY_SIZE(coredump_sram_banks); i++) {
+    if (coredump_sram_banks[i].chip_id == sl->chip_id && count < COREDUMP_SRAM_REGION_NUM_MAX) {
+      regions[count].addr = coredump_sram_banks[i].addr;
+      regions[count].size = coredump_sram_banks[i].size;
+      count++;
+    }
+  }
+
+  return (count);
+}
+
+int32_t stlink_coredump(stlink_t *sl, const char *path, const struct stlink_coredump_region *regions,
+                        uint32_t count) {
+  struct stlink_reg regs;
+  uint8_t prstatus[PRSTATUS_SIZE];
+  uint8_t vfp[ARM_VFP_SIZE];
+  uint8_t *hdr;
+  uint32_t hdr_size, notes_size, offset, total = 0;
+  int32_t fpu, err = -1;
+  uint32_t start = time_ms();
+  FILE *fp;
+
+  if (count == 0 || count > COREDUMP_REGION_NUM_MAX) {
+    ELOG("Invalid number of core dump regions: %u\n", count);
+    return (-1);
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    if ((regions[i].addr & 3) || (regions[i].size & 3) || regions[i].size == 0) {
+      ELOG("Core dump region %#010x+%#x is not word aligned\n", regions[i].addr, regions[i].size);
+      return (-1);
+    }
+  }
+
+  if (stlink_force_debug(sl)) {
+    ELOG("Failed to halt the core\n");
+    return (-1);
+  }
+
+  memset(&regs, 0, sizeof(regs));
+
+  if (stlink_read_all_regs(sl, &regs)) {
+    ELOG("Failed to read the core registers\n");
+    return (-1);
+  }
+
+  fpu = has_fpu(sl);
+
+  if (fpu && stlink_read_all_unsupported_regs(sl, &regs)) {
+    WLOG("Failed to read the FPU registers\n");
+    fpu = 0;
+  }
+
+  // NT_PRSTATUS, pr_reg holds r0-r15, cpsr and orig_r0
+  memset(prstatus, 0, sizeof(prstatus));
+  put_u16(prstatus, 12, SIGTRAP);
+  put_u32(prstatus, 24, 1); // pr_pid
+
+  for (uint32_t i = 0; i < 16; i++) {
+    put_u32(prstatus, PRSTATUS_REG_OFFSET + i * 4, regs.r[i]);
+  }
+
+  put_u32(prstatus, PRSTATUS_REG_OFFSET + 16 * 4, regs.xpsr);
+  put_u32(prstatus, PRSTATUS_REG_OFFSET + 17 * 4, regs.r[0]);
+  put_u32(prstatus, PRSTATUS_SIZE - 4, fpu);
+
+  // NT_ARM_VFP, d0-d31 and fpscr; s2n and s2n+1 make up dn
+  memset(vfp, 0, sizeof(vfp));
+
+  for (uint32_t i = 0; i < 32; i++) {
+    put_u32(vfp, i * 4, regs.s[i]);
+  }
+
+  put_u32(vfp, 32 * 8, regs.fpscr);
+
+  notes_size = (NOTE_HEADER_SIZE + PRSTATUS_SIZE) + (fpu ? NOTE_HEADER_SIZE + ARM_VFP_SIZE : 0);
+  hdr_size = ELF_HEADER_SIZE + (count + 1) * ELF_PHDR_SIZE + notes_size;
+  hdr = calloc(1, hdr_size);
+
+  if (hdr == NULL) {
+    return (-1);
+  }
+
+  // ELF header
+  memcpy(hdr, "\177ELF", 4);
+  hdr[4] = 1; // ELFCLASS32
+  hdr[5] = 1; // ELFDATA2LSB
+  hdr[6] = 1; // EV_CURRENT
+  put_u16(hdr, 16, ELF_ET_CORE);
+  put_u16(hdr, 18, ELF_EM_ARM);
+  put_u32(hdr, 20, 1);
+  put_u32(hdr, 28, ELF_HEADER_SIZE);  // e_phoff
+  put_u16(hdr, 40, ELF_HEADER_SIZE);  // e_ehsize
+  put_u16(hdr, 42, ELF_PHDR_SIZE);    // e_phentsize
+  put_u16(hdr, 44, (uint16_t)(count + 1));
+
+  // program headers, PT_NOTE first
+  offset = ELF_HEADER_SIZE + (count + 1) * ELF_PHDR_SIZE;
+  uint8_t *ph = &hdr[ELF_HEADER_SIZE];
+  put_u32(ph, 0, ELF_PT_NOTE);
+  put_u32(ph, 4, offset);
+  put_u32(ph, 16, notes_size);
+  put_u32(ph, 28, 4);
+
+  uint32_t note = put_note(&hdr[offset], NT_PRSTATUS, prstatus, PRSTATUS_SIZE);
+
+  if (fpu) {
+    put_note(&hdr[offset + note], NT_ARM_VFP, vfp, ARM_VFP_SIZE);
+  }
+
+  offset = hdr_size;
+
+  for (uint32_t i = 0; i < count; i++) {
+    ph = &hdr[ELF_HEADER_SIZE + (i + 1) * ELF_PHDR_SIZE];
+    put_u32(ph, 0, ELF_PT_LOAD);
+    put_u32(ph, 4, offset);
+    put_u32(ph, 8, regions[i].addr);  // p_vaddr
+    put_u32(ph, 12, regions[i].addr); // p_paddr
+    put_u32(ph, 16, regions[i].size); // p_filesz
+    put_u32(ph, 20, regions[i].size); // p_memsz
+    put_u32(ph, 24, ELF_PF_RWX);
+    put_u32(ph, 28, 4);
+    offset += regions[i].size;
+  }
+
+  fp = fopen(path, "wb");
+
+  if (fp == NULL) {
+    ELOG("Cannot open %s for writing\n", path);
+    free(hdr);
+    return (-1);
+  }
+
+  if (fwrite(hdr, 1, hdr_size, fp) != hdr_size) {
+    goto on_error;
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    ILOG("Dumping %#010x..%#010x\n", regions[i].addr, regions[i].addr + regions[i].size);
+
+    if (dump_region(sl, fp, regions[i].addr, regions[i].size)) {
+      goto on_error;
+    }
+
+    total += regions[i].size;
+  }
+
+  err = 0;
+
+on_error:
+  if (fclose(fp)) {
+    err = -1;
+  }
+
+  free(hdr);
+
+  if (err) {
+    ELOG("Failed to write core dump %s\n", path);
+  } else {
+    uint32_t elapsed = time_ms() - start;
+    ILOG("Core dump of %u bytes written to %s in %u ms\n", total, path, elapsed);
+  }
+
+  return (err);
+}
@@ -0,0 +1,26 @@
+/*
+ * File: coredump.h
+ *
+ * ELF core dump of the target state
+ */
+
+#ifndef COREDUMP_H
+#define COREDUMP_H
+
+#include <stdint.h>
+
+#include <stlink.h>
+
+#define COREDUMP_REGION_NUM_MAX      16
+#define COREDUMP_SRAM_REGION_NUM_MAX 8
+
+struct stlink_coredump_region {
+  stm32_addr_t addr;
+  uint32_t size;
+};
+
+uint32_t stlink_coredump_sram_regions(stlink_t *sl, struct stlink_coredump_region *regions);
+int32_t stlink_coredump(stlink_t *sl, const char *path, const struct stlink_coredump_region *regions,
+                        uint32_t count);
+
+#endif // COREDUMP_H
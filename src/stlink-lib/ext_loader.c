@@ -0,0 +1,311 @@
+/*
+ * File: ext_loader.c
+ *
+ * External memory loaders
+ *
+ * An external loader is a small program, built for a given board, which
+ * drives a QSPI/OSPI (or any other) memory on behalf of the host: st-flash
+ * uploads it to SRAM, then calls its entry points the way a debugger calls
+ * functions on the target. The data goes through two SRAM buffers, one being
+ * filled over SWD while the loader programs the other.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <stlink.h>
+#include "ext_loader.h"
+
+#include "helper.h"
+#include "logging.h"
+#include "map_file.h"
+#include "read_write.h"
+#include "register.h"
+
+#define EXT_STACK_SIZE      1024       // when the header leaves it at 0
+#define EXT_BUF_MIN         1024
+#define EXT_BUF_MAX         (64 * 1024)
+#define EXT_UPLOAD_BLOCK    (32 * 1024)
+#define EXT_TRAP            0xbe00be00 // bkpt #0, twice
+
+#define EXT_INIT_TIMEOUT    2000       // ms
+#define EXT_ERASE_TIMEOUT   10000      // ms, per sector
+#define EXT_PROGRAM_TIMEOUT 10000      // ms, per buffer
+
+// the entry point must lie in the image, verify alone is optional
+static bool ext_entry_valid(const struct stlink_ext_loader *xl, stm32_addr_t entry, bool optional) {
+  if (entry == 0) { return (optional); }
+
+  entry &= ~1u;
+  return (entry >= xl->load_addr && entry - xl->load_addr < xl->image_size);
+}
+
+int32_t stlink_ext_loader_open(stlink_t *sl, struct stlink_ext_loader *xl, const char *path) {
+  mapped_file_t mf = MAPPED_FILE_INITIALIZER;
+  stm32_addr_t sram_end = sl->sram_base + sl->sram_size;
+  uint32_t stack_size, avail;
+
+  memset(xl, 0, sizeof(*xl));
+
+  if (map_file(&mf, path) == -1) {
+    ELOG("Cannot read the external loader %s\n", path);
+    return (-1);
+  }
+
+  if (mf.len < EXT_LOADER_HEADER_SIZE || read_uint32(mf.base, 0) != EXT_LOADER_MAGIC) {
+    ELOG("%s is not an external loader\n", path);
+    unmap_file(&mf);
+    return (-1);
+  } else if (read_uint32(mf.base, 4) != EXT_LOADER_VERSION) {
+    ELOG("%s: external loader version %u, expected %u\n", path, read_uint32(mf.base, 4), EXT_LOADER_VERSION);
+    unmap_file(&mf);
+    return (-1);
+  }
+
+  xl->image = malloc(mf.len);
+
+  if (xl->image == NULL) {
+    unmap_file(&mf);
+    return (-1);
+  }
+
+  memcpy(xl->image, mf.base, mf.len);
+  xl->image_size = mf.len;
+  unmap_file(&mf);
+
+  xl->load_addr = read_uint32(xl->image, 8);
+  xl->mem_base = read_uint32(xl->image, 12);
+  xl->mem_size = read_uint32(xl->image, 16);
+  xl->sector_size = read_uint32(xl->image, 20);
+  stack_size = read_uint32(xl->image, 24);
+  xl->init = read_uint32(xl->image, 28);
+  xl->erase = read_uint32(xl->image, 32);
+  xl->program = read_uint32(xl->image, 36);
+  xl->verify = read_uint32(xl->image, 40);
+
+  if (stack_size == 0) { stack_size = EXT_STACK_SIZE; }
+
+  // image, trap, two buffers, then the stack at the top of SRAM
+  xl->trap = (xl->load_addr + xl->image_size + 3) & ~3u;
+  xl->buf[0] = xl->trap + 4;
+  xl->stack = sram_end & ~7u;
+
+  if (xl->mem_size == 0 || xl->sector_size == 0 || xl->mem_base + xl->mem_size < xl->mem_base) {
+    ELOG("%s: invalid external memory %#x, size %#x, sector size %#x\n", path, xl->mem_base, xl->mem_size,
+         xl->sector_size);
+  } else if (!ext_entry_valid(xl, xl->init, false) || !ext_entry_valid(xl, xl->erase, false) ||
+             !ext_entry_valid(xl, xl->program, false) || !ext_entry_valid(xl, xl->verify, true)) {
+    ELOG("%s: entry point outside of the loader image\n", path);
+  } else if (xl->load_addr < sl->sram_base || xl->buf[0] > sram_end ||
+             sram_end - xl->buf[0] < 2 * EXT_BUF_MIN + stack_size) {
+    ELOG("%s: loader at %#x does not fit in the SRAM at %#x, size %#x\n", path, xl->load_addr, sl->sram_base,
+         sl->sram_size);
+  } else {
+    avail = (sram_end - xl->buf[0] - stack_size) / 2;
+    xl->buf_size = (avail > EXT_BUF_MAX ? EXT_BUF_MAX : avail) & ~(EXT_BUF_MIN - 1);
+    xl->buf[1] = xl->buf[0] + xl->buf_size;
+
+    ILOG("External loader %s: memory at %#x, size %#x, 2 buffers of %u bytes\n", path, xl->mem_base,
+         xl->mem_size, xl->buf_size);
+    return (0);
+  }
+
+  stlink_ext_loader_close(xl);
+  return (-1);
+}
+
+void stlink_ext_loader_close(struct stlink_ext_loader *xl) {
+  free(xl->image);
+  memset(xl, 0, sizeof(*xl));
+}
+
+bool stlink_ext_loader_contains(const struct stlink_ext_loader *xl, stm32_addr_t addr) {
+  return (xl->image != NULL && addr >= xl->mem_base && addr - xl->mem_base < xl->mem_size);
+}
+
+// writes SRAM, the core may be running
+static int32_t ext_upload(stlink_t *sl, stm32_addr_t addr, const uint8_t *data, uint32_t size) {
+  int32_t ret = 0;
+
+  for (uint32_t off = 0; off < size && !ret; off += EXT_UPLOAD_BLOCK) {
+    uint32_t chunk = (size - off > EXT_UPLOAD_BLOCK) ? EXT_UPLOAD_BLOCK : size - off;
+
+    memcpy(sl->q_buf, data + off, chunk);
+
+    // only the last block may end unaligned, the loader gets the exact size
+    if (chunk & 3) {
+      memset(sl->q_buf + chunk, 0xff, 4 - (chunk & 3));
+      chunk += 4 - (chunk & 3);
+    }
+
+    ret = stlink_write_mem32(sl, addr + off, (uint16_t)chunk);
+  }
+
+  return (ret);
+}
+
+/*
+ * Starts an entry point, which returns to the trap. As for the flash loaders,
+ * r0 is the SRAM buffer (0 for init and erase), r1 the target address and
+ * r2 the size.
+ */
+static int32_t ext_call(stlink_t *sl, struct stlink_ext_loader *xl, stm32_addr_t entry, stm32_addr_t buf,
+                        stm32_addr_t addr, uint32_t size) {
+  stlink_write_reg(sl, buf, 0);
+  stlink_write_reg(sl, addr, 1);
+  stlink_write_reg(sl, size, 2);
+  stlink_write_reg(sl, xl->stack, 13);
+  stlink_write_reg(sl, xl->trap | 1, 14);
+  stlink_write_reg(sl, entry & ~1u, 15);
+
+  return (stlink_run(sl, RUN_FLASH_LOADER));
+}
+
+// waits for the entry point to return, 0 in r0 is a success
+static int32_t ext_wait(stlink_t *sl, struct stlink_ext_loader *xl, uint32_t timeout_ms, const char *what) {
+  struct stlink_reg rr;
+  uint32_t timeout = time_ms() + timeout_ms;
+
+  while (!stlink_is_core_halted(sl)) {
+    if (time_ms() > timeout) {
+      stlink_force_debug(sl);
+      ELOG("External loader %s timed out\n", what);
+      return (-1);
+    }
+
+    usleep(1000);
+  }
+
+  memset(&rr, 0, sizeof(rr));
+  stlink_read_reg(sl, 15, &rr);
+  stlink_read_reg(sl, 0, &rr);
+
+  if (rr.r[15] != xl->trap && rr.r[15] != xl->trap + 2) {
+    ELOG("External loader %s stopped at %#x instead of returning\n", what, rr.r[15]);
+    return (-1);
+  } else if (rr.r[0] != 0) {
+    ELOG("External loader %s failed (%#x)\n", what, rr.r[0]);
+    return (-1);
+  }
+
+  return (0);
+}
+
+// halts the core with its interrupts masked, uploads the loader and runs its init
+static int32_t ext_start(stlink_t *sl, struct stlink_ext_loader *xl) {
+  uint8_t trap[4];
+
+  stlink_write_debug32(sl, STLINK_REG_DHCSR,
+                       STLINK_REG_DHCSR_DBGKEY | STLINK_REG_DHCSR_C_DEBUGEN | STLINK_REG_DHCSR_C_HALT);
+  stlink_write_debug32(sl, STLINK_REG_DHCSR,
+                       STLINK_REG_DHCSR_DBGKEY | STLINK_REG_DHCSR_C_DEBUGEN | STLINK_REG_DHCSR_C_HALT |
+                       STLINK_REG_DHCSR_C_MASKINTS);
+
+  write_uint32(trap, EXT_TRAP);
+
+  if (ext_upload(sl, xl->load_addr, xl->image, xl->image_size) ||
+      ext_upload(sl, xl->trap, trap, sizeof(trap))) {
+    ELOG("Failed to write the external loader to SRAM\n");
+    return (-1);
+  }
+
+  if (ext_call(sl, xl, xl->init, 0, 0, 0)) { return (-1); }
+
+  return (ext_wait(sl, xl, EXT_INIT_TIMEOUT, "init"));
+}
+
+static int32_t ext_erase_sectors(stlink_t *sl, struct stlink_ext_loader *xl, stm32_addr_t addr, uint32_t len) {
+  // whole sectors, from the one holding addr
+  uint32_t skip = (addr - xl->mem_base) % xl->sector_size;
+  uint64_t end = (uint64_t)addr + len;
+
+  for (stm32_addr_t sector = addr - skip; sector < end; sector += xl->sector_size) {
+    if (ext_call(sl, xl, xl->erase, 0, sector, xl->sector_size) ||
+        ext_wait(sl, xl, EXT_ERASE_TIMEOUT, "erase")) {
+      ELOG("Failed to erase the external sector at %#x\n", sector);
+      return (-1);
+    }
+
+    DLOG("External sector at %#x erased\n", sector);
+
+    if (stlink_progress(sl, STLINK_PROGRESS_ERASE, (sector + xl->sector_size - addr < len) ?
+                        sector + xl->sector_size - addr : len, len)) {
+      return (-1);
+    }
+
+    if (sector + xl->sector_size < sector) { break; } // end of the address space
+  }
+
+  return (0);
+}
+
+// runs program or verify over the data, the next buffer uploads while the loader works on one
+static int32_t ext_stream(stlink_t *sl, struct stlink_ext_loader *xl, stm32_addr_t entry, const char *what,
+                          stm32_addr_t addr, const uint8_t *base, uint32_t len, enum stlink_progress_phase phase) {
+  uint32_t size = (len > xl->buf_size) ? xl->buf_size : len;
+
+  if (ext_upload(sl, xl->buf[0], base, size)) { return (-1); }
+
+  for (uint32_t off = 0, n = 0; off < len; off += size, n++) {
+    size = (len - off > xl->buf_size) ? xl->buf_size : len - off;
+    uint32_t next = off + size;
+
+    if (ext_call(sl, xl, entry, xl->buf[n & 1], addr + off, size)) { return (-1); }
+
+    if (next < len &&
+        ext_upload(sl, xl->buf[(n + 1) & 1], base + next, (len - next > xl->buf_size) ? xl->buf_size : len - next)) {
+      stlink_force_debug(sl);
+      return (-1);
+    }
+
+    if (ext_wait(sl, xl, EXT_PROGRAM_TIMEOUT, what)) {
+      ELOG("External loader %s failed at %#x\n", what, addr + off);
+      return (-1);
+    }
+
+    if (stlink_progress(sl, phase, next, len)) { return (-1); }
+  }
+
+  return (0);
+}
+
+static int32_t ext_check_range(const struct stlink_ext_loader *xl, stm32_addr_t addr, uint32_t len) {
+  if (!stlink_ext_loader_contains(xl, addr) || len > xl->mem_size - (addr - xl->mem_base)) {
+    ELOG("%#x..%#x is outside of the external memory at %#x, size %#x\n", addr, addr + len, xl->mem_base,
+         xl->mem_size);
+    return (-1);
+  }
+
+  return (0);
+}
+
+int32_t stlink_ext_erase(stlink_t *sl, struct stlink_ext_loader *xl, stm32_addr_t addr, uint32_t len) {
+  if (ext_check_range(xl, addr, len) || ext_start(sl, xl)) { return (-1); }
+
+  return (ext_erase_sectors(sl, xl, addr, len));
+}
+
+int32_t stlink_ext_write(stlink_t *sl, struct stlink_ext_loader *xl, stm32_addr_t addr, const uint8_t *base,
+                         uint32_t len, bool erase) {
+  uint32_t start = time_ms();
+
+  ILOG("Attempting to write %u (%#x) bytes to external memory at %#x\n", len, len, addr);
+
+  if (ext_check_range(xl, addr, len) || ext_start(sl, xl)) { return (-1); }
+
+  if (erase && ext_erase_sectors(sl, xl, addr, len)) { return (-1); }
+
+  if (ext_stream(sl, xl, xl->program, "program", addr, base, len, STLINK_PROGRESS_WRITE)) { return (-1); }
+
+  if (xl->verify == 0) {
+    WLOG("The external loader cannot verify, %u bytes written unchecked\n", len);
+  } else if (ext_stream(sl, xl, xl->verify, "verify", addr, base, len, STLINK_PROGRESS_VERIFY)) {
+    return (-1);
+  }
+
+  ILOG("Wrote %u bytes to external memory in %u ms\n", len, time_ms() - start);
+  return (0);
+}
@@ -0,0 +1,45 @@
+/*
+ * File: ext_loader.h
+ *
+ * External memory loaders
+ */
+
+#ifndef EXT_LOADER_H
+#define EXT_LOADER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <stlink.h>
+
+#define EXT_LOADER_MAGIC       0x4c585453 // "STXL"
+#define EXT_LOADER_VERSION     1
+#define EXT_LOADER_HEADER_SIZE 44
+
+/*
+ * An external loader image, as described by its header: see doc/flashloaders.md
+ * for the header layout and the calling convention of the entry points.
+ */
+struct stlink_ext_loader {
+  uint8_t *image;         // the loader image, header included
+  uint32_t image_size;
+  stm32_addr_t load_addr; // SRAM address the image is linked to run at
+  stm32_addr_t mem_base;  // external memory, where it is mapped in the address space
+  uint32_t mem_size;
+  uint32_t sector_size;   // erase unit
+  stm32_addr_t init, erase, program, verify; // entry points, verify may be 0
+
+  stm32_addr_t trap;      // breakpoint the entry points return to
+  stm32_addr_t buf[2];    // the data buffers, filled in turns
+  uint32_t buf_size;
+  stm32_addr_t stack;     // initial sp
+};
+
+int32_t stlink_ext_loader_open(stlink_t *sl, struct stlink_ext_loader *xl, const char *path);
+void stlink_ext_loader_close(struct stlink_ext_loader *xl);
+bool stlink_ext_loader_contains(const struct stlink_ext_loader *xl, stm32_addr_t addr);
+int32_t stlink_ext_erase(stlink_t *sl, struct stlink_ext_loader *xl, stm32_addr_t addr, uint32_t len);
+int32_t stlink_ext_write(stlink_t *sl, struct stlink_ext_loader *xl, stm32_addr_t addr, const uint8_t *base,
+                         uint32_t len, bool erase);
+
+#endif // EXT_LOADER_H
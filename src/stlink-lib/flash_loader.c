@@ -330,7 +330,8 @@ int32_t stlink_flash_loader_write_to_sram(stlink_t *sl, stm32_addr_t* addr, uint
     return (0); // success
 }
 
-int32_t stlink_flash_loader_run(stlink_t *sl, flash_loader_t* fl, stm32_addr_t target, const uint8_t* buf, uint32_t size) {
+// runs the flash loader on the size bytes already in its SRAM buffer
+static int32_t flash_loader_exec(stlink_t *sl, flash_loader_t* fl, stm32_addr_t target, uint32_t size) {
     struct stlink_reg rr;
     uint32_t timeout;
     uint32_t flash_base = 0;
@@ -338,11 +339,6 @@ int32_t stlink_flash_loader_run(stlink_t *sl, flash_loader_t* fl, stm32_addr_t t
 
     DLOG("Running flash loader, write address:%#x, size: %u\n", target, size);
 
-    if (write_buffer_to_sram(sl, fl, buf, size) == -1) {
-        ELOG("write_buffer_to_sram() == -1\n");
-        return (-1);
-    }
-
     if ((sl->flash_type == STM32_FLASH_TYPE_F1_XL) && (target >= FLASH_BANK2_START_ADDR)) {
         flash_base = FLASH_REGS_BANK2_OFS;
     }
@@ -423,6 +419,15 @@ int32_t stlink_flash_loader_run(stlink_t *sl, flash_loader_t* fl, stm32_addr_t t
   return (-1);
 }
 
+int32_t stlink_flash_loader_run(stlink_t *sl, flash_loader_t* fl, stm32_addr_t target, const uint8_t* buf, uint32_t size) {
+    if (write_buffer_to_sram(sl, fl, buf, size) == -1) {
+        ELOG("write_buffer_to_sram() == -1\n");
+        return (-1);
+    }
+
+    return (flash_loader_exec(sl, fl, target, size));
+}
+
 
 /* === Content from old source file flashloader.c === */
 
@@ -475,6 +480,11 @@ int32_t stm32l1_write_half_pages(stlink_t *sl, flash_loader_t *fl, stm32_addr_t
       fflush(stdout);
     }
 
+    if (stlink_progress(sl, STLINK_PROGRESS_WRITE, (count + 1) * pagesize, len)) {
+      ret = -1;
+      break; // leaves the half page mode below
+    }
+
     // wait for sr.busy to be cleared
     wait_flash_busy(sl);
   }
@@ -590,7 +600,134 @@ static void set_dma_state(stlink_t *sl, flash_loader_t *fl, int32_t bckpRstr) {
   }
 }
 
-int32_t stlink_flashloader_start(stlink_t *sl, flash_loader_t *fl) {
+/*
+ * --boost-clock: the flash loaders of F2/F4/F7 run from the 16 MHz HSI after a
+ * reset. They run at 64 MHz instead, from the PLL fed by the HSI, with
+ * 3 wait states and APB1/APB2 at HCLK/4 and HCLK/2: within the limits of
+ * every chip of these families, at any supply voltage and voltage scale.
+ * Targets whose firmware already set up its clocks are left alone.
+ */
+#define BOOST_PLLCFGR  0x06012008 // PLLQ 6, PLLSRC HSI, PLLP 4, PLLN 128, PLLM 8
+#define BOOST_CFGR_PRE 0x00009400 // PPRE2 2, PPRE1 4, HPRE 1
+#define BOOST_LATENCY  3
+#define BOOST_TIMEOUT  100        // ms
+
+static bool wait_clock(stlink_t *sl, uint32_t addr, uint32_t mask, uint32_t match) {
+  uint32_t timeout = time_ms() + BOOST_TIMEOUT;
+  uint32_t value;
+
+  do {
+    if (stlink_read_debug32(sl, addr, &value)) { return (false); }
+
+    if ((value & mask) == match) { return (true); }
+  } while (time_ms() < timeout);
+
+  return (false);
+}
+
+// puts the clock registers back as boost_clock() found them
+static void restore_clock(stlink_t *sl, flash_loader_t *fl) {
+  if (!fl->clock_boosted) { return; }
+
+  fl->clock_boosted = false;
+
+  // back to the HSI, then the PLL can stop, then the wait states can go
+  stlink_write_debug32(sl, STM32F4_RCC_CFGR, fl->rcc_cfgr_bkp);
+
+  if (!wait_clock(sl, STM32F4_RCC_CFGR, STM32F4_RCC_CFGR_SWS_MASK, fl->rcc_cfgr_bkp & STM32F4_RCC_CFGR_SWS_MASK)) {
+    WLOG("Core clock does not switch back, target left running from the PLL\n");
+    return;
+  }
+
+  stlink_write_debug32(sl, STM32F4_RCC_CR, fl->rcc_cr_bkp);
+  wait_clock(sl, STM32F4_RCC_CR, STM32F4_RCC_CR_PLLRDY, 0);
+  stlink_write_debug32(sl, STM32F4_RCC_PLLCFGR, fl->rcc_pllcfgr_bkp);
+  stlink_write_debug32(sl, FLASH_F4_ACR, fl->flash_acr_bkp);
+  DLOG("Core clock restored\n");
+}
+
+static void boost_clock(stlink_t *sl, flash_loader_t *fl) {
+  uint32_t cr, pllcfgr, cfgr, acr;
+
+  fl->clock_boosted = false;
+
+  if (!sl->boost_clock) { return; }
+
+  if (sl->flash_type != STM32_FLASH_TYPE_F2_F4 && sl->flash_type != STM32_FLASH_TYPE_F7) {
+    WLOG("--boost-clock is not supported on this chip, ignored\n");
+    return;
+  }
+
+  if (stlink_read_debug32(sl, STM32F4_RCC_CR, &cr) ||
+      stlink_read_debug32(sl, STM32F4_RCC_PLLCFGR, &pllcfgr) ||
+      stlink_read_debug32(sl, STM32F4_RCC_CFGR, &cfgr) ||
+      stlink_read_debug32(sl, FLASH_F4_ACR, &acr)) {
+    WLOG("Failed to read the clock configuration, clock not boosted\n");
+    return;
+  }
+
+  if ((cr & STM32F4_RCC_CR_PLLON) || (cfgr & STM32F4_RCC_CFGR_SWS_MASK)) {
+    ILOG("Core clock already configured by the target, not boosted\n");
+    return;
+  }
+
+  fl->rcc_cr_bkp = cr;
+  fl->rcc_pllcfgr_bkp = pllcfgr;
+  fl->rcc_cfgr_bkp = cfgr;
+  fl->flash_acr_bkp = acr;
+  fl->clock_boosted = true;
+
+  // the wait states go up before the clock does
+  stlink_write_debug32(sl, FLASH_F4_ACR, (acr & ~FLASH_F4_ACR_LATENCY_MASK) | BOOST_LATENCY);
+  stlink_write_debug32(sl, STM32F4_RCC_CFGR, (cfgr & ~STM32F4_RCC_CFGR_PRE_MASK) | BOOST_CFGR_PRE);
+  stlink_write_debug32(sl, STM32F4_RCC_PLLCFGR, (pllcfgr & ~STM32F4_RCC_PLLCFGR_MASK) | BOOST_PLLCFGR);
+  stlink_write_debug32(sl, STM32F4_RCC_CR, cr | STM32F4_RCC_CR_PLLON);
+
+  if (!wait_clock(sl, FLASH_F4_ACR, FLASH_F4_ACR_LATENCY_MASK, BOOST_LATENCY) ||
+      !wait_clock(sl, STM32F4_RCC_CR, STM32F4_RCC_CR_PLLRDY, STM32F4_RCC_CR_PLLRDY)) {
+    WLOG("PLL does not lock, clock not boosted\n");
+    restore_clock(sl, fl);
+    return;
+  }
+
+  stlink_write_debug32(sl, STM32F4_RCC_CFGR,
+                       (cfgr & ~(STM32F4_RCC_CFGR_PRE_MASK | STM32F4_RCC_CFGR_SW_MASK)) |
+                       BOOST_CFGR_PRE | STM32F4_RCC_CFGR_SW_PLL);
+
+  if (!wait_clock(sl, STM32F4_RCC_CFGR, STM32F4_RCC_CFGR_SWS_MASK, STM32F4_RCC_CFGR_SWS_PLL)) {
+    WLOG("Core clock does not switch to the PLL, clock not boosted\n");
+    restore_clock(sl, fl);
+    return;
+  }
+
+  ILOG("Core clock boosted to 64 MHz for the flash loader\n");
+}
+
+// the target voltage, which selects the flash write parallelism on F2/F4/F7
+static int32_t flash_write_voltage(stlink_t *sl) {
+  int32_t voltage;
+
+  if (sl->version.stlink_v == 1) {
+    WLOG("STLINK V1 cannot read voltage, use default voltage 3.2 V\n");
+    voltage = 3200;
+  } else {
+    voltage = stlink_target_voltage(sl);
+  }
+
+  if (voltage == -1) { ELOG("Failed to read Target voltage\n"); }
+
+  return (voltage);
+}
+
+/*
+ * Uploads the flash loader of the families that have one, masks the interrupts
+ * and turns the DMA off, then boosts the clock if asked to. The flash is left
+ * locked: stlink_flashloader_unlock() sets it up for programming.
+ */
+int32_t stlink_flashloader_prepare(stlink_t *sl, flash_loader_t *fl) {
+  fl->clock_boosted = false;
+  fl->voltage = 0;
+
   // disable DMA
   set_dma_state(sl, fl, 0);
 
@@ -610,35 +747,64 @@ int32_t stlink_flashloader_start(stlink_t *sl, flash_loader_t *fl) {
       return (-1);
     }
 
-    unlock_flash_if(sl); // first unlock the cr
-
-    int32_t voltage;
-    if (sl->version.stlink_v == 1) {
-      WLOG("STLINK V1 cannot read voltage, use default voltage 3.2 V\n");
-      voltage = 3200;
-    } else {
-      voltage = stlink_target_voltage(sl);
-    }
+    fl->voltage = flash_write_voltage(sl);
 
-    if (voltage == -1) {
-      ELOG("Failed to read Target voltage\n");
-      return (-1);
-    }
+    if (fl->voltage == -1) { return (-1); }
 
     if (sl->flash_type == STM32_FLASH_TYPE_L4) {
       // L4 does not have a byte-write mode
-      if (voltage < 1710) {
-        ELOG("Target voltage (%d mV) too low for flash writes!\n", voltage);
+      if (fl->voltage < 1710) {
+        ELOG("Target voltage (%d mV) too low for flash writes!\n", fl->voltage);
         return (-1);
       }
+    } else if (fl->voltage > 2700) {
+      ILOG("enabling 32-bit flash writes\n");
     } else {
-      if (voltage > 2700) {
-        ILOG("enabling 32-bit flash writes\n");
-        write_flash_cr_psiz(sl, 2, BANK_1);
-      } else {
-        ILOG("Target voltage (%d mV) too low for 32-bit flash, using 8-bit flash writes\n", voltage);
-        write_flash_cr_psiz(sl, 0, BANK_1);
-      }
+      ILOG("Target voltage (%d mV) too low for 32-bit flash, using 8-bit flash writes\n", fl->voltage);
+    }
+  } else if (sl->flash_type == STM32_FLASH_TYPE_WB_WL ||
+             sl->flash_type == STM32_FLASH_TYPE_G0 ||
+             sl->flash_type == STM32_FLASH_TYPE_G4 ||
+             sl->flash_type == STM32_FLASH_TYPE_L5_U5_H5 ||
+             sl->flash_type == STM32_FLASH_TYPE_C0) {
+    ILOG("Starting Flash write for WB/G0/G4/L5/U5/H5/C0\n");
+  } else if (sl->flash_type == STM32_FLASH_TYPE_L0_L1) {
+    ILOG("Starting Flash write for L0\n");
+
+    /* Flash loader initialisation */
+    if (stlink_flash_loader_init(sl, fl) == -1) {
+      // L0/L1 have fallback to soft write
+      WLOG("stlink_flash_loader_init() == -1\n");
+    }
+  } else if ((sl->flash_type == STM32_FLASH_TYPE_F0_F1_F3) ||
+             (sl->flash_type == STM32_FLASH_TYPE_F1_XL)) {
+    ILOG("Starting Flash write for VL/F0/F3/F1_XL\n");
+
+    // flash loader initialisation
+    if (stlink_flash_loader_init(sl, fl) == -1) {
+      ELOG("stlink_flash_loader_init() == -1\n");
+      return (-1);
+    }
+  } else if (sl->flash_type == STM32_FLASH_TYPE_H7) {
+    ILOG("Starting Flash write for H7\n");
+  } else {
+    ELOG("unknown coreid, not sure how to write: %x\n", sl->core_id);
+    return (-1);
+  }
+
+  boost_clock(sl, fl);
+  return (0);
+}
+
+// Unlocks the flash and puts it in programming mode, again after an erase has locked it
+int32_t stlink_flashloader_unlock(stlink_t *sl, flash_loader_t *fl) {
+  if ((sl->flash_type == STM32_FLASH_TYPE_F2_F4) ||
+      (sl->flash_type == STM32_FLASH_TYPE_F7) ||
+      (sl->flash_type == STM32_FLASH_TYPE_L4)) {
+    unlock_flash_if(sl); // first unlock the cr
+
+    if (sl->flash_type != STM32_FLASH_TYPE_L4) {
+      write_flash_cr_psiz(sl, fl->voltage > 2700 ? 2 : 0, BANK_1);
     }
 
     // set programming mode
@@ -648,13 +814,9 @@ int32_t stlink_flashloader_start(stlink_t *sl, flash_loader_t *fl) {
              sl->flash_type == STM32_FLASH_TYPE_G4 ||
              sl->flash_type == STM32_FLASH_TYPE_L5_U5_H5 ||
              sl->flash_type == STM32_FLASH_TYPE_C0) {
-    ILOG("Starting Flash write for WB/G0/G4/L5/U5/H5/C0\n");
-
     unlock_flash_if(sl);         // unlock flash if necessary
     set_flash_cr_pg(sl, BANK_1); // set PG 'allow programming' bit
   } else if (sl->flash_type == STM32_FLASH_TYPE_L0_L1) {
-    ILOG("Starting Flash write for L0\n");
-
     uint32_t val;
     uint32_t flash_regs_base = get_stm32l0_flash_base(sl);
 
@@ -679,22 +841,8 @@ int32_t stlink_flashloader_start(stlink_t *sl, flash_loader_t *fl) {
       ELOG("pecr.prglock not clear\n");
       return (-1);
     }
-
-    /* Flash loader initialisation */
-    if (stlink_flash_loader_init(sl, fl) == -1) {
-      // L0/L1 have fallback to soft write
-      WLOG("stlink_flash_loader_init() == -1\n");
-    }
   } else if ((sl->flash_type == STM32_FLASH_TYPE_F0_F1_F3) ||
              (sl->flash_type == STM32_FLASH_TYPE_F1_XL)) {
-    ILOG("Starting Flash write for VL/F0/F3/F1_XL\n");
-
-    // flash loader initialisation
-    if (stlink_flash_loader_init(sl, fl) == -1) {
-      ELOG("stlink_flash_loader_init() == -1\n");
-      return (-1);
-    }
-
     // unlock flash
     unlock_flash_if(sl);
 
@@ -704,8 +852,6 @@ int32_t stlink_flashloader_start(stlink_t *sl, flash_loader_t *fl) {
       set_flash_cr_pg(sl, BANK_2);
     }
   } else if (sl->flash_type == STM32_FLASH_TYPE_H7) {
-    ILOG("Starting Flash write for H7\n");
-
     unlock_flash_if(sl);         // unlock the cr
     set_flash_cr_pg(sl, BANK_1); // set programming mode
     if (sl->chip_flags & CHIP_F_HAS_DUAL_BANK) {
@@ -719,13 +865,49 @@ int32_t stlink_flashloader_start(stlink_t *sl, flash_loader_t *fl) {
       }
     }
   } else {
-    ELOG("unknown coreid, not sure how to write: %x\n", sl->core_id);
     return (-1);
   }
 
   return (0);
 }
 
+// Leaves the programming mode and locks the flash
+void stlink_flashloader_lock(stlink_t *sl) {
+  if ((sl->flash_type == STM32_FLASH_TYPE_C0) ||
+      (sl->flash_type == STM32_FLASH_TYPE_F0_F1_F3) ||
+      (sl->flash_type == STM32_FLASH_TYPE_F1_XL) ||
+      (sl->flash_type == STM32_FLASH_TYPE_F2_F4) ||
+      (sl->flash_type == STM32_FLASH_TYPE_F7) ||
+      (sl->flash_type == STM32_FLASH_TYPE_G0) ||
+      (sl->flash_type == STM32_FLASH_TYPE_G4) ||
+      (sl->flash_type == STM32_FLASH_TYPE_H7) ||
+      (sl->flash_type == STM32_FLASH_TYPE_L4) ||
+      (sl->flash_type == STM32_FLASH_TYPE_L5_U5_H5) ||
+      (sl->flash_type == STM32_FLASH_TYPE_WB_WL)) {
+
+    clear_flash_cr_pg(sl, BANK_1);
+    if ((sl->flash_type == STM32_FLASH_TYPE_H7 && sl->chip_flags & CHIP_F_HAS_DUAL_BANK) ||
+        sl->flash_type == STM32_FLASH_TYPE_F1_XL) {
+      clear_flash_cr_pg(sl, BANK_2);
+    }
+    lock_flash(sl);
+  } else if (sl->flash_type == STM32_FLASH_TYPE_L0_L1) {
+    uint32_t val;
+    uint32_t flash_regs_base = get_stm32l0_flash_base(sl);
+
+    // reset lock bits
+    stlink_read_debug32(sl, flash_regs_base + FLASH_PECR_OFF, &val);
+    val |= (1 << 0) | (1 << 1) | (1 << 2);
+    stlink_write_debug32(sl, flash_regs_base + FLASH_PECR_OFF, val);
+  }
+}
+
+int32_t stlink_flashloader_start(stlink_t *sl, flash_loader_t *fl) {
+  if (stlink_flashloader_prepare(sl, fl)) { return (-1); }
+
+  return (stlink_flashloader_unlock(sl, fl));
+}
+
 int32_t stlink_flashloader_write(stlink_t *sl, flash_loader_t *fl, stm32_addr_t addr, uint8_t *base, uint32_t len) {
   uint32_t off;
 
@@ -742,6 +924,8 @@ int32_t stlink_flashloader_write(stlink_t *sl, flash_loader_t *fl, stm32_addr_t
       }
 
       off += size;
+
+      if (stlink_progress(sl, STLINK_PROGRESS_WRITE, off, len)) { return (-1); }
     }
   } else if (sl->flash_type == STM32_FLASH_TYPE_WB_WL ||
              sl->flash_type == STM32_FLASH_TYPE_G0 ||
@@ -762,6 +946,11 @@ int32_t stlink_flashloader_write(stlink_t *sl, flash_loader_t *fl, stm32_addr_t
         fflush(stdout);
       }
 
+      // page boundaries only, the words are programmed in pairs
+      if ((off % sl->flash_pgsz) == 0 && stlink_progress(sl, STLINK_PROGRESS_WRITE, off, len)) {
+        return (-1);
+      }
+
       // write_uint32((unsigned char *)&data, *(uint32_t *)(base + off));
       data = 0;
       memcpy(&data, base + off, (len - off) < 4 ? (len - off) : 4);
@@ -831,6 +1020,8 @@ int32_t stlink_flashloader_write(stlink_t *sl, flash_loader_t *fl, stm32_addr_t
 
       lock_flash(sl);
 
+      if (stlink_progress(sl, STLINK_PROGRESS_WRITE, off + size, len)) { return (-1); }
+
       if (sl->verbose >= 1) {
         // show progress; writing procedure is slow and previous errors are
         // misleading
@@ -847,11 +1038,18 @@ int32_t stlink_flashloader_write(stlink_t *sl, flash_loader_t *fl, stm32_addr_t
       // Program STM32H7x with 64-byte Flash words
       uint32_t chunk = (len - off > 64) ? 64 : len - off;
       memcpy(sl->q_buf, base + off, chunk);
-      stlink_write_mem32(sl, addr + off, 64);
+
+      if (stlink_write_mem32(sl, addr + off, 64)) {
+        ELOG("Failed to write the flash word at %#x\n", addr + off);
+        return (-1);
+      }
+
       wait_flash_busy(sl);
 
       off += chunk;
 
+      if (stlink_progress(sl, STLINK_PROGRESS_WRITE, off, len)) { return (-1); }
+
       if (sl->verbose >= 1) {
         // show progress
         fprintf(stdout, "%u/%u bytes written\n", off, len);
@@ -868,43 +1066,131 @@ int32_t stlink_flashloader_write(stlink_t *sl, flash_loader_t *fl, stm32_addr_t
   return check_flash_error(sl);
 }
 
-int32_t stlink_flashloader_stop(stlink_t *sl, flash_loader_t *fl) {
-  uint32_t dhcsr;
+/*
+ * Erases the sectors of F2/F4/F7 just in time, right before they are programmed.
+ * A sector erase keeps the flash busy for up to seconds but leaves the SRAM
+ * writable, so the loader and the next data buffer are uploaded while it runs.
+ * The control register only goes back to programming mode once the erase is
+ * done, it cannot be written while the flash is busy.
+ */
+static int32_t flashloader_erase_write(stlink_t *sl, flash_loader_t *fl, stm32_addr_t addr, uint8_t *base, uint32_t len) {
+  uint32_t buf_size = (sl->sram_size > 0x8000) ? 0x8000 : 0x4000;
+  stm32_addr_t sector = addr; // the sector erasing, or erased last
+  stm32_addr_t erased = addr; // end of the sectors erased, or being erased
+  bool erasing, programming = false;
+  int32_t voltage;
+  uint32_t off, size;
+
+  ILOG("Starting Flash erase and write for F2/F4/F7\n");
+
+  // the first sector erases while the loader is uploaded
+  stlink_erase_flash_page_start(sl, sector);
+  erased += stlink_calculate_pagesize(sl, sector);
+  erasing = true;
+
+  if (stlink_flash_loader_init(sl, fl) == -1) {
+    ELOG("stlink_flash_loader_init() == -1\n");
+    return (-1);
+  }
 
-  if ((sl->flash_type == STM32_FLASH_TYPE_C0) ||
-      (sl->flash_type == STM32_FLASH_TYPE_F0_F1_F3) ||
-      (sl->flash_type == STM32_FLASH_TYPE_F1_XL) ||
-      (sl->flash_type == STM32_FLASH_TYPE_F2_F4) ||
-      (sl->flash_type == STM32_FLASH_TYPE_F7) ||
-      (sl->flash_type == STM32_FLASH_TYPE_G0) ||
-      (sl->flash_type == STM32_FLASH_TYPE_G4) ||
-      (sl->flash_type == STM32_FLASH_TYPE_H7) ||
-      (sl->flash_type == STM32_FLASH_TYPE_L4) ||
-      (sl->flash_type == STM32_FLASH_TYPE_L5_U5_H5) ||
-      (sl->flash_type == STM32_FLASH_TYPE_WB_WL)) {
+  voltage = flash_write_voltage(sl);
 
-    clear_flash_cr_pg(sl, BANK_1);
-    if ((sl->flash_type == STM32_FLASH_TYPE_H7 && sl->chip_flags & CHIP_F_HAS_DUAL_BANK) ||
-        sl->flash_type == STM32_FLASH_TYPE_F1_XL) {
-      clear_flash_cr_pg(sl, BANK_2);
+  if (voltage == -1) {
+    return (-1);
+  } else if (voltage <= 2700) {
+    ILOG("Target voltage (%d mV) too low for 32-bit flash, using 8-bit flash writes\n", voltage);
+  }
+
+  for (off = 0; off < len; off += size) {
+    size = len - off > buf_size ? buf_size : len - off;
+
+    if (!erasing && addr + off + size > erased) {
+      if (programming) { clear_flash_cr_pg(sl, BANK_1); }
+
+      sector = erased;
+      stlink_erase_flash_page_start(sl, sector);
+      erased += stlink_calculate_pagesize(sl, sector);
+      erasing = true;
+      programming = false;
     }
-    lock_flash(sl);
-  } else if (sl->flash_type == STM32_FLASH_TYPE_L0_L1) {
-    uint32_t val;
-    uint32_t flash_regs_base = get_stm32l0_flash_base(sl);
 
-    // reset lock bits
-    stlink_read_debug32(sl, flash_regs_base + FLASH_PECR_OFF, &val);
-    val |= (1 << 0) | (1 << 1) | (1 << 2);
-    stlink_write_debug32(sl, flash_regs_base + FLASH_PECR_OFF, val);
+    if (write_buffer_to_sram(sl, fl, base + off, size) == -1) {
+      ELOG("write_buffer_to_sram() == -1\n");
+      return (-1);
+    }
+
+    // a buffer may span more than one sector, the further ones erase in turn
+    while (erasing) {
+      wait_flash_busy(sl);
+
+      if (check_flash_error(sl)) {
+        ELOG("Failed to erase the flash sector at %#x\n", sector);
+        return (-1);
+      }
+
+      fprintf(stdout, "-> Flash page at %#x erased (size: %#x)\n", sector, erased - sector);
+      fflush(stdout);
+
+      if (stlink_progress(sl, STLINK_PROGRESS_ERASE, (erased - addr < len) ? erased - addr : len, len)) {
+        return (-1);
+      }
+
+      erasing = addr + off + size > erased;
+
+      if (erasing) {
+        sector = erased;
+        stlink_erase_flash_page_start(sl, sector);
+        erased += stlink_calculate_pagesize(sl, sector);
+      }
+    }
+
+    if (!programming) {
+      // the parallelism sticks, the PG bit comes and goes with the erases
+      if (off == 0) { write_flash_cr_psiz(sl, voltage > 2700 ? 2 : 0, BANK_1); }
+
+      set_flash_cr_pg(sl, BANK_1);
+      programming = true;
+    }
+
+    if (flash_loader_exec(sl, fl, addr + off, size) == -1) {
+      ELOG("stlink_flash_loader_run(%#x) failed! == -1\n", (addr + off));
+      check_flash_error(sl);
+      return (-1);
+    }
+
+    if (stlink_progress(sl, STLINK_PROGRESS_WRITE, off + size, len)) { return (-1); }
   }
 
+  return (0);
+}
+
+int32_t stlink_flashloader_erase_write(stlink_t *sl, flash_loader_t *fl, stm32_addr_t addr, uint8_t *base, uint32_t len) {
+  // disable DMA
+  set_dma_state(sl, fl, 0);
+
+  // wait for ongoing op to finish
+  wait_flash_busy(sl);
+  // Clear errors
+  clear_flash_error(sl);
+
+  boost_clock(sl, fl);
+
+  return (flashloader_erase_write(sl, fl, addr, base, len));
+}
+
+int32_t stlink_flashloader_stop(stlink_t *sl, flash_loader_t *fl) {
+  uint32_t dhcsr;
+
+  stlink_flashloader_lock(sl);
+
   // enable interrupt
   if (!stlink_read_debug32(sl, STLINK_REG_DHCSR, &dhcsr)) {
     stlink_write_debug32(sl, STLINK_REG_DHCSR, STLINK_REG_DHCSR_DBGKEY | STLINK_REG_DHCSR_C_DEBUGEN |
                          (dhcsr & (~STLINK_REG_DHCSR_C_MASKINTS)));
   }
 
+  restore_clock(sl, fl);
+
   // restore DMA state
   set_dma_state(sl, fl, 1);
 
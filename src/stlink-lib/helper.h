@@ -8,6 +8,7 @@
 #define HELPER_H
 
 uint32_t time_ms();
+uint64_t time_us();
 int32_t arg_parse_freq(const char *str);
 
 #endif // HELPER_H
@@ -75,6 +75,13 @@
 /* Data Watchpoint and Trace (DWT) Registers */
 #define STLINK_REG_DWT_CTRL                 0xE0001000 // DWT Control Register
 #define STLINK_REG_DWT_CTRL_NUM_COMP        (1 << 28)
+#define STLINK_REG_DWT_CTRL_NOPRFCNT        (1 << 24)
+#define STLINK_REG_DWT_CTRL_CYCEVTENA       (1 << 22)
+#define STLINK_REG_DWT_CTRL_FOLDEVTENA      (1 << 21)
+#define STLINK_REG_DWT_CTRL_LSUEVTENA       (1 << 20)
+#define STLINK_REG_DWT_CTRL_SLEEPEVTENA     (1 << 19)
+#define STLINK_REG_DWT_CTRL_EXCEVTENA       (1 << 18)
+#define STLINK_REG_DWT_CTRL_CPIEVTENA       (1 << 17)
 #define STLINK_REG_DWT_CTRL_CYC_TAP         (1 << 9)
 #define STLINK_REG_DWT_CTRL_POST_INIT       (1 << 5)
 #define STLINK_REG_DWT_CTRL_POST_PRESET     (1 << 1)
@@ -111,12 +118,19 @@
 #define STLINK_REG_TPI_FFCR  0xE0040304     // TPI Formatter and Flush Control Register
 #define STLINK_REG_TPI_FFCR_TRIG_IN         (0x01 << 8)
 
+/* Vector Table Offset Register */
+#define STLINK_REG_VTOR                     0xe000ed08
+
 /* Application Interrupt and Reset Control Register */
 #define STLINK_REG_AIRCR                    0xe000ed0c
 #define STLINK_REG_AIRCR_VECTKEY            0x05fa0000
 #define STLINK_REG_AIRCR_SYSRESETREQ        0x00000004
 #define STLINK_REG_AIRCR_VECTRESET          0x00000001
 
+/* Coprocessor Access Control Register */
+#define STLINK_REG_CPACR                    0xE000ED88
+#define STLINK_REG_CPACR_CP10_CP11          (0x0F << 20)
+
 /* ARM Cortex-M7 Processor Technical Reference Manual */
 /* Cache Control and Status Register */
 #define STLINK_REG_CM7_CTR                  0xE000ED7C
@@ -22,10 +22,15 @@
 #include <stdbool.h>
 #include <unistd.h>
 
+#if defined(STLINK_HAVE_PTHREAD_H)
+#include <pthread.h>
+#endif // STLINK_HAVE_PTHREAD_H
+
 #include <stlink.h>
 #include "usb.h"
 
 #include "commands.h"
+#include "helper.h"
 #include "logging.h"
 #include "read_write.h"
 #include "register.h"
@@ -77,6 +82,114 @@ static int32_t _stlink_match_speed_map(const uint32_t *map, uint32_t map_size, u
     return (speed_index);
 }
 
+/*
+ * One libusb context is shared by all the open probes. While more than one is
+ * open, a thread handles the USB events of them all: the transfers then wait
+ * in libusb_handle_events_completed(), which leaves the events to the thread
+ * holding the event lock, instead of each probe polling its own context.
+ * refs counts the users of the context, handles only the open probes.
+ */
+static struct {
+    libusb_context *ctx;
+    uint32_t refs;
+    uint32_t handles;
+#if defined(STLINK_HAVE_PTHREAD_H)
+    pthread_t thread;
+    bool thread_started;
+    int32_t thread_stop;
+#endif // STLINK_HAVE_PTHREAD_H
+} usb_shared;
+
+#if defined(STLINK_HAVE_PTHREAD_H)
+static pthread_mutex_t usb_shared_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *usb_event_thread(void *arg) {
+    (void) arg;
+
+    while (!usb_shared.thread_stop) {
+        struct timeval tv = { 0, 100000 };
+        libusb_handle_events_timeout_completed(usb_shared.ctx, &tv, &usb_shared.thread_stop);
+    }
+
+    return (NULL);
+}
+
+// called with usb_shared_lock held
+static void usb_event_thread_stop(void) {
+    if (!usb_shared.thread_started) { return; }
+
+    usb_shared.thread_stop = 1;
+#if LIBUSB_API_VERSION >= 0x01000105
+    libusb_interrupt_event_handler(usb_shared.ctx);
+#endif
+    pthread_join(usb_shared.thread, NULL);
+    usb_shared.thread_started = false;
+}
+#endif // STLINK_HAVE_PTHREAD_H
+
+// handle is true for an open probe, false for a mere user of the context
+static libusb_context *usb_context_get(enum ugly_loglevel verbose, bool handle) {
+    libusb_context *ctx = NULL;
+
+#if defined(STLINK_HAVE_PTHREAD_H)
+    pthread_mutex_lock(&usb_shared_lock);
+#endif // STLINK_HAVE_PTHREAD_H
+
+    if (usb_shared.refs == 0 && libusb_init(&usb_shared.ctx)) {
+        usb_shared.ctx = NULL;
+        goto on_error;
+    }
+
+#if LIBUSB_API_VERSION < 0x01000106
+    libusb_set_debug(usb_shared.ctx, ugly_libusb_log_level(verbose));
+#else
+    libusb_set_option(usb_shared.ctx, LIBUSB_OPTION_LOG_LEVEL, ugly_libusb_log_level(verbose));
+#endif
+
+    ctx = usb_shared.ctx;
+    usb_shared.refs++;
+
+    if (handle) { usb_shared.handles++; }
+
+#if defined(STLINK_HAVE_PTHREAD_H)
+    // a single probe handles its own events, without a thread switch per transfer
+    if (usb_shared.handles == 2 && !usb_shared.thread_started) {
+        usb_shared.thread_stop = 0;
+        usb_shared.thread_started = pthread_create(&usb_shared.thread, NULL, usb_event_thread, NULL) == 0;
+
+        if (!usb_shared.thread_started) { WLOG("cannot start the USB event thread\n"); }
+    }
+#endif // STLINK_HAVE_PTHREAD_H
+
+on_error:
+#if defined(STLINK_HAVE_PTHREAD_H)
+    pthread_mutex_unlock(&usb_shared_lock);
+#endif // STLINK_HAVE_PTHREAD_H
+    return (ctx);
+}
+
+static void usb_context_put(bool handle) {
+#if defined(STLINK_HAVE_PTHREAD_H)
+    pthread_mutex_lock(&usb_shared_lock);
+#endif // STLINK_HAVE_PTHREAD_H
+
+    if (handle && usb_shared.handles) { usb_shared.handles--; }
+
+#if defined(STLINK_HAVE_PTHREAD_H)
+    // back to a single probe, or none
+    if (usb_shared.handles < 2) { usb_event_thread_stop(); }
+#endif // STLINK_HAVE_PTHREAD_H
+
+    if (usb_shared.refs && --usb_shared.refs == 0) {
+        libusb_exit(usb_shared.ctx);
+        usb_shared.ctx = NULL;
+    }
+
+#if defined(STLINK_HAVE_PTHREAD_H)
+    pthread_mutex_unlock(&usb_shared_lock);
+#endif // STLINK_HAVE_PTHREAD_H
+}
+
 void _stlink_usb_close(stlink_t* sl) {
     if (!sl) { return; }
 
@@ -84,13 +197,87 @@ void _stlink_usb_close(stlink_t* sl) {
 
     // maybe we couldn't even get the usb device?
     if (handle != NULL) {
+        libusb_free_transfer(handle->transfer_req);
+        libusb_free_transfer(handle->transfer_rep);
+        libusb_free_transfer(handle->transfer_trace);
+
         if (handle->usb_handle != NULL) { libusb_close(handle->usb_handle); }
 
-        libusb_exit(handle->libusb_ctx);
+        if (handle->libusb_ctx != NULL) { usb_context_put(true); }
+
         free(handle);
     }
 }
 
+static void LIBUSB_CALL usb_transfer_done(struct libusb_transfer *transfer) {
+    *(int32_t *) transfer->user_data = 1;
+}
+
+/*
+ * Synchronous bulk transfer on the preallocated transfer of an endpoint, the
+ * same as libusb_bulk_transfer() without the allocation per call. Returns a
+ * libusb error code.
+ */
+static int32_t usb_transfer(struct stlink_libusb* handle, struct libusb_transfer *transfer, uint32_t endpoint,
+                            unsigned char* buf, uint32_t len, int32_t *actual, uint32_t timeout) {
+    int32_t completed = 0;
+    int32_t t;
+
+    *actual = 0;
+    libusb_fill_bulk_transfer(transfer, handle->usb_handle, (unsigned char) endpoint, buf, (int32_t) len,
+                              usb_transfer_done, &completed, timeout);
+    t = libusb_submit_transfer(transfer);
+
+    if (t) { return (t); }
+
+    while (!completed) {
+        t = libusb_handle_events_completed(handle->libusb_ctx, &completed);
+
+        if (t < 0 && t != LIBUSB_ERROR_INTERRUPTED) {
+            libusb_cancel_transfer(transfer);
+
+            while (!completed && libusb_handle_events_completed(handle->libusb_ctx, &completed) >= 0) {}
+
+            return (t);
+        }
+    }
+
+    *actual = transfer->actual_length;
+
+    switch (transfer->status) {
+    case LIBUSB_TRANSFER_COMPLETED: return (0);
+    case LIBUSB_TRANSFER_TIMED_OUT: return (LIBUSB_ERROR_TIMEOUT);
+    case LIBUSB_TRANSFER_STALL:     return (LIBUSB_ERROR_PIPE);
+    case LIBUSB_TRANSFER_NO_DEVICE: return (LIBUSB_ERROR_NO_DEVICE);
+    case LIBUSB_TRANSFER_OVERFLOW:  return (LIBUSB_ERROR_OVERFLOW);
+    default:                        return (LIBUSB_ERROR_IO);
+    }
+}
+
+static uint32_t usb_timeout(const struct stlink_libusb* handle, uint32_t len) {
+    return (STLINK_USB_TIMEOUT_MS + handle->busy_ms + len * STLINK_SWD_CLOCKS_PER_BYTE / handle->swd_khz);
+}
+
+/*
+ * Reads a reply. A reply filling its last packet completes without a ZLP, but
+ * the probe may still terminate it with one, which then shows up as an empty
+ * next reply: it is skipped without another request.
+ */
+static int32_t usb_read(struct stlink_libusb* handle, struct libusb_transfer *transfer, uint32_t endpoint,
+                        unsigned char* buf, uint32_t len, int32_t *actual) {
+    uint32_t timeout = usb_timeout(handle, len);
+    int32_t t = usb_transfer(handle, transfer, endpoint, buf, len, actual, timeout);
+
+    if (t == 0 && *actual == 0 && len != 0 && handle->rep_zlp) {
+        DLOG("skipping the ZLP of the previous reply\n");
+        t = usb_transfer(handle, transfer, endpoint, buf, len, actual, timeout);
+    }
+
+    handle->rep_zlp = t == 0 && *actual != 0 && *actual % handle->packet_size == 0;
+    handle->busy_ms = 0;
+    return (t);
+}
+
 ssize_t send_recv(struct stlink_libusb* handle, int32_t terminate, unsigned char* txbuf, uint32_t txsize,
                     unsigned char* rxbuf, uint32_t rxsize, int32_t check_error, const char *cmd) {
     // Note: txbuf and rxbuf can point to the same area
@@ -98,7 +285,9 @@ ssize_t send_recv(struct stlink_libusb* handle, int32_t terminate, unsigned char
 
     while (1) {
         res = 0;
-        t = libusb_bulk_transfer(handle->usb_handle, handle->ep_req, txbuf, (int32_t) txsize, &res, 3000);
+        // the probe knows the length from the command, no ZLP after full packets
+        t = usb_transfer(handle, handle->transfer_req, handle->ep_req, txbuf, txsize, &res,
+                         usb_timeout(handle, txsize));
 
         if (t) {
             ELOG("%s send request failed: %s\n", cmd, libusb_error_name(t));
@@ -107,8 +296,12 @@ ssize_t send_recv(struct stlink_libusb* handle, int32_t terminate, unsigned char
             ELOG("%s send request wrote %u bytes, instead of %u\n", cmd, (uint32_t) res, (uint32_t) txsize);
         }
 
+        // data to write keeps the probe busy after it has been received
+        handle->busy_ms = rxsize == 0 && txsize > handle->cmd_len ?
+            txsize * STLINK_SWD_CLOCKS_PER_BYTE / handle->swd_khz : 0;
+
         if (rxsize != 0) {
-            t = libusb_bulk_transfer(handle->usb_handle, handle->ep_rep, rxbuf, (int32_t) rxsize, &res, 3000);
+            t = usb_read(handle, handle->transfer_rep, handle->ep_rep, rxbuf, rxsize, &res);
 
             if (t) {
                 ELOG("%s read reply failed: %s\n", cmd, libusb_error_name(t));
@@ -152,7 +345,7 @@ ssize_t send_recv(struct stlink_libusb* handle, int32_t terminate, unsigned char
         if ((handle->protocoll == 1) && terminate) {
             // read the SG reply
             unsigned char sg_buf[13];
-            t = libusb_bulk_transfer(handle->usb_handle, handle->ep_rep, sg_buf, 13, &res, 3000);
+            t = usb_read(handle, handle->transfer_rep, handle->ep_rep, sg_buf, 13, &res);
 
             if (t) {
                 ELOG("%s read storage failed: %s\n", cmd, libusb_error_name(t));
@@ -637,6 +830,8 @@ int32_t _stlink_usb_set_swdclk(stlink_t* sl, int32_t clk_freq) {
             case 1800: clk_divisor = STLINK_SWDCLK_1P8MHZ_DIVISOR; break;
             case 4000: clk_divisor = STLINK_SWDCLK_4MHZ_DIVISOR; break;
             }
+
+            slu->swd_khz = map[speed_index];
         } else
             clk_divisor = STLINK_SWDCLK_1P8MHZ_DIVISOR;
 
@@ -689,6 +884,8 @@ int32_t _stlink_usb_set_swdclk(stlink_t* sl, int32_t clk_freq) {
 
         size = send_recv(slu, 1, cmd, slu->cmd_len, data, 8, CMD_CHECK_STATUS, "SET_COM_FREQ");
 
+        if (size >= 0 && map[speed_index]) { slu->swd_khz = map[speed_index]; }
+
         return (size < 0 ? -1 : 0);
     } else if (clk_freq) {
         WLOG("ST-Link firmware does not support frequency setup\n");
@@ -1039,7 +1236,8 @@ int32_t _stlink_usb_read_trace(stlink_t* sl, uint8_t* buf, uint32_t size) {
 
     if (trace_count != 0) {
         int32_t res = 0;
-        int32_t t = libusb_bulk_transfer(slu->usb_handle, slu->ep_trace, buf, trace_count, &res, 3000);
+        int32_t t = usb_transfer(slu, slu->transfer_trace, slu->ep_trace, buf, trace_count, &res,
+                                 STLINK_USB_TIMEOUT_MS);
 
         if (t || res != (int32_t) trace_count) {
             ELOG("read_trace read error %d\n", t);
@@ -1120,19 +1318,17 @@ uint32_t stlink_serial(struct libusb_device_handle *handle, struct libusb_device
     return (uint32_t)strlen(serial);
 }
 
-/**
- * Open a stlink
- * @param verbose Verbosity loglevel
- * @param connect Type of connect to target
- * @param serial  Serial number to search for, when NULL the first stlink found is opened (binary format)
- * @retval NULL   Error while opening the stlink
- * @retval !NULL  Stlink found and ready to use
+/*
+ * Opens the probe dev, or the first one with the given serial if dev is NULL,
+ * and connects to its target.
  */
-stlink_t *stlink_open_usb(enum ugly_loglevel verbose, enum connect_type connect, char serial[STLINK_SERIAL_BUFFER_SIZE], int32_t freq) {
+static stlink_t *usb_open(enum ugly_loglevel verbose, enum connect_type connect,
+                          char serial[STLINK_SERIAL_BUFFER_SIZE], int32_t freq, libusb_device *dev) {
     stlink_t* sl = NULL;
     struct stlink_libusb* slu = NULL;
     int32_t ret = -1;
     int32_t config;
+    uint64_t start = time_us();
 
     sl = calloc(1, sizeof(stlink_t));
     if (sl == NULL) { goto on_malloc_error; }
@@ -1146,72 +1342,77 @@ stlink_t *stlink_open_usb(enum ugly_loglevel verbose, enum connect_type connect,
 
     sl->core_stat = TARGET_UNKNOWN;
 
-    if (libusb_init(&(slu->libusb_ctx))) {
+    slu->libusb_ctx = usb_context_get(verbose, true);
+
+    if (slu->libusb_ctx == NULL) {
         WLOG("failed to init libusb context, wrong version of libraries?\n");
         goto on_error;
     }
 
-#if LIBUSB_API_VERSION < 0x01000106
-    libusb_set_debug(slu->libusb_ctx, ugly_libusb_log_level(verbose));
-#else
-    libusb_set_option(slu->libusb_ctx, LIBUSB_OPTION_LOG_LEVEL, ugly_libusb_log_level(verbose));
-#endif
-
     libusb_device **list = NULL;
-    ssize_t cnt = libusb_get_device_list(slu->libusb_ctx, &list);
     struct libusb_device_descriptor desc;
 
-    while (cnt-- > 0) {
-        struct libusb_device_handle *handle;
+    if (dev != NULL) {
+        // the caller has read its serial already
+        libusb_get_device_descriptor(dev, &desc);
+        memcpy(sl->serial, serial, STLINK_SERIAL_BUFFER_SIZE);
+    } else {
+        ssize_t cnt = libusb_get_device_list(slu->libusb_ctx, &list);
 
-        libusb_get_device_descriptor(list[cnt], &desc);
+        while (cnt-- > 0) {
+            struct libusb_device_handle *handle;
 
-        if (desc.idVendor != STLINK_USB_VID_ST) { continue; }
+            libusb_get_device_descriptor(list[cnt], &desc);
 
-        ret = libusb_open(list[cnt], &handle);
+            if (desc.idVendor != STLINK_USB_VID_ST) { continue; }
 
-        if (ret) { continue; } // could not open device
+            ret = libusb_open(list[cnt], &handle);
 
-        uint32_t serial_len = stlink_serial(handle, &desc, sl->serial);
+            if (ret) { continue; } // could not open device
 
-        libusb_close(handle);
+            uint32_t serial_len = stlink_serial(handle, &desc, sl->serial);
 
-        if (serial_len != STLINK_SERIAL_LENGTH) { continue; } // could not read the serial
-
-        // if no serial provided, or if serial match device, fixup version and protocol
-        if (((serial == NULL) || (*serial == 0)) || (memcmp(serial, &sl->serial, STLINK_SERIAL_LENGTH) == 0)) {
-            if (STLINK_V1_USB_PID(desc.idProduct)) {
-                slu->protocoll = 1;
-                sl->version.stlink_v = 1;
-            } else if (STLINK_V2_USB_PID(desc.idProduct) || STLINK_V2_1_USB_PID(desc.idProduct)) {
-                sl->version.stlink_v = 2;
-            } else if (STLINK_V3_USB_PID(desc.idProduct)) {
-                sl->version.stlink_v = 3;
-            }
+            libusb_close(handle);
 
-            break;
+            if (serial_len != STLINK_SERIAL_LENGTH) { continue; } // could not read the serial
+
+            // if no serial provided, or if serial match device
+            if (((serial == NULL) || (*serial == 0)) || (memcmp(serial, &sl->serial, STLINK_SERIAL_LENGTH) == 0)) {
+                dev = list[cnt];
+                break;
+            }
         }
-    }
 
-    if (cnt < 0) {
-        WLOG ("Couldn't find any ST-Link devices\n");
-        libusb_free_device_list(list, 1);
-        goto on_error;
-    } else {
-        ret = libusb_open(list[cnt], &slu->usb_handle);
-
-        if (ret != 0) {
-            WLOG("Error %d (%s) opening ST-Link v%d device %03d:%03d\n", ret,
-                 strerror(errno),
-                 sl->version.stlink_v,
-                 libusb_get_bus_number(list[cnt]),
-                 libusb_get_device_address(list[cnt]));
+        if (dev == NULL) {
+            WLOG ("Couldn't find any ST-Link devices\n");
             libusb_free_device_list(list, 1);
             goto on_error;
         }
     }
 
-    libusb_free_device_list(list, 1);
+    // fixup version and protocol
+    if (STLINK_V1_USB_PID(desc.idProduct)) {
+        slu->protocoll = 1;
+        sl->version.stlink_v = 1;
+    } else if (STLINK_V2_USB_PID(desc.idProduct) || STLINK_V2_1_USB_PID(desc.idProduct)) {
+        sl->version.stlink_v = 2;
+    } else if (STLINK_V3_USB_PID(desc.idProduct)) {
+        sl->version.stlink_v = 3;
+    }
+
+    ret = libusb_open(dev, &slu->usb_handle);
+
+    if (ret != 0) {
+        WLOG("Error %d (%s) opening ST-Link v%d device %03d:%03d\n", ret,
+             strerror(errno),
+             sl->version.stlink_v,
+             libusb_get_bus_number(dev),
+             libusb_get_device_address(dev));
+        if (list) { libusb_free_device_list(list, 1); }
+        goto on_error;
+    }
+
+    if (list) { libusb_free_device_list(list, 1); }
 
 // libusb_kernel_driver_active is not available on Windows.
 #if !defined(_WIN32)
@@ -1267,10 +1468,23 @@ stlink_t *stlink_open_usb(enum ugly_loglevel verbose, enum connect_type connect,
 
     slu->sg_transfer_idx = 0;
     slu->cmd_len = (slu->protocoll == 1) ? STLINK_SG_SIZE : STLINK_CMD_SIZE;
+    slu->packet_size = STLINK_USB_PACKET_SIZE;
+    slu->swd_khz = STLINK_SWD_KHZ_DEFAULT;
+    slu->transfer_req = libusb_alloc_transfer(0);
+    slu->transfer_rep = libusb_alloc_transfer(0);
+    slu->transfer_trace = libusb_alloc_transfer(0);
+
+    if (!slu->transfer_req || !slu->transfer_rep || !slu->transfer_trace) {
+        WLOG("libusb_alloc_transfer() failed\n");
+        goto on_libusb_error;
+    }
 
     // initialize stlink version (sl->version)
     stlink_version(sl);
 
+    // the short version replies don't depend on it, V3 probes use high speed packets
+    if (sl->version.stlink_v == 3) { slu->packet_size = STLINK_V3_USB_PACKET_SIZE; }
+
     int32_t mode = stlink_current_mode(sl);
     if (mode == STLINK_DEV_DFU_MODE) {
         DLOG("-- exit_dfu_mode\n");
@@ -1296,6 +1510,7 @@ stlink_t *stlink_open_usb(enum ugly_loglevel verbose, enum connect_type connect,
     DLOG("JTAG/SWD freq set to %d\n", freq);
     _stlink_usb_set_swdclk(sl, freq);
 
+    sl->connect_times.usb = (uint32_t) (time_us() - start);
     stlink_target_connect(sl, connect);
     return (sl);
 
@@ -1304,7 +1519,7 @@ on_libusb_error:
     return (NULL);
 
 on_error:
-    if (slu->libusb_ctx) { libusb_exit(slu->libusb_ctx); }
+    if (slu->libusb_ctx) { usb_context_put(true); }
 
 on_malloc_error:
     if (sl != NULL) { free(sl); }
@@ -1313,6 +1528,18 @@ on_malloc_error:
     return (NULL);
 }
 
+/**
+ * Open a stlink
+ * @param verbose Verbosity loglevel
+ * @param connect Type of connect to target
+ * @param serial  Serial number to search for, when NULL the first stlink found is opened (binary format)
+ * @retval NULL   Error while opening the stlink
+ * @retval !NULL  Stlink found and ready to use
+ */
+stlink_t *stlink_open_usb(enum ugly_loglevel verbose, enum connect_type connect, char serial[STLINK_SERIAL_BUFFER_SIZE], int32_t freq) {
+    return (usb_open(verbose, connect, serial, freq, NULL));
+}
+
 static uint32_t stlink_probe_usb_devs(libusb_device **devs, stlink_t **sldevs[], enum connect_type connect, int32_t freq) {
     stlink_t **_sldevs;
     libusb_device *dev;
@@ -1382,7 +1609,7 @@ static uint32_t stlink_probe_usb_devs(libusb_device **devs, stlink_t **sldevs[],
 
         if (serial_len != STLINK_SERIAL_LENGTH) { continue; }
 
-        stlink_t *sl = stlink_open_usb(0, connect, serial, freq);
+        stlink_t *sl = usb_open(0, connect, serial, freq, dev);
 
         if (!sl) {
             ELOG("Failed to open USB device %#06x:%#06x\n", desc.idVendor, desc.idProduct);
@@ -1402,21 +1629,23 @@ uint32_t stlink_probe_usb(stlink_t **stdevs[], enum connect_type connect, int32_
     stlink_t **sldevs;
 
     uint32_t slcnt = 0;
-    int32_t r;
     ssize_t cnt;
 
-    r = libusb_init(NULL);
+    libusb_context *ctx = usb_context_get(0, false);
 
-    if (r < 0) { return (0); }
+    if (ctx == NULL) { return (0); }
 
-    cnt = libusb_get_device_list(NULL, &devs);
+    cnt = libusb_get_device_list(ctx, &devs);
 
-    if (cnt < 0) { return (0); }
+    if (cnt < 0) {
+        usb_context_put(false);
+        return (0);
+    }
 
     slcnt = stlink_probe_usb_devs(devs, &sldevs, connect, freq);
     libusb_free_device_list(devs, 1);
 
-    libusb_exit(NULL);
+    usb_context_put(false);
 
     *stdevs = sldevs;
 
@@ -7,6 +7,7 @@
 #ifndef USB_H
 #define USB_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "libusb_settings.h"
@@ -48,6 +49,17 @@
 #define STLINK_SG_SIZE 31
 #define STLINK_CMD_SIZE 16
 
+// bulk endpoint packet sizes, ST-LINK/V3 is a high speed device
+#define STLINK_USB_PACKET_SIZE    64
+#define STLINK_V3_USB_PACKET_SIZE 512
+
+// Transfer timeouts: a round trip through the probe firmware, plus the SWD time
+// of the payload at the current clock. 12 SWD clocks per byte of memory access,
+// doubled for the wait states of the target.
+#define STLINK_USB_TIMEOUT_MS         250
+#define STLINK_SWD_CLOCKS_PER_BYTE    24
+#define STLINK_SWD_KHZ_DEFAULT        1800
+
 enum SCSI_Generic_Direction {SG_DXFER_TO_DEV = 0, SG_DXFER_FROM_DEV = 0x80};
 
 struct stlink_libusb {
@@ -59,6 +71,14 @@ struct stlink_libusb {
     int32_t protocoll;
     uint32_t sg_transfer_idx;
     uint32_t cmd_len;
+    // reused for every transfer on the endpoint, instead of one allocated per call
+    struct libusb_transfer* transfer_req;
+    struct libusb_transfer* transfer_rep;
+    struct libusb_transfer* transfer_trace;
+    uint32_t packet_size;
+    uint32_t swd_khz;           // SWD clock the timeouts are scaled for
+    uint32_t busy_ms;           // SWD time of written data the probe may still be working on
+    bool rep_zlp;               // the last reply filled its last packet, a ZLP may follow
 };
 
 // static inline uint32_t le_to_h_u32(const uint8_t* buf);
@@ -0,0 +1,394 @@
+/*
+ * File: bench.c
+ *
+ * Microbenchmarks of the host-side kernels whose cost grows with the size of
+ * the image or of the trace: Intel hex parsing, MD5 and checksum of images,
+ * the GDB hex codec, ITM decoding and chip file parsing. Each runs on
+ * synthetic inputs, after warmup runs, a number of times; one JSON object per
+ * kernel is printed on stdout, for scripts to compare runs.
+ *
+ * Usage: test-bench [--quick] [--reps=N] [--warmup=N]
+ *
+ * --quick runs each kernel once on small inputs, which checks the results
+ * but measures nothing: this is how ctest runs it.
+ */
+
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include <stlink.h>
+#include <chipid.h>
+#include <lib_md5.h>
+#include <logging.h>
+#include <md5.h>
+
+#include "gdb-remote.h"
+#include "itm.h"
+
+#define BENCH_IHEX_SIZE  (16 * 1024 * 1024)   // of the file
+#define BENCH_IMAGE_SIZE (16 * 1024 * 1024)   // md5, checksum
+#define BENCH_HEX_SIZE   (1024 * 1024)        // of the hex packet
+#define BENCH_TRACE_SIZE (100 * 1024 * 1024)
+#define BENCH_TRACE_BUF  (1024 * 1024)        // replayed until BENCH_TRACE_SIZE
+#define BENCH_QUICK      64                   // --quick divides the sizes by this
+
+#define BENCH_IHEX_BASE  0x08000000
+
+struct bench {
+    const char *name;
+    bool (*setup)(void);
+    void (*run)(void);
+    bool (*check)(void);
+    const uint64_t *bytes;  // processed by one run
+};
+
+static uint32_t bench_div = 1;
+static uint32_t bench_reps = 5;
+static uint32_t bench_warmup = 1;
+
+static uint8_t *image;      // random data, BENCH_IMAGE_SIZE
+static uint32_t image_size;
+static uint64_t image_bytes;
+
+static char ihex_path[] = "/tmp/stlink-bench-XXXXXX";
+static uint32_t ihex_data_size;
+static uint64_t ihex_bytes;
+static uint8_t *ihex_mem;
+static uint32_t ihex_mem_size;
+static uint32_t ihex_begin;
+
+static MD5_HASH md5_hash;
+static MD5_HASH md5_first;
+
+static char *hex_text;
+static uint8_t *hex_data;
+static uint32_t hex_size;   // bytes, the packet has twice as many digits
+static uint64_t hex_bytes;
+
+static uint8_t *trace_buf;
+static uint32_t trace_len;
+static uint32_t trace_passes;
+static uint32_t trace_chars;      // target source bytes in trace_buf
+static uint64_t trace_bytes;
+static st_trace_t trace;
+
+static char chips_dir[] = STLINK_CHIPS_DIR;
+static uint32_t chips_count;
+static uint64_t chips_bytes;
+
+static uint64_t bench_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec);
+}
+
+static uint32_t lcg_state = 0x12345678;
+
+static uint8_t lcg_next(void) {
+    lcg_state = lcg_state * 1664525u + 1013904223u;
+    return ((uint8_t)(lcg_state >> 24));
+}
+
+/* Intel hex: 16 byte data records from BENCH_IHEX_BASE, with an extended
+ * linear address record at each 64 KiB boundary. */
+
+static void ihex_record(FILE *fp, uint8_t type, uint16_t offset, const uint8_t *data, uint8_t len) {
+    uint8_t sum = (uint8_t)(len + (offset >> 8) + (offset & 0xff) + type);
+
+    fprintf(fp, ":%02X%04X%02X", len, offset, type);
+
+    for (uint32_t i = 0; i < len; i++) {
+        fprintf(fp, "%02X", data[i]);
+        sum += data[i];
+    }
+
+    fprintf(fp, "%02X\n", (uint8_t)(0x100 - sum));
+}
+
+static bool ihex_setup(void) {
+    int32_t fd = mkstemp(ihex_path);
+    FILE *fp = fd < 0 ? NULL : fdopen(fd, "w");
+
+    if (fp == NULL) {
+        perror(ihex_path);
+        return (false);
+    }
+
+    // 44 characters per 16 byte record
+    ihex_data_size = (BENCH_IHEX_SIZE / bench_div) / 44 * 16;
+
+    for (uint32_t off = 0; off < ihex_data_size; off += 16) {
+        uint32_t addr = BENCH_IHEX_BASE + off;
+
+        if ((addr & 0xffff) == 0) {
+            uint8_t lba[2] = { (uint8_t)(addr >> 24), (uint8_t)(addr >> 16) };
+            ihex_record(fp, 4, 0, lba, 2);
+        }
+
+        ihex_record(fp, 0, (uint16_t)addr, image + off, 16);
+    }
+
+    ihex_record(fp, 1, 0, NULL, 0);
+    ihex_bytes = (uint64_t)ftell(fp);
+    fclose(fp);
+    return (true);
+}
+
+static void ihex_run(void) {
+    free(ihex_mem);
+    ihex_mem = NULL;
+
+    if (stlink_parse_ihex(ihex_path, 0xff, &ihex_mem, &ihex_mem_size, &ihex_begin)) {
+        ihex_mem_size = 0;
+    }
+}
+
+static bool ihex_check(void) {
+    bool ok = ihex_mem != NULL && ihex_begin == BENCH_IHEX_BASE && ihex_mem_size == ihex_data_size &&
+              !memcmp(ihex_mem, image, ihex_data_size);
+    free(ihex_mem);
+    ihex_mem = NULL;
+    unlink(ihex_path);
+    return (ok);
+}
+
+static void md5_run(void) {
+    Md5Context context;
+
+    Md5Initialise(&context);
+    Md5Update(&context, image, image_size);
+    Md5Finalise(&context, &md5_hash);
+}
+
+static bool md5_check(void) {
+    // same digest from 1 byte updates
+    Md5Context context;
+
+    Md5Initialise(&context);
+
+    for (uint32_t i = 0; i < image_size; i++) { Md5Update(&context, image + i, 1); }
+
+    Md5Finalise(&context, &md5_first);
+    return (!memcmp(&md5_hash, &md5_first, sizeof(md5_hash)));
+}
+
+static void checksum_run(void) {
+    mapped_file_t mp = { image, image_size };
+    stlink_checksum(&mp);  // prints the sum on stdout
+}
+
+static bool hex_setup(void) {
+    hex_size = BENCH_HEX_SIZE / 2 / bench_div;
+    hex_text = malloc(hex_size * 2);
+    hex_data = malloc(hex_size);
+    hex_bytes = (uint64_t)hex_size * 2;
+    return (hex_text != NULL && hex_data != NULL);
+}
+
+static void hex_encode_run(void) {
+    gdb_hex_encode(hex_text, image, hex_size);
+}
+
+static void hex_decode_run(void) {
+    gdb_hex_decode(hex_data, hex_text, hex_size);
+}
+
+static bool hex_check(void) {
+    return (!memcmp(hex_data, image, hex_size));
+}
+
+/* ITM: mostly stimulus port 0 bytes, as printf() over SWO makes them, with
+ * timestamps and DWT packets in between. */
+
+static bool trace_setup(void) {
+    uint32_t size = BENCH_TRACE_BUF / bench_div;
+    trace_buf = malloc(size);
+
+    if (trace_buf == NULL) { return (false); }
+
+    trace_len = 0;
+    trace_chars = 0;
+
+    for (uint32_t i = 0; trace_len + 6 <= size; i++) {
+        if (i % 16 == 7) {
+            // local timestamp, 1 continuation byte
+            trace_buf[trace_len++] = 0xc0;
+            trace_buf[trace_len++] = 0x05;
+        } else if (i % 64 == 13) {
+            // DWT packet with a 4 byte payload
+            trace_buf[trace_len++] = 0x07;
+
+            for (uint32_t j = 0; j < 4; j++) { trace_buf[trace_len++] = lcg_next(); }
+        } else {
+            trace_buf[trace_len++] = 0x01;
+            trace_buf[trace_len++] = (i % 64 == 63) ? '\n' : (uint8_t)('a' + i % 26);
+            trace_chars++;
+        }
+    }
+
+    trace_passes = (BENCH_TRACE_SIZE / bench_div) / trace_len;
+    trace_bytes = (uint64_t)trace_len * trace_passes;
+    return (true);
+}
+
+static void trace_run(void) {
+    memset(&trace, 0, sizeof(trace));
+
+    for (uint32_t pass = 0; pass < trace_passes; pass++) {
+        for (uint32_t i = 0; i < trace_len; i++) { trace.state = update_trace(&trace, trace_buf[i]); }
+    }
+}
+
+static void trace_block_run(void) {
+    memset(&trace, 0, sizeof(trace));
+
+    for (uint32_t pass = 0; pass < trace_passes; pass++) { update_trace_block(&trace, trace_buf, trace_len); }
+}
+
+static bool trace_check(void) {
+    return (trace.count_target_data == trace_chars * trace_passes && trace.count_error == 0 &&
+            trace.count_raw_bytes == trace_len * trace_passes);
+}
+
+static bool chips_setup(void) {
+    DIR *d = opendir(chips_dir);
+    struct dirent *dir;
+    if (d == NULL) {
+        perror(chips_dir);
+        return (false);
+    }
+
+    while ((dir = readdir(d)) != NULL) {
+        size_t nl = strlen(dir->d_name);
+        char path[1024];
+        struct stat st;
+
+        if (nl < 5 || strcmp(dir->d_name + nl - 5, ".chip")) { continue; }
+
+        snprintf(path, sizeof(path), "%s/%s", chips_dir, dir->d_name);
+
+        if (!stat(path, &st)) {
+            chips_bytes += (uint64_t)st.st_size;
+            chips_count++;
+        }
+    }
+
+    closedir(d);
+    return (chips_count > 0);
+}
+
+static void chips_run(void) {
+    init_chipids(chips_dir);   // the previous list is leaked, as on every call
+}
+
+static bool chips_check(void) {
+    uint32_t n = 0;
+
+    for (uint32_t id = 0; id < 0x1000; id++) { n += stlink_chipid_get_params(id) != NULL; }
+
+    return (n > 0 && n <= chips_count);
+}
+
+static struct bench benches[] = {
+    { "ihex_parse",       ihex_setup,  ihex_run,        ihex_check,  &ihex_bytes  },
+    { "md5",              NULL,        md5_run,         md5_check,   &image_bytes },
+    { "checksum",         NULL,        checksum_run,    NULL,        &image_bytes },
+    { "gdb_hex_encode",   hex_setup,   hex_encode_run,  NULL,        &hex_bytes   },
+    { "gdb_hex_decode",   NULL,        hex_decode_run,  hex_check,   &hex_bytes   },
+    { "itm_decode",       trace_setup, trace_run,       trace_check, &trace_bytes },
+    { "itm_decode_block", NULL,        trace_block_run, trace_check, &trace_bytes },
+    { "chipfiles",        chips_setup, chips_run,       chips_check, &chips_bytes },
+};
+
+static int compare_ns(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return ((x > y) - (x < y));
+}
+
+static bool bench_one(FILE *out, struct bench *b) {
+    uint64_t *ns = calloc(bench_reps, sizeof(uint64_t));
+    uint64_t total = 0;
+
+    if (ns == NULL || (b->setup && !b->setup())) {
+        fprintf(out, "{\"kernel\":\"%s\",\"error\":\"setup\"}\n", b->name);
+        free(ns);
+        return (false);
+    }
+
+    for (uint32_t i = 0; i < bench_warmup; i++) { b->run(); }
+
+    for (uint32_t i = 0; i < bench_reps; i++) {
+        uint64_t start = bench_ns();
+        b->run();
+        ns[i] = bench_ns() - start;
+        total += ns[i];
+    }
+
+    qsort(ns, bench_reps, sizeof(uint64_t), compare_ns);
+    uint64_t median = ns[bench_reps / 2];
+    uint64_t bytes = *b->bytes;
+    bool ok = b->check == NULL || b->check();
+
+    fprintf(out, "{\"kernel\":\"%s\",\"bytes\":%llu,\"warmup\":%u,\"reps\":%u,"
+            "\"min_ns\":%llu,\"median_ns\":%llu,\"mean_ns\":%llu,\"mb_per_s\":%.1f,\"ok\":%s}\n",
+            b->name, (unsigned long long)bytes, bench_warmup, bench_reps, (unsigned long long)ns[0],
+            (unsigned long long)median, (unsigned long long)(total / bench_reps),
+            median ? (double)bytes * 1000.0 / (double)median : 0.0, ok ? "true" : "false");
+
+    free(ns);
+    return (ok);
+}
+
+int32_t main(int32_t argc, char **argv) {
+    for (int32_t i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--quick")) {
+            bench_div = BENCH_QUICK;
+            bench_reps = 1;
+            bench_warmup = 0;
+        } else if (!strncmp(argv[i], "--reps=", 7) && atoi(argv[i] + 7) > 0) {
+            bench_reps = (uint32_t)atoi(argv[i] + 7);
+        } else if (!strncmp(argv[i], "--warmup=", 9) && atoi(argv[i] + 9) >= 0) {
+            bench_warmup = (uint32_t)atoi(argv[i] + 9);
+        } else {
+            fprintf(stderr, "Usage: %s [--quick] [--reps=N] [--warmup=N]\n", argv[0]);
+            return (1);
+        }
+    }
+
+    // the kernels print their results and the ITM decoder the target output on stdout
+    FILE *out = fdopen(dup(STDOUT_FILENO), "w");
+
+    if (out == NULL || freopen("/dev/null", "w", stdout) == NULL) { return (1); }
+
+    ugly_init(UERROR);
+
+    image_size = BENCH_IMAGE_SIZE / bench_div;
+    image_bytes = image_size;
+    image = malloc(image_size);
+
+    if (image == NULL) { return (1); }
+
+    for (uint32_t i = 0; i < image_size; i++) { image[i] = lcg_next(); }
+
+    uint32_t failures = 0;
+
+    for (uint32_t i = 0; i < STLINK_ARRAY_SIZE(benches); i++) {
+        if (!bench_one(out, &benches[i])) { failures++; }
+
+        fflush(out);
+    }
+
+    free(image);
+    free(hex_text);
+    free(hex_data);
+    free(trace_buf);
+    return (failures ? 1 : 0);
+}
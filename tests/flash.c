@@ -72,6 +72,13 @@ static bool execute_test(const struct Test * test) {
         ret &= (opts.log_level == test->opts.log_level);
         ret &= (opts.freq == test->opts.freq);
         ret &= (opts.format == test->opts.format);
+        ret &= (opts.ram == test->opts.ram);
+        ret &= (opts.boost_clock == test->opts.boost_clock);
+        ret &= cmp_strings(opts.ext_loader, test->opts.ext_loader);
+        ret &= (opts.connect == test->opts.connect);
+        ret &= (opts.dump_count == test->opts.dump_count);
+        ret &= cmp_mem((const uint8_t *) opts.dump, (const uint8_t *) test->opts.dump,
+                       opts.dump_count * sizeof(opts.dump[0]));
     }
 
     printf("[%s] (%d) %s\n", ret ? "OK" : "ERROR", res, test->cmd_line);
@@ -230,6 +237,100 @@ static struct Test tests[] = {
         .freq = 0,
         .format = FLASH_FORMAT_BINARY }
     },
+    { "coredump core.elf", 0,
+      { .cmd = CMD_COREDUMP,
+        .serial = { 0 },
+        .filename = "core.elf",
+        .addr = 0,
+        .size = 0,
+        .reset = 0,
+        .log_level = STND_LOG_LEVEL,
+        .freq = 0,
+        .format = FLASH_FORMAT_BINARY,
+        .connect = CONNECT_HOT_PLUG,
+        .dump_count = 0 }
+    },
+    { "coredump core.elf 0x40021000 0x400 0x10000000 64k", 0,
+      { .cmd = CMD_COREDUMP,
+        .serial = { 0 },
+        .filename = "core.elf",
+        .addr = 0,
+        .size = 0,
+        .reset = 0,
+        .log_level = STND_LOG_LEVEL,
+        .freq = 0,
+        .format = FLASH_FORMAT_BINARY,
+        .connect = CONNECT_HOT_PLUG,
+        .dump = { { 0x40021000, 0x400 }, { 0x10000000, 0x10000 } },
+        .dump_count = 2 }
+    },
+    { "--ram write test.bin", 0,
+      { .cmd = FLASH_CMD_WRITE,
+        .serial = { 0 },
+        .filename = "test.bin",
+        .addr = 0,
+        .size = 0,
+        .reset = 0,
+        .log_level = STND_LOG_LEVEL,
+        .freq = 0,
+        .format = FLASH_FORMAT_BINARY,
+        .ram = 1 }
+    },
+    { "--ram write test.bin 0x20000400", 0,
+      { .cmd = FLASH_CMD_WRITE,
+        .serial = { 0 },
+        .filename = "test.bin",
+        .addr = 0x20000400,
+        .size = 0,
+        .reset = 0,
+        .log_level = STND_LOG_LEVEL,
+        .freq = 0,
+        .format = FLASH_FORMAT_BINARY,
+        .ram = 1 }
+    },
+    { "--ram --format=ihex write test.hex", 0,
+      { .cmd = FLASH_CMD_WRITE,
+        .serial = { 0 },
+        .filename = "test.hex",
+        .addr = 0,
+        .size = 0,
+        .reset = 0,
+        .log_level = STND_LOG_LEVEL,
+        .freq = 0,
+        .format = FLASH_FORMAT_IHEX,
+        .ram = 1 }
+    },
+    { "--boost-clock write test.bin 0x80000000", 0,
+      { .cmd = FLASH_CMD_WRITE,
+        .serial = { 0 },
+        .filename = "test.bin",
+        .addr = 0x80000000,
+        .size = 0,
+        .reset = 0,
+        .log_level = STND_LOG_LEVEL,
+        .freq = 0,
+        .format = FLASH_FORMAT_BINARY,
+        .boost_clock = 1 }
+    },
+    { "--ext-loader=qspi.bin write assets.bin 0x90000000", 0,
+      { .cmd = FLASH_CMD_WRITE,
+        .serial = { 0 },
+        .filename = "assets.bin",
+        .addr = 0x90000000,
+        .size = 0,
+        .reset = 0,
+        .log_level = STND_LOG_LEVEL,
+        .freq = 0,
+        .format = FLASH_FORMAT_BINARY,
+        .ext_loader = "qspi.bin" }
+    },
+    { "--ext-loader qspi.bin --mass-erase write assets.bin 0x90000000", -1, FLASH_OPTS_INITIALIZER },
+    { "write test.bin", -1, FLASH_OPTS_INITIALIZER },
+    { "--ram read test.bin 0x20000000 0x1000", -1, FLASH_OPTS_INITIALIZER },
+    { "--ram --mass-erase write test.bin", -1, FLASH_OPTS_INITIALIZER },
+    { "coredump", -1, FLASH_OPTS_INITIALIZER },
+    { "coredump core.elf 0x40021000", -1, FLASH_OPTS_INITIALIZER },
+    { "--connect-under-reset coredump core.elf", -1, FLASH_OPTS_INITIALIZER },
     { "--serial=ABCEFF544851717867216044 erase", 0,
       { .cmd = FLASH_CMD_ERASE,
         .serial = "ABCEFF544851717867216044",
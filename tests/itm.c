@@ -0,0 +1,230 @@
+/*
+ * File: itm.c
+ *
+ * Checks update_trace_block() against update_trace(), the byte at a time
+ * decoder it replaces in st-trace: same output of the target and same
+ * counters, whatever the split of the stream into reads.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <stlink.h>
+#include <logging.h>
+
+#include "itm.h"
+
+#define ITM_TRACE_SIZE (256 * 1024)
+
+static uint8_t trace_buf[ITM_TRACE_SIZE];
+static uint32_t trace_len;
+
+static uint32_t lcg_state = 0x2545f491;
+
+static uint32_t lcg_next(void) {
+    lcg_state = lcg_state * 1664525u + 1013904223u;
+    return (lcg_state >> 8);
+}
+
+static void put(uint8_t c) {
+    if (trace_len < ITM_TRACE_SIZE) { trace_buf[trace_len++] = c; }
+}
+
+// printf() over stimulus port 0, with timestamps and DWT packets in between
+static void make_printf(void) {
+    for (uint32_t i = 0; trace_len < ITM_TRACE_SIZE; i++) {
+        if (i % 16 == 7) {
+            put(0xc0);
+            put(0x05);
+        } else if (i % 64 == 13) {
+            put(0x07);
+
+            for (uint32_t j = 0; j < 4; j++) { put((uint8_t)lcg_next()); }
+        } else {
+            put(0x01);
+            put((i % 64 == 63) ? '\n' : (uint8_t)('a' + i % 26));
+        }
+    }
+}
+
+// every kind of packet, well formed, including the ones st-trace rejects
+static void make_packets(void) {
+    while (trace_len < ITM_TRACE_SIZE) {
+        uint32_t r = lcg_next();
+        uint32_t cont = r >> 8 & 3;
+
+        switch (r % 13) {
+        case 0: case 1: case 2: case 3:    // stimulus port 0, 1 byte
+            put(0x01);
+            put((uint8_t)(r >> 16));
+            break;
+        case 4: {                           // other stimulus ports and sizes
+            uint8_t size = (uint8_t)(1 + (r >> 10) % 3);
+            put((uint8_t)((r >> 12 & 0xf8) | size));
+
+            for (uint32_t j = 0; j < (size == 3 ? 4u : size); j++) { put((uint8_t)lcg_next()); }
+
+            break;
+        }
+        case 5: {                           // hardware sources
+            uint8_t size = (uint8_t)(1 + (r >> 10) % 3);
+            put((uint8_t)((r >> 12 & 0xf8) | 0x04 | size));
+
+            for (uint32_t j = 0; j < (size == 3 ? 4u : size); j++) { put((uint8_t)lcg_next()); }
+
+            break;
+        }
+        case 6:                             // local timestamp
+            put(cont ? 0xc0 : (uint8_t)(0x10 * (1 + (r >> 12) % 6)));
+
+            for (uint32_t j = 0; j < cont; j++) { put((uint8_t)(0x80 | lcg_next())); }
+
+            if (cont) { put((uint8_t)(lcg_next() & 0x7f)); }
+
+            break;
+        case 7:                             // global timestamps
+            put((r >> 12 & 1) ? 0xb4 : 0x94);
+
+            for (uint32_t j = 0; j < cont; j++) { put((uint8_t)(0x80 | lcg_next())); }
+
+            put((uint8_t)(lcg_next() & 0x7f));
+            break;
+        case 8:                             // extension
+            put((r >> 12 & 1) ? 0x88 : 0x08);
+
+            if (r >> 12 & 1) { put((uint8_t)(lcg_next() & 0x7f)); }
+
+            break;
+        case 9:                             // overflow
+            put(0x70);
+            break;
+        case 10:                            // synchronisation
+            for (uint32_t j = 0; j < 5; j++) { put(0x00); }
+
+            put(0x80);
+            break;
+        case 11:                            // DWT event counters
+            put(0x05);
+            put((uint8_t)(lcg_next() & 0x3f));
+            break;
+        default:                            // newline on stimulus port 0
+            put(0x01);
+            put('\n');
+            break;
+        }
+    }
+}
+
+static void make_noise(void) {
+    while (trace_len < ITM_TRACE_SIZE) { put((uint8_t)lcg_next()); }
+}
+
+/*
+ * Decodes the trace in reads of random sizes, at most max bytes, resetting the
+ * state as st-trace does on a buffer overflow every overflow reads if not 0.
+ * Returns what the decoder wrote on stdout, in a malloc'd buffer.
+ */
+static uint8_t *decode(st_trace_t *trace, bool block, uint32_t max, uint32_t overflow, size_t *size) {
+    FILE *out = tmpfile();
+    int32_t saved = dup(STDOUT_FILENO);
+    uint32_t seed = lcg_state;  // both decoders get the same reads
+    uint32_t reads = 0;
+
+    fflush(stdout);
+    dup2(fileno(out), STDOUT_FILENO);
+    memset(trace, 0, sizeof(*trace));
+
+    for (uint32_t off = 0; off < trace_len; reads++) {
+        uint32_t n = 1 + lcg_next() % max;
+
+        if (n > trace_len - off) { n = trace_len - off; }
+
+        if (overflow && reads % overflow == overflow - 1) { trace->state = TRACE_STATE_UNKNOWN; }
+
+        if (block) {
+            update_trace_block(trace, trace_buf + off, n);
+        } else {
+            for (uint32_t i = 0; i < n; i++) { trace->state = update_trace(trace, trace_buf[off + i]); }
+        }
+
+        off += n;
+    }
+
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    lcg_state = seed;
+
+    *size = (size_t)ftell(out);
+    uint8_t *data = malloc(*size + 1);
+    rewind(out);
+
+    if (data == NULL || fread(data, 1, *size, out) != *size) {
+        free(data);
+        data = NULL;
+    }
+
+    fclose(out);
+    return (data);
+}
+
+static bool same(const char *name, uint32_t max, uint32_t overflow) {
+    st_trace_t a, b;
+    size_t a_size, b_size;
+    uint8_t *a_out = decode(&a, false, max, overflow, &a_size);
+    uint8_t *b_out = decode(&b, true, max, overflow, &b_size);
+    bool ok = a_out != NULL && b_out != NULL && a_size == b_size && !memcmp(a_out, b_out, a_size) &&
+              a.state == b.state && a.count_raw_bytes == b.count_raw_bytes &&
+              a.count_target_data == b.count_target_data && a.count_time_packets == b.count_time_packets &&
+              a.count_hw_overflow == b.count_hw_overflow && a.count_error == b.count_error &&
+              a.unknown_sources == b.unknown_sources &&
+              !memcmp(a.count_dwt_event, b.count_dwt_event, sizeof(a.count_dwt_event)) &&
+              !memcmp(a.unknown_opcodes, b.unknown_opcodes, sizeof(a.unknown_opcodes));
+
+    printf("%-8s reads <= %-6u overflow %-3u %8u target bytes %6u errors: %s\n", name, max, overflow,
+           b.count_target_data, b.count_error, ok ? "ok" : "MISMATCH");
+
+    if (!ok) {
+        printf("  reference: %zu output bytes, state %d, %u target, %u time, %u overflow, %u errors\n",
+               a_size, a.state, a.count_target_data, a.count_time_packets, a.count_hw_overflow, a.count_error);
+        printf("  block:     %zu output bytes, state %d, %u target, %u time, %u overflow, %u errors\n",
+               b_size, b.state, b.count_target_data, b.count_time_packets, b.count_hw_overflow, b.count_error);
+    }
+
+    free(a_out);
+    free(b_out);
+    return (ok);
+}
+
+int32_t main(void) {
+    static const struct {
+        const char *name;
+        void (*make)(void);
+    } traces[] = {
+        { "printf",  make_printf },
+        { "packets", make_packets },
+        { "noise",   make_noise },
+    };
+    static const uint32_t reads[] = { 1, 7, 64, STLINK_V3_TRACE_BUF_LEN, ITM_TRACE_SIZE };
+    uint32_t failures = 0;
+
+    ugly_init(UERROR);  // st-trace warns about unsupported packets, once each
+
+    for (uint32_t t = 0; t < STLINK_ARRAY_SIZE(traces); t++) {
+        trace_len = 0;
+        traces[t].make();
+
+        for (uint32_t r = 0; r < STLINK_ARRAY_SIZE(reads); r++) {
+            if (!same(traces[t].name, reads[r], 0)) { failures++; }
+        }
+
+        if (!same(traces[t].name, 4096, 5)) { failures++; }
+    }
+
+    printf("%u failure(s)\n", failures);
+    return (failures ? 1 : 0);
+}
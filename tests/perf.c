@@ -0,0 +1,1347 @@
+/*
+ * File: perf.c
+ *
+ * Performance regression tests. The library, and st-util, run unmodified
+ * against an ST-LINK/V2 emulated behind a stand-in of the libusb API. Each
+ * scenario counts the USB transfers it makes and its modelled wall time,
+ * which must stay within the budgets below: a change adding round trips to
+ * a hot path fails here instead of on the bench.
+ *
+ * The model charges every bulk transfer a fixed latency plus the time on the
+ * wire for its payload, and host sleeps at their full length (usleep() is
+ * replaced as well, so nothing actually waits). The target itself is
+ * infinitely fast: flash is never busy and the flash loader completes as
+ * soon as it is started.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <stlink.h>
+#include <chipid.h>
+#include <commands.h>
+#include <common_flash.h>
+#include <ext_loader.h>
+#include <logging.h>
+#include <register.h>
+#include <usb.h>
+
+#ifndef LIBUSB_CALL
+#define LIBUSB_CALL
+#endif
+
+#define PERF_TRANSFER_NS    250000  // latency of a bulk transfer on a full speed probe
+#define PERF_BYTE_NS        1000    // ~1 MB/s of bulk payload
+
+#define PERF_FLASH_BASE     STM32_FLASH_BASE
+#define PERF_FLASH_SIZE     (2048 * 1024)
+#define PERF_SRAM_BASE      STM32_SRAM_BASE
+#define PERF_SRAM_SIZE      (512 * 1024)
+#define PERF_IMAGE_SIZE     (256 * 1024)
+#define PERF_EXT_BASE       0x90000000  // QSPI flash behind an external loader
+#define PERF_EXT_SIZE       (1024 * 1024)
+#define PERF_EXT_SECTOR     (64 * 1024)
+#define PERF_EXT_LOADER     (PERF_SRAM_BASE + 0x100)
+#define PERF_IO_NUM         256
+
+#define PERF_EP_REQ         (2 | LIBUSB_ENDPOINT_OUT)
+#define PERF_EP_REP         (1 | LIBUSB_ENDPOINT_IN)
+#define PERF_EP_TRACE       (3 | LIBUSB_ENDPOINT_IN)
+
+#define PERF_JTAG_V         37      // ST-LINK/V2 firmware V2J37
+#define PERF_SERIAL         "504552460000000000000001"
+
+#define PERF_TRACE_FREQ     2000000 // SWO baud rate
+#define PERF_TRACE_SECONDS  10
+#define PERF_GDB_STEPS      100
+#define PERF_GDB_READS      100     // live reads while the core runs, in non-stop mode
+
+// st-util, built into this test with its main() renamed
+int32_t st_util_main(int32_t argc, char** argv);
+
+/*
+ * Budgets
+ *
+ * Transfers are counted exactly, the emulation being deterministic. Lower a
+ * budget when a change saves round trips, so that they are not given back.
+ */
+
+struct perf_budget {
+    const char *name;
+    uint32_t transfers;
+    uint32_t ms;            // modelled wall time
+};
+
+static const struct perf_budget perf_budgets[] = {
+    // scenario                 transfers   ms
+    { "connect",                      30,     10 },
+    { "flash C0",                  33322,   8890 },
+    { "verify C0",                    32,     50 },
+    { "flash F0_F1_F3",             8248,   4040 },
+    { "verify F0_F1_F3",             256,    340 },
+    { "flash F1_XL",                9798,   4450 },
+    { "verify F1_XL",                256,    340 },
+    { "flash F2_F4",                 446,    740 },
+    { "verify F2_F4",                 86,    300 },
+    { "flash F7",                    440,    740 },
+    { "verify F7",                    86,    300 },
+    { "flash G0",                 266540,  71100 },
+    { "verify G0",                   256,    340 },
+    { "flash G4",                 264364,  70520 },
+    { "verify G4",                   128,    310 },
+    { "flash H7",                  32990,   9340 },
+    { "verify H7",                    86,    300 },
+    { "flash L0_L1",               73798,  41020 },
+    { "verify L0_L1",               2048,    810 },
+    { "flash L4",                   3834,   1640 },
+    { "verify L4",                   256,    340 },
+    { "flash L5_U5_H5",           264234,  70480 },
+    { "verify L5_U5_H5",             128,    310 },
+    { "flash WB_WL",              264234,  70480 },
+    { "verify WB_WL",                128,    310 },
+    { "gdb attach",                   80,     30 },
+    { "gdb load",                    420,    470 },
+    { "gdb 100 steps",              1000,    280 },
+    { "gdb non-stop",                210,     60 },
+    { "swo 10 s",                  31255,  10210 },
+    { "ext write",                   362,    640 },
+};
+
+/*
+ * Targets, one per flash type
+ */
+
+struct perf_target {
+    const char *name;
+    enum stm32_flash_type flash_type;
+    uint32_t chip_id;           // DBGMCU_IDCODE[11:0]
+    uint32_t core_id;           // SW-DP IDCODE
+    uint32_t cpuid;
+    uint32_t chip_id_reg;
+    uint32_t flash_size_reg;
+    uint32_t flash_kib;
+};
+
+static const struct perf_target perf_targets[] = {
+    { "C0", STM32_FLASH_TYPE_C0, 0x453, 0x0bc11477, 0x410cc601, 0x40015800, 0x1fff75a0, 32 },
+    { "F0_F1_F3", STM32_FLASH_TYPE_F0_F1_F3, 0x414, 0x1ba01477, 0x411fc231, 0xe0042000, 0x1ffff7e0, 512 },
+    { "F1_XL", STM32_FLASH_TYPE_F1_XL, 0x430, 0x1ba01477, 0x411fc231, 0xe0042000, 0x1ffff7e0, 1024 },
+    { "F2_F4", STM32_FLASH_TYPE_F2_F4, 0x413, 0x2ba01477, 0x410fc241, 0xe0042000, 0x1fff7a22, 1024 },
+    { "F7", STM32_FLASH_TYPE_F7, 0x449, 0x5ba02477, 0x411fc271, 0xe0042000, 0x1ff0f442, 1024 },
+    { "G0", STM32_FLASH_TYPE_G0, 0x467, 0x0bc11477, 0x410cc601, 0x40015800, 0x1fff75e0, 512 },
+    { "G4", STM32_FLASH_TYPE_G4, 0x469, 0x2ba01477, 0x410fc241, 0xe0042000, 0x1fff75e0, 512 },
+    { "H7", STM32_FLASH_TYPE_H7, 0x450, 0x6ba02477, 0x411fc271, 0x5c001000, 0x1ff1e880, 2048 },
+    { "L0_L1", STM32_FLASH_TYPE_L0_L1, 0x437, 0x2ba01477, 0x412fc231, 0xe0042000, 0x1ff800cc, 512 },
+    { "L4", STM32_FLASH_TYPE_L4, 0x415, 0x2ba01477, 0x410fc241, 0xe0042000, 0x1fff75e0, 1024 },
+    { "L5_U5_H5", STM32_FLASH_TYPE_L5_U5_H5, 0x472, 0x0be02477, 0x410fd213, 0xe0044000, 0x0bfa05e0, 512 },
+    { "WB_WL", STM32_FLASH_TYPE_WB_WL, 0x495, 0x2ba01477, 0x410fc241, 0xe0042000, 0x1fff75e0, 1024 },
+};
+
+/*
+ * Counters and the modelled clock, shared with the st-util thread
+ */
+
+struct perf_count {
+    uint64_t transfers;
+    uint64_t bytes;
+    uint64_t time_ns;
+    uint64_t sleep_ns;
+};
+
+static pthread_mutex_t perf_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct perf_count perf;
+static uint32_t perf_failures;
+static FILE *perf_out;      // the report, stdout and stderr being silenced
+
+static struct perf_count perf_now(void) {
+    pthread_mutex_lock(&perf_lock);
+    struct perf_count now = perf;
+    pthread_mutex_unlock(&perf_lock);
+    return (now);
+}
+
+static void perf_fail(const char *what) {
+    fprintf(perf_out, "FAIL: %s\n", what);
+    perf_failures++;
+}
+
+static void perf_check(const char *name, const struct perf_count *from) {
+    struct perf_count now = perf_now();
+    uint64_t transfers = now.transfers - from->transfers;
+    uint64_t bytes = now.bytes - from->bytes;
+    uint64_t ms = (now.time_ns - from->time_ns + 999999) / 1000000;
+    uint64_t sleep_ms = (now.sleep_ns - from->sleep_ns) / 1000000;
+    const struct perf_budget *budget = NULL;
+
+    for (uint32_t i = 0; i < STLINK_ARRAY_SIZE(perf_budgets); i++) {
+        if (!strcmp(perf_budgets[i].name, name)) { budget = &perf_budgets[i]; }
+    }
+
+    if (budget == NULL) {
+        fprintf(perf_out, "%-18s %8llu %10llu %8llu %8llu   no budget\n", name, (unsigned long long)transfers,
+                (unsigned long long)bytes, (unsigned long long)ms, (unsigned long long)sleep_ms);
+        perf_fail(name);
+        return;
+    }
+
+    bool over = transfers > budget->transfers || ms > budget->ms;
+    fprintf(perf_out, "%-18s %8llu %10llu %8llu %8llu   %8u %8u%s\n", name, (unsigned long long)transfers,
+            (unsigned long long)bytes, (unsigned long long)ms, (unsigned long long)sleep_ms,
+            budget->transfers, budget->ms, over ? "   OVER BUDGET" : "");
+
+    if (over) { perf_fail(name); }
+}
+
+/*
+ * Target: memories, core registers and the debug registers the library uses
+ */
+
+static struct {
+    const struct perf_target *chip;
+    uint8_t flash[PERF_FLASH_SIZE];
+    uint8_t sram[PERF_SRAM_SIZE];
+    uint8_t ext[PERF_EXT_SIZE];
+    uint32_t regs[128];         // by DCRSR REGSEL, READREG indexes match for r0..psp
+    uint32_t dcrdr;
+    uint32_t demcr;
+    uint32_t dfsr;
+    bool halted;
+    bool debugen;
+    bool maskints;
+    bool reset_st;              // DHCSR S_RESET_ST, cleared on read
+    struct { uint32_t addr, value; } io[PERF_IO_NUM];
+    uint32_t io_num;
+} target;
+
+static uint32_t le32(const uint8_t *p) {
+    return ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint8_t *target_mem(uint32_t addr) {
+    if (addr >= PERF_FLASH_BASE && addr - PERF_FLASH_BASE < PERF_FLASH_SIZE) {
+        return (&target.flash[addr - PERF_FLASH_BASE]);
+    }
+
+    if (addr >= PERF_SRAM_BASE && addr - PERF_SRAM_BASE < PERF_SRAM_SIZE) {
+        return (&target.sram[addr - PERF_SRAM_BASE]);
+    }
+
+    if (addr >= PERF_EXT_BASE && addr - PERF_EXT_BASE < PERF_EXT_SIZE) {
+        return (&target.ext[addr - PERF_EXT_BASE]);
+    }
+
+    return (NULL);
+}
+
+// flash controllers read as unlocked, idle and without errors, writes are ignored
+static bool target_flash_regs(uint32_t addr) {
+    uint32_t block = addr & ~0x3ffu;
+    return (block == 0x40022000 || block == 0x40023c00 || block == 0x52002000 || block == 0x58004000);
+}
+
+static void target_reset(void) {
+    target.reset_st = true;
+    target.regs[13] = target.regs[17] = le32(&target.flash[0]);
+    target.regs[15] = le32(&target.flash[4]) & ~1u;
+    target.regs[16] = 0x01000000;
+
+    if (target.demcr & STLINK_REG_CM3_DEMCR_VC_CORERESET) {
+        target.halted = true;
+        target.dfsr |= STLINK_REG_DFSR_VCATCH;
+    } else {
+        target.halted = false;
+    }
+}
+
+static void target_power_on(const struct perf_target *chip) {
+    memset(&target, 0, sizeof(target));
+    memset(target.flash, 0xff, sizeof(target.flash));
+    target.chip = chip;
+    target_reset();
+}
+
+static uint32_t target_read32(uint32_t addr);
+static void target_write32(uint32_t addr, uint32_t value);
+
+static void target_read(uint32_t addr, uint8_t *buf, uint32_t len) {
+    uint32_t word = 0;
+
+    for (uint32_t i = 0; i < len; i++, addr++) {
+        uint8_t *p = target_mem(addr);
+
+        if (p) {
+            buf[i] = *p;
+            continue;
+        }
+
+        if (i == 0 || (addr & 3) == 0) { word = target_read32(addr & ~3u); }
+
+        buf[i] = (uint8_t)(word >> (8 * (addr & 3)));
+    }
+}
+
+static void target_write(uint32_t addr, const uint8_t *buf, uint32_t len) {
+    for (uint32_t i = 0; i < len; ) {
+        uint8_t *p = target_mem(addr + i);
+
+        if (p) {
+            *p = buf[i++];
+        } else if (((addr + i) & 3) == 0 && len - i >= 4) {
+            target_write32(addr + i, le32(&buf[i]));
+            i += 4;
+        } else {
+            uint32_t aligned = (addr + i) & ~3u;
+            uint8_t word[4];
+            put_le32(word, target_read32(aligned));
+            word[(addr + i) & 3] = buf[i];
+            target_write32(aligned, le32(word));
+            i++;
+        }
+    }
+}
+
+/*
+ * An entry point of the external loader at PERF_EXT_LOADER, found by the
+ * header of its image: runs it on the external memory and returns to lr.
+ */
+static bool target_run_ext(void) {
+    const uint8_t *hdr = target_mem(PERF_EXT_LOADER);
+    const uint8_t *trap = target_mem(target.regs[14] & ~1u);
+    uint32_t pc = target.regs[15], buf = target.regs[0], addr = target.regs[1], len = target.regs[2];
+    uint8_t *src = target_mem(buf), *dst = target_mem(addr), *end = target_mem(addr + len - 1);
+    uint32_t result = 0;
+
+    if (trap == NULL || le32(trap) != 0xbe00be00 || le32(hdr) != EXT_LOADER_MAGIC) { return (false); }
+
+    if (pc == (le32(hdr + 28) & ~1u)) {
+        // init, nothing to set up
+    } else if (dst == NULL || end == NULL || end - dst != len - 1) {
+        result = 1;
+    } else if (pc == (le32(hdr + 32) & ~1u)) {
+        memset(dst, 0xff, len);
+    } else if (pc == (le32(hdr + 36) & ~1u) && src != NULL) {
+        for (uint32_t i = 0; i < len; i++) { dst[i] &= src[i]; }
+    } else if (pc == (le32(hdr + 40) & ~1u) && src != NULL) {
+        result = memcmp(dst, src, len) != 0;
+    } else {
+        result = 1;
+    }
+
+    target.regs[0] = result;
+    target.regs[15] = target.regs[14] & ~1u;
+    target.halted = true;
+    target.dfsr |= STLINK_REG_DFSR_BKPT;
+    return (true);
+}
+
+// the flash loader: copies r2 bytes from r0 to r1 and stops at its breakpoint
+static void target_run(void) {
+    if (!target.maskints) {
+        target.halted = false;
+        return;
+    }
+
+    if (target_run_ext()) { return; }
+
+    uint8_t buf[256];
+    uint32_t src = target.regs[0], dst = target.regs[1], len = target.regs[2];
+
+    while (len) {
+        uint32_t chunk = len > sizeof(buf) ? (uint32_t)sizeof(buf) : len;
+        target_read(src, buf, chunk);
+        target_write(dst, buf, chunk);
+        src += chunk;
+        dst += chunk;
+        len -= chunk;
+    }
+
+    target.regs[2] = 0;
+    target.halted = true;
+    target.dfsr |= STLINK_REG_DFSR_BKPT;
+}
+
+static uint32_t target_read32(uint32_t addr) {
+    const struct perf_target *chip = target.chip;
+    uint8_t *p = target_mem(addr);
+
+    if (p) { return (le32(p)); }
+
+    switch (addr) {
+    case STLINK_REG_DHCSR: {
+        uint32_t value = STLINK_REG_DHCSR_S_REGRDY;
+
+        if (target.debugen) { value |= STLINK_REG_DHCSR_C_DEBUGEN; }
+
+        if (target.maskints) { value |= STLINK_REG_DHCSR_C_MASKINTS; }
+
+        if (target.halted) { value |= STLINK_REG_DHCSR_C_HALT | STLINK_REG_DHCSR_S_HALT; }
+
+        if (target.reset_st) { value |= STLINK_REG_DHCSR_S_RESET_ST; }
+
+        target.reset_st = false;
+        return (value);
+    }
+    case STLINK_REG_DFSR: return (target.dfsr);
+    case STLINK_REG_DEMCR: return (target.demcr);
+    case STLINK_REG_DCRDR: return (target.dcrdr);
+    case STLINK_REG_CM3_CPUID: return (chip->cpuid);
+    case STLINK_REG_AIRCR: return (0xfa050000);
+    }
+
+    if (addr == chip->chip_id_reg) { return (0x10000000 | chip->chip_id); }
+
+    if (addr == (chip->flash_size_reg & ~3u)) {
+        return (chip->flash_kib << ((chip->flash_size_reg & 2) ? 16 : 0));
+    }
+
+    if (target_flash_regs(addr)) { return (0); }
+
+    for (uint32_t i = 0; i < target.io_num; i++) {
+        if (target.io[i].addr == addr) { return (target.io[i].value); }
+    }
+
+    return (0);
+}
+
+static void target_write32(uint32_t addr, uint32_t value) {
+    uint8_t *p = target_mem(addr);
+
+    if (p) {
+        put_le32(p, value);
+        return;
+    }
+
+    switch (addr) {
+    case STLINK_REG_DHCSR:
+        if ((value & 0xffff0000) != (uint32_t)STLINK_REG_DHCSR_DBGKEY) { return; }
+
+        target.debugen = (value & STLINK_REG_DHCSR_C_DEBUGEN) != 0;
+        target.maskints = (value & STLINK_REG_DHCSR_C_MASKINTS) != 0;
+
+        if (value & STLINK_REG_DHCSR_C_HALT) {
+            target.halted = true;
+        } else if (value & STLINK_REG_DHCSR_C_STEP) {
+            if (target.halted) { target.regs[15] += 2; }
+
+            target.halted = true;
+        } else {
+            target_run();
+        }
+
+        return;
+    case STLINK_REG_DFSR:
+        target.dfsr &= ~value;
+        return;
+    case STLINK_REG_DEMCR:
+        target.demcr = value;
+        return;
+    case STLINK_REG_DCRDR:
+        target.dcrdr = value;
+        return;
+    case STLINK_REG_DCRSR:
+        if (value & (1 << 16)) {
+            target.regs[value & 0x7f] = target.dcrdr;
+        } else {
+            target.dcrdr = target.regs[value & 0x7f];
+        }
+
+        return;
+    case STLINK_REG_AIRCR:
+        if ((value & 0xffff0000) == STLINK_REG_AIRCR_VECTKEY && (value & STLINK_REG_AIRCR_SYSRESETREQ)) {
+            target_reset();
+        }
+
+        return;
+    }
+
+    if (target_flash_regs(addr)) { return; }
+
+    for (uint32_t i = 0; i < target.io_num; i++) {
+        if (target.io[i].addr == addr) {
+            target.io[i].value = value;
+            return;
+        }
+    }
+
+    if (target.io_num < PERF_IO_NUM) {
+        target.io[target.io_num].addr = addr;
+        target.io[target.io_num].value = value;
+        target.io_num++;
+    }
+}
+
+/*
+ * Probe: the ST-LINK/V2 firmware, one command per request transfer
+ */
+
+static struct {
+    int32_t mode;
+    bool nrst_low;
+    uint8_t reply[0x2000];
+    uint32_t reply_len;
+    bool reply_ready;
+    uint32_t write_addr;        // data phase of WRITEMEM_32BIT/8BIT
+    uint32_t write_len;
+    bool trace_on;
+    uint32_t trace_buf;
+    uint64_t trace_start_ns;
+    uint64_t trace_read;
+    uint64_t trace_lost;
+    uint32_t trace_ready;
+} probe;
+
+static void probe_reply(const uint8_t *data, uint32_t len) {
+    memcpy(probe.reply, data, len);
+    probe.reply_len = len;
+    probe.reply_ready = true;
+}
+
+static void probe_status(uint32_t len, uint32_t value) {
+    uint8_t rep[88] = { STLINK_DEBUG_ERR_OK };
+
+    if (len >= 8) { put_le32(&rep[4], value); }
+
+    probe_reply(rep, len);
+}
+
+static void probe_trace_update(void) {
+    uint64_t produced = (perf.time_ns - probe.trace_start_ns) * (PERF_TRACE_FREQ / 10) / 1000000000;
+    uint64_t pending = produced - probe.trace_read - probe.trace_lost;
+
+    if (pending > probe.trace_buf) {
+        probe.trace_lost += pending - probe.trace_buf;
+        pending = probe.trace_buf;
+    }
+
+    probe.trace_ready = (uint32_t)pending;
+}
+
+static void probe_debug_command(const uint8_t *cmd) {
+    uint32_t addr = le32(&cmd[2]);
+    uint8_t rep[88] = { STLINK_DEBUG_ERR_OK };
+
+    switch (cmd[1]) {
+    case STLINK_DEBUG_APIV2_ENTER:
+        probe.mode = STLINK_DEV_DEBUG_MODE;
+        probe_status(2, 0);
+        break;
+    case STLINK_DEBUG_EXIT:
+        probe.mode = STLINK_DEV_MASS_MODE;
+        break;
+    case STLINK_DEBUG_APIV2_READ_IDCODES:
+        probe_status(12, target.chip->core_id);
+        break;
+    case STLINK_DEBUG_APIV2_READDEBUGREG:
+        probe_status(8, target_read32(addr));
+        break;
+    case STLINK_DEBUG_APIV2_WRITEDEBUGREG:
+        target_write32(addr, le32(&cmd[6]));
+        probe_status(2, 0);
+        break;
+    case STLINK_DEBUG_READMEM_32BIT:
+        target_read(addr, probe.reply, cmd[6] | (uint32_t)cmd[7] << 8);
+        probe.reply_len = cmd[6] | (uint32_t)cmd[7] << 8;
+        probe.reply_ready = true;
+        break;
+    case STLINK_DEBUG_WRITEMEM_32BIT:
+    case STLINK_DEBUG_WRITEMEM_8BIT:
+        probe.write_addr = addr;
+        probe.write_len = cmd[6] | (uint32_t)cmd[7] << 8;
+        break;
+    case STLINK_DEBUG_APIV2_GETLASTRWSTATUS:
+        probe_status(2, 0);
+        break;
+    case STLINK_DEBUG_APIV2_GETLASTRWSTATUS2:
+        probe_status(12, 0);
+        break;
+    case STLINK_DEBUG_APIV2_RESETSYS:
+        target_reset();
+        probe_status(2, 0);
+        break;
+    case STLINK_DEBUG_APIV2_DRIVE_NRST:
+        if (cmd[2] == STLINK_DEBUG_APIV2_DRIVE_NRST_LOW) {
+            probe.nrst_low = true;
+        } else if (probe.nrst_low) {
+            probe.nrst_low = false;
+            target_reset();
+        }
+
+        probe_status(2, 0);
+        break;
+    case STLINK_DEBUG_APIV2_READALLREGS:
+        for (uint32_t i = 0; i < 21; i++) { put_le32(&rep[4 + 4 * i], target.regs[i]); }
+
+        probe_reply(rep, 88);
+        break;
+    case STLINK_DEBUG_APIV2_READREG:
+        probe_status(8, target.regs[cmd[2] & 0x7f]);
+        break;
+    case STLINK_DEBUG_APIV2_WRITEREG:
+        target.regs[cmd[2] & 0x7f] = le32(&cmd[3]);
+        probe_status(2, 0);
+        break;
+    case STLINK_DEBUG_APIV2_SWD_SET_FREQ:
+        probe_status(2, 0);
+        break;
+    case STLINK_DEBUG_APIV2_START_TRACE_RX:
+        probe.trace_on = true;
+        probe.trace_buf = cmd[2] | (uint32_t)cmd[3] << 8;
+        probe.trace_start_ns = perf.time_ns;
+        probe.trace_read = probe.trace_lost = 0;
+        probe_status(2, 0);
+        break;
+    case STLINK_DEBUG_APIV2_STOP_TRACE_RX:
+        probe.trace_on = false;
+        probe_status(2, 0);
+        break;
+    case STLINK_DEBUG_APIV2_GET_TRACE_NB:
+        if (probe.trace_on) { probe_trace_update(); }
+
+        rep[0] = (uint8_t)probe.trace_ready;
+        rep[1] = (uint8_t)(probe.trace_ready >> 8);
+        probe_reply(rep, 2);
+        break;
+    default:
+        fprintf(perf_out, "unknown debug command %#04x\n", cmd[1]);
+        perf_fail("probe command");
+    }
+}
+
+static void probe_command(const uint8_t *cmd) {
+    uint8_t rep[8] = { 0 };
+
+    switch (cmd[0]) {
+    case STLINK_GET_VERSION:
+        rep[0] = (uint8_t)(2 << 4 | PERF_JTAG_V >> 2);
+        rep[1] = (uint8_t)((PERF_JTAG_V & 3) << 6 | 7);
+        rep[2] = (uint8_t)STLINK_USB_VID_ST;
+        rep[3] = (uint8_t)(STLINK_USB_VID_ST >> 8);
+        rep[4] = (uint8_t)STLINK_USB_PID_STLINK_32L;
+        rep[5] = (uint8_t)(STLINK_USB_PID_STLINK_32L >> 8);
+        probe_reply(rep, 6);
+        break;
+    case STLINK_GET_CURRENT_MODE:
+        rep[0] = (uint8_t)probe.mode;
+        probe_reply(rep, 2);
+        break;
+    case STLINK_GET_TARGET_VOLTAGE:
+        put_le32(&rep[0], 8);
+        put_le32(&rep[4], 11); // 3.3 V
+        probe_reply(rep, 8);
+        break;
+    case STLINK_DFU_COMMAND:
+        probe.mode = STLINK_DEV_MASS_MODE;
+        break;
+    case STLINK_DEBUG_COMMAND:
+        probe_debug_command(cmd);
+        break;
+    default:
+        fprintf(perf_out, "unknown command %#04x\n", cmd[0]);
+        perf_fail("probe command");
+    }
+}
+
+/*
+ * libusb stand-in: one ST-LINK/V2 on the bus
+ */
+
+struct libusb_context { int32_t unused; };
+struct libusb_device { int32_t unused; };
+struct libusb_device_handle { int32_t unused; };
+
+static struct libusb_context perf_context;
+static struct libusb_device perf_device;
+static struct libusb_device_handle perf_handle;
+static libusb_device *perf_device_list[] = { &perf_device, NULL };
+
+int32_t LIBUSB_CALL libusb_init(libusb_context **ctx) {
+    if (ctx) { *ctx = &perf_context; }
+
+    return (0);
+}
+
+void LIBUSB_CALL libusb_exit(libusb_context *ctx) {
+    (void)ctx;
+}
+
+#if LIBUSB_API_VERSION < 0x01000106
+void LIBUSB_CALL libusb_set_debug(libusb_context *ctx, int32_t level) {
+    (void)ctx;
+    (void)level;
+}
+#else
+int32_t LIBUSB_CALL libusb_set_option(libusb_context *ctx, enum libusb_option option, ...) {
+    (void)ctx;
+    (void)option;
+    return (0);
+}
+#endif
+
+const char * LIBUSB_CALL libusb_error_name(int32_t errcode) {
+    return (errcode ? "LIBUSB_ERROR_IO" : "LIBUSB_SUCCESS");
+}
+
+ssize_t LIBUSB_CALL libusb_get_device_list(libusb_context *ctx, libusb_device ***list) {
+    (void)ctx;
+    *list = perf_device_list;
+    return (1);
+}
+
+void LIBUSB_CALL libusb_free_device_list(libusb_device **list, int32_t unref_devices) {
+    (void)list;
+    (void)unref_devices;
+}
+
+int32_t LIBUSB_CALL libusb_get_device_descriptor(libusb_device *dev, struct libusb_device_descriptor *desc) {
+    (void)dev;
+    memset(desc, 0, sizeof(*desc));
+    desc->idVendor = STLINK_USB_VID_ST;
+    desc->idProduct = STLINK_USB_PID_STLINK_32L;
+    desc->iSerialNumber = 3;
+    return (0);
+}
+
+uint8_t LIBUSB_CALL libusb_get_bus_number(libusb_device *dev) {
+    (void)dev;
+    return (1);
+}
+
+uint8_t LIBUSB_CALL libusb_get_device_address(libusb_device *dev) {
+    (void)dev;
+    return (1);
+}
+
+int32_t LIBUSB_CALL libusb_open(libusb_device *dev, libusb_device_handle **dev_handle) {
+    (void)dev;
+    *dev_handle = &perf_handle;
+    return (0);
+}
+
+void LIBUSB_CALL libusb_close(libusb_device_handle *dev_handle) {
+    (void)dev_handle;
+}
+
+int32_t LIBUSB_CALL libusb_kernel_driver_active(libusb_device_handle *dev_handle, int32_t interface_number) {
+    (void)dev_handle;
+    (void)interface_number;
+    return (0);
+}
+
+int32_t LIBUSB_CALL libusb_detach_kernel_driver(libusb_device_handle *dev_handle, int32_t interface_number) {
+    (void)dev_handle;
+    (void)interface_number;
+    return (0);
+}
+
+int32_t LIBUSB_CALL libusb_get_configuration(libusb_device_handle *dev_handle, int32_t *config) {
+    (void)dev_handle;
+    *config = 1;
+    return (0);
+}
+
+int32_t LIBUSB_CALL libusb_set_configuration(libusb_device_handle *dev_handle, int32_t configuration) {
+    (void)dev_handle;
+    (void)configuration;
+    return (0);
+}
+
+int32_t LIBUSB_CALL libusb_claim_interface(libusb_device_handle *dev_handle, int32_t interface_number) {
+    (void)dev_handle;
+    (void)interface_number;
+    return (0);
+}
+
+// string descriptors: LANGID 0x0409 and the serial as UTF-16LE
+int32_t LIBUSB_CALL libusb_control_transfer(libusb_device_handle *dev_handle, uint8_t request_type, uint8_t bRequest,
+                                            uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength,
+                                            uint32_t timeout) {
+    uint8_t desc[2 + 2 * STLINK_SERIAL_LENGTH];
+    uint32_t len;
+    (void)dev_handle;
+    (void)request_type;
+    (void)bRequest;
+    (void)wIndex;
+    (void)timeout;
+
+    if ((wValue & 0xff) == 0) {
+        len = 4;
+        desc[2] = 0x09;
+        desc[3] = 0x04;
+    } else {
+        len = sizeof(desc);
+
+        for (uint32_t i = 0; i < STLINK_SERIAL_LENGTH; i++) {
+            desc[2 + 2 * i] = (uint8_t)PERF_SERIAL[i];
+            desc[3 + 2 * i] = 0;
+        }
+    }
+
+    desc[0] = (uint8_t)len;
+    desc[1] = 3;
+
+    if (len > wLength) { len = wLength; }
+
+    memcpy(data, desc, len);
+    return ((int32_t)len);
+}
+
+int32_t LIBUSB_CALL libusb_get_string_descriptor_ascii(libusb_device_handle *dev_handle, uint8_t desc_index,
+                                                       unsigned char *data, int32_t length) {
+    (void)dev_handle;
+    (void)desc_index;
+
+    if (length <= STLINK_SERIAL_LENGTH) { return (LIBUSB_ERROR_OVERFLOW); }
+
+    memcpy(data, PERF_SERIAL, STLINK_SERIAL_LENGTH + 1);
+    return (STLINK_SERIAL_LENGTH);
+}
+
+static int32_t perf_bulk_transfer(unsigned char endpoint, unsigned char *data, int32_t length,
+                                  int32_t *transferred) {
+    int32_t ret = 0;
+    uint32_t len = 0;
+
+    pthread_mutex_lock(&perf_lock);
+
+    if (endpoint == PERF_EP_REQ) {
+        len = (uint32_t)length;
+
+        if (probe.write_len) {
+            target_write(probe.write_addr, data, len < probe.write_len ? len : probe.write_len);
+            probe.write_len = 0;
+        } else {
+            probe.reply_ready = false;
+            probe_command(data);
+        }
+    } else if (endpoint == PERF_EP_REP) {
+        if (probe.reply_ready) {
+            len = probe.reply_len < (uint32_t)length ? probe.reply_len : (uint32_t)length;
+            memcpy(data, probe.reply, len);
+            probe.reply_ready = false;
+        } else {
+            ret = LIBUSB_ERROR_TIMEOUT;
+        }
+    } else if (endpoint == PERF_EP_TRACE) {
+        len = probe.trace_ready < (uint32_t)length ? probe.trace_ready : (uint32_t)length;
+        memset(data, 0, len);
+        probe.trace_read += len;
+        probe.trace_ready -= len;
+    } else {
+        ret = LIBUSB_ERROR_PIPE;
+    }
+
+    perf.transfers++;
+    perf.bytes += len;
+    perf.time_ns += PERF_TRANSFER_NS + (uint64_t)len * PERF_BYTE_NS;
+
+    pthread_mutex_unlock(&perf_lock);
+
+    *transferred = (int32_t)len;
+    return (ret);
+}
+
+/*
+ * The library submits one transfer at a time and waits for it: transfers
+ * complete on submission, their callback runs from the next event handling of
+ * the same thread, as with the real libusb.
+ */
+static __thread struct libusb_transfer *perf_completed;
+
+struct libusb_transfer * LIBUSB_CALL libusb_alloc_transfer(int32_t iso_packets) {
+    (void)iso_packets;
+    return (calloc(1, sizeof(struct libusb_transfer)));
+}
+
+void LIBUSB_CALL libusb_free_transfer(struct libusb_transfer *transfer) {
+    free(transfer);
+}
+
+int32_t LIBUSB_CALL libusb_submit_transfer(struct libusb_transfer *transfer) {
+    int32_t ret = perf_bulk_transfer(transfer->endpoint, transfer->buffer, transfer->length,
+                                     &transfer->actual_length);
+
+    transfer->status = ret == LIBUSB_ERROR_TIMEOUT ? LIBUSB_TRANSFER_TIMED_OUT :
+                       ret == LIBUSB_ERROR_PIPE ? LIBUSB_TRANSFER_STALL :
+                       ret ? LIBUSB_TRANSFER_ERROR : LIBUSB_TRANSFER_COMPLETED;
+    perf_completed = transfer;
+    return (0);
+}
+
+int32_t LIBUSB_CALL libusb_cancel_transfer(struct libusb_transfer *transfer) {
+    (void)transfer;
+    return (LIBUSB_ERROR_NOT_FOUND);
+}
+
+int32_t LIBUSB_CALL libusb_handle_events_completed(libusb_context *ctx, int32_t *completed) {
+    struct libusb_transfer *transfer = perf_completed;
+    (void)ctx;
+    (void)completed;
+
+    perf_completed = NULL;
+
+    if (transfer) { transfer->callback(transfer); }
+
+    return (0);
+}
+
+// host sleeps take modelled time only
+int usleep(useconds_t usec) {
+    pthread_mutex_lock(&perf_lock);
+    perf.time_ns += (uint64_t)usec * 1000;
+    perf.sleep_ns += (uint64_t)usec * 1000;
+    pthread_mutex_unlock(&perf_lock);
+    return (0);
+}
+
+/*
+ * Scenarios
+ */
+
+static uint8_t perf_image[PERF_IMAGE_SIZE];
+
+static void perf_image_init(void) {
+    uint32_t x = 0x12345678;
+
+    for (uint32_t i = 0; i < sizeof(perf_image); i++) {
+        x = x * 1103515245 + 12345;
+        perf_image[i] = (uint8_t)(x >> 16);
+    }
+
+    put_le32(&perf_image[0], PERF_SRAM_BASE + 0x1000); // initial sp
+    put_le32(&perf_image[4], PERF_FLASH_BASE + 0x101); // reset handler
+}
+
+static stlink_t *perf_open(const struct perf_target *chip) {
+    target_power_on(chip);
+    memset(&probe, 0, sizeof(probe));
+    probe.mode = STLINK_DEV_MASS_MODE;
+
+    stlink_t *sl = stlink_open_usb(UWARN, CONNECT_NORMAL, NULL, 0);
+
+    if (sl == NULL || sl->flash_type != chip->flash_type) {
+        fprintf(perf_out, "cannot connect to the %s target\n", chip->name);
+        perf_fail(chip->name);
+        stlink_close(sl);
+        return (NULL);
+    }
+
+    return (sl);
+}
+
+static void perf_flash(const struct perf_target *chip) {
+    char name[32];
+    uint32_t size = chip->flash_kib * 1024 < PERF_IMAGE_SIZE ? chip->flash_kib * 1024 : PERF_IMAGE_SIZE;
+    struct perf_count from = perf_now();
+    stlink_t *sl = perf_open(chip);
+
+    if (sl == NULL) { return; }
+
+    if (chip == &perf_targets[0]) { perf_check("connect", &from); }
+
+    // as st-flash write: erase, program, verify, then start the application
+    snprintf(name, sizeof(name), "flash %s", chip->name);
+    from = perf_now();
+
+    if (stlink_mwrite_flash(sl, perf_image, size, PERF_FLASH_BASE, SECTION_ERASE)) {
+        perf_fail(name);
+    } else if (memcmp(target.flash, perf_image, size)) {
+        fprintf(perf_out, "%s: flash content differs from the image\n", name);
+        perf_fail(name);
+    }
+
+    perf_check(name, &from);
+
+    snprintf(name, sizeof(name), "verify %s", chip->name);
+    from = perf_now();
+
+    if (stlink_verify_write_flash(sl, PERF_FLASH_BASE, perf_image, size)) { perf_fail(name); }
+
+    perf_check(name, &from);
+    stlink_close(sl);
+}
+
+// st-flash --ext-loader: the image to the external memory, double buffered, then verified
+static void perf_ext(void) {
+    uint8_t loader[256];
+    char path[] = "/tmp/perf-ext-XXXXXX";
+    int32_t fd = mkstemp(path);
+    struct stlink_ext_loader xl;
+    static const uint32_t header[] = {
+        EXT_LOADER_MAGIC, EXT_LOADER_VERSION, PERF_EXT_LOADER, PERF_EXT_BASE, PERF_EXT_SIZE,
+        PERF_EXT_SECTOR, 0, PERF_EXT_LOADER + 0x41, PERF_EXT_LOADER + 0x61, PERF_EXT_LOADER + 0x81,
+        PERF_EXT_LOADER + 0xa1
+    };
+
+    memset(loader, 0, sizeof(loader));
+
+    for (uint32_t i = 0; i < STLINK_ARRAY_SIZE(header); i++) { put_le32(&loader[4 * i], header[i]); }
+
+    if (fd < 0 || write(fd, loader, sizeof(loader)) != sizeof(loader)) {
+        perf_fail("ext write");
+        return;
+    }
+
+    close(fd);
+
+    stlink_t *sl = perf_open(&perf_targets[3]);
+
+    if (sl == NULL || stlink_ext_loader_open(sl, &xl, path)) {
+        perf_fail("ext write");
+        stlink_close(sl);
+        remove(path);
+        return;
+    }
+
+    struct perf_count from = perf_now();
+
+    if (stlink_ext_write(sl, &xl, PERF_EXT_BASE, perf_image, PERF_IMAGE_SIZE, true)) {
+        perf_fail("ext write");
+    } else if (memcmp(target.ext, perf_image, PERF_IMAGE_SIZE)) {
+        fprintf(perf_out, "ext write: external memory content differs from the image\n");
+        perf_fail("ext write");
+    }
+
+    perf_check("ext write", &from);
+    stlink_ext_loader_close(&xl);
+    stlink_close(sl);
+    remove(path);
+}
+
+// the capture loop of st-trace: poll, and back off 100 us when there is nothing
+static void perf_swo(void) {
+    uint8_t buf[STLINK_V3_TRACE_BUF_LEN];
+    uint64_t received = 0;
+    stlink_t *sl = perf_open(&perf_targets[3]);
+
+    if (sl == NULL) { return; }
+
+    struct perf_count from = perf_now();
+
+    if (sl->backend->trace_enable(sl, PERF_TRACE_FREQ)) { perf_fail("swo enable"); }
+
+    while (perf_now().time_ns - from.time_ns < PERF_TRACE_SECONDS * 1000000000ull) {
+        int32_t length = sl->backend->trace_read(sl, buf, sizeof(buf));
+
+        if (length < 0) {
+            perf_fail("swo read");
+            break;
+        }
+
+        if (length == 0) { usleep(100); }
+
+        received += (uint32_t)length;
+    }
+
+    sl->backend->trace_disable(sl);
+    perf_check("swo 10 s", &from);
+
+    if (probe.trace_lost) {
+        fprintf(perf_out, "swo: %llu of %llu bytes lost\n", (unsigned long long)probe.trace_lost,
+                (unsigned long long)(received + probe.trace_lost));
+        perf_fail("swo overflow");
+    }
+
+    stlink_close(sl);
+}
+
+/*
+ * A minimal GDB: remote protocol with acknowledgments, over TCP to st-util
+ */
+
+static int32_t gdb_fd = -1;
+
+static int32_t gdb_command(const char *data, uint32_t len, char *reply, uint32_t size) {
+    static char packet[0x4000 + 4];
+    uint8_t cksum = 0;
+    uint32_t n = 0;
+    char c;
+
+    packet[n++] = '$';
+
+    for (uint32_t i = 0; i < len; i++) {
+        packet[n++] = data[i];
+        cksum = (uint8_t)(cksum + (uint8_t)data[i]);
+    }
+
+    n += (uint32_t)sprintf(&packet[n], "#%02x", cksum);
+
+    if (write(gdb_fd, packet, n) != (ssize_t)n) { return (-1); }
+
+    if (read(gdb_fd, &c, 1) != 1 || c != '+') { return (-1); }
+
+    do {
+        if (read(gdb_fd, &c, 1) != 1) { return (-1); }
+    } while (c != '$');
+
+    for (n = 0; ; ) {
+        if (read(gdb_fd, &c, 1) != 1) { return (-1); }
+
+        if (c == '#') { break; }
+
+        if (n + 1 < size) { reply[n++] = c; }
+    }
+
+    reply[n] = '\0';
+
+    char sum[2];
+
+    if (read(gdb_fd, sum, 2) != 2 || write(gdb_fd, "+", 1) != 1) { return (-1); }
+
+    return (0);
+}
+
+static int32_t gdb_command_str(const char *data, char *reply, uint32_t size) {
+    return (gdb_command(data, (uint32_t)strlen(data), reply, size));
+}
+
+// what 'load' sends: erase the section, write it in binary packets, done
+static int32_t gdb_load(const uint8_t *image, uint32_t size) {
+    static char packet[0x4000];
+    char reply[64];
+    uint32_t chunk = 0x1000;
+
+    snprintf(packet, sizeof(packet), "vFlashErase:%08x,%x", PERF_FLASH_BASE, size);
+
+    if (gdb_command_str(packet, reply, sizeof(reply)) || strcmp(reply, "OK")) { return (-1); }
+
+    for (uint32_t off = 0; off < size; off += chunk) {
+        uint32_t n = (uint32_t)sprintf(packet, "vFlashWrite:%x:", PERF_FLASH_BASE + off);
+
+        for (uint32_t i = off; i < off + chunk && i < size; i++) {
+            uint8_t b = image[i];
+
+            if (b == '#' || b == '$' || b == '}' || b == '*') {
+                packet[n++] = '}';
+                b ^= 0x20;
+            }
+
+            packet[n++] = (char)b;
+        }
+
+        if (gdb_command(packet, n, reply, sizeof(reply)) || strcmp(reply, "OK")) { return (-1); }
+    }
+
+    if (gdb_command_str("vFlashDone", reply, sizeof(reply)) || strcmp(reply, "OK")) { return (-1); }
+
+    return (0);
+}
+
+// an asynchronous notification, not acknowledged
+static int32_t gdb_notification(char *reply, uint32_t size) {
+    uint32_t n = 0;
+    char c;
+
+    do {
+        if (read(gdb_fd, &c, 1) != 1) { return (-1); }
+    } while (c != '%');
+
+    while (1) {
+        if (read(gdb_fd, &c, 1) != 1) { return (-1); }
+
+        if (c == '#') { break; }
+
+        if (n + 1 < size) { reply[n++] = c; }
+    }
+
+    reply[n] = '\0';
+
+    char sum[2];
+    return (read(gdb_fd, sum, 2) == 2 ? 0 : -1);
+}
+
+static uint32_t gdb_pc(const char *regs) {
+    char hex[9];
+
+    if (strlen(regs) < 16 * 8) { return (0); }
+
+    memcpy(hex, &regs[15 * 8], 8);
+    hex[8] = '\0';
+    return (ntohl((uint32_t)strtoul(hex, NULL, 16)));
+}
+
+// stepi as GDB does it: step, fetch the registers and the next instruction
+static int32_t gdb_step(char *regs, uint32_t size) {
+    char reply[64];
+    char packet[32];
+
+    if (gdb_command_str("s", reply, sizeof(reply)) || reply[0] != 'S') { return (-1); }
+
+    if (gdb_command_str("g", regs, size)) { return (-1); }
+
+    snprintf(packet, sizeof(packet), "m%x,4", gdb_pc(regs));
+    return (gdb_command_str(packet, reply, sizeof(reply)));
+}
+
+static void *perf_gdb_server(void *arg) {
+    char port[32];
+    snprintf(port, sizeof(port), "--listen_port=%d", *(int32_t *)arg);
+    char *argv[] = { "st-util", "-v0", port, NULL };
+    st_util_main(3, argv);
+    return (NULL);
+}
+
+static void perf_gdb(void) {
+    static char regs[512];
+    int32_t port = 20000 + getpid() % 20000;
+    struct sockaddr_in addr;
+    pthread_t server;
+
+    target_power_on(&perf_targets[3]);
+    memset(&probe, 0, sizeof(probe));
+    probe.mode = STLINK_DEV_MASS_MODE;
+
+    struct perf_count from = perf_now();
+
+    if (pthread_create(&server, NULL, perf_gdb_server, &port)) {
+        perf_fail("gdb server");
+        return;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((uint16_t)port);
+
+    // wait for st-util to listen, in real time
+    for (uint32_t i = 0; i < 1000 && gdb_fd < 0; i++) {
+        const struct timespec delay = { 0, 10000000 };
+        gdb_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+        if (connect(gdb_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            close(gdb_fd);
+            gdb_fd = -1;
+            nanosleep(&delay, NULL);
+        }
+    }
+
+    if (gdb_fd >= 0) {
+        // as GDB does, else Nagle and delayed acks add 40 ms per packet
+        int32_t one = 1;
+        setsockopt(gdb_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    if (gdb_fd < 0) {
+        perf_fail("gdb connect");
+        pthread_cancel(server);
+        return;
+    }
+
+    // what GDB asks for on 'target extended-remote'
+    if (gdb_command_str("qSupported:multiprocess+;swbreak+;hwbreak+", regs, sizeof(regs)) ||
+        gdb_command_str("?", regs, sizeof(regs)) ||
+        gdb_command_str("g", regs, sizeof(regs))) {
+        perf_fail("gdb attach");
+    }
+
+    perf_check("gdb attach", &from);
+
+    from = perf_now();
+
+    if (gdb_load(perf_image, PERF_IMAGE_SIZE)) {
+        perf_fail("gdb load");
+    } else if (memcmp(target.flash, perf_image, PERF_IMAGE_SIZE)) {
+        fprintf(perf_out, "gdb load: flash content differs from the image\n");
+        perf_fail("gdb load");
+    }
+
+    perf_check("gdb load", &from);
+
+    if (gdb_command_str("g", regs, sizeof(regs))) { perf_fail("gdb registers"); }
+
+    uint32_t pc = gdb_pc(regs);
+    from = perf_now();
+
+    for (uint32_t i = 0; i < PERF_GDB_STEPS; i++) {
+        if (gdb_step(regs, sizeof(regs))) {
+            perf_fail("gdb step");
+            break;
+        }
+    }
+
+    perf_check("gdb 100 steps", &from);
+
+    if (gdb_pc(regs) != pc + 2 * PERF_GDB_STEPS) {
+        fprintf(perf_out, "gdb: pc %#x after %u steps from %#x\n", gdb_pc(regs), PERF_GDB_STEPS, pc);
+        perf_fail("gdb step");
+    }
+
+    // non-stop: memory is read while the core runs, it is stopped by vCont;t
+    from = perf_now();
+
+    if (gdb_command_str("QNonStop:1", regs, sizeof(regs)) || strcmp(regs, "OK") ||
+        gdb_command_str("vCont;c", regs, sizeof(regs)) || strcmp(regs, "OK")) {
+        perf_fail("gdb non-stop");
+    }
+
+    for (uint32_t i = 0; i < PERF_GDB_READS; i++) {
+        char packet[32];
+        snprintf(packet, sizeof(packet), "m%x,4", PERF_FLASH_BASE + 4 * i);
+
+        if (gdb_command_str(packet, regs, sizeof(regs)) || strlen(regs) != 8 || target.halted) {
+            fprintf(perf_out, "gdb non-stop: read %u: %s, core %s\n", i, regs, target.halted ? "halted" : "running");
+            perf_fail("gdb non-stop");
+            break;
+        }
+    }
+
+    // a running core cannot be stepped
+    if (gdb_command_str("vCont;s", regs, sizeof(regs)) || strcmp(regs, "E01") || target.halted) {
+        perf_fail("gdb non-stop");
+    }
+
+    if (gdb_command_str("vCont;t", regs, sizeof(regs)) || strcmp(regs, "OK") ||
+        gdb_notification(regs, sizeof(regs)) || strcmp(regs, "Stop:S00") ||
+        gdb_command_str("vStopped", regs, sizeof(regs)) || strcmp(regs, "OK") || !target.halted) {
+        perf_fail("gdb non-stop");
+    }
+
+    perf_check("gdb non-stop", &from);
+
+    close(gdb_fd);
+    gdb_fd = -1;
+    pthread_join(server, NULL);
+}
+
+int32_t main(void) {
+    // the library and st-util report progress on stdout and stderr, keep it out of the table
+    perf_out = fdopen(dup(STDOUT_FILENO), "w");
+
+    if (perf_out == NULL || freopen("/dev/null", "w", stdout) == NULL ||
+        freopen("/dev/null", "w", stderr) == NULL) {
+        return (1);
+    }
+
+    setvbuf(perf_out, NULL, _IOLBF, 0);
+
+    init_chipids(STLINK_CHIPS_DIR);
+    perf_image_init();
+
+    fprintf(perf_out, "%-18s %8s %10s %8s %8s   %8s %8s\n", "scenario", "xfers", "bytes", "ms", "sleep", "budget", "ms");
+
+    for (uint32_t i = 0; i < STLINK_ARRAY_SIZE(perf_targets); i++) { perf_flash(&perf_targets[i]); }
+
+    perf_gdb();
+    perf_swo();
+    perf_ext();
+
+    fprintf(perf_out, "%u failure(s)\n", perf_failures);
+    return (perf_failures ? 1 : 0);
+}